@@ -59,7 +59,9 @@ DEFINE_GUID(BtrfsBusInterface, 0x4d414874, 0x6865, 0x6761, 0x6d, 0x65, 0x83, 0x6
 PDRIVER_OBJECT drvobj;
 PDEVICE_OBJECT master_devobj;
 #ifndef __REACTOS__
-BOOL have_sse42 = FALSE, have_sse2 = FALSE;
+BOOL have_sse42 = FALSE, have_sse2 = FALSE, have_ssse3 = FALSE, have_avx2 = FALSE;
+tKeSaveExtendedProcessorState fKeSaveExtendedProcessorState;
+tKeRestoreExtendedProcessorState fKeRestoreExtendedProcessorState;
 #endif
 UINT64 num_reads = 0;
 LIST_ENTRY uid_map_list, gid_map_list;
@@ -5160,16 +5162,55 @@ static void init_serial(BOOL first_time) {
 #ifndef __REACTOS__
 static void check_cpu() {
     unsigned int cpuInfo[4];
+    BOOL have_avx = FALSE;
 #ifndef _MSC_VER
     __get_cpuid(1, &cpuInfo[0], &cpuInfo[1], &cpuInfo[2], &cpuInfo[3]);
     have_sse42 = cpuInfo[2] & bit_SSE4_2;
     have_sse2 = cpuInfo[3] & bit_SSE2;
+    have_ssse3 = cpuInfo[2] & bit_SSSE3;
+
+    // AVX is only any use if the OS saves the YMM registers
+    if ((cpuInfo[2] & bit_OSXSAVE) && (cpuInfo[2] & bit_AVX)) {
+        unsigned int xcr0_lo, xcr0_hi;
+
+        __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        have_avx = (xcr0_lo & 6) == 6;
+    }
+
+    if (have_avx) {
+        __cpuid_count(7, 0, cpuInfo[0], cpuInfo[1], cpuInfo[2], cpuInfo[3]);
+        have_avx2 = cpuInfo[1] & bit_AVX2;
+    }
 #else
    __cpuid(cpuInfo, 1);
    have_sse42 = cpuInfo[2] & (1 << 20);
    have_sse2 = cpuInfo[3] & (1 << 26);
+   have_ssse3 = cpuInfo[2] & (1 << 9);
+
+   // AVX is only any use if the OS saves the YMM registers
+   if ((cpuInfo[2] & (1 << 27)) && (cpuInfo[2] & (1 << 28)))
+       have_avx = (_xgetbv(0) & 6) == 6;
+
+   if (have_avx) {
+       __cpuidex(cpuInfo, 7, 0);
+       have_avx2 = cpuInfo[1] & (1 << 5);
+   }
 #endif
 
+    // Kernel code has to save the AVX registers itself, which needs Windows 7
+    if (have_avx2) {
+        UNICODE_STRING name;
+
+        RtlInitUnicodeString(&name, L"KeSaveExtendedProcessorState");
+        fKeSaveExtendedProcessorState = (tKeSaveExtendedProcessorState)MmGetSystemRoutineAddress(&name);
+
+        RtlInitUnicodeString(&name, L"KeRestoreExtendedProcessorState");
+        fKeRestoreExtendedProcessorState = (tKeRestoreExtendedProcessorState)MmGetSystemRoutineAddress(&name);
+
+        if (!fKeSaveExtendedProcessorState || !fKeRestoreExtendedProcessorState)
+            have_avx2 = FALSE;
+    }
+
     if (have_sse42)
         TRACE("SSE4.2 is supported\n");
     else
@@ -5179,6 +5220,16 @@ static void check_cpu() {
         TRACE("SSE2 is supported\n");
     else
         TRACE("SSE2 is not supported\n");
+
+    if (have_ssse3)
+        TRACE("SSSE3 is supported\n");
+    else
+        TRACE("SSSE3 is not supported\n");
+
+    if (have_avx2)
+        TRACE("AVX2 is supported\n");
+    else
+        TRACE("AVX2 is not supported\n");
 }
 #endif
 
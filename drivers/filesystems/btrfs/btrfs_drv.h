@@ -578,6 +578,8 @@ typedef struct {
     UINT8* data;
     UINT32* csum;
     UINT32 sectors;
+    UINT32 blocksize;
+    LONG blocks;
     LONG pos, done;
     KEVENT event;
     LONG refcount;
@@ -1181,6 +1183,8 @@ void init_fast_io_dispatch(FAST_IO_DISPATCH** fiod);
 
 // in crc32c.c
 UINT32 calc_crc32c(_In_ UINT32 seed, _In_reads_bytes_(msglen) UINT8* msg, _In_ ULONG msglen);
+void calc_sector_csums(_In_reads_bytes_(sectors*sector_size) UINT8* data, _In_ UINT32 sectors, _In_ ULONG sector_size,
+                       _Out_writes_(sectors) UINT32* csum);
 
 typedef struct {
     LIST_ENTRY* list;
@@ -1487,6 +1491,8 @@ void galois_divpower(UINT8* data, UINT8 div, UINT32 readlen);
 UINT8 gpow2(UINT8 e);
 UINT8 gmul(UINT8 a, UINT8 b);
 UINT8 gdiv(UINT8 a, UINT8 b);
+void galois_recover2(UINT8* qxy, UINT8* pxy, UINT8* p, UINT8* q, UINT8 a, UINT8 b, UINT32 len);
+void do_xor(UINT8* buf1, UINT8* buf2, UINT32 len);
 
 // in devctrl.c
 
@@ -1503,8 +1509,7 @@ void NTAPI calc_thread(void* context);
 void calc_thread(void* context);
 #endif
 
-NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj);
-void free_calc_job(calc_job* cj);
+NTSTATUS do_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum);
 
 // in balance.c
 NTSTATUS start_balance(device_extension* Vcb, void* data, ULONG length, KPROCESSOR_MODE processor_mode);
@@ -1598,34 +1603,6 @@ static __inline BOOL write_fcb_compressed(fcb* fcb) {
     return FALSE;
 }
 
-static __inline void do_xor(UINT8* buf1, UINT8* buf2, UINT32 len) {
-    UINT32 j;
-#ifndef __REACTOS__
-    __m128i x1, x2;
-#endif
-
-#ifndef __REACTOS__
-    if (have_sse2 && ((uintptr_t)buf1 & 0xf) == 0 && ((uintptr_t)buf2 & 0xf) == 0) {
-        while (len >= 16) {
-            x1 = _mm_load_si128((__m128i*)buf1);
-            x2 = _mm_load_si128((__m128i*)buf2);
-            x1 = _mm_xor_si128(x1, x2);
-            _mm_store_si128((__m128i*)buf1, x1);
-
-            buf1 += 16;
-            buf2 += 16;
-            len -= 16;
-        }
-    }
-#endif
-
-    for (j = 0; j < len; j++) {
-        *buf1 ^= *buf2;
-        buf1++;
-        buf2++;
-    }
-}
-
 #ifdef DEBUG_FCB_REFCOUNTS
 #ifdef DEBUG_LONG_MESSAGES
 #define increase_fileref_refcount(fileref) {\
@@ -1748,6 +1725,12 @@ typedef VOID (*tCcSetAdditionalCacheAttributesEx)(PFILE_OBJECT FileObject, ULONG
 
 typedef VOID (*tFsRtlUpdateDiskCounters)(ULONG64 BytesRead, ULONG64 BytesWritten);
 
+#ifndef __REACTOS__
+typedef NTSTATUS (*tKeSaveExtendedProcessorState)(ULONG64 Mask, PXSTATE_SAVE XStateSave);
+
+typedef VOID (*tKeRestoreExtendedProcessorState)(PXSTATE_SAVE XStateSave);
+#endif
+
 #ifndef __REACTOS__
 #ifndef _MSC_VER
 
@@ -19,7 +19,7 @@
 
 #define SECTOR_BLOCK 16
 
-NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj) {
+static NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj) {
     calc_job* cj;
 
     cj = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_job), ALLOC_TAG);
@@ -36,6 +36,11 @@ NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32
     cj->refcount = 1;
     KeInitializeEvent(&cj->event, NotificationEvent, FALSE);
 
+    // Split the job evenly between the CPUs, so each thread only has to come back for more
+    // if another one is slow to start.
+    cj->blocksize = max(SECTOR_BLOCK, (sectors + Vcb->calcthreads.num_threads - 1) / Vcb->calcthreads.num_threads);
+    cj->blocks = (sectors + cj->blocksize - 1) / cj->blocksize;
+
     ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
 
     InsertTailList(&Vcb->calcthreads.job_list, &cj->list_entry);
@@ -50,7 +55,7 @@ NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32
     return STATUS_SUCCESS;
 }
 
-void free_calc_job(calc_job* cj) {
+static void free_calc_job(calc_job* cj) {
     LONG rc = InterlockedDecrement(&cj->refcount);
 
     if (rc == 0)
@@ -59,38 +64,52 @@ void free_calc_job(calc_job* cj) {
 
 static BOOL do_calc(device_extension* Vcb, calc_job* cj) {
     LONG pos, done;
-    UINT32* csum;
-    UINT8* data;
-    ULONG blocksize, i;
+    UINT32 start, count;
 
     pos = InterlockedIncrement(&cj->pos) - 1;
 
-    if ((UINT32)pos * SECTOR_BLOCK >= cj->sectors)
+    if (pos >= cj->blocks)
         return FALSE;
 
-    csum = &cj->csum[pos * SECTOR_BLOCK];
-    data = cj->data + (pos * SECTOR_BLOCK * Vcb->superblock.sector_size);
-
-    blocksize = min(SECTOR_BLOCK, cj->sectors - (pos * SECTOR_BLOCK));
-    for (i = 0; i < blocksize; i++) {
-        *csum = ~calc_crc32c(0xffffffff, data, Vcb->superblock.sector_size);
-        csum++;
-        data += Vcb->superblock.sector_size;
-    }
-
-    done = InterlockedIncrement(&cj->done);
-
-    if ((UINT32)done * SECTOR_BLOCK >= cj->sectors) {
+    // Once the last block has been taken, there's nothing left for anyone else
+    if (pos == cj->blocks - 1) {
         ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
         RemoveEntryList(&cj->list_entry);
         ExReleaseResourceLite(&Vcb->calcthreads.lock);
+    }
+
+    start = (UINT32)pos * cj->blocksize;
+    count = min(cj->blocksize, cj->sectors - start);
+
+    calc_sector_csums(cj->data + ((SIZE_T)start * Vcb->superblock.sector_size), count, Vcb->superblock.sector_size, &cj->csum[start]);
 
+    done = InterlockedIncrement(&cj->done);
+
+    if (done == cj->blocks)
         KeSetEvent(&cj->event, 0, FALSE);
-    }
 
     return TRUE;
 }
 
+NTSTATUS do_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum) {
+    NTSTATUS Status;
+    calc_job* cj;
+
+    Status = add_calc_job(Vcb, data, sectors, csum, &cj);
+    if (!NT_SUCCESS(Status)) {
+        ERR("add_calc_job returned %08x\n", Status);
+        return Status;
+    }
+
+    // Rather than just waiting for the calc threads, do our share of the work
+    while (do_calc(Vcb, cj)) { }
+
+    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
+    free_calc_job(cj);
+
+    return STATUS_SUCCESS;
+}
+
 _Function_class_(KSTART_ROUTINE)
 #ifdef __REACTOS__
 void NTAPI calc_thread(void* context) {
@@ -107,9 +126,8 @@ void calc_thread(void* context) {
 
         while (TRUE) {
             calc_job* cj;
-            BOOL b;
 
-            ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
+            ExAcquireResourceSharedLite(&Vcb->calcthreads.lock, TRUE);
 
             if (IsListEmpty(&Vcb->calcthreads.job_list)) {
                 ExReleaseResourceLite(&Vcb->calcthreads.lock);
@@ -117,16 +135,14 @@ void calc_thread(void* context) {
             }
 
             cj = CONTAINING_RECORD(Vcb->calcthreads.job_list.Flink, calc_job, list_entry);
-            cj->refcount++;
+            InterlockedIncrement(&cj->refcount);
 
             ExReleaseResourceLite(&Vcb->calcthreads.lock);
 
-            b = do_calc(Vcb, cj);
+            // Keep going until the job runs out, rather than going back to the list for every block
+            while (do_calc(Vcb, cj)) { }
 
             free_calc_job(cj);
-
-            if (!b)
-                break;
         }
 
         if (thread->quit)
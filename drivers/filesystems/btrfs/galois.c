@@ -16,6 +16,24 @@
  * along with WinBtrfs.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "btrfs_drv.h"
+#ifndef __REACTOS__
+#include <immintrin.h>
+
+extern BOOL have_ssse3, have_avx2;
+extern tKeSaveExtendedProcessorState fKeSaveExtendedProcessorState;
+extern tKeRestoreExtendedProcessorState fKeRestoreExtendedProcessorState;
+#endif
+
+#if !defined(__REACTOS__) && defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+// Below this, saving and restoring the AVX registers costs more than it saves
+#define AVX2_MIN_LEN 256
 
 static const UINT8 glog[] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26,
                              0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0,
@@ -51,21 +69,6 @@ static const UINT8 gilog[] = {0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1a, 0xc6, 0x
                               0xcb, 0x59, 0x5f, 0xb0, 0x9c, 0xa9, 0xa0, 0x51, 0x0b, 0xf5, 0x16, 0xeb, 0x7a, 0x75, 0x2c, 0xd7,
                               0x4f, 0xae, 0xd5, 0xe9, 0xe6, 0xe7, 0xad, 0xe8, 0x74, 0xd6, 0xf4, 0xea, 0xa8, 0x50, 0x58, 0xaf};
 
-// divides the bytes in data by 2^div
-void galois_divpower(UINT8* data, UINT8 div, UINT32 len) {
-    while (len > 0) {
-        if (data[0] != 0) {
-            if (gilog[data[0]] <= div)
-                data[0] = glog[(gilog[data[0]] + (255 - div)) % 255];
-            else
-                data[0] = glog[(gilog[data[0]] - div) % 255];
-        }
-
-        data++;
-        len--;
-    }
-}
-
 UINT8 gpow2(UINT8 e) {
     return glog[e%255];
 }
@@ -90,6 +93,17 @@ UINT8 gdiv(UINT8 a, UINT8 b) {
     }
 }
 
+// Multiplying by a constant is linear, so c*x = c*(x & 0xf) ^ c*(x & 0xf0), and each half
+// can be looked up in a table of 16. The SIMD versions do the lookups with pshufb.
+static void galois_mul_tables(UINT8 c, UINT8* lo, UINT8* hi) {
+    UINT8 i;
+
+    for (i = 0; i < 16; i++) {
+        lo[i] = gmul(c, i);
+        hi[i] = gmul(c, (UINT8)(i << 4));
+    }
+}
+
 // The code from the following functions is derived from the paper
 // "The mathematics of RAID-6", by H. Peter Anvin.
 // https://www.kernel.org/pub/linux/kernel/people/hpa/raid6.pdf
@@ -106,9 +120,7 @@ __inline static UINT32 galois_double_mask32(UINT32 v) {
 }
 #endif
 
-void galois_double(UINT8* data, UINT32 len) {
-    // FIXME - SIMD?
-
+static void galois_double_scalar(UINT8* data, UINT32 len) {
 #ifdef _AMD64_
     while (len > sizeof(UINT64)) {
         UINT64 v = *((UINT64*)data), vv;
@@ -139,3 +151,321 @@ void galois_double(UINT8* data, UINT32 len) {
         len--;
     }
 }
+
+static void galois_mul_scalar(UINT8* data, const UINT8* lo, const UINT8* hi, UINT32 len) {
+    while (len > 0) {
+        data[0] = lo[data[0] & 0xf] ^ hi[data[0] >> 4];
+        data++;
+        len--;
+    }
+}
+
+static void galois_recover2_scalar(UINT8* qxy, UINT8* pxy, UINT8* p, UINT8* q, const UINT8* alo, const UINT8* ahi,
+                                   const UINT8* blo, const UINT8* bhi, UINT32 len) {
+    while (len > 0) {
+        UINT8 pp = *p ^ *pxy, qq = *q ^ *qxy;
+
+        *qxy = alo[pp & 0xf] ^ ahi[pp >> 4] ^ blo[qq & 0xf] ^ bhi[qq >> 4];
+
+        p++;
+        q++;
+        pxy++;
+        qxy++;
+        len--;
+    }
+}
+
+static void do_xor_scalar(UINT8* buf1, UINT8* buf2, UINT32 len) {
+#ifdef _AMD64_
+    while (len >= sizeof(UINT64)) {
+        *(UINT64*)buf1 ^= *(UINT64*)buf2;
+
+        buf1 += sizeof(UINT64);
+        buf2 += sizeof(UINT64);
+        len -= sizeof(UINT64);
+    }
+#else
+    while (len >= sizeof(UINT32)) {
+        *(UINT32*)buf1 ^= *(UINT32*)buf2;
+
+        buf1 += sizeof(UINT32);
+        buf2 += sizeof(UINT32);
+        len -= sizeof(UINT32);
+    }
+#endif
+
+    while (len > 0) {
+        *buf1 ^= *buf2;
+        buf1++;
+        buf2++;
+        len--;
+    }
+}
+
+#ifndef __REACTOS__
+// The SIMD functions only do whole vectors, and return how many bytes that came to.
+
+static UINT32 galois_double_sse2(UINT8* data, UINT32 len) {
+    __m128i poly = _mm_set1_epi8(0x1d), zero = _mm_setzero_si128();
+    UINT32 done = 0;
+
+    while (len - done >= 16) {
+        __m128i v = _mm_loadu_si128((__m128i*)(data + done));
+        __m128i top = _mm_cmpgt_epi8(zero, v); // 0xff where the top bit is set
+
+        v = _mm_xor_si128(_mm_add_epi8(v, v), _mm_and_si128(top, poly));
+        _mm_storeu_si128((__m128i*)(data + done), v);
+
+        done += 16;
+    }
+
+    return done;
+}
+
+TARGET_AVX2 static UINT32 galois_double_avx2(UINT8* data, UINT32 len) {
+    __m256i poly = _mm256_set1_epi8(0x1d), zero = _mm256_setzero_si256();
+    XSTATE_SAVE state;
+    UINT32 done = 0;
+
+    if (!NT_SUCCESS(fKeSaveExtendedProcessorState(XSTATE_MASK_AVX, &state)))
+        return 0;
+
+    while (len - done >= 32) {
+        __m256i v = _mm256_loadu_si256((__m256i*)(data + done));
+        __m256i top = _mm256_cmpgt_epi8(zero, v);
+
+        v = _mm256_xor_si256(_mm256_add_epi8(v, v), _mm256_and_si256(top, poly));
+        _mm256_storeu_si256((__m256i*)(data + done), v);
+
+        done += 32;
+    }
+
+    fKeRestoreExtendedProcessorState(&state);
+
+    return done;
+}
+
+TARGET_SSSE3 static UINT32 galois_mul_ssse3(UINT8* data, const UINT8* lo, const UINT8* hi, UINT32 len) {
+    __m128i tlo = _mm_loadu_si128((__m128i*)lo), thi = _mm_loadu_si128((__m128i*)hi);
+    __m128i mask = _mm_set1_epi8(0xf);
+    UINT32 done = 0;
+
+    while (len - done >= 16) {
+        __m128i v = _mm_loadu_si128((__m128i*)(data + done));
+
+        v = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(v, mask)),
+                          _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(v, 4), mask)));
+        _mm_storeu_si128((__m128i*)(data + done), v);
+
+        done += 16;
+    }
+
+    return done;
+}
+
+TARGET_AVX2 static UINT32 galois_mul_avx2(UINT8* data, const UINT8* lo, const UINT8* hi, UINT32 len) {
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)hi));
+    __m256i mask = _mm256_set1_epi8(0xf);
+    XSTATE_SAVE state;
+    UINT32 done = 0;
+
+    if (!NT_SUCCESS(fKeSaveExtendedProcessorState(XSTATE_MASK_AVX, &state)))
+        return 0;
+
+    while (len - done >= 32) {
+        __m256i v = _mm256_loadu_si256((__m256i*)(data + done));
+
+        v = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(v, mask)),
+                             _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+        _mm256_storeu_si256((__m256i*)(data + done), v);
+
+        done += 32;
+    }
+
+    fKeRestoreExtendedProcessorState(&state);
+
+    return done;
+}
+
+TARGET_SSSE3 static UINT32 galois_recover2_ssse3(UINT8* qxy, UINT8* pxy, UINT8* p, UINT8* q, const UINT8* alo, const UINT8* ahi,
+                                                 const UINT8* blo, const UINT8* bhi, UINT32 len) {
+    __m128i talo = _mm_loadu_si128((__m128i*)alo), tahi = _mm_loadu_si128((__m128i*)ahi);
+    __m128i tblo = _mm_loadu_si128((__m128i*)blo), tbhi = _mm_loadu_si128((__m128i*)bhi);
+    __m128i mask = _mm_set1_epi8(0xf);
+    UINT32 done = 0;
+
+    while (len - done >= 16) {
+        __m128i pp = _mm_xor_si128(_mm_loadu_si128((__m128i*)(p + done)), _mm_loadu_si128((__m128i*)(pxy + done)));
+        __m128i qq = _mm_xor_si128(_mm_loadu_si128((__m128i*)(q + done)), _mm_loadu_si128((__m128i*)(qxy + done)));
+        __m128i v;
+
+        v = _mm_xor_si128(_mm_shuffle_epi8(talo, _mm_and_si128(pp, mask)),
+                          _mm_shuffle_epi8(tahi, _mm_and_si128(_mm_srli_epi64(pp, 4), mask)));
+        v = _mm_xor_si128(v, _mm_shuffle_epi8(tblo, _mm_and_si128(qq, mask)));
+        v = _mm_xor_si128(v, _mm_shuffle_epi8(tbhi, _mm_and_si128(_mm_srli_epi64(qq, 4), mask)));
+        _mm_storeu_si128((__m128i*)(qxy + done), v);
+
+        done += 16;
+    }
+
+    return done;
+}
+
+TARGET_AVX2 static UINT32 galois_recover2_avx2(UINT8* qxy, UINT8* pxy, UINT8* p, UINT8* q, const UINT8* alo, const UINT8* ahi,
+                                               const UINT8* blo, const UINT8* bhi, UINT32 len) {
+    __m256i talo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)alo));
+    __m256i tahi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)ahi));
+    __m256i tblo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)blo));
+    __m256i tbhi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)bhi));
+    __m256i mask = _mm256_set1_epi8(0xf);
+    XSTATE_SAVE state;
+    UINT32 done = 0;
+
+    if (!NT_SUCCESS(fKeSaveExtendedProcessorState(XSTATE_MASK_AVX, &state)))
+        return 0;
+
+    while (len - done >= 32) {
+        __m256i pp = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(p + done)), _mm256_loadu_si256((__m256i*)(pxy + done)));
+        __m256i qq = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(q + done)), _mm256_loadu_si256((__m256i*)(qxy + done)));
+        __m256i v;
+
+        v = _mm256_xor_si256(_mm256_shuffle_epi8(talo, _mm256_and_si256(pp, mask)),
+                             _mm256_shuffle_epi8(tahi, _mm256_and_si256(_mm256_srli_epi64(pp, 4), mask)));
+        v = _mm256_xor_si256(v, _mm256_shuffle_epi8(tblo, _mm256_and_si256(qq, mask)));
+        v = _mm256_xor_si256(v, _mm256_shuffle_epi8(tbhi, _mm256_and_si256(_mm256_srli_epi64(qq, 4), mask)));
+        _mm256_storeu_si256((__m256i*)(qxy + done), v);
+
+        done += 32;
+    }
+
+    fKeRestoreExtendedProcessorState(&state);
+
+    return done;
+}
+
+static UINT32 do_xor_sse2(UINT8* buf1, UINT8* buf2, UINT32 len) {
+    UINT32 done = 0;
+
+    while (len - done >= 16) {
+        __m128i x1 = _mm_loadu_si128((__m128i*)(buf1 + done));
+        __m128i x2 = _mm_loadu_si128((__m128i*)(buf2 + done));
+
+        _mm_storeu_si128((__m128i*)(buf1 + done), _mm_xor_si128(x1, x2));
+
+        done += 16;
+    }
+
+    return done;
+}
+
+TARGET_AVX2 static UINT32 do_xor_avx2(UINT8* buf1, UINT8* buf2, UINT32 len) {
+    XSTATE_SAVE state;
+    UINT32 done = 0;
+
+    if (!NT_SUCCESS(fKeSaveExtendedProcessorState(XSTATE_MASK_AVX, &state)))
+        return 0;
+
+    while (len - done >= 32) {
+        __m256i x1 = _mm256_loadu_si256((__m256i*)(buf1 + done));
+        __m256i x2 = _mm256_loadu_si256((__m256i*)(buf2 + done));
+
+        _mm256_storeu_si256((__m256i*)(buf1 + done), _mm256_xor_si256(x1, x2));
+
+        done += 32;
+    }
+
+    fKeRestoreExtendedProcessorState(&state);
+
+    return done;
+}
+#endif
+
+void galois_double(UINT8* data, UINT32 len) {
+#ifndef __REACTOS__
+    UINT32 done = 0;
+
+    if (have_avx2 && len >= AVX2_MIN_LEN)
+        done = galois_double_avx2(data, len);
+
+    if (have_sse2)
+        done += galois_double_sse2(data + done, len - done);
+
+    data += done;
+    len -= done;
+#endif
+
+    galois_double_scalar(data, len);
+}
+
+// divides the bytes in data by 2^div
+void galois_divpower(UINT8* data, UINT8 div, UINT32 len) {
+    UINT8 lo[16], hi[16];
+
+    // dividing by 2^div is multiplying by 2^(255-div)
+    galois_mul_tables(gpow2(255 - div), lo, hi);
+
+#ifndef __REACTOS__
+    {
+        UINT32 done = 0;
+
+        if (have_avx2 && len >= AVX2_MIN_LEN)
+            done = galois_mul_avx2(data, lo, hi, len);
+
+        if (have_ssse3)
+            done += galois_mul_ssse3(data + done, lo, hi, len - done);
+
+        data += done;
+        len -= done;
+    }
+#endif
+
+    galois_mul_scalar(data, lo, hi, len);
+}
+
+// Second step of recovering two missing data stripes: sets qxy to a*(p^pxy) ^ b*(q^qxy),
+// which is the first missing stripe.
+void galois_recover2(UINT8* qxy, UINT8* pxy, UINT8* p, UINT8* q, UINT8 a, UINT8 b, UINT32 len) {
+    UINT8 alo[16], ahi[16], blo[16], bhi[16];
+
+    galois_mul_tables(a, alo, ahi);
+    galois_mul_tables(b, blo, bhi);
+
+#ifndef __REACTOS__
+    {
+        UINT32 done = 0;
+
+        if (have_avx2 && len >= AVX2_MIN_LEN)
+            done = galois_recover2_avx2(qxy, pxy, p, q, alo, ahi, blo, bhi, len);
+
+        if (have_ssse3)
+            done += galois_recover2_ssse3(qxy + done, pxy + done, p + done, q + done, alo, ahi, blo, bhi, len - done);
+
+        qxy += done;
+        pxy += done;
+        p += done;
+        q += done;
+        len -= done;
+    }
+#endif
+
+    galois_recover2_scalar(qxy, pxy, p, q, alo, ahi, blo, bhi, len);
+}
+
+void do_xor(UINT8* buf1, UINT8* buf2, UINT32 len) {
+#ifndef __REACTOS__
+    UINT32 done = 0;
+
+    if (have_avx2 && len >= AVX2_MIN_LEN)
+        done = do_xor_avx2(buf1, buf2, len);
+
+    if (have_sse2)
+        done += do_xor_sse2(buf1 + done, buf2 + done, len - done);
+
+    buf1 += done;
+    buf2 += done;
+    len -= done;
+#endif
+
+    do_xor_scalar(buf1, buf2, len);
+}
@@ -88,7 +88,6 @@ static NTSTATUS read_data_completion(PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOI
 
 NTSTATUS check_csum(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum) {
     NTSTATUS Status;
-    calc_job* cj;
     UINT32* csum2;
 
     // From experimenting, it seems that 40 sectors is roughly the crossover
@@ -114,22 +113,18 @@ NTSTATUS check_csum(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32*
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    Status = add_calc_job(Vcb, data, sectors, csum2, &cj);
+    Status = do_calc_job(Vcb, data, sectors, csum2);
     if (!NT_SUCCESS(Status)) {
-        ERR("add_calc_job returned %08x\n", Status);
+        ERR("do_calc_job returned %08x\n", Status);
         ExFreePool(csum2);
         return Status;
     }
 
-    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
-
     if (RtlCompareMemory(csum2, csum, sectors * sizeof(UINT32)) != sectors * sizeof(UINT32)) {
-        free_calc_job(cj);
         ExFreePool(csum2);
         return STATUS_CRC_ERROR;
     }
 
-    free_calc_job(cj);
     ExFreePool(csum2);
 
     return STATUS_SUCCESS;
@@ -887,7 +882,6 @@ void raid6_recover2(UINT8* sectors, UINT16 num_stripes, ULONG sector_size, UINT1
     } else { // reconstruct from p and q
         UINT16 x, y, stripe;
         UINT8 gyx, gx, denom, a, b, *p, *q, *pxy, *qxy;
-        UINT32 j;
 
         stripe = num_stripes - 3;
 
@@ -931,14 +925,7 @@ void raid6_recover2(UINT8* sectors, UINT16 num_stripes, ULONG sector_size, UINT1
         p = sectors + ((num_stripes - 2) * sector_size);
         q = sectors + ((num_stripes - 1) * sector_size);
 
-        for (j = 0; j < sector_size; j++) {
-            *qxy = gmul(a, *p ^ *pxy) ^ gmul(b, *q ^ *qxy);
-
-            p++;
-            q++;
-            pxy++;
-            qxy++;
-        }
+        galois_recover2(qxy, pxy, p, q, a, b, sector_size);
 
         do_xor(out + sector_size, out, sector_size);
         do_xor(out + sector_size, sectors + ((num_stripes - 2) * sector_size), sector_size);
@@ -2776,32 +2776,15 @@ static void remove_fcb_extent(fcb* fcb, extent* ext, LIST_ENTRY* rollback) {
 
 NTSTATUS calc_csum(_In_ device_extension* Vcb, _In_reads_bytes_(sectors*Vcb->superblock.sector_size) UINT8* data,
                    _In_ UINT32 sectors, _Out_writes_bytes_(sectors*sizeof(UINT32)) UINT32* csum) {
-    NTSTATUS Status;
-    calc_job* cj;
-
     // From experimenting, it seems that 40 sectors is roughly the crossover
     // point where offloading the crc32 calculation becomes worth it.
 
     if (sectors < 40 || KeQueryActiveProcessorCount(NULL) < 2) {
-        ULONG j;
-
-        for (j = 0; j < sectors; j++) {
-            csum[j] = ~calc_crc32c(0xffffffff, data + (j * Vcb->superblock.sector_size), Vcb->superblock.sector_size);
-        }
-
+        calc_sector_csums(data, sectors, Vcb->superblock.sector_size, csum);
         return STATUS_SUCCESS;
     }
 
-    Status = add_calc_job(Vcb, data, sectors, csum, &cj);
-    if (!NT_SUCCESS(Status)) {
-        ERR("add_calc_job returned %08x\n", Status);
-        return Status;
-    }
-
-    KeWaitForSingleObject(&cj->event, Executive, KernelMode, FALSE, NULL);
-    free_calc_job(cj);
-
-    return STATUS_SUCCESS;
+    return do_calc_job(Vcb, data, sectors, csum);
 }
 
 _Requires_lock_held_(c->lock)
@@ -178,6 +178,24 @@ FindFile(
         }
     }
 
+    if (WildCard == FALSE && DirContext->DirIndex == 0 &&
+        vfatUseNameIndex(DeviceExt, Parent))
+    {
+        Status = vfatNameIndexFindEntry(DeviceExt, Parent, FileToFindU, DirContext, &Context);
+        if (NT_SUCCESS(Status))
+        {
+            DPRINT("FindFile: new Name %wZ, DirIndex %u (index)\n",
+                &DirContext->LongNameU, DirContext->DirIndex);
+            CcUnpinData(Context);
+        }
+        else if (Status == STATUS_OBJECT_NAME_NOT_FOUND)
+        {
+            Status = STATUS_NO_MORE_ENTRIES;
+        }
+        ExFreePool(PathNameBuffer);
+        return Status;
+    }
+
     /* FsRtlIsNameInExpression need the searched string to be upcase,
     * even if IgnoreCase is specified */
     Status = RtlUpcaseUnicodeString(&FileToFindUpcase, FileToFindU, TRUE);
@@ -778,6 +778,8 @@ FATAddEntry(
         return Status;
     }
 
+    vfatNameIndexAddEntry(ParentFcb, &DirContext.LongNameU, &DirContext.ShortNameU, DirContext.DirIndex);
+
     DPRINT("new : entry=%11.11s\n", (*Fcb)->entry.Fat.Filename);
     DPRINT("new : entry=%11.11s\n", DirContext.DirEntry.Fat.Filename);
 
@@ -1023,9 +1025,12 @@ FATDelEntry(
         CcUnpinData(Context);
     }
 
+    vfatNameIndexRemoveEntry(pFcb->parentFcb, &pFcb->LongNameU, &pFcb->ShortNameU, pFcb->dirIndex);
+
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        FsRtlTruncateLargeMcb(&pFcb->ClusterMcb, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
@@ -1105,6 +1110,7 @@ FATXDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        FsRtlTruncateLargeMcb(&pFcb->ClusterMcb, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
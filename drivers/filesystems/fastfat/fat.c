@@ -377,6 +377,26 @@ FAT32FindAndMarkAvailableCluster(
     return STATUS_DISK_FULL;
 }
 
+/*
+ * FUNCTION: Prepares the cluster bitmap to be filled in while counting free
+ *           clusters, returns NULL if the volume has none
+ */
+static
+PRTL_BITMAP
+ClusterBitmapStart(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    PRTL_BITMAP Bitmap = &DeviceExt->ClusterBitmap;
+
+    if (Bitmap->Buffer == NULL)
+        return NULL;
+
+    /* Clusters 0 and 1 don't exist, never hand them out */
+    RtlClearAllBits(Bitmap);
+    RtlSetBits(Bitmap, 0, 2);
+    return Bitmap;
+}
+
 /*
  * FUNCTION: Counts free cluster in a FAT12 table
  */
@@ -393,6 +413,7 @@ FAT12CountAvailableClusters(
     LARGE_INTEGER Offset;
     PVOID Context;
     PUSHORT CBlock;
+    PRTL_BITMAP Bitmap;
 
     Offset.QuadPart = 0;
     _SEH2_TRY
@@ -406,6 +427,7 @@ FAT12CountAvailableClusters(
     _SEH2_END;
 
     numberofclusters = DeviceExt->FatInfo.NumberOfClusters + 2;
+    Bitmap = ClusterBitmapStart(DeviceExt);
 
     for (i = 2; i < numberofclusters; i++)
     {
@@ -421,6 +443,8 @@ FAT12CountAvailableClusters(
 
         if (Entry == 0)
             ulCount++;
+        else if (Bitmap)
+            RtlSetBit(Bitmap, i);
     }
 
     CcUnpinData(Context);
@@ -448,9 +472,11 @@ FAT16CountAvailableClusters(
     PVOID Context = NULL;
     LARGE_INTEGER Offset;
     ULONG FatLength;
+    PRTL_BITMAP Bitmap;
 
     ChunkSize = CACHEPAGESIZE(DeviceExt);
     FatLength = (DeviceExt->FatInfo.NumberOfClusters + 2);
+    Bitmap = ClusterBitmapStart(DeviceExt);
 
     for (i = 2; i < FatLength; )
     {
@@ -472,6 +498,8 @@ FAT16CountAvailableClusters(
         {
             if (*Block == 0)
                 ulCount++;
+            else if (Bitmap)
+                RtlSetBit(Bitmap, i);
             Block++;
             i++;
         }
@@ -503,9 +531,11 @@ FAT32CountAvailableClusters(
     PVOID Context = NULL;
     LARGE_INTEGER Offset;
     ULONG FatLength;
+    PRTL_BITMAP Bitmap;
 
     ChunkSize = CACHEPAGESIZE(DeviceExt);
     FatLength = (DeviceExt->FatInfo.NumberOfClusters + 2);
+    Bitmap = ClusterBitmapStart(DeviceExt);
 
     for (i = 2; i < FatLength; )
     {
@@ -528,6 +558,8 @@ FAT32CountAvailableClusters(
         {
             if ((*Block & 0x0fffffff) == 0)
                 ulCount++;
+            else if (Bitmap)
+                RtlSetBit(Bitmap, i);
             Block++;
             i++;
         }
@@ -541,6 +573,19 @@ FAT32CountAvailableClusters(
     return STATUS_SUCCESS;
 }
 
+static
+NTSTATUS
+DoCountAvailableClusters(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->FatInfo.FatType == FAT12)
+        return FAT12CountAvailableClusters(DeviceExt);
+    else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
+        return FAT16CountAvailableClusters(DeviceExt);
+    else
+        return FAT32CountAvailableClusters(DeviceExt);
+}
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -550,12 +595,7 @@ CountAvailableClusters(
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     if (!DeviceExt->AvailableClustersValid)
     {
-        if (DeviceExt->FatInfo.FatType == FAT12)
-            Status = FAT12CountAvailableClusters(DeviceExt);
-        else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
-            Status = FAT16CountAvailableClusters(DeviceExt);
-        else
-            Status = FAT32CountAvailableClusters(DeviceExt);
+        Status = DoCountAvailableClusters(DeviceExt);
     }
     if (Clusters != NULL)
     {
@@ -566,6 +606,92 @@ CountAvailableClusters(
     return Status;
 }
 
+/*
+ * FUNCTION: Builds the cluster bitmap of a big volume after mount
+ */
+static
+VOID
+NTAPI
+ClusterBitmapWorker(
+    PDEVICE_OBJECT DeviceObject,
+    PVOID Context)
+{
+    PDEVICE_EXTENSION DeviceExt = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    /* Writers to the FAT wait for us, readers don't have to */
+    ExAcquireResourceSharedLite(&DeviceExt->FatResource, TRUE);
+    if (!DeviceExt->AvailableClustersValid &&
+        !BooleanFlagOn(DeviceExt->Flags, VCB_DISMOUNT_PENDING))
+    {
+        DoCountAvailableClusters(DeviceExt);
+    }
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+
+    IoFreeWorkItem(DeviceExt->ClusterBitmapWorkItem);
+    DeviceExt->ClusterBitmapWorkItem = NULL;
+    KeSetEvent(&DeviceExt->ClusterBitmapEvent, IO_NO_INCREMENT, FALSE);
+}
+
+/*
+ * FUNCTION: Sets up the cluster bitmap and counts the free clusters of a
+ *           newly mounted volume
+ * NOTES: The FAT of a big volume is scanned in the background, until then
+ *        clusters are allocated by searching the FAT
+ */
+NTSTATUS
+InitializeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    ULONG Clusters;
+    PULONG Buffer;
+
+    KeInitializeEvent(&DeviceExt->ClusterBitmapEvent, NotificationEvent, TRUE);
+
+    Clusters = DeviceExt->FatInfo.NumberOfClusters + 2;
+    Buffer = ExAllocatePoolWithTag(PagedPool, ROUND_UP(Clusters, 32) / 8, TAG_VFAT);
+    if (Buffer == NULL)
+    {
+        DPRINT1("No memory for the bitmap of %u clusters\n", Clusters);
+        return CountAvailableClusters(DeviceExt, NULL);
+    }
+
+    RtlInitializeBitMap(&DeviceExt->ClusterBitmap, Buffer, Clusters);
+
+    if (Clusters > VFAT_BACKGROUND_SCAN_CLUSTERS)
+    {
+        DeviceExt->ClusterBitmapWorkItem = IoAllocateWorkItem(DeviceExt->VolumeDevice);
+        if (DeviceExt->ClusterBitmapWorkItem != NULL)
+        {
+            KeClearEvent(&DeviceExt->ClusterBitmapEvent);
+            IoQueueWorkItem(DeviceExt->ClusterBitmapWorkItem,
+                            ClusterBitmapWorker,
+                            DelayedWorkQueue,
+                            DeviceExt);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return CountAvailableClusters(DeviceExt, NULL);
+}
+
+/*
+ * FUNCTION: Waits for the background scan and frees the cluster bitmap
+ */
+VOID
+UninitializeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->ClusterBitmap.Buffer == NULL)
+        return;
+
+    KeWaitForSingleObject(&DeviceExt->ClusterBitmapEvent, Executive, KernelMode, FALSE, NULL);
+
+    ExFreePoolWithTag(DeviceExt->ClusterBitmap.Buffer, TAG_VFAT);
+    DeviceExt->ClusterBitmap.Buffer = NULL;
+}
+
 
 /*
  * FUNCTION: Writes a cluster to the FAT12 physical and in-memory tables
@@ -719,9 +845,17 @@ WriteCluster(
     if (DeviceExt->AvailableClustersValid)
     {
         if (OldValue && NewValue == 0)
+        {
             InterlockedIncrement((PLONG)&DeviceExt->AvailableClusters);
+            if (DeviceExt->ClusterBitmap.Buffer)
+                RtlClearBit(&DeviceExt->ClusterBitmap, ClusterToWrite);
+        }
         else if (OldValue == 0 && NewValue)
+        {
             InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+            if (DeviceExt->ClusterBitmap.Buffer)
+                RtlSetBit(&DeviceExt->ClusterBitmap, ClusterToWrite);
+        }
     }
     ExReleaseResourceLite(&DeviceExt->FatResource);
     return Status;
@@ -770,6 +904,226 @@ GetNextCluster(
     return Status;
 }
 
+/*
+ * FUNCTION: Frees a chain of clusters that isn't linked to any file yet
+ */
+static
+VOID
+FreeClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG Cluster)
+{
+    ULONG NextCluster;
+    NTSTATUS Status;
+
+    while (Cluster != 0xffffffff && Cluster > 1)
+    {
+        Status = DeviceExt->GetNextCluster(DeviceExt, Cluster, &NextCluster);
+        WriteCluster(DeviceExt, Cluster, 0);
+        if (!NT_SUCCESS(Status))
+            break;
+        Cluster = NextCluster;
+    }
+}
+
+/*
+ * FUNCTION: Gives back a run of clusters taken from the cluster bitmap
+ *           that isn't linked to any chain
+ */
+static
+VOID
+FreeClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG Start,
+    ULONG Run)
+{
+    ULONG Cluster, OldValue;
+
+    /* The entries may be partly written, clear all of them */
+    for (Cluster = Start; Cluster < Start + Run; Cluster++)
+        DeviceExt->WriteCluster(DeviceExt, Cluster, 0, &OldValue);
+
+    RtlClearBits(&DeviceExt->ClusterBitmap, Start, Run);
+    InterlockedExchangeAdd((PLONG)&DeviceExt->AvailableClusters, Run);
+}
+
+/*
+ * FUNCTION: Allocates clusters one at a time by searching the FAT, used
+ *           until the cluster bitmap is available
+ */
+static
+NTSTATUS
+ExtendClusterChainFromFat(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstNewCluster,
+    PULONG LastNewCluster)
+{
+    ULONG FirstCluster = 0;
+    ULONG PreviousCluster = 0;
+    ULONG NewCluster;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    while (ClusterCount-- > 0)
+    {
+        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        if (PreviousCluster != 0)
+        {
+            Status = WriteCluster(DeviceExt, PreviousCluster, NewCluster);
+            if (!NT_SUCCESS(Status))
+            {
+                WriteCluster(DeviceExt, NewCluster, 0);
+                break;
+            }
+        }
+        else
+        {
+            FirstCluster = NewCluster;
+        }
+
+        PreviousCluster = NewCluster;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        /* Give back what we got so far */
+        if (FirstCluster != 0)
+            FreeClusterChain(DeviceExt, FirstCluster);
+        return Status;
+    }
+
+    /* Link the new clusters to the end of the chain */
+    if (LastCluster != 0)
+    {
+        Status = WriteCluster(DeviceExt, LastCluster, FirstCluster);
+        if (!NT_SUCCESS(Status))
+        {
+            FreeClusterChain(DeviceExt, FirstCluster);
+            return Status;
+        }
+    }
+
+    *FirstNewCluster = FirstCluster;
+    *LastNewCluster = PreviousCluster;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * FUNCTION: Allocates clusters and appends them to a cluster chain
+ * ARGUMENTS:
+ *           LastCluster: Last cluster of the chain, 0 to start a new one
+ *           ClusterCount: Number of clusters to allocate
+ *           FirstNewCluster: Receives the first allocated cluster
+ *           LastNewCluster: Receives the new last cluster of the chain
+ * NOTES: Nothing is allocated if this fails, whether for lack of free
+ *        clusters or because the FAT couldn't be written. The clusters are
+ *        taken as contiguous runs from the cluster bitmap, following
+ *        LastCluster where possible, so that a file grown in one go gets a
+ *        single extent.
+ */
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstNewCluster,
+    PULONG LastNewCluster)
+{
+    PRTL_BITMAP Bitmap = &DeviceExt->ClusterBitmap;
+    ULONG FirstCluster = 0;
+    ULONG PreviousCluster = LastCluster;
+    ULONG Start, Run, Cluster;
+    ULONG OldValue;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT("ExtendClusterChain(DeviceExt %p, LastCluster %x, ClusterCount %u)\n",
+           DeviceExt, LastCluster, ClusterCount);
+
+    ASSERT(ClusterCount > 0);
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+
+    if (Bitmap->Buffer == NULL || !DeviceExt->AvailableClustersValid)
+    {
+        Status = ExtendClusterChainFromFat(DeviceExt, LastCluster, ClusterCount,
+                                           FirstNewCluster, LastNewCluster);
+        ExReleaseResourceLite(&DeviceExt->FatResource);
+        return Status;
+    }
+
+    if (ClusterCount > DeviceExt->AvailableClusters)
+    {
+        ExReleaseResourceLite(&DeviceExt->FatResource);
+        return STATUS_DISK_FULL;
+    }
+
+    while (ClusterCount > 0)
+    {
+        /* Look for the whole remainder right after the chain first */
+        Run = ClusterCount;
+        Start = RtlFindClearBits(Bitmap, Run,
+                                 PreviousCluster != 0 ? PreviousCluster + 1 : DeviceExt->LastAvailableCluster);
+        if (Start == 0xffffffff)
+        {
+            /* The volume is fragmented, fill the largest hole */
+            Run = RtlFindLongestRunClear(Bitmap, &Start);
+            if (Run == 0)
+            {
+                DPRINT1("Cluster bitmap and free cluster count disagree\n");
+                Status = STATUS_DISK_FULL;
+                break;
+            }
+            Run = min(Run, ClusterCount);
+        }
+
+        /* Take the run, it is given back below if it can't be linked */
+        RtlSetBits(Bitmap, Start, Run);
+        InterlockedExchangeAdd((PLONG)&DeviceExt->AvailableClusters, -(LONG)Run);
+
+        for (Cluster = Start; Cluster < Start + Run - 1; Cluster++)
+        {
+            Status = DeviceExt->WriteCluster(DeviceExt, Cluster, Cluster + 1, &OldValue);
+            if (!NT_SUCCESS(Status))
+                break;
+        }
+        if (NT_SUCCESS(Status))
+            Status = DeviceExt->WriteCluster(DeviceExt, Cluster, 0xffffffff, &OldValue);
+        if (NT_SUCCESS(Status) && PreviousCluster != 0)
+            Status = DeviceExt->WriteCluster(DeviceExt, PreviousCluster, Start, &OldValue);
+        if (!NT_SUCCESS(Status))
+        {
+            FreeClusterRun(DeviceExt, Start, Run);
+            break;
+        }
+        if (FirstCluster == 0)
+            FirstCluster = Start;
+
+        PreviousCluster = Start + Run - 1;
+        DeviceExt->LastAvailableCluster = PreviousCluster;
+        ClusterCount -= Run;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        *FirstNewCluster = FirstCluster;
+        *LastNewCluster = PreviousCluster;
+    }
+    else if (FirstCluster != 0)
+    {
+        /* Cut the runs we already linked off the chain and give them back */
+        if (LastCluster != 0)
+            DeviceExt->WriteCluster(DeviceExt, LastCluster, 0xffffffff, &OldValue);
+        FreeClusterChain(DeviceExt, FirstCluster);
+    }
+
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+    return Status;
+}
+
 /*
  * FUNCTION: Retrieve the next cluster depending on the FAT type
  */
@@ -792,16 +1146,9 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
-        if (!NT_SUCCESS(Status))
-        {
-            ExReleaseResourceLite(&DeviceExt->FatResource);
-            return Status;
-        }
-
-        *NextCluster = NewCluster;
+        Status = ExtendClusterChain(DeviceExt, 0, 1, NextCluster, &NewCluster);
         ExReleaseResourceLite(&DeviceExt->FatResource);
-        return STATUS_SUCCESS;
+        return Status;
     }
 
     Status = DeviceExt->GetNextCluster(DeviceExt, CurrentCluster, NextCluster);
@@ -809,19 +1156,7 @@ GetNextClusterExtend(
     if ((*NextCluster) == 0xFFFFFFFF)
     {
         /* We are after last existing cluster, we must add one to file */
-        /* Firstly, find the next available open allocation unit and
-           mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
-        if (!NT_SUCCESS(Status))
-        {
-            ExReleaseResourceLite(&DeviceExt->FatResource);
-            return Status;
-        }
-
-        /* Now, write the AU of the LastCluster with the value of the newly
-           found AU */
-        WriteCluster(DeviceExt, CurrentCluster, NewCluster);
-        *NextCluster = NewCluster;
+        Status = ExtendClusterChain(DeviceExt, CurrentCluster, 1, NextCluster, &NewCluster);
     }
 
     ExReleaseResourceLite(&DeviceExt->FatResource);
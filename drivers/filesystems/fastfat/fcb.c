@@ -53,6 +53,127 @@ vfatNameHash(
     return hash;
 }
 
+static
+BOOLEAN
+vfatNameIndexInsert(
+    PVFAT_NAME_INDEX NameIndex,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG Bucket = Hash & (NameIndex->BucketCount - 1);
+
+    Entry = ExAllocateFromPagedLookasideList(&VfatGlobalData->NameIndexLookasideList);
+    if (Entry == NULL)
+    {
+        return FALSE;
+    }
+
+    Entry->Hash = Hash;
+    Entry->DirIndex = DirIndex;
+    Entry->Next = NameIndex->Buckets[Bucket];
+    NameIndex->Buckets[Bucket] = Entry;
+    return TRUE;
+}
+
+static
+VOID
+vfatNameIndexDelete(
+    PVFAT_NAME_INDEX NameIndex,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX_ENTRY *Link;
+    PVFAT_NAME_INDEX_ENTRY Entry;
+
+    Link = &NameIndex->Buckets[Hash & (NameIndex->BucketCount - 1)];
+    while ((Entry = *Link) != NULL)
+    {
+        if (Entry->Hash == Hash && Entry->DirIndex == DirIndex)
+        {
+            *Link = Entry->Next;
+            ExFreeToPagedLookasideList(&VfatGlobalData->NameIndexLookasideList, Entry);
+        }
+        else
+        {
+            Link = &Entry->Next;
+        }
+    }
+}
+
+static
+VOID
+vfatDestroyNameIndex(
+    PVFATFCB pDirectoryFCB)
+{
+    PVFAT_NAME_INDEX NameIndex = pDirectoryFCB->NameIndex;
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG i;
+
+    if (NameIndex == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < NameIndex->BucketCount; i++)
+    {
+        while ((Entry = NameIndex->Buckets[i]) != NULL)
+        {
+            NameIndex->Buckets[i] = Entry->Next;
+            ExFreeToPagedLookasideList(&VfatGlobalData->NameIndexLookasideList, Entry);
+        }
+    }
+
+    ExFreePoolWithTag(NameIndex, TAG_IDX);
+    pDirectoryFCB->NameIndex = NULL;
+}
+
+/*
+ * Record a directory entry in the name index of its directory, if it has
+ * one. The index is dropped if this fails, lookups fall back to scanning
+ * the directory rather than missing the entry.
+ */
+VOID
+vfatNameIndexAddEntry(
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING LongNameU,
+    PUNICODE_STRING ShortNameU,
+    ULONG DirIndex)
+{
+    ULONG LongHash, ShortHash;
+
+    if (pDirectoryFCB->NameIndex == NULL)
+    {
+        return;
+    }
+
+    LongHash = vfatNameHash(0, LongNameU);
+    ShortHash = vfatNameHash(0, ShortNameU);
+    if (!vfatNameIndexInsert(pDirectoryFCB->NameIndex, LongHash, DirIndex) ||
+        (ShortHash != LongHash &&
+         !vfatNameIndexInsert(pDirectoryFCB->NameIndex, ShortHash, DirIndex)))
+    {
+        DPRINT1("Dropping name index of %wZ\n", &pDirectoryFCB->PathNameU);
+        vfatDestroyNameIndex(pDirectoryFCB);
+    }
+}
+
+VOID
+vfatNameIndexRemoveEntry(
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING LongNameU,
+    PUNICODE_STRING ShortNameU,
+    ULONG DirIndex)
+{
+    if (pDirectoryFCB->NameIndex == NULL)
+    {
+        return;
+    }
+
+    vfatNameIndexDelete(pDirectoryFCB->NameIndex, vfatNameHash(0, LongNameU), DirIndex);
+    vfatNameIndexDelete(pDirectoryFCB->NameIndex, vfatNameHash(0, ShortNameU), DirIndex);
+}
+
 VOID
 vfatSplitPathName(
     PUNICODE_STRING PathNameU,
@@ -153,7 +274,7 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->PagingIoResource);
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
-    ExInitializeFastMutex(&rcFCB->LastMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->ClusterMcb, NonPagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -279,6 +400,8 @@ vfatDestroyFCB(
 #endif
 
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->ClusterMcb);
+    vfatDestroyNameIndex(pFCB);
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
     {
@@ -779,6 +902,202 @@ vfatAttachFCBToFileObject(
     return STATUS_SUCCESS;
 }
 
+/*
+ * Index the names of all the entries of a big directory, so that lookups
+ * don't have to read through it. Nothing is indexed if we fail.
+ */
+static
+VOID
+vfatBuildNameIndex(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB)
+{
+    NTSTATUS status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    BOOLEAN First = TRUE;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    PVFAT_NAME_INDEX NameIndex;
+    ULONG BucketCount, Entries;
+
+    Entries = pDirectoryFCB->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY);
+    BucketCount = 64;
+    while (BucketCount < Entries / 2 && BucketCount < 0x10000)
+    {
+        BucketCount <<= 1;
+    }
+
+    NameIndex = ExAllocatePoolWithTag(PagedPool,
+                                      FIELD_OFFSET(VFAT_NAME_INDEX, Buckets) +
+                                      BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY),
+                                      TAG_IDX);
+    if (NameIndex == NULL)
+    {
+        return;
+    }
+    NameIndex->BucketCount = BucketCount;
+    RtlZeroMemory(NameIndex->Buckets, BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY));
+    pDirectoryFCB->NameIndex = NameIndex;
+
+    DPRINT("Indexing %wZ, %u entries, %u buckets\n",
+           &pDirectoryFCB->PathNameU, Entries, BucketCount);
+
+    DirContext.DirIndex = 0;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.Length = 0;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.Length = 0;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+    DirContext.DeviceExt = pDeviceExt;
+
+    while (TRUE)
+    {
+        status = VfatGetNextDirEntry(pDeviceExt,
+            &Context,
+            &Page,
+            pDirectoryFCB,
+            &DirContext,
+            First);
+        First = FALSE;
+        if (status == STATUS_NO_MORE_ENTRIES)
+        {
+            return;
+        }
+        if (!NT_SUCCESS(status))
+        {
+            vfatDestroyNameIndex(pDirectoryFCB);
+            return;
+        }
+
+        /* Same entries as vfatDirFindFile() would consider */
+        if (!FAT_ENTRY_VOLUME(&DirContext.DirEntry.Fat) &&
+            DirContext.LongNameU.Length != 0 &&
+            DirContext.ShortNameU.Length != 0)
+        {
+            vfatNameIndexAddEntry(pDirectoryFCB,
+                                  &DirContext.LongNameU,
+                                  &DirContext.ShortNameU,
+                                  DirContext.DirIndex);
+            if (pDirectoryFCB->NameIndex == NULL)
+            {
+                CcUnpinData(Context);
+                return;
+            }
+        }
+        DirContext.DirIndex++;
+    }
+}
+
+/*
+ * Make sure a big directory has its name index. Returns whether lookups in
+ * the directory can go through it.
+ */
+BOOLEAN
+vfatUseNameIndex(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB)
+{
+    if (vfatVolumeIsFatX(pDeviceExt))
+    {
+        return FALSE;
+    }
+
+    ASSERT(ExIsResourceAcquiredExclusive(&pDeviceExt->DirResource));
+
+    if (pDirectoryFCB->NameIndex == NULL &&
+        pDirectoryFCB->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY) >= VFAT_NAME_INDEX_MIN_ENTRIES)
+    {
+        vfatBuildNameIndex(pDeviceExt, pDirectoryFCB);
+    }
+
+    return pDirectoryFCB->NameIndex != NULL;
+}
+
+/*
+ * Look a name up through the name index of a directory. Only the entries
+ * whose name hash matches are read back, and entries that no longer match
+ * what is on disk are dropped on the way. On success, the directory page
+ * holding the entry stays pinned in *pContext.
+ */
+NTSTATUS
+vfatNameIndexFindEntry(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PVOID *pContext)
+{
+    NTSTATUS status;
+    PVOID Page = NULL;
+    PVFAT_NAME_INDEX NameIndex = pDirectoryFCB->NameIndex;
+    PVFAT_NAME_INDEX_ENTRY *Link;
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG Hash;
+    BOOLEAN Valid;
+
+    Hash = vfatNameHash(0, FileToFindU);
+    Link = &NameIndex->Buckets[Hash & (NameIndex->BucketCount - 1)];
+    while ((Entry = *Link) != NULL)
+    {
+        if (Entry->Hash != Hash)
+        {
+            Link = &Entry->Next;
+            continue;
+        }
+
+        *pContext = NULL;
+        DirContext->DirIndex = Entry->DirIndex;
+        DirContext->LongNameU.Length = 0;
+        DirContext->ShortNameU.Length = 0;
+        status = VfatGetNextDirEntry(pDeviceExt,
+            pContext,
+            &Page,
+            pDirectoryFCB,
+            DirContext,
+            TRUE);
+        if (!NT_SUCCESS(status) && status != STATUS_NO_MORE_ENTRIES)
+        {
+            return status;
+        }
+
+        Valid = (status != STATUS_NO_MORE_ENTRIES &&
+                 DirContext->DirIndex == Entry->DirIndex &&
+                 !FAT_ENTRY_VOLUME(&DirContext->DirEntry.Fat) &&
+                 DirContext->LongNameU.Length != 0 &&
+                 DirContext->ShortNameU.Length != 0);
+        if (Valid &&
+            (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+             RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE)))
+        {
+            return STATUS_SUCCESS;
+        }
+        if (*pContext != NULL)
+        {
+            CcUnpinData(*pContext);
+            *pContext = NULL;
+        }
+
+        /* A different name with the same hash stays, a stale entry goes */
+        if (Valid &&
+            (vfatNameHash(0, &DirContext->LongNameU) == Hash ||
+             vfatNameHash(0, &DirContext->ShortNameU) == Hash))
+        {
+            Link = &Entry->Next;
+        }
+        else
+        {
+            DPRINT1("Stale name index entry %u in %wZ\n", Entry->DirIndex, &pDirectoryFCB->PathNameU);
+            *Link = Entry->Next;
+            ExFreeToPagedLookasideList(&VfatGlobalData->NameIndexLookasideList, Entry);
+        }
+    }
+
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
 NTSTATUS
 vfatDirFindFile(
     PDEVICE_EXTENSION pDeviceExt,
@@ -816,6 +1135,24 @@ vfatDirFindFile(
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
     DirContext.DeviceExt = pDeviceExt;
 
+    if (vfatUseNameIndex(pDeviceExt, pDirectoryFCB))
+    {
+        status = vfatNameIndexFindEntry(pDeviceExt,
+            pDirectoryFCB,
+            FileToFindU,
+            &DirContext,
+            &Context);
+        if (NT_SUCCESS(status))
+        {
+            status = vfatMakeFCBFromDirEntry(pDeviceExt,
+                pDirectoryFCB,
+                &DirContext,
+                pFoundFCB);
+            CcUnpinData(Context);
+        }
+        return status;
+    }
+
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
@@ -1244,7 +1244,6 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         if (FirstCluster == 0)
         {
-            Fcb->LastCluster = Fcb->LastOffset = 0;
             Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
             if (!NT_SUCCESS(Status))
             {
@@ -1294,39 +1293,24 @@ VfatSetAllocationSizeInformation(
         }
         else
         {
-            if (Fcb->LastCluster > 0)
-            {
-                if (Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize == Fcb->LastOffset)
-                {
-                    Cluster = Fcb->LastCluster;
-                    Status = STATUS_SUCCESS;
-                }
-                else
-                {
-                    Status = OffsetToCluster(DeviceExt, Fcb->LastCluster,
-                                             Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize - Fcb->LastOffset,
-                                             &Cluster, FALSE);
-                }
-            }
-            else
-            {
-                Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                         Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
-                                         &Cluster, FALSE);
-            }
-
+            Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                        Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
+                                        &Cluster, NULL);
             if (!NT_SUCCESS(Status))
             {
                 return Status;
             }
 
-            Fcb->LastCluster = Cluster;
-            Fcb->LastOffset = Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize;
+            if (Cluster == 0xffffffff)
+            {
+                return STATUS_FILE_CORRUPT_ERROR;
+            }
 
             /* FIXME: Check status */
             /* Cluster points now to the last cluster within the chain */
             Status = OffsetToCluster(DeviceExt, Cluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize) - Fcb->LastOffset,
+                                     ROUND_DOWN(NewSize - 1, ClusterSize) -
+                                     (Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize),
                                      &NCluster, TRUE);
             if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
             {
@@ -1358,8 +1342,9 @@ VfatSetAllocationSizeInformation(
         DPRINT("Can set file size\n");
 
         AllocSizeChanged = TRUE;
-        /* FIXME: Use the cached cluster/offset better way. */
-        Fcb->LastCluster = Fcb->LastOffset = 0;
+        /* Forget the runs of the clusters about to be freed */
+        FsRtlTruncateLargeMcb(&Fcb->ClusterMcb,
+                              ROUND_UP_64(NewSize, ClusterSize) / ClusterSize);
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
         if (NewSize > 0)
         {
@@ -737,8 +737,8 @@ VfatMount(
     _SEH2_END;
 
     DeviceExt->LastAvailableCluster = 2;
-    CountAvailableClusters(DeviceExt, NULL);
     ExInitializeResourceLite(&DeviceExt->FatResource);
+    InitializeClusterBitmap(DeviceExt);
 
     InitializeListHead(&DeviceExt->FcbListHead);
 
@@ -804,6 +804,8 @@ ByeBye:
     if (!NT_SUCCESS(Status))
     {
         /* Cleanup */
+        if (DeviceExt)
+            UninitializeClusterBitmap(DeviceExt);
         if (DeviceExt && DeviceExt->FATFileObject)
             ObDereferenceObject (DeviceExt->FATFileObject);
         if (DeviceExt && DeviceExt->SpareVPB)
@@ -941,9 +943,9 @@ VfatGetRetrievalPointers(
     ULONG MaxExtentCount;
     PVFATFCB Fcb;
     PDEVICE_EXTENSION DeviceExt;
-    ULONG FirstCluster;
     ULONG CurrentCluster;
     ULONG LastCluster;
+    ULONG RunLength;
     NTSTATUS Status;
 
     DPRINT("VfatGetRetrievalPointers(IrpContext %p)\n", IrpContext);
@@ -978,40 +980,45 @@ VfatGetRetrievalPointers(
         goto ByeBye;
     }
 
-    CurrentCluster = FirstCluster = vfatDirEntryGetFirstCluster(DeviceExt, &Fcb->entry);
-    Status = OffsetToCluster(DeviceExt, FirstCluster,
-                             Vcn.u.LowPart * DeviceExt->FatInfo.BytesPerCluster,
-                             &CurrentCluster, FALSE);
-    if (!NT_SUCCESS(Status))
-    {
-        goto ByeBye;
-    }
-
     RetrievalPointers->StartingVcn = Vcn;
     RetrievalPointers->ExtentCount = 0;
-    RetrievalPointers->Extents[0].Lcn.u.HighPart = 0;
-    RetrievalPointers->Extents[0].Lcn.u.LowPart = CurrentCluster - 2;
     LastCluster = 0;
-    while (CurrentCluster != 0xffffffff && RetrievalPointers->ExtentCount < MaxExtentCount)
+    for (;;)
     {
-        LastCluster = CurrentCluster;
-        Status = NextCluster(DeviceExt, CurrentCluster, &CurrentCluster, FALSE);
-        Vcn.QuadPart++;
+        Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                    Vcn.u.LowPart * DeviceExt->FatInfo.BytesPerCluster,
+                                    &CurrentCluster, &RunLength);
         if (!NT_SUCCESS(Status))
         {
             goto ByeBye;
         }
 
-        if (LastCluster + 1 != CurrentCluster)
+        if (CurrentCluster == 0xffffffff)
+        {
+            /* Close the last extent */
+            if (LastCluster != 0)
+                RetrievalPointers->ExtentCount++;
+            break;
+        }
+
+        if (LastCluster != 0 && LastCluster + 1 != CurrentCluster)
         {
-            RetrievalPointers->Extents[RetrievalPointers->ExtentCount].NextVcn = Vcn;
             RetrievalPointers->ExtentCount++;
-            if (RetrievalPointers->ExtentCount < MaxExtentCount)
-            {
-                RetrievalPointers->Extents[RetrievalPointers->ExtentCount].Lcn.u.HighPart = 0;
-                RetrievalPointers->Extents[RetrievalPointers->ExtentCount].Lcn.u.LowPart = CurrentCluster - 2;
-            }
+            LastCluster = 0;
+        }
+
+        if (LastCluster == 0)
+        {
+            if (RetrievalPointers->ExtentCount >= MaxExtentCount)
+                break;
+
+            RetrievalPointers->Extents[RetrievalPointers->ExtentCount].Lcn.u.HighPart = 0;
+            RetrievalPointers->Extents[RetrievalPointers->ExtentCount].Lcn.u.LowPart = CurrentCluster - 2;
         }
+
+        Vcn.QuadPart += RunLength;
+        RetrievalPointers->Extents[RetrievalPointers->ExtentCount].NextVcn = Vcn;
+        LastCluster = CurrentCluster + RunLength - 1;
     }
 
     IrpContext->Irp->IoStatus.Information = sizeof(RETRIEVAL_POINTERS_BUFFER) + (sizeof(RetrievalPointers->Extents[0]) * (RetrievalPointers->ExtentCount - 1));
@@ -1299,6 +1306,7 @@ VfatDismountVolume(
     ExReleaseResourceLite(&DeviceExt->FatResource);
 
     /* Release a few resources and quit, we're done */
+    UninitializeClusterBitmap(DeviceExt);
     ExDeleteResourceLite(&DeviceExt->DirResource);
     ExDeleteResourceLite(&DeviceExt->FatResource);
     ObDereferenceObject(DeviceExt->FATFileObject);
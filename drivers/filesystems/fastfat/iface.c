@@ -132,6 +132,8 @@ DriverEntry(
                                     NULL, NULL, 0, sizeof(VFATCCB), TAG_CCB, 0);
     ExInitializeNPagedLookasideList(&VfatGlobalData->IrpContextLookasideList,
                                     NULL, NULL, 0, sizeof(VFAT_IRP_CONTEXT), TAG_IRP, 0);
+    ExInitializePagedLookasideList(&VfatGlobalData->NameIndexLookasideList,
+                                   NULL, NULL, 0, sizeof(VFAT_NAME_INDEX_ENTRY), TAG_IDX, 0);
 
     ExInitializeResourceLite(&VfatGlobalData->VolumeListLock);
     InitializeListHead(&VfatGlobalData->VolumeListHead);
@@ -469,6 +469,8 @@ VfatCheckForDismount(
     {
         PVPB DelVpb;
 
+        UninitializeClusterBitmap(DeviceExt);
+
         /* If we have a local VPB, we'll have to delete it
          * but we won't dismount us - something went bad before
          */
@@ -66,7 +66,8 @@ OffsetToCluster(
     BOOLEAN Extend)
 {
     ULONG CurrentCluster;
-    ULONG i;
+    ULONG NextCluster;
+    ULONG i, Count;
     NTSTATUS Status;
 /*
     DPRINT("OffsetToCluster(DeviceExt %x, Fcb %x, FirstCluster %x,"
@@ -91,11 +92,24 @@ OffsetToCluster(
         CurrentCluster = FirstCluster;
         if (Extend)
         {
-            for (i = 0; i < FileOffset / DeviceExt->FatInfo.BytesPerCluster; i++)
+            Count = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+            for (i = 0; i < Count; i++)
             {
-                Status = GetNextClusterExtend (DeviceExt, CurrentCluster, &CurrentCluster);
+                Status = GetNextCluster (DeviceExt, CurrentCluster, &NextCluster);
                 if (!NT_SUCCESS(Status))
                     return Status;
+
+                if (NextCluster == 0xffffffff)
+                {
+                    /* Allocate the rest of the way at once */
+                    Status = ExtendClusterChain(DeviceExt, CurrentCluster, Count - i,
+                                                &NextCluster, &CurrentCluster);
+                    if (!NT_SUCCESS(Status))
+                        return Status;
+                    break;
+                }
+
+                CurrentCluster = NextCluster;
             }
             *Cluster = CurrentCluster;
         }
@@ -113,6 +127,99 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Return the cluster at a cluster aligned offset of a file and the number of
+ * clusters from there on that are known to be contiguous on disk. The FAT
+ * chain is only walked past the runs already recorded in the FCB, which are
+ * extended as we go. Cluster is 0xffffffff past the end of the chain.
+ */
+NTSTATUS
+OffsetToClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FileOffset,
+    PULONG Cluster,
+    PULONG RunLength)
+{
+    LONGLONG Vcn, Lcn, Count;
+    LONGLONG RunVcn;
+    ULONG RunCluster, RunClusters;
+    ULONG CurrentCluster, NextCluster;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Vcn = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, Vcn, &Lcn, &Count, NULL, NULL, NULL) &&
+        Lcn != -1)
+    {
+        *Cluster = (ULONG)Lcn;
+        if (RunLength)
+            *RunLength = (ULONG)min(Count, MAXULONG);
+        return STATUS_SUCCESS;
+    }
+
+    /* Carry on from the last cluster we know about */
+    if (FsRtlLookupLastLargeMcbEntry(&Fcb->ClusterMcb, &RunVcn, &Lcn))
+    {
+        CurrentCluster = (ULONG)Lcn;
+    }
+    else
+    {
+        RunVcn = 0;
+        CurrentCluster = vfatDirEntryGetFirstCluster(DeviceExt, &Fcb->entry);
+        if (CurrentCluster == 0)
+        {
+            *Cluster = 0xffffffff;
+            if (RunLength)
+                *RunLength = 0;
+            return STATUS_SUCCESS;
+        }
+
+        /* The FAT12/16 root directory isn't made of clusters */
+        if (CurrentCluster == 1)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    RunCluster = CurrentCluster;
+    RunClusters = 1;
+    while (RunVcn + RunClusters <= Vcn)
+    {
+        Status = GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
+        if (!NT_SUCCESS(Status) || NextCluster == 0xffffffff)
+            break;
+
+        if (NextCluster != CurrentCluster + 1)
+        {
+            FsRtlAddLargeMcbEntry(&Fcb->ClusterMcb, RunVcn, RunCluster, RunClusters);
+            RunVcn += RunClusters;
+            RunCluster = NextCluster;
+            RunClusters = 0;
+        }
+
+        CurrentCluster = NextCluster;
+        RunClusters++;
+    }
+    FsRtlAddLargeMcbEntry(&Fcb->ClusterMcb, RunVcn, RunCluster, RunClusters);
+
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (RunVcn + RunClusters <= Vcn)
+    {
+        *Cluster = 0xffffffff;
+        if (RunLength)
+            *RunLength = 0;
+        return STATUS_SUCCESS;
+    }
+
+    *Cluster = CurrentCluster;
+    if (RunLength)
+        *RunLength = 1;
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -130,14 +237,12 @@ VfatReadFileData(
     ULONG ClusterCount;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
-    BOOLEAN First = TRUE;
     PVFATFCB Fcb;
     NTSTATUS Status;
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    ULONG RunLength;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -215,87 +320,64 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+    /*
+     * Find the cluster to start the read from
+     */
+    Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                                &CurrentCluster, &RunLength);
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status) && CurrentCluster != 0xffffffff)
     {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != CurrentCluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
     }
+#endif
 
     if (!NT_SUCCESS(Status))
     {
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
     IrpContext->RefCount = 1;
 
     while (Length > 0 && CurrentCluster != 0xffffffff)
     {
         StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector +
+                               ReadOffset.u.LowPart % BytesPerCluster;
         BytesDone = 0;
         ClusterCount = 0;
 
+        /* Take whole runs for as long as they follow each other on disk */
         do
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (ReadOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += ReadOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            ClusterCount += RunLength;
+            BytesDone = (ULONG)min((ULONGLONG)Length,
+                                   (ULONGLONG)ClusterCount * BytesPerCluster -
+                                   ReadOffset.u.LowPart % BytesPerCluster);
+            if (BytesDone == Length)
+                break;
+
+            Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                        ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) +
+                                        ClusterCount * BytesPerCluster,
+                                        &CurrentCluster, &RunLength);
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
+        while (NT_SUCCESS(Status) && StartCluster + ClusterCount == CurrentCluster);
         DPRINT("start %08x, next %08x, count %u\n",
                StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
 
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
@@ -344,13 +426,11 @@ VfatWriteFileData(
     ULONG StartCluster;
     ULONG ClusterCount;
     NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    ULONG RunLength;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -428,89 +508,64 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /*
      * Find the cluster to start the write from
      */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+    Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                                &CurrentCluster, &RunLength);
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status) && CurrentCluster != 0xffffffff)
     {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != CurrentCluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
     }
+#endif
 
     if (!NT_SUCCESS(Status))
     {
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     IrpContext->RefCount = 1;
     BufferOffset = 0;
 
     while (Length > 0 && CurrentCluster != 0xffffffff)
     {
         StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector +
+                               WriteOffset.u.LowPart % BytesPerCluster;
         BytesDone = 0;
         ClusterCount = 0;
 
+        /* Take whole runs for as long as they follow each other on disk */
         do
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (WriteOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += WriteOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            ClusterCount += RunLength;
+            BytesDone = (ULONG)min((ULONGLONG)Length,
+                                   (ULONGLONG)ClusterCount * BytesPerCluster -
+                                   WriteOffset.u.LowPart % BytesPerCluster);
+            if (BytesDone == Length)
+                break;
+
+            Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                        ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) +
+                                        ClusterCount * BytesPerCluster,
+                                        &CurrentCluster, &RunLength);
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
+        while (NT_SUCCESS(Status) && StartCluster + ClusterCount == CurrentCluster);
         DPRINT("start %08x, next %08x, count %u\n",
                StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
 
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
@@ -245,6 +245,14 @@ typedef union _DIR_ENTRY DIR_ENTRY, *PDIR_ENTRY;
 #define VCB_IS_DIRTY            0x4000 /* Volume is dirty */
 #define VCB_CLEAR_DIRTY         0x8000 /* Clean dirty flag at shutdown */
 
+/* Volumes with more clusters have their FAT scanned for the cluster
+ * bitmap after mount instead of during it */
+#define VFAT_BACKGROUND_SCAN_CLUSTERS 0x100000
+
+/* Directories with at least this many entries get a name index built on
+ * their first lookup */
+#define VFAT_NAME_INDEX_MIN_ENTRIES 1024
+
 typedef struct
 {
     ULONG VolumeID;
@@ -278,6 +286,20 @@ typedef struct _HASHENTRY
 }
 HASHENTRY;
 
+typedef struct _VFAT_NAME_INDEX_ENTRY
+{
+    ULONG Hash;
+    ULONG DirIndex;
+    struct _VFAT_NAME_INDEX_ENTRY *Next;
+} VFAT_NAME_INDEX_ENTRY, *PVFAT_NAME_INDEX_ENTRY;
+
+typedef struct _VFAT_NAME_INDEX
+{
+    /* Always a power of two */
+    ULONG BucketCount;
+    PVFAT_NAME_INDEX_ENTRY Buckets[1];
+} VFAT_NAME_INDEX, *PVFAT_NAME_INDEX;
+
 typedef struct DEVICE_EXTENSION *PDEVICE_EXTENSION;
 
 typedef NTSTATUS (*PGET_NEXT_CLUSTER)(PDEVICE_EXTENSION,ULONG,PULONG);
@@ -324,6 +346,12 @@ typedef struct DEVICE_EXTENSION
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
     ULONG Flags;
+
+    /* Clusters in use, set bits are allocated. Filled in along with
+     * AvailableClusters and only valid once AvailableClustersValid is set */
+    RTL_BITMAP ClusterBitmap;
+    PIO_WORKITEM ClusterBitmapWorkItem;
+    KEVENT ClusterBitmapEvent;
     struct _VFATFCB *VolumeFcb;
     PSTATISTICS Statistics;
 
@@ -408,6 +436,7 @@ typedef struct
     NPAGED_LOOKASIDE_LIST FcbLookasideList;
     NPAGED_LOOKASIDE_LIST CcbLookasideList;
     NPAGED_LOOKASIDE_LIST IrpContextLookasideList;
+    PAGED_LOOKASIDE_LIST NameIndexLookasideList;
     FAST_IO_DISPATCH FastIoDispatch;
     CACHE_MANAGER_CALLBACKS CacheMgrCallbacks;
 } VFAT_GLOBAL_DATA, *PVFAT_GLOBAL_DATA;
@@ -503,13 +532,17 @@ typedef struct _VFATFCB
     FILE_LOCK FileLock;
 
     /*
-     * Optimization: caching of last read/write cluster+offset pair. Can't
-     * be in VFATCCB because it must be reset everytime the allocated clusters
-     * change.
+     * Runs of the cluster chain seen so far, mapping cluster indexes in the
+     * file to cluster numbers. Filled in as the file is accessed, can't be
+     * in VFATCCB because it must be truncated whenever clusters are freed.
+     */
+    LARGE_MCB ClusterMcb;
+
+    /*
+     * For big directories, hashes of the long and short names of the
+     * entries to their short name entry index. Guarded by DirResource.
      */
-    FAST_MUTEX LastMutex;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    PVFAT_NAME_INDEX NameIndex;
 } VFATFCB, *PVFATFCB;
 
 #define CCB_DELETE_ON_CLOSE     0x0001
@@ -528,6 +561,7 @@ typedef struct _VFATCCB
 #define TAG_FCB  'BCFV'
 #define TAG_IRP  'PRIV'
 #define TAG_VFAT 'TAFV'
+#define TAG_IDX  'XDIV'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -893,6 +927,22 @@ CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
     PLARGE_INTEGER Clusters);
 
+NTSTATUS
+InitializeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt);
+
+VOID
+UninitializeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt);
+
+NTSTATUS
+ExtendClusterChain(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstNewCluster,
+    PULONG LastNewCluster);
+
 NTSTATUS
 WriteCluster(
     PDEVICE_EXTENSION DeviceExt,
@@ -1046,6 +1096,33 @@ vfatMakeFCBFromDirEntry(
     PVFAT_DIRENTRY_CONTEXT DirContext,
     PVFATFCB *fileFCB);
 
+BOOLEAN
+vfatUseNameIndex(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB);
+
+NTSTATUS
+vfatNameIndexFindEntry(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PVOID *pContext);
+
+VOID
+vfatNameIndexAddEntry(
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING LongNameU,
+    PUNICODE_STRING ShortNameU,
+    ULONG DirIndex);
+
+VOID
+vfatNameIndexRemoveEntry(
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING LongNameU,
+    PUNICODE_STRING ShortNameU,
+    ULONG DirIndex);
+
 /* finfo.c */
 
 NTSTATUS
@@ -1170,6 +1247,14 @@ NextCluster(
     PULONG CurrentCluster,
     BOOLEAN Extend);
 
+NTSTATUS
+OffsetToClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FileOffset,
+    PULONG Cluster,
+    PULONG RunLength);
+
 /* shutdown.c */
 
 DRIVER_DISPATCH
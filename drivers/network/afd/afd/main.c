@@ -1271,6 +1271,15 @@ AfdCancelHandler(PDEVICE_OBJECT DeviceObject,
             return;
     }
 
+    if (Irp == FCB->DirectRecvIrp)
+    {
+        /* The transport is filling this buffer, so the receive completion finishes it */
+        ASSERT(FCB->ReceiveIrp.InFlightRequest);
+        IoCancelIrp(FCB->ReceiveIrp.InFlightRequest);
+        SocketStateUnlock(FCB);
+        return;
+    }
+
     CurrentEntry = FCB->PendingIrpList[Function].Flink;
     while (CurrentEntry != &FCB->PendingIrpList[Function])
     {
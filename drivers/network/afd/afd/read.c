@@ -10,6 +10,65 @@
 
 #include "afd.h"
 
+static BOOLEAN QualifiesForDirectReceive( PIRP Irp )
+{
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IrpSp);
+    PAFD_MAPBUF Map;
+
+    /* Immediate receives are completed by their caller if no data is waiting */
+    if (!(IrpSp->Control & SL_PENDING_RETURNED)) return FALSE;
+
+    /* Peeked data has to stay in the window */
+    if (RecvReq->TdiFlags & TDI_RECEIVE_PEEK) return FALSE;
+
+    /* The transport fills a single MDL */
+    if (!RecvReq->BufferArray || RecvReq->BufferCount != 1) return FALSE;
+
+    Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+
+    return Map[0].Mdl && RecvReq->BufferArray[0].len;
+}
+
+static BOOLEAN ReceiveDirect( PAFD_FCB FCB )
+{
+    PIRP NextIrp;
+    PAFD_RECV_INFO RecvReq;
+    PAFD_MAPBUF Map;
+    NTSTATUS Status;
+
+    if (IsListEmpty(&FCB->PendingIrpList[FUNCTION_RECV])) return FALSE;
+
+    NextIrp = CONTAINING_RECORD(FCB->PendingIrpList[FUNCTION_RECV].Flink,
+                                IRP, Tail.Overlay.ListEntry);
+
+    if (!QualifiesForDirectReceive(NextIrp)) return FALSE;
+
+    RecvReq = GetLockedData(NextIrp, IoGetCurrentIrpStackLocation( NextIrp ));
+    Map = (PAFD_MAPBUF)(RecvReq->BufferArray + RecvReq->BufferCount);
+
+    AFD_DbgPrint(MID_TRACE,("Receiving directly into %p\n", NextIrp));
+
+    /* The receive may complete before TdiReceiveMdl returns */
+    FCB->DirectRecvIrp = NextIrp;
+
+    Status = TdiReceiveMdl( &FCB->ReceiveIrp.InFlightRequest,
+                            FCB->Connection.Object,
+                            TDI_RECEIVE_NORMAL,
+                            Map[0].Mdl,
+                            RecvReq->BufferArray[0].len,
+                            ReceiveComplete,
+                            FCB );
+
+    if (!NT_SUCCESS(Status))
+    {
+        FCB->DirectRecvIrp = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static VOID RefillSocketBuffer( PAFD_FCB FCB )
 {
     /* Make sure nothing's in flight first */
@@ -18,6 +77,15 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
     /* Now ensure that receive is still allowed */
     if (FCB->TdiReceiveClosed) return;
 
+    /* An empty window isn't needed while a receive is waiting */
+    if (FCB->Recv.Content == FCB->Recv.BytesUsed)
+    {
+        FCB->Recv.Content = 0;
+        FCB->Recv.BytesUsed = 0;
+
+        if (ReceiveDirect(FCB)) return;
+    }
+
     /* Check if the buffer is full */
     if (FCB->Recv.Content == FCB->Recv.Size)
     {
@@ -52,6 +120,14 @@ static VOID RefillSocketBuffer( PAFD_FCB FCB )
 
 static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Information )
 {
+    /* We cancelled an empty window receive to make way for a direct one */
+    if (FCB->RecvWindowCancelled && Status == STATUS_CANCELLED && !FCB->TdiReceiveClosed)
+    {
+        FCB->RecvWindowCancelled = FALSE;
+        return;
+    }
+
+    FCB->RecvWindowCancelled = FALSE;
     FCB->LastReceiveStatus = Status;
 
     /* We got closed while the receive was in progress */
@@ -71,11 +147,6 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
             /* Receive is closed */
             FCB->TdiReceiveClosed = TRUE;
         }
-        else
-        {
-            /* Issue another receive IRP to keep the buffer well stocked */
-            RefillSocketBuffer(FCB);
-        }
     }
     /* Receive failed with no data (unexpected closure) */
     else
@@ -85,6 +156,34 @@ static VOID HandleReceiveComplete( PAFD_FCB FCB, NTSTATUS Status, ULONG_PTR Info
     }
 }
 
+static VOID HandleDirectReceiveComplete( PAFD_FCB FCB, PIRP Irp, NTSTATUS Status, ULONG_PTR Information )
+{
+    PAFD_RECV_INFO RecvReq = GetLockedData(Irp, IoGetCurrentIrpStackLocation( Irp ));
+
+    /* Data or a cancellation of the receive itself completes it here,
+     * anything else is left for ReceiveActivity like a window receive */
+    if ((Status == STATUS_SUCCESS && Information != 0) ||
+        (Status == STATUS_CANCELLED && Irp->Cancel && !FCB->TdiReceiveClosed))
+    {
+        AFD_DbgPrint(MID_TRACE,("Completing direct recv %p (%u)\n", Irp,
+                                (UINT)Information));
+
+        if (Status == STATUS_SUCCESS)
+            FCB->LastReceiveStatus = Status;
+
+        RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+        UnlockBuffers( RecvReq->BufferArray, RecvReq->BufferCount, FALSE );
+        Irp->IoStatus.Status = Status;
+        Irp->IoStatus.Information = Information;
+        if( Irp->MdlAddress ) UnlockRequest( Irp, IoGetCurrentIrpStackLocation( Irp ) );
+        (void)IoSetCancelRoutine(Irp, NULL);
+        IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+        return;
+    }
+
+    HandleReceiveComplete( FCB, Status, 0 );
+}
+
 static BOOLEAN CantReadMore( PAFD_FCB FCB ) {
     UINT BytesAvailable = FCB->Recv.Content - FCB->Recv.BytesUsed;
 
@@ -168,6 +267,14 @@ static NTSTATUS ReceiveActivity( PAFD_FCB FCB, PIRP Irp ) {
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
             NextIrpEntry = RemoveHeadList(&FCB->PendingIrpList[FUNCTION_RECV]);
             NextIrp = CONTAINING_RECORD(NextIrpEntry, IRP, Tail.Overlay.ListEntry);
+
+            /* The transport still owns the buffer of a direct receive */
+            if( NextIrp == FCB->DirectRecvIrp ) {
+                InsertHeadList(&FCB->PendingIrpList[FUNCTION_RECV],
+                               &NextIrp->Tail.Overlay.ListEntry);
+                break;
+            }
+
             NextIrpSp = IoGetCurrentIrpStackLocation( NextIrp );
             RecvReq = GetLockedData(NextIrp, NextIrpSp);
 
@@ -272,7 +379,7 @@ NTSTATUS NTAPI ReceiveComplete
   PVOID Context ) {
     PAFD_FCB FCB = (PAFD_FCB)Context;
     PLIST_ENTRY NextIrpEntry;
-    PIRP NextIrp;
+    PIRP NextIrp, DirectIrp;
     PAFD_RECV_INFO RecvReq;
     PIO_STACK_LOCATION NextIrpSp;
 
@@ -286,6 +393,13 @@ NTSTATUS NTAPI ReceiveComplete
     ASSERT(FCB->ReceiveIrp.InFlightRequest == Irp);
     FCB->ReceiveIrp.InFlightRequest = NULL;
 
+    DirectIrp = FCB->DirectRecvIrp;
+    if( DirectIrp ) {
+        /* The MDL belongs to the user's receive, don't let the I/O manager free it */
+        Irp->MdlAddress = NULL;
+        FCB->DirectRecvIrp = NULL;
+    }
+
     if( FCB->State == SOCKET_STATE_CLOSED ) {
         /* Cleanup our IRP queue because the FCB is being destroyed */
         while( !IsListEmpty( &FCB->PendingIrpList[FUNCTION_RECV] ) ) {
@@ -308,10 +422,18 @@ NTSTATUS NTAPI ReceiveComplete
         return STATUS_INVALID_PARAMETER;
     }
 
-    HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    if( DirectIrp ) {
+        HandleDirectReceiveComplete( FCB, DirectIrp, Irp->IoStatus.Status,
+                                     Irp->IoStatus.Information );
+    } else {
+        HandleReceiveComplete( FCB, Irp->IoStatus.Status, Irp->IoStatus.Information );
+    }
 
     ReceiveActivity( FCB, NULL );
 
+    /* Issue another receive IRP to keep the buffer well stocked */
+    RefillSocketBuffer( FCB );
+
     SocketStateUnlock( FCB );
 
     return STATUS_SUCCESS;
@@ -532,6 +654,21 @@ AfdConnectedSocketReadData(PDEVICE_OBJECT DeviceObject, PIRP Irp,
         AFD_DbgPrint(MID_TRACE,("Leaving read irp\n"));
         IoMarkIrpPending( Irp );
         (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+
+        /* From here on the receive may be completed by the transport */
+        if( FCB->ReceiveIrp.InFlightRequest ) {
+            /* An empty window receive would cost an extra copy, so trade it
+             * for a receive straight into the user's buffer */
+            if( !FCB->DirectRecvIrp && !FCB->RecvWindowCancelled &&
+                FCB->Recv.Content == FCB->Recv.BytesUsed &&
+                FCB->PendingIrpList[FUNCTION_RECV].Flink == &Irp->Tail.Overlay.ListEntry &&
+                QualifiesForDirectReceive( Irp ) ) {
+                FCB->RecvWindowCancelled = TRUE;
+                IoCancelIrp( FCB->ReceiveIrp.InFlightRequest );
+            }
+        } else {
+            RefillSocketBuffer( FCB );
+        }
     } else {
         AFD_DbgPrint(MID_TRACE,("Completed with status %x\n", Status));
     }
@@ -973,17 +973,21 @@ NTSTATUS TdiSend(
     return STATUS_PENDING;
 }
 
-NTSTATUS TdiReceive(
+NTSTATUS TdiReceiveMdl(
     PIRP *Irp,
     PFILE_OBJECT TransportObject,
     USHORT Flags,
-    PCHAR Buffer,
+    PMDL Mdl,
     UINT BufferLength,
     PIO_COMPLETION_ROUTINE CompletionRoutine,
     PVOID CompletionContext)
+/*
+ * FUNCTION: Receives into a buffer that is already described by a locked MDL
+ * NOTES: The MDL is attached to the receive IRP, so a caller that wants to
+ *        keep it must detach it again in its completion routine
+ */
 {
     PDEVICE_OBJECT DeviceObject;
-    PMDL Mdl;
 
     ASSERT(*Irp == NULL);
 
@@ -1009,7 +1013,38 @@ NTSTATUS TdiReceive(
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    AFD_DbgPrint(MID_TRACE, ("Allocating irp for %p:%u\n", Buffer,BufferLength));
+    AFD_DbgPrint(MID_TRACE,("AFD>>> Receiving into MDL: %p:%u\n", Mdl, BufferLength));
+
+    TdiBuildReceive(*Irp,                   /* I/O Request Packet */
+                    DeviceObject,           /* Device object */
+                    TransportObject,        /* File object */
+                    CompletionRoutine,      /* Completion routine */
+                    CompletionContext,      /* Completion context */
+                    Mdl,                    /* Data buffer */
+                    Flags,                  /* Flags */
+                    BufferLength);          /* Length of data */
+
+
+    TdiCall(*Irp, DeviceObject, NULL, NULL);
+    /* Does not block...  The MDL is deleted in the receive completion
+       routine unless the completion routine takes it back. */
+
+    return STATUS_PENDING;
+}
+
+NTSTATUS TdiReceive(
+    PIRP *Irp,
+    PFILE_OBJECT TransportObject,
+    USHORT Flags,
+    PCHAR Buffer,
+    UINT BufferLength,
+    PIO_COMPLETION_ROUTINE CompletionRoutine,
+    PVOID CompletionContext)
+{
+    NTSTATUS Status;
+    PMDL Mdl;
+
+    AFD_DbgPrint(MID_TRACE, ("Allocating mdl for %p:%u\n", Buffer,BufferLength));
 
     Mdl = IoAllocateMdl(Buffer,         /* Virtual address */
                         BufferLength,   /* Length of buffer */
@@ -1018,40 +1053,35 @@ NTSTATUS TdiReceive(
                         NULL);          /* Don't use IRP */
     if (!Mdl) {
         AFD_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
-        IoCompleteRequest(*Irp, IO_NO_INCREMENT);
-        *Irp = NULL;
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
     _SEH2_TRY {
         AFD_DbgPrint(MID_TRACE, ("probe and lock\n"));
-        MmProbeAndLockPages(Mdl, (*Irp)->RequestorMode, IoModifyAccess);
+        MmProbeAndLockPages(Mdl, KernelMode, IoModifyAccess);
         AFD_DbgPrint(MID_TRACE, ("probe and lock done\n"));
     } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER) {
         AFD_DbgPrint(MIN_TRACE, ("MmProbeAndLockPages() failed.\n"));
         IoFreeMdl(Mdl);
-        IoCompleteRequest(*Irp, IO_NO_INCREMENT);
-        *Irp = NULL;
         _SEH2_YIELD(return STATUS_INSUFFICIENT_RESOURCES);
     } _SEH2_END;
 
     AFD_DbgPrint(MID_TRACE,("AFD>>> Got an MDL: %p\n", Mdl));
 
-    TdiBuildReceive(*Irp,                   /* I/O Request Packet */
-                    DeviceObject,           /* Device object */
-                    TransportObject,        /* File object */
-                    CompletionRoutine,      /* Completion routine */
-                    CompletionContext,      /* Completion context */
-                    Mdl,                    /* Data buffer */
-                    Flags,                  /* Flags */
-                    BufferLength);          /* Length of data */
-
+    Status = TdiReceiveMdl(Irp,
+                           TransportObject,
+                           Flags,
+                           Mdl,
+                           BufferLength,
+                           CompletionRoutine,
+                           CompletionContext);
 
-    TdiCall(*Irp, DeviceObject, NULL, NULL);
-    /* Does not block...  The MDL is deleted in the receive completion
-       routine. */
+    if (!NT_SUCCESS(Status)) {
+        MmUnlockPages(Mdl);
+        IoFreeMdl(Mdl);
+    }
 
-    return STATUS_PENDING;
+    return Status;
 }
 
 
@@ -15,12 +15,24 @@ ULONG ChecksumCompute(
     UINT Count,
     ULONG Seed);
 
+ULONG ChecksumCopy(
+    PVOID Destination,
+    PVOID Source,
+    UINT Count,
+    ULONG Seed);
+
 unsigned int
 csum_partial(
   const unsigned char * buff,
   int len,
   unsigned int sum);
 
+ULONG
+UDPv4ChecksumFinish(
+  PIPv4_HEADER IPHeader,
+  ULONG DataLength,
+  ULONG Sum);
+
 ULONG
 UDPv4ChecksumCalculate(
   PIPv4_HEADER IPHeader,
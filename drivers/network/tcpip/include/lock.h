@@ -9,5 +9,7 @@ extern VOID TcpipReleaseSpinLockFromDpcLevel( PKSPIN_LOCK SpinLock );
 extern VOID TcpipInterlockedInsertTailList( PLIST_ENTRY ListHead,
 					    PLIST_ENTRY Item,
 					    PKSPIN_LOCK Lock );
+extern VOID TcpipRaiseIrqlToDpcLevel( PKIRQL Irql );
+extern VOID TcpipLowerIrql( KIRQL Irql );
 extern VOID TcpipAcquireFastMutex( PFAST_MUTEX Mutex );
 extern VOID TcpipReleaseFastMutex( PFAST_MUTEX Mutex );
@@ -12,9 +12,17 @@
 /* Number of seconds before destroying the IPDR */
 #define MAX_TIMEOUT_COUNT 3
 
+/* Number of hash buckets for datagrams being reassembled (a power of two) */
+#define IP_REASSEMBLY_BUCKETS 64
+
+/* Fragment data held for reassembly before the least recently active
+   datagrams are evicted. The fragments pin receive packets, so this also
+   bounds how many packets reassembly can take from the miniports */
+#define IP_REASSEMBLY_MAX_BYTES (1024 * 1024)
+
 /* IP datagram fragment descriptor. Used to store IP datagram fragments */
 typedef struct IP_FRAGMENT {
-    LIST_ENTRY ListEntry; /* Entry on list */
+    LIST_ENTRY ListEntry; /* Entry on list, sorted by Offset */
     PNDIS_PACKET Packet;  /* NDIS packet containing fragment data */
     BOOLEAN ReturnPacket; /* States whether to call NdisReturnPackets */
     UINT PacketOffset;    /* Offset into NDIS packet where data is */
@@ -22,18 +30,12 @@ typedef struct IP_FRAGMENT {
     UINT Size;            /* Size of this fragment */
 } IP_FRAGMENT, *PIP_FRAGMENT;
 
-/* IP datagram hole descriptor. Used to reassemble IP datagrams */
-typedef struct IPDATAGRAM_HOLE {
-    LIST_ENTRY ListEntry; /* Entry on list */
-    UINT First;           /* Offset of first octet of the hole */
-    UINT Last;            /* Offset of last octet of the hole */
-} IPDATAGRAM_HOLE, *PIPDATAGRAM_HOLE;
-
 /* IP datagram reassembly information */
 typedef struct IPDATAGRAM_REASSEMBLY {
-    LIST_ENTRY ListEntry;        /* Entry on list */
-    KSPIN_LOCK Lock;             /* Protecting spin lock */
-    UINT DataSize;               /* Size of datagram data area */
+    LIST_ENTRY ListEntry;        /* Entry on list, least recently active first */
+    LIST_ENTRY HashEntry;        /* Entry on hash bucket */
+    UINT DataSize;               /* Size of datagram data area, 0 until the last fragment */
+    UINT ReceivedSize;           /* Bytes of data held in fragments */
     IP_ADDRESS SrcAddr;          /* Source address */
     IP_ADDRESS DstAddr;          /* Destination address */
     UCHAR Protocol;              /* Internet Protocol number */
@@ -41,16 +43,15 @@ typedef struct IPDATAGRAM_REASSEMBLY {
     PIP_HEADER IPv4Header;       /* Pointer to IP header */
     UINT HeaderSize;             /* Length of IP header */
     LIST_ENTRY FragmentListHead; /* IP fragment list */
-    LIST_ENTRY HoleListHead;     /* IP datagram hole list */
     UINT TimeoutCount;           /* Timeout counter */
 } IPDATAGRAM_REASSEMBLY, *PIPDATAGRAM_REASSEMBLY;
 
 
 extern LIST_ENTRY ReassemblyListHead;
+extern LIST_ENTRY ReassemblyHashTable[IP_REASSEMBLY_BUCKETS];
 extern KSPIN_LOCK ReassemblyListLock;
 extern NPAGED_LOOKASIDE_LIST IPDRList;
 extern NPAGED_LOOKASIDE_LIST IPFragmentList;
-extern NPAGED_LOOKASIDE_LIST IPHoleList;
 
 
 VOID IPFreeReassemblyList(
@@ -20,6 +20,30 @@ typedef struct _FIB_ENTRY {
     UINT Metric;                  /* Cost of this route */
 } FIB_ENTRY, *PFIB_ENTRY;
 
+/* Route in a FIB table. Indexes are one based, zero means none */
+typedef struct _FIB_ROUTE {
+    PNEIGHBOR_CACHE_ENTRY Router; /* Pointer to NCE of router to use */
+    UINT Metric;                  /* Cost of this route */
+    ULONG Next;                   /* Next route with the same prefix */
+} FIB_ROUTE, *PFIB_ROUTE;
+
+/* Node of the binary trie indexing the IPv4 routes by prefix */
+typedef struct _FIB_NODE {
+    ULONG Child[2];               /* Nodes for the next prefix bit */
+    ULONG Routes;                 /* Routes for this prefix, by metric */
+    ULONG Parent;                 /* Closest shorter prefix with routes */
+} FIB_NODE, *PFIB_NODE;
+
+#define FIB_CACHE_SIZE 256
+
+/* Read-only snapshot of the IPv4 routes, rebuilt whenever the FIB changes */
+typedef struct _FIB_TABLE {
+    ULONG NodeCount;              /* Number of nodes in use */
+    PFIB_ROUTE Routes;            /* Routes, stored after the nodes */
+    LONGLONG Cache[FIB_CACHE_SIZE]; /* Destination and deepest node with routes */
+    FIB_NODE Nodes[ANYSIZE_ARRAY]; /* Trie, root first */
+} FIB_TABLE, *PFIB_TABLE;
+
 PFIB_ENTRY RouterAddRoute(
     PIP_ADDRESS NetworkAddress,
     PIP_ADDRESS Netmask,
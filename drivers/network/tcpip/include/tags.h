@@ -19,7 +19,6 @@
 #define IP_INTERFACE_TAG 'FIPI'
 #define DATAGRAM_REASSEMBLY_TAG 'RDPI'
 #define DATAGRAM_FRAGMENT_TAG 'GFPI'
-#define DATAGRAM_HOLE_TAG 'LHPI'
 #define OSKITTCP_CONTEXT_TAG 'TKSO'
 #define NEIGHBOR_PACKET_TAG 'kPbN'
 #define NCE_TAG ' ECN'
@@ -27,6 +26,7 @@
 #define PACKET_BUFFER_TAG 'fuBP'
 #define FRAGMENT_DATA_TAG 'taDF'
 #define FIB_TAG ' BIF'
+#define FIB_TABLE_TAG 'TBIF'
 #define IFC_TAG ' CFI'
 #define TDI_BUCKET_TAG 'BidT'
 #define FBSD_TAG 'DSBF'
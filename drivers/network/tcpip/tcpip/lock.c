@@ -37,6 +37,14 @@ VOID TcpipInterlockedInsertTailList( PLIST_ENTRY ListHead,
     ExInterlockedInsertTailList( ListHead, Item, Lock );
 }
 
+VOID TcpipRaiseIrqlToDpcLevel( PKIRQL Irql ) {
+    KeRaiseIrql( DISPATCH_LEVEL, Irql );
+}
+
+VOID TcpipLowerIrql( KIRQL Irql ) {
+    KeLowerIrql( Irql );
+}
+
 VOID TcpipAcquireFastMutex( PFAST_MUTEX Mutex ) {
     ExAcquireFastMutex( Mutex );
 }
@@ -40,6 +40,16 @@ VOID TcpipInterlockedInsertTailList( PLIST_ENTRY ListHead,
     InsertTailList( ListHead, Item );
 }
 
+VOID TcpipRaiseIrqlToDpcLevel( PKIRQL Irql ) {
+    *Irql = KernelIrql;
+    KernelIrql = DISPATCH_LEVEL;
+}
+
+VOID TcpipLowerIrql( KIRQL Irql ) {
+    ASSERT( Irql <= KernelIrql );
+    KernelIrql = Irql;
+}
+
 VOID TcpipAcquireFastMutex( PFAST_MUTEX Mutex ) {
 }
 
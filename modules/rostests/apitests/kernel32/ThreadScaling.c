@@ -0,0 +1,179 @@
+/*
+ * PROJECT:     ReactOS api tests
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Test that CPU-bound threads spread over all processors
+ */
+
+#include "precomp.h"
+
+#include <ndk/kefuncs.h>
+
+#define MAX_THREADS     32
+#define WORK_ROUNDS     (64 * 1024 * 1024)
+
+typedef struct _WORKER
+{
+    HANDLE StartEvent;
+    ULONG Rounds;
+    volatile ULONG Result;
+    ULONG_PTR ProcessorsSeen;
+} WORKER, *PWORKER;
+
+static
+DWORD
+WINAPI
+WorkerThread(
+    _In_ PVOID Parameter)
+{
+    PWORKER Worker = Parameter;
+    ULONG Round;
+    ULONG Value = 1;
+
+    WaitForSingleObject(Worker->StartEvent, INFINITE);
+
+    for (Round = 0; Round < Worker->Rounds; Round++)
+    {
+        /* Some work the compiler can't throw away */
+        Value = Value * 1103515245 + 12345;
+
+        /* Note where we run now and then */
+        if ((Round & 0xFFFFF) == 0)
+            Worker->ProcessorsSeen |= (ULONG_PTR)1 << NtGetCurrentProcessorNumber();
+    }
+
+    Worker->Result = Value;
+    return 0;
+}
+
+/* Runs Count threads of the same work at once, returns the elapsed time in ms */
+static
+ULONG
+RunWorkers(
+    _In_ ULONG Count,
+    _Out_ PULONG_PTR ProcessorsSeen)
+{
+    WORKER Workers[MAX_THREADS];
+    HANDLE Threads[MAX_THREADS];
+    HANDLE StartEvent;
+    LARGE_INTEGER Frequency, Start, End;
+    ULONG Index;
+
+    *ProcessorsSeen = 0;
+
+    StartEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ok(StartEvent != NULL, "CreateEventW failed with %lu\n", GetLastError());
+    if (!StartEvent)
+        return 0;
+
+    for (Index = 0; Index < Count; Index++)
+    {
+        Workers[Index].StartEvent = StartEvent;
+        Workers[Index].Rounds = WORK_ROUNDS;
+        Workers[Index].Result = 0;
+        Workers[Index].ProcessorsSeen = 0;
+        Threads[Index] = CreateThread(NULL, 0, WorkerThread, &Workers[Index], 0, NULL);
+        ok(Threads[Index] != NULL, "CreateThread failed with %lu\n", GetLastError());
+        if (!Threads[Index])
+        {
+            Count = Index;
+            break;
+        }
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    SetEvent(StartEvent);
+    WaitForMultipleObjects(Count, Threads, TRUE, INFINITE);
+    QueryPerformanceCounter(&End);
+
+    for (Index = 0; Index < Count; Index++)
+    {
+        *ProcessorsSeen |= Workers[Index].ProcessorsSeen;
+        CloseHandle(Threads[Index]);
+    }
+    CloseHandle(StartEvent);
+
+    return (ULONG)((End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart);
+}
+
+static
+ULONG
+CountProcessors(
+    _In_ ULONG_PTR Set)
+{
+    ULONG Count = 0;
+
+    while (Set)
+    {
+        Set &= Set - 1;
+        Count++;
+    }
+
+    return Count;
+}
+
+static
+void
+TestScaling(
+    _In_ ULONG ProcessorCount)
+{
+    ULONG SingleTime, MultiTime;
+    ULONG_PTR ProcessorsSeen;
+    ULONG Count;
+
+    Count = min(ProcessorCount, MAX_THREADS);
+
+    SingleTime = RunWorkers(1, &ProcessorsSeen);
+    MultiTime = RunWorkers(Count, &ProcessorsSeen);
+    trace("1 thread: %lu ms, %lu threads: %lu ms on %lu processors\n",
+          SingleTime, Count, MultiTime, CountProcessors(ProcessorsSeen));
+
+    /* Every processor should have had one of the threads. The times depend on
+     * the rest of the system, so they are only traced */
+    ok(CountProcessors(ProcessorsSeen) == Count,
+       "Threads ran on %lu processors, expected %lu\n", CountProcessors(ProcessorsSeen), Count);
+}
+
+static
+void
+TestAffinity(
+    _In_ ULONG ProcessorCount,
+    _In_ DWORD_PTR ActiveMask)
+{
+    ULONG Processor, Current;
+    DWORD_PTR OldMask;
+    ULONG Try;
+
+    for (Processor = 0; Processor < min(ProcessorCount, sizeof(ULONG_PTR) * 8); Processor++)
+    {
+        OldMask = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << Processor);
+        ok(OldMask != 0, "SetThreadAffinityMask failed with %lu\n", GetLastError());
+
+        /* The switch happens on the way out of the call, allow for a late one anyway */
+        for (Try = 0; Try < 10; Try++)
+        {
+            Current = NtGetCurrentProcessorNumber();
+            if (Current == Processor)
+                break;
+            Sleep(1);
+        }
+        ok(Current == Processor, "Running on processor %lu, expected %lu\n", Current, Processor);
+    }
+
+    SetThreadAffinityMask(GetCurrentThread(), ActiveMask);
+}
+
+START_TEST(ThreadScaling)
+{
+    SYSTEM_INFO SystemInfo;
+
+    GetSystemInfo(&SystemInfo);
+    if (SystemInfo.dwNumberOfProcessors < 2)
+    {
+        skip("Only one processor\n");
+        return;
+    }
+
+    TestAffinity(SystemInfo.dwNumberOfProcessors, SystemInfo.dwActiveProcessorMask);
+    TestScaling(SystemInfo.dwNumberOfProcessors);
+}
@@ -0,0 +1,220 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for RtlSetHeapInformation / RtlQueryHeapInformation and the LFH
+ */
+
+#include "precomp.h"
+
+#define STRESS_THREADS      4
+#define STRESS_ITERATIONS   200000
+#define STRESS_LIVE_BLOCKS  64
+
+typedef struct _STRESS_CONTEXT
+{
+    HANDLE Heap;
+    ULONG Seed;
+    ULONG Failures;
+} STRESS_CONTEXT, *PSTRESS_CONTEXT;
+
+static
+ULONG
+QueryFrontEnd(HANDLE Heap)
+{
+    NTSTATUS Status;
+    ULONG FrontEnd = 0xdeadbeef;
+    SIZE_T ReturnLength = 0;
+
+    Status = RtlQueryHeapInformation(Heap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd), &ReturnLength);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_size_t(ReturnLength, sizeof(ULONG));
+    return FrontEnd;
+}
+
+static
+NTSTATUS
+EnableLfh(HANDLE Heap)
+{
+    ULONG FrontEnd = 2;
+
+    return RtlSetHeapInformation(Heap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+}
+
+static
+DWORD
+WINAPI
+StressThread(LPVOID Parameter)
+{
+    PSTRESS_CONTEXT Context = Parameter;
+    PUCHAR Blocks[STRESS_LIVE_BLOCKS] = { NULL };
+    SIZE_T Sizes[STRESS_LIVE_BLOCKS] = { 0 };
+    ULONG i, Slot;
+
+    for (i = 0; i < STRESS_ITERATIONS; i++)
+    {
+        Slot = RtlRandom(&Context->Seed) % STRESS_LIVE_BLOCKS;
+
+        /* Check that nobody scribbled over our block, then replace it */
+        if (Blocks[Slot])
+        {
+            if (Blocks[Slot][0] != (UCHAR)Slot || Blocks[Slot][Sizes[Slot] - 1] != (UCHAR)Slot)
+                Context->Failures++;
+            RtlFreeHeap(Context->Heap, 0, Blocks[Slot]);
+        }
+
+        Sizes[Slot] = 1 + RtlRandom(&Context->Seed) % 512;
+        Blocks[Slot] = RtlAllocateHeap(Context->Heap, 0, Sizes[Slot]);
+        if (!Blocks[Slot])
+        {
+            Context->Failures++;
+            continue;
+        }
+        Blocks[Slot][0] = (UCHAR)Slot;
+        Blocks[Slot][Sizes[Slot] - 1] = (UCHAR)Slot;
+    }
+
+    for (Slot = 0; Slot < STRESS_LIVE_BLOCKS; Slot++)
+        RtlFreeHeap(Context->Heap, 0, Blocks[Slot]);
+
+    return 0;
+}
+
+static
+ULONG
+RunStress(HANDLE Heap)
+{
+    STRESS_CONTEXT Contexts[STRESS_THREADS];
+    HANDLE Threads[STRESS_THREADS];
+    DWORD StartTime;
+    ULONG i;
+
+    StartTime = GetTickCount();
+    for (i = 0; i < STRESS_THREADS; i++)
+    {
+        Contexts[i].Heap = Heap;
+        Contexts[i].Seed = 0x1234 + i;
+        Contexts[i].Failures = 0;
+        Threads[i] = CreateThread(NULL, 0, StressThread, &Contexts[i], 0, NULL);
+        ok(Threads[i] != NULL, "CreateThread failed with %lu\n", GetLastError());
+    }
+
+    WaitForMultipleObjects(STRESS_THREADS, Threads, TRUE, INFINITE);
+
+    for (i = 0; i < STRESS_THREADS; i++)
+    {
+        ok(Contexts[i].Failures == 0, "Thread %lu had %lu failures\n", i, Contexts[i].Failures);
+        CloseHandle(Threads[i]);
+    }
+
+    return GetTickCount() - StartTime;
+}
+
+static
+void
+TestLowFragHeapBlocks(HANDLE Heap)
+{
+    PUCHAR Buffer, NewBuffer;
+    PVOID Blocks[100];
+    SIZE_T Size;
+    ULONG i;
+
+    /* Size and zeroing must work for every small size class */
+    for (Size = 1; Size < 1000; Size += 7)
+    {
+        Buffer = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, Size);
+        ok(Buffer != NULL, "Allocation of %Iu bytes failed\n", Size);
+        if (!Buffer) continue;
+
+        ok_size_t(RtlSizeHeap(Heap, 0, Buffer), Size);
+        ok(Buffer[0] == 0 && Buffer[Size - 1] == 0, "Block of %Iu bytes not zeroed\n", Size);
+        ok(((ULONG_PTR)Buffer & (MEMORY_ALLOCATION_ALIGNMENT - 1)) == 0, "Unaligned block %p\n", Buffer);
+        ok(RtlValidateHeap(Heap, 0, Buffer), "Block %p doesn't validate\n", Buffer);
+
+        /* Dirty it, so that reuse of this block has to zero it again */
+        RtlFillMemory(Buffer, Size, 0x55);
+        ok(RtlFreeHeap(Heap, 0, Buffer), "Free of %p failed\n", Buffer);
+    }
+
+    /* Reallocation keeps the contents */
+    Buffer = RtlAllocateHeap(Heap, 0, 24);
+    ok(Buffer != NULL, "Allocation failed\n");
+    if (Buffer)
+    {
+        RtlFillMemory(Buffer, 24, 0x11);
+        NewBuffer = RtlReAllocateHeap(Heap, HEAP_ZERO_MEMORY, Buffer, 300);
+        ok(NewBuffer != NULL, "Reallocation failed\n");
+        if (NewBuffer)
+        {
+            ok(NewBuffer[0] == 0x11 && NewBuffer[23] == 0x11, "Contents lost\n");
+            ok(NewBuffer[24] == 0 && NewBuffer[299] == 0, "Grown part not zeroed\n");
+            ok_size_t(RtlSizeHeap(Heap, 0, NewBuffer), 300);
+
+            NewBuffer = RtlReAllocateHeap(Heap, 0, NewBuffer, 16);
+            ok(NewBuffer != NULL, "Reallocation failed\n");
+            if (NewBuffer)
+            {
+                ok(NewBuffer[0] == 0x11 && NewBuffer[15] == 0x11, "Contents lost\n");
+                ok_size_t(RtlSizeHeap(Heap, 0, NewBuffer), 16);
+                RtlFreeHeap(Heap, 0, NewBuffer);
+            }
+        }
+    }
+
+    /* Blocks of one size class are distinct */
+    for (i = 0; i < RTL_NUMBER_OF(Blocks); i++)
+        Blocks[i] = RtlAllocateHeap(Heap, 0, 32);
+    for (i = 1; i < RTL_NUMBER_OF(Blocks); i++)
+        ok(Blocks[i] != Blocks[i - 1], "Same block returned twice\n");
+    for (i = 0; i < RTL_NUMBER_OF(Blocks); i++)
+        RtlFreeHeap(Heap, 0, Blocks[i]);
+}
+
+START_TEST(RtlHeapInformation)
+{
+    HANDLE Heap;
+    NTSTATUS Status;
+    ULONG FrontEnd = 2, BackEndTime, FrontEndTime;
+
+    /* Too small buffer */
+    Status = RtlSetHeapInformation(RtlGetProcessHeap(), HeapCompatibilityInformation, &FrontEnd, sizeof(UCHAR));
+    ok_hex(Status, STATUS_BUFFER_TOO_SMALL);
+
+    /* Unserialized heaps can't have a front end */
+    Heap = RtlCreateHeap(HEAP_GROWABLE | HEAP_NO_SERIALIZE, NULL, 0, 0, NULL, NULL);
+    ok(Heap != NULL, "RtlCreateHeap failed\n");
+    if (Heap)
+    {
+        Status = EnableLfh(Heap);
+        ok(!NT_SUCCESS(Status), "Enabling LFH succeeded\n");
+        ok_dec(QueryFrontEnd(Heap), 0);
+        RtlDestroyHeap(Heap);
+    }
+
+    /* Back end only */
+    Heap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(Heap != NULL, "RtlCreateHeap failed\n");
+    if (!Heap) return;
+    ok_dec(QueryFrontEnd(Heap), 0);
+    BackEndTime = RunStress(Heap);
+    RtlDestroyHeap(Heap);
+
+    /* Back end with the low fragmentation heap in front of it */
+    Heap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(Heap != NULL, "RtlCreateHeap failed\n");
+    if (!Heap) return;
+    Status = EnableLfh(Heap);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_dec(QueryFrontEnd(Heap), 2);
+
+    /* Enabling it again is fine */
+    Status = EnableLfh(Heap);
+    ok_hex(Status, STATUS_SUCCESS);
+
+    TestLowFragHeapBlocks(Heap);
+    FrontEndTime = RunStress(Heap);
+    ok(RtlValidateHeap(Heap, 0, NULL), "Heap doesn't validate after stress\n");
+    RtlDestroyHeap(Heap);
+
+    trace("%u threads x %u iterations: back end %lu ms, LFH %lu ms\n",
+          STRESS_THREADS, STRESS_ITERATIONS, BackEndTime, FrontEndTime);
+}
@@ -0,0 +1,110 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for RtlMultipleAllocateHeap / RtlMultipleFreeHeap
+ */
+
+#include "precomp.h"
+
+#define BLOCK_COUNT     256
+#define BENCH_ROUNDS    2000
+
+static PVOID Blocks[BLOCK_COUNT];
+
+static
+void
+TestBlocks(HANDLE Heap, ULONG Flags, SIZE_T Size, ULONG Count)
+{
+    NTSTATUS Status;
+    PUCHAR Block;
+    ULONG i, j;
+
+    RtlFillMemory(Blocks, sizeof(Blocks), 0xCC);
+    Status = RtlMultipleAllocateHeap(Heap, Flags, Size, Count, Blocks);
+    ok(NT_SUCCESS(Status), "Allocation of %lu x %Iu failed with 0x%lx\n", Count, Size, Status);
+    if (!NT_SUCCESS(Status)) return;
+
+    for (i = 0; i < Count; i++)
+    {
+        Block = Blocks[i];
+        ok(Block != NULL, "Block %lu is NULL\n", i);
+        if (!Block) continue;
+
+        ok_size_t(RtlSizeHeap(Heap, 0, Block), Size);
+        ok(RtlValidateHeap(Heap, 0, Block), "Block %lu doesn't validate\n", i);
+        if (Flags & HEAP_ZERO_MEMORY)
+            ok(Block[0] == 0 && Block[Size - 1] == 0, "Block %lu not zeroed\n", i);
+
+        /* Stamp it, so that overlapping blocks show up below */
+        RtlFillMemory(Block, Size, (UCHAR)i);
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        Block = Blocks[i];
+        if (!Block) continue;
+
+        for (j = 0; j < Size; j++)
+        {
+            if (Block[j] != (UCHAR)i) break;
+        }
+        ok(j == Size, "Block %lu overwritten at offset %lu\n", i, j);
+    }
+
+    /* NULL entries are skipped */
+    Blocks[Count] = NULL;
+    Status = RtlMultipleFreeHeap(Heap, 0, Count + 1, Blocks);
+    ok(NT_SUCCESS(Status), "Free failed with 0x%lx\n", Status);
+    ok(RtlValidateHeap(Heap, 0, NULL), "Heap doesn't validate\n");
+}
+
+static
+void
+Benchmark(HANDLE Heap, SIZE_T Size)
+{
+    DWORD SingleTime, MultipleTime, StartTime;
+    NTSTATUS Status;
+    ULONG Round, i;
+
+    StartTime = GetTickCount();
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        for (i = 0; i < BLOCK_COUNT; i++)
+            Blocks[i] = RtlAllocateHeap(Heap, 0, Size);
+        for (i = 0; i < BLOCK_COUNT; i++)
+            RtlFreeHeap(Heap, 0, Blocks[i]);
+    }
+    SingleTime = GetTickCount() - StartTime;
+
+    StartTime = GetTickCount();
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        Status = RtlMultipleAllocateHeap(Heap, 0, Size, BLOCK_COUNT, Blocks);
+        if (!NT_SUCCESS(Status)) break;
+        RtlMultipleFreeHeap(Heap, 0, BLOCK_COUNT, Blocks);
+    }
+    MultipleTime = GetTickCount() - StartTime;
+
+    trace("%u x %u blocks of %Iu bytes: single %lu ms, multiple %lu ms\n",
+          BENCH_ROUNDS, BLOCK_COUNT, Size, SingleTime, MultipleTime);
+}
+
+START_TEST(RtlMultipleAllocateHeap)
+{
+    HANDLE Heap;
+
+    Heap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(Heap != NULL, "RtlCreateHeap failed\n");
+    if (!Heap) return;
+
+    TestBlocks(Heap, 0, 1, 1);
+    TestBlocks(Heap, 0, 24, BLOCK_COUNT - 1);
+    TestBlocks(Heap, HEAP_ZERO_MEMORY, 100, 64);
+    TestBlocks(Heap, 0, 3000, 100);
+    TestBlocks(Heap, HEAP_ZERO_MEMORY, 0x20000, 8);
+
+    Benchmark(Heap, 32);
+    Benchmark(Heap, 512);
+
+    RtlDestroyHeap(Heap);
+}
@@ -0,0 +1,376 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test driver for view lookups in small and big cached files
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define IOCTL_START_TEST  1
+#define IOCTL_FINISH_TEST 2
+
+#define VIEW_SIZE       (256 * 1024)
+#define MAPPED_VIEWS    64
+#define LOOKUP_ROUNDS   10000
+
+typedef struct _TEST_FCB
+{
+    FSRTL_ADVANCED_FCB_HEADER Header;
+    SECTION_OBJECT_POINTERS SectionObjectPointers;
+    FAST_MUTEX HeaderMutex;
+} TEST_FCB, *PTEST_FCB;
+
+static ULONG TestTestId = -1;
+static PFILE_OBJECT TestFileObject;
+static PDEVICE_OBJECT TestDeviceObject;
+static KMT_IRP_HANDLER TestIrpHandler;
+static KMT_MESSAGE_HANDLER TestMessageHandler;
+
+NTSTATUS
+TestEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PCUNICODE_STRING RegistryPath,
+    _Out_ PCWSTR *DeviceName,
+    _Inout_ INT *Flags)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    *DeviceName = L"CcViewLookup";
+    *Flags = TESTENTRY_NO_EXCLUSIVE_DEVICE |
+             TESTENTRY_BUFFERED_IO_DEVICE |
+             TESTENTRY_NO_READONLY_DEVICE;
+
+    KmtRegisterIrpHandler(IRP_MJ_READ, NULL, TestIrpHandler);
+    KmtRegisterMessageHandler(0, NULL, TestMessageHandler);
+
+    return Status;
+}
+
+VOID
+TestUnload(
+    _In_ PDRIVER_OBJECT DriverObject)
+{
+    PAGED_CODE();
+}
+
+BOOLEAN
+NTAPI
+AcquireForLazyWrite(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromLazyWrite(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+BOOLEAN
+NTAPI
+AcquireForReadAhead(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromReadAhead(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+static CACHE_MANAGER_CALLBACKS Callbacks = {
+    AcquireForLazyWrite,
+    ReleaseFromLazyWrite,
+    AcquireForReadAhead,
+    ReleaseFromReadAhead,
+};
+
+/* Test 0 uses a 1MB file, test 1 a 4GB one */
+static CC_FILE_SIZES FileSizes[] = {
+    {
+        RTL_CONSTANT_LARGE_INTEGER((LONGLONG)0x100000),     // .AllocationSize
+        RTL_CONSTANT_LARGE_INTEGER((LONGLONG)0x100000),     // .FileSize
+        RTL_CONSTANT_LARGE_INTEGER((LONGLONG)0x100000)      // .ValidDataLength
+    },
+    {
+        RTL_MAKE_LARGE_INTEGER(0, 1),                       // .AllocationSize
+        RTL_MAKE_LARGE_INTEGER(0, 1),                       // .FileSize
+        RTL_MAKE_LARGE_INTEGER(0, 1)                        // .ValidDataLength
+    },
+};
+
+static
+PVOID
+MapAndLockUserBuffer(
+    _In_ _Out_ PIRP Irp,
+    _In_ ULONG BufferLength)
+{
+    PMDL Mdl;
+
+    if (Irp->MdlAddress == NULL)
+    {
+        Mdl = IoAllocateMdl(Irp->UserBuffer, BufferLength, FALSE, FALSE, Irp);
+        if (Mdl == NULL)
+        {
+            return NULL;
+        }
+
+        _SEH2_TRY
+        {
+            MmProbeAndLockPages(Mdl, Irp->RequestorMode, IoWriteAccess);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            IoFreeMdl(Mdl);
+            Irp->MdlAddress = NULL;
+            _SEH2_YIELD(return NULL);
+        }
+        _SEH2_END;
+    }
+
+    return MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+}
+
+static
+BOOLEAN
+MapAndCheck(
+    _In_ LONGLONG FileOffset)
+{
+    PVOID Bcb;
+    BOOLEAN Ret;
+    PULONG Buffer;
+    LARGE_INTEGER Offset;
+
+    Ret = FALSE;
+    Offset.QuadPart = FileOffset;
+    KmtStartSeh();
+    Ret = CcMapData(TestFileObject, &Offset, PAGE_SIZE, MAP_WAIT, &Bcb, (PVOID *)&Buffer);
+    KmtEndSeh(STATUS_SUCCESS);
+
+    if (!Ret)
+    {
+        return FALSE;
+    }
+
+    /* Every page of the file contains its page number, so we'd notice a wrong view */
+    ok_eq_ulong(Buffer[0], (ULONG)(FileOffset >> PAGE_SHIFT));
+    CcUnpinData(Bcb);
+
+    return TRUE;
+}
+
+static
+VOID
+PerformTest(
+    ULONG TestId,
+    PDEVICE_OBJECT DeviceObject)
+{
+    PTEST_FCB Fcb;
+    LONGLONG Stride, LastView;
+    ULONG Views, i;
+    LARGE_INTEGER Start, Stop, Frequency;
+
+    ok_eq_pointer(TestFileObject, NULL);
+    ok_eq_pointer(TestDeviceObject, NULL);
+    ok_eq_ulong(TestTestId, -1);
+
+    if (!skip(TestId < RTL_NUMBER_OF(FileSizes), "Invalid test %lu\n", TestId))
+    {
+        TestDeviceObject = DeviceObject;
+        TestTestId = TestId;
+        TestFileObject = IoCreateStreamFileObject(NULL, DeviceObject);
+        if (!skip(TestFileObject != NULL, "Failed to allocate FO\n"))
+        {
+            Fcb = ExAllocatePool(NonPagedPool, sizeof(TEST_FCB));
+            if (!skip(Fcb != NULL, "ExAllocatePool failed\n"))
+            {
+                RtlZeroMemory(Fcb, sizeof(TEST_FCB));
+                ExInitializeFastMutex(&Fcb->HeaderMutex);
+                FsRtlSetupAdvancedHeader(&Fcb->Header, &Fcb->HeaderMutex);
+
+                TestFileObject->FsContext = Fcb;
+                TestFileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
+
+                KmtStartSeh();
+                CcInitializeCacheMap(TestFileObject, &FileSizes[TestId], FALSE, &Callbacks, NULL);
+                KmtEndSeh(STATUS_SUCCESS);
+
+                if (!skip(CcIsFileCached(TestFileObject) == TRUE, "CcInitializeCacheMap failed\n"))
+                {
+                    /* Bring views spread over the whole file into the cache */
+                    Views = (ULONG)min(FileSizes[TestId].FileSize.QuadPart / VIEW_SIZE, MAPPED_VIEWS);
+                    Stride = FileSizes[TestId].FileSize.QuadPart / Views;
+                    for (i = 0; i < Views; i++)
+                    {
+                        ok(MapAndCheck(i * Stride), "CcMapData failed at %I64x\n", i * Stride);
+                    }
+
+                    /* And look up the last one again and again */
+                    LastView = (Views - 1) * Stride;
+                    Start = KeQueryPerformanceCounter(&Frequency);
+                    for (i = 0; i < LOOKUP_ROUNDS; i++)
+                    {
+                        if (!MapAndCheck(LastView))
+                        {
+                            ok(FALSE, "CcMapData failed at %I64x\n", LastView);
+                            break;
+                        }
+                    }
+                    Stop = KeQueryPerformanceCounter(NULL);
+
+                    trace("File size %I64x, %lu views: %I64u ns per lookup\n",
+                          FileSizes[TestId].FileSize.QuadPart, Views,
+                          (Stop.QuadPart - Start.QuadPart) * 1000000000LL / Frequency.QuadPart / LOOKUP_ROUNDS);
+                }
+            }
+        }
+    }
+}
+
+
+static
+VOID
+CleanupTest(
+    ULONG TestId,
+    PDEVICE_OBJECT DeviceObject)
+{
+    LARGE_INTEGER Zero = RTL_CONSTANT_LARGE_INTEGER(0LL);
+    CACHE_UNINITIALIZE_EVENT CacheUninitEvent;
+
+    ok_eq_pointer(TestDeviceObject, DeviceObject);
+    ok_eq_ulong(TestTestId, TestId);
+
+    if (!skip(TestFileObject != NULL, "No test FO\n"))
+    {
+        if (CcIsFileCached(TestFileObject))
+        {
+            KeInitializeEvent(&CacheUninitEvent.Event, NotificationEvent, FALSE);
+            CcUninitializeCacheMap(TestFileObject, &Zero, &CacheUninitEvent);
+            KeWaitForSingleObject(&CacheUninitEvent.Event, Executive, KernelMode, FALSE, NULL);
+        }
+
+        if (TestFileObject->FsContext != NULL)
+        {
+            ExFreePool(TestFileObject->FsContext);
+            TestFileObject->FsContext = NULL;
+            TestFileObject->SectionObjectPointer = NULL;
+        }
+
+        ObDereferenceObject(TestFileObject);
+    }
+
+    TestFileObject = NULL;
+    TestDeviceObject = NULL;
+    TestTestId = -1;
+}
+
+
+static
+NTSTATUS
+TestMessageHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ ULONG ControlCode,
+    _In_opt_ PVOID Buffer,
+    _In_ SIZE_T InLength,
+    _Inout_ PSIZE_T OutLength)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    switch (ControlCode)
+    {
+        case IOCTL_START_TEST:
+            ok_eq_ulong((ULONG)InLength, sizeof(ULONG));
+            PerformTest(*(PULONG)Buffer, DeviceObject);
+            break;
+
+        case IOCTL_FINISH_TEST:
+            ok_eq_ulong((ULONG)InLength, sizeof(ULONG));
+            CleanupTest(*(PULONG)Buffer, DeviceObject);
+            break;
+
+        default:
+            Status = STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+    return Status;
+}
+
+static
+NTSTATUS
+TestIrpHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION IoStack)
+{
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    DPRINT("IRP %x/%x\n", IoStack->MajorFunction, IoStack->MinorFunction);
+    ASSERT(IoStack->MajorFunction == IRP_MJ_READ);
+
+    Status = STATUS_NOT_SUPPORTED;
+    Irp->IoStatus.Information = 0;
+
+    if (IoStack->MajorFunction == IRP_MJ_READ)
+    {
+        ULONG Length, i;
+        PUCHAR Buffer;
+        LARGE_INTEGER Offset;
+
+        Offset = IoStack->Parameters.Read.ByteOffset;
+        Length = IoStack->Parameters.Read.Length;
+
+        ok_eq_pointer(DeviceObject, TestDeviceObject);
+        ok_eq_pointer(IoStack->FileObject, TestFileObject);
+
+        ok(FlagOn(Irp->Flags, IRP_NOCACHE), "Not coming from Cc\n");
+        ok(Offset.QuadPart % PAGE_SIZE == 0, "Offset is not aligned: %I64i\n", Offset.QuadPart);
+        ok(Length % PAGE_SIZE == 0, "Length is not aligned: %lu\n", Length);
+
+        Buffer = MapAndLockUserBuffer(Irp, Length);
+        ok(Buffer != NULL, "Null pointer!\n");
+        if (Buffer != NULL)
+        {
+            /* Tag every page with its page number in the file */
+            for (i = 0; i < Length; i += PAGE_SIZE)
+            {
+                RtlFillMemoryUlong(Buffer + i, PAGE_SIZE, (ULONG)((Offset.QuadPart + i) >> PAGE_SHIFT));
+            }
+
+            Status = STATUS_SUCCESS;
+            Irp->IoStatus.Information = Length;
+        }
+    }
+
+    if (Status == STATUS_PENDING)
+    {
+        IoMarkIrpPending(Irp);
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        Status = STATUS_PENDING;
+    }
+    else
+    {
+        Irp->IoStatus.Status = Status;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
+    return Status;
+}
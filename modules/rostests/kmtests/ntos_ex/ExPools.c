@@ -11,6 +11,11 @@
 #include <debug.h>
 
 #define TAG_POOLTEST 'tstP'
+#define TAG_POOLSTRESS 'sPmK'
+
+#define STRESS_ROUNDS 20000
+#define STRESS_KEPT 16
+#define STRESS_MAX_THREADS 32
 
 #define BASE_POOL_TYPE_MASK 1
 #define QUOTA_POOL_MASK 8
@@ -264,10 +269,192 @@ TestPoolQuota(VOID)
     KmtEndSeh(STATUS_SUCCESS);
 }
 
+typedef struct _STRESS_THREAD
+{
+    HANDLE Handle;
+    KAFFINITY Affinity;
+    ULONG PagedAllocs;
+    ULONG PagedFrees;
+    ULONG NonPagedAllocs;
+    ULONG NonPagedFrees;
+} STRESS_THREAD, *PSTRESS_THREAD;
+
+static
+BOOLEAN
+GetPoolTagUsage(
+    _In_ ULONG Tag,
+    _Out_ PSYSTEM_POOLTAG Usage)
+{
+    PSYSTEM_POOLTAG_INFORMATION Information;
+    ULONG Length = 16 * PAGE_SIZE;
+    NTSTATUS Status;
+    ULONG i;
+
+    RtlZeroMemory(Usage, sizeof(*Usage));
+    Usage->TagUlong = Tag;
+
+    while (TRUE)
+    {
+        Information = ExAllocatePoolWithTag(PagedPool, Length, TAG_POOLTEST);
+        if (!Information)
+            return FALSE;
+
+        Status = ZwQuerySystemInformation(SystemPoolTagInformation,
+                                          Information,
+                                          Length,
+                                          &Length);
+        if (Status != STATUS_INFO_LENGTH_MISMATCH)
+            break;
+
+        /* Leave some room for tags showing up meanwhile */
+        ExFreePoolWithTag(Information, TAG_POOLTEST);
+        Length += PAGE_SIZE;
+    }
+
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+    {
+        for (i = 0; i < Information->Count; i++)
+        {
+            if (Information->TagInfo[i].TagUlong == Tag)
+            {
+                *Usage = Information->TagInfo[i];
+                break;
+            }
+        }
+    }
+
+    ExFreePoolWithTag(Information, TAG_POOLTEST);
+    return NT_SUCCESS(Status);
+}
+
+static
+VOID
+NTAPI
+PoolStressThread(
+    _In_ PVOID Context)
+{
+    PSTRESS_THREAD Thread = Context;
+    PVOID Kept[STRESS_KEPT] = { NULL };
+    POOL_TYPE PoolType;
+    ULONG Round, Index;
+
+    KeSetSystemAffinityThread(Thread->Affinity);
+
+    for (Round = 0; Round < STRESS_ROUNDS; Round++)
+    {
+        /* Every slot always holds the same pool type */
+        Index = Round % STRESS_KEPT;
+        PoolType = (Index & 1) ? PagedPool : NonPagedPool;
+
+        if (Kept[Index])
+        {
+            ExFreePoolWithTag(Kept[Index], TAG_POOLSTRESS);
+            if (PoolType == PagedPool)
+                Thread->PagedFrees++;
+            else
+                Thread->NonPagedFrees++;
+        }
+
+        Kept[Index] = ExAllocatePoolWithTag(PoolType, 8 + (Round % 64) * 8, TAG_POOLSTRESS);
+        if (Kept[Index])
+        {
+            if (PoolType == PagedPool)
+                Thread->PagedAllocs++;
+            else
+                Thread->NonPagedAllocs++;
+        }
+    }
+
+    for (Index = 0; Index < STRESS_KEPT; Index++)
+    {
+        if (!Kept[Index])
+            continue;
+
+        ExFreePoolWithTag(Kept[Index], TAG_POOLSTRESS);
+        if (Index & 1)
+            Thread->PagedFrees++;
+        else
+            Thread->NonPagedFrees++;
+    }
+
+    KeRevertToUserAffinityThread();
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+VOID
+TestPoolTagStress(VOID)
+{
+    STRESS_THREAD Threads[STRESS_MAX_THREADS];
+    SYSTEM_POOLTAG Before, After;
+    KAFFINITY ActiveProcessors;
+    ULONG ThreadCount, i;
+    ULONG PagedAllocs = 0, PagedFrees = 0, NonPagedAllocs = 0, NonPagedFrees = 0;
+    ULONGLONG StartTime, EndTime;
+    NTSTATUS Status;
+
+    if (skip(GetPoolTagUsage(TAG_POOLSTRESS, &Before), "No pool tag information\n"))
+        return;
+
+    /* One thread per processor, all hammering the same tag */
+    ActiveProcessors = KeQueryActiveProcessors();
+    ThreadCount = 0;
+    StartTime = KeQueryInterruptTime();
+    for (i = 0; i < sizeof(KAFFINITY) * 8 && ThreadCount < STRESS_MAX_THREADS; i++)
+    {
+        if (!(ActiveProcessors & ((KAFFINITY)1 << i)))
+            continue;
+
+        RtlZeroMemory(&Threads[ThreadCount], sizeof(Threads[ThreadCount]));
+        Threads[ThreadCount].Affinity = (KAFFINITY)1 << i;
+        Status = PsCreateSystemThread(&Threads[ThreadCount].Handle,
+                                      SYNCHRONIZE,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      PoolStressThread,
+                                      &Threads[ThreadCount]);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        if (NT_SUCCESS(Status))
+            ThreadCount++;
+    }
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+        Status = ZwWaitForSingleObject(Threads[i].Handle, FALSE, NULL);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        ZwClose(Threads[i].Handle);
+
+        PagedAllocs += Threads[i].PagedAllocs;
+        PagedFrees += Threads[i].PagedFrees;
+        NonPagedAllocs += Threads[i].NonPagedAllocs;
+        NonPagedFrees += Threads[i].NonPagedFrees;
+    }
+    EndTime = KeQueryInterruptTime();
+    trace("%lu threads did %lu allocations in %I64u ms\n",
+          ThreadCount, PagedAllocs + NonPagedAllocs, (EndTime - StartTime) / 10000);
+
+    ok_eq_ulong(PagedAllocs, PagedFrees);
+    ok_eq_ulong(NonPagedAllocs, NonPagedFrees);
+
+    /* Whichever processor did the work, the totals must add up */
+    if (!GetPoolTagUsage(TAG_POOLSTRESS, &After))
+        return;
+    ok_eq_tag(After.TagUlong, TAG_POOLSTRESS);
+    ok_eq_ulong(After.PagedAllocs - Before.PagedAllocs, PagedAllocs);
+    ok_eq_ulong(After.PagedFrees - Before.PagedFrees, PagedFrees);
+    ok_eq_size(After.PagedUsed, Before.PagedUsed);
+    ok_eq_ulong(After.NonPagedAllocs - Before.NonPagedAllocs, NonPagedAllocs);
+    ok_eq_ulong(After.NonPagedFrees - Before.NonPagedFrees, NonPagedFrees);
+    ok_eq_size(After.NonPagedUsed, Before.NonPagedUsed);
+}
+
 START_TEST(ExPools)
 {
     PoolsTest();
     PoolsCorruption();
     TestPoolTags();
     TestPoolQuota();
+    TestPoolTagStress();
 }
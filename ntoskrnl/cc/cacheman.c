@@ -18,6 +18,9 @@ BOOLEAN CcPfEnablePrefetcher;
 PFSN_PREFETCHER_GLOBALS CcPfGlobals;
 MM_SYSTEMSIZE CcCapturedSystemSize;
 
+/* Largest sequential read ahead window, in bytes */
+ULONG CcReadAheadMaximum = CC_DEFAULT_READ_AHEAD_MAXIMUM;
+
 static ULONG BugCheckFileId = 0x4 << 16;
 
 /* FUNCTIONS *****************************************************************/
@@ -82,6 +85,17 @@ CcInitializeCacheManager(VOID)
             break;
     }
 
+    /* Sanitize the read ahead ceiling we got from the registry */
+    if (CcReadAheadMaximum < VACB_MAPPING_GRANULARITY)
+    {
+        CcReadAheadMaximum = VACB_MAPPING_GRANULARITY;
+    }
+    else if (CcReadAheadMaximum > CC_MAX_READ_AHEAD_MAXIMUM)
+    {
+        CcReadAheadMaximum = CC_MAX_READ_AHEAD_MAXIMUM;
+    }
+    CcReadAheadMaximum = ROUND_DOWN(CcReadAheadMaximum, PAGE_SIZE);
+
     /* Allocate a work item for all our threads */
     for (Thread = 0; Thread < CcNumberWorkerThreads; ++Thread)
     {
@@ -151,7 +165,7 @@ CcRemapBcb (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -163,15 +177,18 @@ CcScheduleReadAhead (
 {
     KIRQL OldIrql;
     LARGE_INTEGER NewOffset;
+    LONGLONG Stride, WindowStart, WindowEnd;
+    ULONG Window;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
-    PPRIVATE_CACHE_MAP PrivateCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
     PrivateCacheMap = FileObject->PrivateCacheMap;
 
     /* If file isn't cached, or if read ahead is disabled, this is no op */
     if (SharedCacheMap == NULL || PrivateCacheMap == NULL ||
-        BooleanFlagOn(SharedCacheMap->Flags, READAHEAD_DISABLED))
+        BooleanFlagOn(SharedCacheMap->Flags, READAHEAD_DISABLED) ||
+        BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
     {
         return;
     }
@@ -183,40 +200,72 @@ CcScheduleReadAhead (
 
     /* Lock read ahead spin lock */
     KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
-    /* Easy case: the file is sequentially read */
-    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+
+    /* Distance from the previous read of this handle */
+    Stride = FileOffset->QuadPart - PrivateCacheMap->FileOffset2.QuadPart;
+
+    /* Easy case: the file is sequentially read. Either the caller told us so,
+     * or this read starts within or right after the previous one */
+    if ((BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY) && Stride >= 0) ||
+        (FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart &&
+         FileOffset->QuadPart <= PrivateCacheMap->BeyondLastByte2.QuadPart))
     {
-        /* If we went backward, this is no go! */
-        if (NewOffset.QuadPart < PrivateCacheMap->ReadAheadOffset[1].QuadPart)
+        /* Grow the window while the pattern holds, sequential only files
+         * don't need to prove it */
+        if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
         {
-            KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            return;
+            Window = CcReadAheadMaximum;
         }
-
-        /* FIXME: hackish, but will do the job for now */
-        PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-        PrivateCacheMap->ReadAheadLength[1] = Length;
-    }
-    /* Other cases: try to find some logic in that mess... */
-    else
-    {
-        /* Let's check if we always read the same way (like going down in the file)
-         * and pretend it's enough for now
-         */
-        if (PrivateCacheMap->FileOffset2.QuadPart >= PrivateCacheMap->FileOffset1.QuadPart &&
-            FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
+        else if (PrivateCacheMap->ReadAheadWindow == 0)
         {
-            /* FIXME: hackish, but will do the job for now */
-            PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-            PrivateCacheMap->ReadAheadLength[1] = Length;
+            Window = min(max(2 * Length, VACB_MAPPING_GRANULARITY), CcReadAheadMaximum);
         }
         else
         {
-            /* FIXME: handle the other cases */
+            Window = min(2 * PrivateCacheMap->ReadAheadWindow, CcReadAheadMaximum);
+        }
+        PrivateCacheMap->ReadAheadWindow = Window;
+
+        /* Don't bother if the reader is still far from the end of what
+         * was already read ahead */
+        WindowEnd = PrivateCacheMap->ReadAheadOffset[1].QuadPart + PrivateCacheMap->ReadAheadLength[1];
+        if (NewOffset.QuadPart >= PrivateCacheMap->ReadAheadOffset[1].QuadPart &&
+            NewOffset.QuadPart + Window / 2 <= WindowEnd)
+        {
             KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            UNIMPLEMENTED_ONCE;
             return;
         }
+
+        /* Start where the previous read ahead stopped, if the reader is in it */
+        WindowStart = NewOffset.QuadPart;
+        if (NewOffset.QuadPart >= PrivateCacheMap->ReadAheadOffset[1].QuadPart &&
+            NewOffset.QuadPart < WindowEnd)
+        {
+            WindowStart = WindowEnd;
+        }
+
+        PrivateCacheMap->ReadAheadOffset[0].QuadPart = 0;
+        PrivateCacheMap->ReadAheadLength[0] = 0;
+        PrivateCacheMap->ReadAheadOffset[1].QuadPart = WindowStart;
+        PrivateCacheMap->ReadAheadLength[1] = (ULONG)(NewOffset.QuadPart + Window - WindowStart);
+    }
+    /* Strided reads, forward or backward: fetch the next two reads */
+    else if (Stride != 0 &&
+             Stride == PrivateCacheMap->FileOffset2.QuadPart - PrivateCacheMap->FileOffset1.QuadPart &&
+             FileOffset->QuadPart + 2 * Stride >= 0)
+    {
+        PrivateCacheMap->ReadAheadWindow = 0;
+        PrivateCacheMap->ReadAheadOffset[0].QuadPart = FileOffset->QuadPart + Stride;
+        PrivateCacheMap->ReadAheadLength[0] = Length;
+        PrivateCacheMap->ReadAheadOffset[1].QuadPart = FileOffset->QuadPart + 2 * Stride;
+        PrivateCacheMap->ReadAheadLength[1] = Length;
+    }
+    /* No pattern (yet), start over with a small window */
+    else
+    {
+        PrivateCacheMap->ReadAheadWindow = 0;
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
     }
 
     /* If read ahead isn't active yet */
@@ -252,7 +301,7 @@ CcScheduleReadAhead (
         InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
     }
 
-    /* Done (fail) */
+    /* Done (fail, or the active read ahead will pick up the new windows) */
     KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
 }
 
@@ -361,7 +410,7 @@ CcSetReadAheadGranularity (
 	IN	ULONG		Granularity
 	)
 {
-    PPRIVATE_CACHE_MAP PrivateMap;
+    PROS_PRIVATE_CACHE_MAP PrivateMap;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p Granularity=%lu\n",
         FileObject, Granularity);
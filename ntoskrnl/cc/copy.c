@@ -50,6 +50,22 @@ ULONG CcFastReadResourceMiss;
 ULONG CcDataPages = 0;
 ULONG CcDataFlushes = 0;
 
+/* Number of views read by read ahead */
+ULONG CcReadAheadIos = 0;
+
+/* How many views read ahead reads at once */
+#define READ_AHEAD_MAX_IOS 8
+
+/* An in-flight view read */
+typedef struct _CC_VACB_READ
+{
+    PROS_VACB Vacb;
+    PMDL Mdl;
+    ULONG Size;
+    IO_STATUS_BLOCK IoStatus;
+    KEVENT Event;
+} CC_VACB_READ, *PCC_VACB_READ;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -76,28 +92,27 @@ CcInitCacheZeroPage (
     MiZeroPhysicalPage(CcZeroPage);
 }
 
+static
 NTSTATUS
-NTAPI
-CcReadVirtualAddress (
-    PROS_VACB Vacb)
+CcStartReadVirtualAddress (
+    PROS_VACB Vacb,
+    PCC_VACB_READ Read)
 {
-    ULONG Size, Pages;
-    PMDL Mdl;
+    ULONG Pages;
     NTSTATUS Status;
-    IO_STATUS_BLOCK IoStatus;
-    KEVENT Event;
 
-    Size = (ULONG)(Vacb->SharedCacheMap->SectionSize.QuadPart - Vacb->FileOffset.QuadPart);
-    if (Size > VACB_MAPPING_GRANULARITY)
+    Read->Vacb = Vacb;
+    Read->Size = (ULONG)(Vacb->SharedCacheMap->SectionSize.QuadPart - Vacb->FileOffset.QuadPart);
+    if (Read->Size > VACB_MAPPING_GRANULARITY)
     {
-        Size = VACB_MAPPING_GRANULARITY;
+        Read->Size = VACB_MAPPING_GRANULARITY;
     }
 
-    Pages = BYTES_TO_PAGES(Size);
+    Pages = BYTES_TO_PAGES(Read->Size);
     ASSERT(Pages * PAGE_SIZE <= VACB_MAPPING_GRANULARITY);
 
-    Mdl = IoAllocateMdl(Vacb->BaseAddress, Pages * PAGE_SIZE, FALSE, FALSE, NULL);
-    if (!Mdl)
+    Read->Mdl = IoAllocateMdl(Vacb->BaseAddress, Pages * PAGE_SIZE, FALSE, FALSE, NULL);
+    if (!Read->Mdl)
     {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -105,30 +120,40 @@ CcReadVirtualAddress (
     Status = STATUS_SUCCESS;
     _SEH2_TRY
     {
-        MmProbeAndLockPages(Mdl, KernelMode, IoWriteAccess);
+        MmProbeAndLockPages(Read->Mdl, KernelMode, IoWriteAccess);
     }
     _SEH2_EXCEPT (EXCEPTION_EXECUTE_HANDLER)
     {
         Status = _SEH2_GetExceptionCode();
-        DPRINT1("MmProbeAndLockPages failed with: %lx for %p (%p, %p)\n", Status, Mdl, Vacb, Vacb->BaseAddress);
+        DPRINT1("MmProbeAndLockPages failed with: %lx for %p (%p, %p)\n", Status, Read->Mdl, Vacb, Vacb->BaseAddress);
         KeBugCheck(CACHE_MANAGER);
     } _SEH2_END;
 
-    if (NT_SUCCESS(Status))
+    Read->Mdl->MdlFlags |= MDL_IO_PAGE_READ;
+    KeInitializeEvent(&Read->Event, NotificationEvent, FALSE);
+    return IoPageRead(Vacb->SharedCacheMap->FileObject, Read->Mdl, &Vacb->FileOffset, &Read->Event, &Read->IoStatus);
+}
+
+static
+NTSTATUS
+CcFinishReadVirtualAddress (
+    PCC_VACB_READ Read,
+    NTSTATUS Status)
+{
+    if (Read->Mdl == NULL)
     {
-        Mdl->MdlFlags |= MDL_IO_PAGE_READ;
-        KeInitializeEvent(&Event, NotificationEvent, FALSE);
-        Status = IoPageRead(Vacb->SharedCacheMap->FileObject, Mdl, &Vacb->FileOffset, &Event, &IoStatus);
-        if (Status == STATUS_PENDING)
-        {
-            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-            Status = IoStatus.Status;
-        }
+        return Status;
+    }
 
-        MmUnlockPages(Mdl);
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Read->Event, Executive, KernelMode, FALSE, NULL);
+        Status = Read->IoStatus.Status;
     }
 
-    IoFreeMdl(Mdl);
+    MmUnlockPages(Read->Mdl);
+    IoFreeMdl(Read->Mdl);
+    Read->Mdl = NULL;
 
     if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE))
     {
@@ -136,10 +161,10 @@ CcReadVirtualAddress (
         return Status;
     }
 
-    if (Size < VACB_MAPPING_GRANULARITY)
+    if (Read->Size < VACB_MAPPING_GRANULARITY)
     {
-        RtlZeroMemory((char*)Vacb->BaseAddress + Size,
-                      VACB_MAPPING_GRANULARITY - Size);
+        RtlZeroMemory((char*)Read->Vacb->BaseAddress + Read->Size,
+                      VACB_MAPPING_GRANULARITY - Read->Size);
     }
 
     return STATUS_SUCCESS;
@@ -147,14 +172,25 @@ CcReadVirtualAddress (
 
 NTSTATUS
 NTAPI
-CcWriteVirtualAddress (
+CcReadVirtualAddress (
     PROS_VACB Vacb)
+{
+    NTSTATUS Status;
+    CC_VACB_READ Read;
+
+    Status = CcStartReadVirtualAddress(Vacb, &Read);
+    return CcFinishReadVirtualAddress(&Read, Status);
+}
+
+static
+NTSTATUS
+CcLockVacbForWrite (
+    PROS_VACB Vacb,
+    PMDL *VacbMdl)
 {
     ULONG Size;
     PMDL Mdl;
     NTSTATUS Status;
-    IO_STATUS_BLOCK IoStatus;
-    KEVENT Event;
 
     Size = (ULONG)(Vacb->SharedCacheMap->SectionSize.QuadPart - Vacb->FileOffset.QuadPart);
     if (Size > VACB_MAPPING_GRANULARITY)
@@ -191,19 +227,34 @@ CcWriteVirtualAddress (
         KeBugCheck(CACHE_MANAGER);
     } _SEH2_END;
 
-    if (NT_SUCCESS(Status))
+    if (!NT_SUCCESS(Status))
     {
-        KeInitializeEvent(&Event, NotificationEvent, FALSE);
-        Status = IoSynchronousPageWrite(Vacb->SharedCacheMap->FileObject, Mdl, &Vacb->FileOffset, &Event, &IoStatus);
-        if (Status == STATUS_PENDING)
-        {
-            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-            Status = IoStatus.Status;
-        }
+        IoFreeMdl(Mdl);
+        return Status;
+    }
+
+    *VacbMdl = Mdl;
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+CcWriteMdl (
+    PROS_VACB Vacb,
+    PMDL Mdl)
+{
+    NTSTATUS Status;
+    IO_STATUS_BLOCK IoStatus;
+    KEVENT Event;
 
-        MmUnlockPages(Mdl);
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    Status = IoSynchronousPageWrite(Vacb->SharedCacheMap->FileObject, Mdl, &Vacb->FileOffset, &Event, &IoStatus);
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = IoStatus.Status;
     }
-    IoFreeMdl(Mdl);
+
     if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE))
     {
         DPRINT1("IoPageWrite failed, Status %x\n", Status);
@@ -213,6 +264,109 @@ CcWriteVirtualAddress (
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+NTAPI
+CcWriteVirtualAddress (
+    PROS_VACB Vacb)
+{
+    PMDL Mdl;
+    NTSTATUS Status;
+
+    Status = CcLockVacbForWrite(Vacb, &Mdl);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    Status = CcWriteMdl(Vacb, Mdl);
+
+    MmUnlockPages(Mdl);
+    IoFreeMdl(Mdl);
+
+    return Status;
+}
+
+/* Write adjacent views of a file with a single paging write.
+ * Views aren't contiguous in system space, so the pages of each view are
+ * locked on their own, and the write goes through an MDL describing all
+ * of them, which the file system maps if it needs to. */
+NTSTATUS
+NTAPI
+CcWriteVirtualAddressRun (
+    PROS_VACB *Vacbs,
+    ULONG Count)
+{
+    ULONG i, Pages;
+    PMDL Mdl;
+    PMDL VacbMdls[CC_MAX_WRITE_BEHIND_VACBS];
+    NTSTATUS Status;
+
+    ASSERT(Count != 0 && Count <= CC_MAX_WRITE_BEHIND_VACBS);
+
+    if (Count == 1)
+    {
+        return CcWriteVirtualAddress(Vacbs[0]);
+    }
+
+    /* Lock all the views */
+    Status = STATUS_SUCCESS;
+    for (i = 0; i < Count; i++)
+    {
+        ASSERT(Vacbs[i]->SharedCacheMap == Vacbs[0]->SharedCacheMap);
+        ASSERT(Vacbs[i]->FileOffset.QuadPart == Vacbs[0]->FileOffset.QuadPart + i * VACB_MAPPING_GRANULARITY);
+
+        Status = CcLockVacbForWrite(Vacbs[i], &VacbMdls[i]);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        /* Only the last view may be partial, the run is contiguous on disk */
+        ASSERT(i == Count - 1 || MmGetMdlByteCount(VacbMdls[i]) == VACB_MAPPING_GRANULARITY);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Mdl = IoAllocateMdl(Vacbs[0]->BaseAddress,
+                            (Count - 1) * VACB_MAPPING_GRANULARITY + MmGetMdlByteCount(VacbMdls[Count - 1]),
+                            FALSE, FALSE, NULL);
+        if (Mdl)
+        {
+            /* Describe the pages of all the views */
+            for (i = 0, Pages = 0; i < Count; i++)
+            {
+                RtlCopyMemory(MmGetMdlPfnArray(Mdl) + Pages,
+                              MmGetMdlPfnArray(VacbMdls[i]),
+                              ADDRESS_AND_SIZE_TO_SPAN_PAGES(0, MmGetMdlByteCount(VacbMdls[i])) * sizeof(PFN_NUMBER));
+                Pages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            }
+            Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+            Status = CcWriteMdl(Vacbs[0], Mdl);
+
+            /* The pages belong to the views MDLs, only drop the mapping */
+            if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+            {
+                MmUnmapLockedPages(Mdl->MappedSystemVa, Mdl);
+            }
+            Mdl->MdlFlags &= ~MDL_PAGES_LOCKED;
+            IoFreeMdl(Mdl);
+        }
+        else
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    while (i-- > 0)
+    {
+        MmUnlockPages(VacbMdls[i]);
+        IoFreeMdl(VacbMdls[i]);
+    }
+
+    return Status;
+}
+
 NTSTATUS
 ReadWriteOrZero(
     _Inout_ PVOID BaseAddress,
@@ -245,6 +399,25 @@ ReadWriteOrZero(
     return Status;
 }
 
+static
+VOID
+CcUpdateReadAheadCounters (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PROS_VACB Vacb,
+    BOOLEAN Valid)
+{
+    /* The counters are statistics only, so they don't need locking */
+    if (!Valid)
+    {
+        SharedCacheMap->ReadAheadMisses++;
+    }
+    else if (Vacb->ReadAhead)
+    {
+        Vacb->ReadAhead = FALSE;
+        SharedCacheMap->ReadAheadHits++;
+    }
+}
+
 BOOLEAN
 CcCopyData (
     _In_ PFILE_OBJECT FileObject,
@@ -258,14 +431,13 @@ CcCopyData (
     NTSTATUS Status;
     LONGLONG CurrentOffset;
     ULONG BytesCopied;
-    KIRQL OldIrql;
+    LONGLONG ViewOffset;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
-    PLIST_ENTRY ListEntry;
     PROS_VACB Vacb;
     ULONG PartialLength;
     PVOID BaseAddress;
     BOOLEAN Valid;
-    PPRIVATE_CACHE_MAP PrivateCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
     PrivateCacheMap = FileObject->PrivateCacheMap;
@@ -275,29 +447,24 @@ CcCopyData (
     if (!Wait)
     {
         /* test if the requested data is available */
-        KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
         /* FIXME: this loop doesn't take into account areas that don't have
-         * a VACB in the list yet */
-        ListEntry = SharedCacheMap->CacheMapVacbListHead.Flink;
-        while (ListEntry != &SharedCacheMap->CacheMapVacbListHead)
+         * a VACB yet */
+        for (ViewOffset = ROUND_DOWN(CurrentOffset, VACB_MAPPING_GRANULARITY);
+             ViewOffset < CurrentOffset + Length;
+             ViewOffset += VACB_MAPPING_GRANULARITY)
         {
-            Vacb = CONTAINING_RECORD(ListEntry,
-                                     ROS_VACB,
-                                     CacheMapVacbListEntry);
-            ListEntry = ListEntry->Flink;
-            if (!Vacb->Valid &&
-                DoRangesIntersect(Vacb->FileOffset.QuadPart,
-                                  VACB_MAPPING_GRANULARITY,
-                                  CurrentOffset, Length))
+            Vacb = CcRosLookupVacb(SharedCacheMap, ViewOffset);
+            if (Vacb == NULL)
+                continue;
+
+            Valid = Vacb->Valid;
+            CcRosVacbDecRefCount(Vacb);
+            if (!Valid)
             {
-                KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
                 /* data not available */
                 return FALSE;
             }
-            if (Vacb->FileOffset.QuadPart >= CurrentOffset + Length)
-                break;
         }
-        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
     }
 
     PartialLength = CurrentOffset % VACB_MAPPING_GRANULARITY;
@@ -312,6 +479,8 @@ CcCopyData (
                                   &Vacb);
         if (!NT_SUCCESS(Status))
             ExRaiseStatus(Status);
+        if (Operation == CcOperationRead)
+            CcUpdateReadAheadCounters(SharedCacheMap, Vacb, Valid);
         if (!Valid)
         {
             Status = CcReadVirtualAddress(Vacb);
@@ -350,6 +519,8 @@ CcCopyData (
                                   &Vacb);
         if (!NT_SUCCESS(Status))
             ExRaiseStatus(Status);
+        if (Operation == CcOperationRead)
+            CcUpdateReadAheadCounters(SharedCacheMap, Vacb, Valid);
         if (!Valid &&
             (Operation == CcOperationRead ||
              PartialLength < VACB_MAPPING_GRANULARITY))
@@ -379,11 +550,10 @@ CcCopyData (
     /* If that was a successful sync read operation, let's handle read ahead */
     if (Operation == CcOperationRead && Length == 0 && Wait)
     {
-        /* If file isn't random access and next read may get us cross VACB boundary,
-         * schedule next read
+        /* If file isn't random access, let read ahead look at this read.
+         * It will decide whether it follows a pattern worth reading ahead
          */
-        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS) &&
-            (CurrentOffset - 1) / VACB_MAPPING_GRANULARITY != (CurrentOffset + BytesCopied - 1) / VACB_MAPPING_GRANULARITY)
+        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
         {
             CcScheduleReadAhead(FileObject, (PLARGE_INTEGER)&FileOffset, BytesCopied);
         }
@@ -400,6 +570,42 @@ CcCopyData (
     return TRUE;
 }
 
+/* Is a write to that volume already waiting for the lazy writer? */
+static
+BOOLEAN
+CcHasDeferredWrites(
+    IN PDEVICE_OBJECT DeviceObject)
+{
+    KIRQL OldIrql;
+    BOOLEAN Found;
+    PLIST_ENTRY ListEntry;
+    PDEFERRED_WRITE DeferredWrite;
+
+    if (IsListEmpty(&CcDeferredWrites))
+    {
+        return FALSE;
+    }
+
+    Found = FALSE;
+    KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+    for (ListEntry = CcDeferredWrites.Flink;
+         ListEntry != &CcDeferredWrites;
+         ListEntry = ListEntry->Flink)
+    {
+        DeferredWrite = CONTAINING_RECORD(ListEntry, DEFERRED_WRITE, DeferredWriteLinks);
+        if (IoGetRelatedDeviceObject(DeferredWrite->FileObject) == DeviceObject)
+        {
+            Found = TRUE;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+    return Found;
+}
+
+#define CC_MAX_BLOCKED_VOLUMES 8
+
 VOID
 CcPostDeferredWrites(VOID)
 {
@@ -412,8 +618,12 @@ CcPostDeferredWrites(VOID)
         KIRQL OldIrql;
         PLIST_ENTRY ListEntry;
         PDEFERRED_WRITE DeferredWrite;
+        PDEVICE_OBJECT DeviceObject;
+        PDEVICE_OBJECT BlockedVolumes[CC_MAX_BLOCKED_VOLUMES];
+        ULONG BlockedCount, i;
 
         DeferredWrite = NULL;
+        BlockedCount = 0;
 
         /* Lock our deferred writes list */
         KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
@@ -424,6 +634,24 @@ CcPostDeferredWrites(VOID)
             /* Extract an entry */
             DeferredWrite = CONTAINING_RECORD(ListEntry, DEFERRED_WRITE, DeferredWriteLinks);
 
+            /* Writes to a volume are served in order: skip the ones queued
+             * behind a write which has to wait, but don't let it block the
+             * writes to the other volumes
+             */
+            DeviceObject = IoGetRelatedDeviceObject(DeferredWrite->FileObject);
+            for (i = 0; i < BlockedCount; i++)
+            {
+                if (BlockedVolumes[i] == DeviceObject)
+                {
+                    break;
+                }
+            }
+            if (i < BlockedCount)
+            {
+                DeferredWrite = NULL;
+                continue;
+            }
+
             /* Compute the modified bytes, based on what we already wrote */
             WrittenBytes += DeferredWrite->BytesToWrite;
             /* We overflowed, give up */
@@ -441,15 +669,22 @@ CcPostDeferredWrites(VOID)
                 break;
             }
 
-            /* If we don't accept modified pages, stop here */
+            /* Reset count as nothing was written yet */
+            WrittenBytes -= DeferredWrite->BytesToWrite;
+
+            /* If we don't accept modified pages, nothing else goes to this volume */
             if (!DeferredWrite->LimitModifiedPages)
             {
-                DeferredWrite = NULL;
-                break;
+                /* Too many stuck volumes, stop here */
+                if (BlockedCount == CC_MAX_BLOCKED_VOLUMES)
+                {
+                    DeferredWrite = NULL;
+                    break;
+                }
+
+                BlockedVolumes[BlockedCount++] = DeviceObject;
             }
 
-            /* Reset count as nothing was written yet */
-            WrittenBytes -= DeferredWrite->BytesToWrite;
             DeferredWrite = NULL;
         }
         KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
@@ -474,21 +709,97 @@ CcPostDeferredWrites(VOID)
     }
 }
 
+static
 VOID
-CcPerformReadAhead(
-    IN PFILE_OBJECT FileObject)
+CcReadAheadWindow(
+    IN PROS_SHARED_CACHE_MAP SharedCacheMap,
+    IN LONGLONG CurrentOffset,
+    IN ULONG Length)
 {
     NTSTATUS Status;
-    LONGLONG CurrentOffset;
-    KIRQL OldIrql;
-    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    NTSTATUS ReadStatus[READ_AHEAD_MAX_IOS];
+    CC_VACB_READ Reads[READ_AHEAD_MAX_IOS];
+    LONGLONG ViewOffset, EndOffset;
     PROS_VACB Vacb;
-    ULONG PartialLength;
     PVOID BaseAddress;
     BOOLEAN Valid;
-    ULONG Length;
-    PPRIVATE_CACHE_MAP PrivateCacheMap;
+    ULONG Count, i;
+
+    /* Don't read past the end of the file */
+    if (CurrentOffset >= SharedCacheMap->FileSize.QuadPart)
+    {
+        return;
+    }
+    EndOffset = min(CurrentOffset + Length, SharedCacheMap->FileSize.QuadPart);
+
+    /* Next of the algorithm will look like CcCopyData with the slight
+     * difference that we don't copy data back to an user-backed buffer
+     * We just bring data into Cc
+     */
+    ViewOffset = ROUND_DOWN(CurrentOffset, VACB_MAPPING_GRANULARITY);
+    while (ViewOffset < EndOffset)
+    {
+        /* Start the reads of several views, so that they are all in flight
+         * at the same time */
+        for (Count = 0;
+             Count < READ_AHEAD_MAX_IOS && ViewOffset < EndOffset;
+             ViewOffset += VACB_MAPPING_GRANULARITY)
+        {
+            Status = CcRosRequestVacb(SharedCacheMap,
+                                      ViewOffset,
+                                      &BaseAddress,
+                                      &Valid,
+                                      &Vacb);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Failed to request VACB: %lx!\n", Status);
+                EndOffset = ViewOffset;
+                break;
+            }
+
+            /* Already there, nothing to do */
+            if (Valid)
+            {
+                CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+                continue;
+            }
+
+            ReadStatus[Count] = CcStartReadVirtualAddress(Vacb, &Reads[Count]);
+            Count++;
+        }
+
+        /* And wait for them to complete */
+        for (i = 0; i < Count; i++)
+        {
+            Vacb = Reads[i].Vacb;
+            Status = CcFinishReadVirtualAddress(&Reads[i], ReadStatus[i]);
+            if (!NT_SUCCESS(Status))
+            {
+                CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
+                DPRINT1("Failed to read data: %lx!\n", Status);
+                EndOffset = ViewOffset;
+                continue;
+            }
+
+            Vacb->ReadAhead = TRUE;
+            CcReadAheadIos++;
+            CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+        }
+    }
+}
+
+VOID
+CcPerformReadAhead(
+    IN PFILE_OBJECT FileObject)
+{
+    KIRQL OldIrql;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
+    LARGE_INTEGER ReadAheadOffset[2];
+    ULONG ReadAheadLength[2];
     BOOLEAN Locked;
+    BOOLEAN Again;
+    ULONG i;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
 
@@ -507,12 +818,12 @@ CcPerformReadAhead(
         ObDereferenceObject(FileObject);
         return;
     }
-    /* Otherwise, extract read offset and length and release private map */
+    /* Otherwise, extract read windows and release private map */
     else
     {
         KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        CurrentOffset = PrivateCacheMap->ReadAheadOffset[1].QuadPart;
-        Length = PrivateCacheMap->ReadAheadLength[1];
+        RtlCopyMemory(ReadAheadOffset, PrivateCacheMap->ReadAheadOffset, sizeof(ReadAheadOffset));
+        RtlCopyMemory(ReadAheadLength, PrivateCacheMap->ReadAheadLength, sizeof(ReadAheadLength));
         KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
@@ -520,106 +831,48 @@ CcPerformReadAhead(
     /* Time to go! */
     DPRINT("Doing ReadAhead for %p\n", FileObject);
     /* Lock the file, first */
-    if (!SharedCacheMap->Callbacks->AcquireForReadAhead(SharedCacheMap->LazyWriteContext, FALSE))
-    {
-        Locked = FALSE;
-        goto Clear;
-    }
-
-    /* Remember it's locked */
-    Locked = TRUE;
-
-    /* Don't read past the end of the file */
-    if (CurrentOffset >= SharedCacheMap->FileSize.QuadPart)
-    {
-        goto Clear;
-    }
-    if (CurrentOffset + Length > SharedCacheMap->FileSize.QuadPart)
-    {
-        Length = SharedCacheMap->FileSize.QuadPart - CurrentOffset;
-    }
+    Locked = SharedCacheMap->Callbacks->AcquireForReadAhead(SharedCacheMap->LazyWriteContext, FALSE);
 
-    /* Next of the algorithm will lock like CcCopyData with the slight
-     * difference that we don't copy data back to an user-backed buffer
-     * We just bring data into Cc
-     */
-    PartialLength = CurrentOffset % VACB_MAPPING_GRANULARITY;
-    if (PartialLength != 0)
+    do
     {
-        PartialLength = min(Length, VACB_MAPPING_GRANULARITY - PartialLength);
-        Status = CcRosRequestVacb(SharedCacheMap,
-                                  ROUND_DOWN(CurrentOffset,
-                                             VACB_MAPPING_GRANULARITY),
-                                  &BaseAddress,
-                                  &Valid,
-                                  &Vacb);
-        if (!NT_SUCCESS(Status))
+        if (Locked)
         {
-            DPRINT1("Failed to request VACB: %lx!\n", Status);
-            goto Clear;
-        }
-
-        if (!Valid)
-        {
-            Status = CcReadVirtualAddress(Vacb);
-            if (!NT_SUCCESS(Status))
+            for (i = 0; i < RTL_NUMBER_OF(ReadAheadOffset); i++)
             {
-                CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
-                DPRINT1("Failed to read data: %lx!\n", Status);
-                goto Clear;
+                if (ReadAheadLength[i] != 0)
+                {
+                    CcReadAheadWindow(SharedCacheMap, ReadAheadOffset[i].QuadPart, ReadAheadLength[i]);
+                }
             }
         }
 
-        CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
-
-        Length -= PartialLength;
-        CurrentOffset += PartialLength;
-    }
-
-    while (Length > 0)
-    {
-        ASSERT(CurrentOffset % VACB_MAPPING_GRANULARITY == 0);
-        PartialLength = min(VACB_MAPPING_GRANULARITY, Length);
-        Status = CcRosRequestVacb(SharedCacheMap,
-                                  CurrentOffset,
-                                  &BaseAddress,
-                                  &Valid,
-                                  &Vacb);
-        if (!NT_SUCCESS(Status))
+        /* See previous comment about private cache map */
+        Again = FALSE;
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+        PrivateCacheMap = FileObject->PrivateCacheMap;
+        if (PrivateCacheMap != NULL)
         {
-            DPRINT1("Failed to request VACB: %lx!\n", Status);
-            goto Clear;
-        }
+            KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
 
-        if (!Valid)
-        {
-            Status = CcReadVirtualAddress(Vacb);
-            if (!NT_SUCCESS(Status))
+            /* If the reader moved the windows while we were reading, go on
+             * with the new ones. Otherwise, mark read ahead as unactive */
+            if (Locked &&
+                (RtlCompareMemory(ReadAheadOffset, PrivateCacheMap->ReadAheadOffset, sizeof(ReadAheadOffset)) != sizeof(ReadAheadOffset) ||
+                 RtlCompareMemory(ReadAheadLength, PrivateCacheMap->ReadAheadLength, sizeof(ReadAheadLength)) != sizeof(ReadAheadLength)))
             {
-                CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
-                DPRINT1("Failed to read data: %lx!\n", Status);
-                goto Clear;
+                RtlCopyMemory(ReadAheadOffset, PrivateCacheMap->ReadAheadOffset, sizeof(ReadAheadOffset));
+                RtlCopyMemory(ReadAheadLength, PrivateCacheMap->ReadAheadLength, sizeof(ReadAheadLength));
+                Again = TRUE;
+            }
+            else
+            {
+                InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
             }
-        }
-
-        CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
-
-        Length -= PartialLength;
-        CurrentOffset += PartialLength;
-    }
 
-Clear:
-    /* See previous comment about private cache map */
-    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    PrivateCacheMap = FileObject->PrivateCacheMap;
-    if (PrivateCacheMap != NULL)
-    {
-        /* Mark read ahead as unactive */
-        KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
-        KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-    }
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+            KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
+        }
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    } while (Again);
 
     /* If file was locked, release it */
     if (Locked)
@@ -652,6 +905,8 @@ CcCanIWrite (
     PFSRTL_COMMON_FCB_HEADER Fcb;
     CC_CAN_WRITE_RETRY TryContext;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_VOLUME_CACHE Volume;
+    PDEVICE_OBJECT DeviceObject;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p BytesToWrite=%lu Wait=%d Retrying=%d\n",
         FileObject, BytesToWrite, Wait, Retrying);
@@ -716,17 +971,32 @@ CcCanIWrite (
         }
     }
 
+    /* Get the volume of the file, if it's cached. Its dirty pages are
+     * accounted separately, so that a slow device doesn't get all the
+     * dirty pages for itself and throttles writers to the other ones
+     */
+    Volume = NULL;
+    if (FileObject->SectionObjectPointer != NULL &&
+        FileObject->SectionObjectPointer->SharedCacheMap != NULL)
+    {
+        SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+        Volume = SharedCacheMap->Volume;
+    }
+    DeviceObject = IoGetRelatedDeviceObject(FileObject);
+
     /* So, now allow write if:
-     * - Not the first try or we have no throttling yet
+     * - Not the first try or we have no throttling yet on this volume
      * AND:
      * - We don't exceed threshold!
+     * - We don't exceed what the volume can write in a reasonable time
      * - We don't exceed what Mm can allow us to use
      *   + If we're above top, that's fine
      *   + If we're above bottom with limited modified pages, that's fine
      *   + Otherwise, throttle!
      */
-    if ((TryContext != FirstTry || IsListEmpty(&CcDeferredWrites)) &&
+    if ((TryContext != FirstTry || !CcHasDeferredWrites(DeviceObject)) &&
         CcTotalDirtyPages + Pages < CcDirtyPageThreshold &&
+        (Volume == NULL || Volume->DirtyPages + Pages < Volume->DirtyPageThreshold) &&
         (MmAvailablePages > MmThrottleTop ||
          (MmModifiedPageListHead.Total < 1000 && MmAvailablePages > MmThrottleBottom)) &&
         !PerFileDefer)
@@ -742,8 +1012,8 @@ CcCanIWrite (
         return FALSE;
     }
 
-    /* Otherwise, if there are no deferred writes yet, start the lazy writer */
-    if (IsListEmpty(&CcDeferredWrites))
+    /* Otherwise, if there are no deferred writes yet for this volume, start the lazy writer */
+    if (!CcHasDeferredWrites(DeviceObject))
     {
         KIRQL OldIrql;
 
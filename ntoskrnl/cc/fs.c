@@ -115,6 +115,8 @@ CcIsThereDirtyData (
 {
     PROS_VACB Vacb;
     PLIST_ENTRY Entry;
+    PLIST_ENTRY VolumeEntry;
+    PROS_VOLUME_CACHE Volume;
     /* Assume no dirty data */
     BOOLEAN Dirty = FALSE;
 
@@ -122,29 +124,41 @@ CcIsThereDirtyData (
 
     KeAcquireGuardedMutex(&ViewLock);
 
-    /* Browse dirty VACBs */
-    for (Entry = DirtyVacbListHead.Flink; Entry != &DirtyVacbListHead; Entry = Entry->Flink)
+    /* Browse volumes which have dirty VACBs */
+    for (VolumeEntry = CcVolumeCacheListHead.Flink;
+         VolumeEntry != &CcVolumeCacheListHead && !Dirty;
+         VolumeEntry = VolumeEntry->Flink)
     {
-        Vacb = CONTAINING_RECORD(Entry, ROS_VACB, DirtyVacbListEntry);
-        /* Look for these associated with our volume */
-        if (Vacb->SharedCacheMap->FileObject->Vpb != Vpb)
+        Volume = CONTAINING_RECORD(VolumeEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+        if (Volume->DirtyPages == 0)
         {
             continue;
         }
 
-        /* From now on, we are associated with our VPB */
-
-        /* Temporary files are not counted as dirty */
-        if (BooleanFlagOn(Vacb->SharedCacheMap->FileObject->Flags, FO_TEMPORARY_FILE))
+        /* Browse dirty VACBs */
+        for (Entry = Volume->DirtyVacbListHead.Flink; Entry != &Volume->DirtyVacbListHead; Entry = Entry->Flink)
         {
-            continue;
-        }
-
-        /* A single dirty VACB is enough to have dirty data */
-        if (Vacb->Dirty)
-        {
-            Dirty = TRUE;
-            break;
+            Vacb = CONTAINING_RECORD(Entry, ROS_VACB, DirtyVacbListEntry);
+            /* Look for these associated with our volume */
+            if (Vacb->SharedCacheMap->FileObject->Vpb != Vpb)
+            {
+                continue;
+            }
+
+            /* From now on, we are associated with our VPB */
+
+            /* Temporary files are not counted as dirty */
+            if (BooleanFlagOn(Vacb->SharedCacheMap->FileObject->Flags, FO_TEMPORARY_FILE))
+            {
+                continue;
+            }
+
+            /* A single dirty VACB is enough to have dirty data */
+            if (Vacb->Dirty)
+            {
+                Dirty = TRUE;
+                break;
+            }
         }
     }
 
@@ -243,7 +257,7 @@ CcPurgeCacheSection (
         {
             CcRosUnmarkDirtyVacb(Vacb, FALSE);
         }
-        RemoveEntryList(&Vacb->CacheMapVacbListEntry);
+        CcRosUnlinkVacb(Vacb);
         InsertHeadList(&FreeList, &Vacb->CacheMapVacbListEntry);
     }
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
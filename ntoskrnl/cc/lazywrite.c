@@ -13,9 +13,11 @@
 #define NDEBUG
 #include <debug.h>
 
+extern KGUARDED_MUTEX ViewLock;
+
 /* Counters:
  * - Amount of pages flushed by lazy writer
- * - Number of times lazy writer ran
+ * - Number of write behind runs of lazy writer
  */
 ULONG CcLazyWritePages = 0;
 ULONG CcLazyWriteIos = 0;
@@ -113,15 +115,49 @@ CcScanDpc(
     CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
 }
 
+VOID
+CcWriteBehind(
+    IN PROS_VOLUME_CACHE Volume,
+    IN ULONG Target)
+{
+    ULONG Count;
+
+    KeEnterCriticalRegion();
+    KeAcquireGuardedMutex(&ViewLock);
+
+    /* Flush! */
+    DPRINT("Write behind starting for %p (%lu)\n", Volume->DeviceObject, Target);
+    CcRosFlushVolume(Volume, Target, &Count, FALSE, TRUE);
+    DPRINT("Write behind done for %p (%lu)\n", Volume->DeviceObject, Count);
+
+    /* The volume can get another worker now */
+    Volume->WriteBehindActive = FALSE;
+    CcRosDereferenceVolumeCache(Volume);
+
+    KeReleaseGuardedMutex(&ViewLock);
+    KeLeaveCriticalRegion();
+
+    /* And update stats, other workers may be doing the same */
+    InterlockedExchangeAdd((PLONG)&CcLazyWritePages, Count);
+    InterlockedIncrement((PLONG)&CcLazyWriteIos);
+
+    /* Writers waiting for that volume may be allowed to go on */
+    if (!IsListEmpty(&CcDeferredWrites))
+    {
+        CcPostDeferredWrites();
+    }
+}
+
 VOID
 CcLazyWriteScan(VOID)
 {
     ULONG Target;
-    ULONG Count;
     KIRQL OldIrql;
     PLIST_ENTRY ListEntry;
     LIST_ENTRY ToPost;
+    LIST_ENTRY ToWrite;
     PWORK_QUEUE_ENTRY WorkItem;
+    PROS_VOLUME_CACHE Volume;
 
     /* Do we have entries to queue after we're done? */
     InitializeListHead(&ToPost);
@@ -138,21 +174,67 @@ CcLazyWriteScan(VOID)
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
-    /* Our target is one-eighth of the dirty pages */
-    Target = CcTotalDirtyPages / 8;
-    if (Target != 0)
+    /* Give each volume with dirty pages its own write behind worker,
+     * so that a slow device doesn't hold back the writes to the others
+     */
+    InitializeListHead(&ToWrite);
+    KeEnterCriticalRegion();
+    KeAcquireGuardedMutex(&ViewLock);
+    for (ListEntry = CcVolumeCacheListHead.Flink;
+         ListEntry != &CcVolumeCacheListHead;
+         ListEntry = ListEntry->Flink)
     {
-        /* Flush! */
-        DPRINT("Lazy writer starting (%d)\n", Target);
-        CcRosFlushDirtyPages(Target, &Count, FALSE, TRUE);
-
-        /* And update stats */
-        CcLazyWritePages += Count;
-        ++CcLazyWriteIos;
-        DPRINT("Lazy writer done (%d)\n", Count);
+        Volume = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+
+        /* Still busy with the previous round? Let it be */
+        if (Volume->WriteBehindActive)
+        {
+            continue;
+        }
+
+        /* Our target is one-eighth of the dirty pages,
+         * and everything above what the volume may hold
+         */
+        Target = Volume->DirtyPages / 8;
+        if (Volume->DirtyPages > Volume->DirtyPageThreshold)
+        {
+            Target += Volume->DirtyPages - Volume->DirtyPageThreshold;
+        }
+
+        if (Target == 0)
+        {
+            continue;
+        }
+
+        WorkItem = ExAllocateFromNPagedLookasideList(&CcTwilightLookasideList);
+        if (WorkItem == NULL)
+        {
+            break;
+        }
+
+        WorkItem->Function = WriteBehind;
+        WorkItem->Parameters.Flush.Volume = Volume;
+        WorkItem->Parameters.Flush.Target = Target;
+
+        /* The worker keeps the volume alive */
+        Volume->ReferenceCount++;
+        Volume->WriteBehindActive = TRUE;
+        InsertTailList(&ToWrite, &WorkItem->WorkQueueLinks);
     }
+    KeReleaseGuardedMutex(&ViewLock);
+    KeLeaveCriticalRegion();
 
-    /* Post items that were due for end of run */
+    /* Start the writers */
+    while (!IsListEmpty(&ToWrite))
+    {
+        ListEntry = RemoveHeadList(&ToWrite);
+        WorkItem = CONTAINING_RECORD(ListEntry, WORK_QUEUE_ENTRY, WorkQueueLinks);
+        CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
+    }
+
+    /* Post items that were due for end of run. They come after
+     * the writers, so they'll be handled once these are done
+     */
     while (!IsListEmpty(&ToPost))
     {
         ListEntry = RemoveHeadList(&ToPost);
@@ -169,6 +251,13 @@ CcLazyWriteScan(VOID)
          */
         CcScheduleLazyWriteScan(FALSE);
     }
+    /* Still dirty pages around, come back in a second */
+    else if (CcTotalDirtyPages != 0)
+    {
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+        CcScheduleLazyWriteScan(FALSE);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    }
     else
     {
         /* We're no longer active */
@@ -285,6 +374,11 @@ CcWorkerThread(
                 CcPerformReadAhead(WorkItem->Parameters.Read.FileObject);
                 break;
 
+            case WriteBehind:
+                CcWriteBehind(WorkItem->Parameters.Flush.Volume,
+                              WorkItem->Parameters.Flush.Target);
+                break;
+
             case LazyWrite:
                 CcLazyWriteScan();
                 break;
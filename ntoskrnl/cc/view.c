@@ -42,7 +42,7 @@
 
 /* GLOBALS *******************************************************************/
 
-LIST_ENTRY DirtyVacbListHead;
+LIST_ENTRY CcVolumeCacheListHead;
 static LIST_ENTRY VacbLruListHead;
 
 KGUARDED_MUTEX ViewLock;
@@ -51,6 +51,9 @@ NPAGED_LOOKASIDE_LIST iBcbLookasideList;
 static NPAGED_LOOKASIDE_LIST SharedCacheMapLookasideList;
 static NPAGED_LOOKASIDE_LIST VacbLookasideList;
 
+/* Number of coalesced writes issued by write behind */
+ULONG CcWriteBehindRuns = 0;
+
 /* Internal vars (MS):
  * - Threshold above which lazy writer will start action
  * - Amount of dirty pages
@@ -179,51 +182,246 @@ CcRosFlushVacb (
     return Status;
 }
 
+static
+PROS_VOLUME_CACHE
+CcRosReferenceVolumeCache (
+    PDEVICE_OBJECT DeviceObject)
+/*
+ * FUNCTION: Gets the write behind state of a volume, creating it if needed
+ * NOTE: ViewLock must be held
+ */
+{
+    PLIST_ENTRY ListEntry;
+    PROS_VOLUME_CACHE Volume;
+
+    for (ListEntry = CcVolumeCacheListHead.Flink;
+         ListEntry != &CcVolumeCacheListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Volume = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+        if (Volume->DeviceObject == DeviceObject)
+        {
+            Volume->ReferenceCount++;
+            return Volume;
+        }
+    }
+
+    Volume = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROS_VOLUME_CACHE), TAG_VOLUME_CACHE);
+    if (Volume == NULL)
+    {
+        return NULL;
+    }
+
+    RtlZeroMemory(Volume, sizeof(*Volume));
+    Volume->DeviceObject = DeviceObject;
+    Volume->ReferenceCount = 1;
+    InitializeListHead(&Volume->DirtyVacbListHead);
+    /* Until we know how fast the device is, let it use half of the dirty pages */
+    Volume->DirtyPageThreshold = CcDirtyPageThreshold / 2;
+    InsertTailList(&CcVolumeCacheListHead, &Volume->VolumeCacheLinks);
+
+    return Volume;
+}
+
+VOID
+NTAPI
+CcRosDereferenceVolumeCache (
+    PROS_VOLUME_CACHE Volume)
+/*
+ * NOTE: ViewLock must be held
+ */
+{
+    ASSERT(Volume->ReferenceCount != 0);
+
+    if (--Volume->ReferenceCount == 0)
+    {
+        ASSERT(IsListEmpty(&Volume->DirtyVacbListHead));
+        ASSERT(Volume->DirtyPages == 0);
+        ASSERT(!Volume->WriteBehindActive);
+
+        RemoveEntryList(&Volume->VolumeCacheLinks);
+        ExFreePoolWithTag(Volume, TAG_VOLUME_CACHE);
+    }
+}
+
+static
+VOID
+CcRosUpdateWriteRate (
+    PROS_VOLUME_CACHE Volume,
+    ULONG Pages,
+    ULONGLONG Elapsed)
+/*
+ * FUNCTION: Accounts a write to the volume, and adjusts how many dirty
+ * pages it may hold once we timed enough of them
+ * NOTE: ViewLock must be held
+ */
+{
+    ULONGLONG Rate;
+    ULONG Threshold;
+
+    Volume->SamplePages += Pages;
+    Volume->SampleTime += Elapsed;
+
+    /* Clock resolution is coarse, wait for a full second worth of writes */
+    if (Volume->SampleTime < 10 * 1000 * 1000)
+    {
+        return;
+    }
+
+    Rate = (ULONGLONG)Volume->SamplePages * 10 * 1000 * 1000 / Volume->SampleTime;
+    if (Rate > MAXULONG / CC_VOLUME_DIRTY_SECONDS)
+    {
+        Rate = MAXULONG / CC_VOLUME_DIRTY_SECONDS;
+    }
+    Volume->SamplePages = 0;
+    Volume->SampleTime = 0;
+
+    /* Smooth it, devices have their moods */
+    if (Volume->WriteRate == 0)
+    {
+        Volume->WriteRate = (ULONG)Rate;
+    }
+    else
+    {
+        Volume->WriteRate = (ULONG)((3 * (ULONGLONG)Volume->WriteRate + Rate) / 4);
+    }
+
+    /* Let it have what it can write in a few seconds, but never starve it */
+    Threshold = Volume->WriteRate * CC_VOLUME_DIRTY_SECONDS;
+    if (Threshold < CcDirtyPageThreshold / 8)
+    {
+        Threshold = CcDirtyPageThreshold / 8;
+    }
+    else if (Threshold > CcDirtyPageThreshold)
+    {
+        Threshold = CcDirtyPageThreshold;
+    }
+    Volume->DirtyPageThreshold = Threshold;
+
+    DPRINT("Volume %p: %lu pages/s, threshold %lu pages\n",
+           Volume->DeviceObject, Volume->WriteRate, Threshold);
+}
+
+static
+ULONG
+CcRosGatherDirtyRun (
+    PROS_VACB First,
+    PROS_VACB *Run)
+/*
+ * FUNCTION: Collects the dirty views following a dirty one, so that they
+ * can be written together. All of them get referenced.
+ * NOTE: ViewLock must be held, it protects the dirty state
+ */
+{
+    ULONG Count;
+    LONGLONG FileOffset;
+    PROS_VACB Vacb;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+
+    SharedCacheMap = First->SharedCacheMap;
+    Run[0] = First;
+    Count = 1;
+
+    for (FileOffset = First->FileOffset.QuadPart + VACB_MAPPING_GRANULARITY;
+         Count < CC_MAX_WRITE_BEHIND_VACBS && FileOffset < SharedCacheMap->SectionSize.QuadPart;
+         FileOffset += VACB_MAPPING_GRANULARITY)
+    {
+        Vacb = CcRosLookupVacb(SharedCacheMap, FileOffset);
+        if (Vacb == NULL)
+        {
+            break;
+        }
+
+        if (!Vacb->Dirty)
+        {
+            CcRosVacbDecRefCount(Vacb);
+            break;
+        }
+
+        Run[Count++] = Vacb;
+    }
+
+    return Count;
+}
+
+static
+NTSTATUS
+CcRosFlushVacbRun (
+    PROS_VACB *Run,
+    ULONG Count)
+{
+    ULONG i;
+    NTSTATUS Status;
+
+    for (i = 0; i < Count; i++)
+    {
+        CcRosUnmarkDirtyVacb(Run[i], TRUE);
+    }
+
+    Status = CcWriteVirtualAddressRun(Run, Count);
+    if (!NT_SUCCESS(Status))
+    {
+        for (i = 0; i < Count; i++)
+        {
+            CcRosMarkDirtyVacb(Run[i]);
+        }
+    }
+
+    return Status;
+}
+
 NTSTATUS
 NTAPI
-CcRosFlushDirtyPages (
+CcRosFlushVolume (
+    PROS_VOLUME_CACHE Volume,
     ULONG Target,
     PULONG Count,
     BOOLEAN Wait,
     BOOLEAN CalledFromLazy)
+/*
+ * FUNCTION: Writes the oldest dirty views of a volume, along with the dirty
+ * views following them in their files
+ * NOTE: ViewLock must be held, and the volume referenced
+ */
 {
     PLIST_ENTRY current_entry;
     PROS_VACB current;
+    PROS_VACB Run[CC_MAX_WRITE_BEHIND_VACBS];
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    ULONG RunLength, i;
+    ULONGLONG StartTime;
     BOOLEAN Locked;
     NTSTATUS Status;
 
-    DPRINT("CcRosFlushDirtyPages(Target %lu)\n", Target);
+    DPRINT("CcRosFlushVolume(Volume %p, Target %lu)\n", Volume->DeviceObject, Target);
 
     (*Count) = 0;
 
-    KeEnterCriticalRegion();
-    KeAcquireGuardedMutex(&ViewLock);
-
-    current_entry = DirtyVacbListHead.Flink;
-    if (current_entry == &DirtyVacbListHead)
+    current_entry = Volume->DirtyVacbListHead.Flink;
+    if (current_entry == &Volume->DirtyVacbListHead)
     {
         DPRINT("No Dirty pages\n");
     }
 
-    while ((current_entry != &DirtyVacbListHead) && (Target > 0))
+    while ((current_entry != &Volume->DirtyVacbListHead) && (Target > 0))
     {
         current = CONTAINING_RECORD(current_entry,
                                     ROS_VACB,
                                     DirtyVacbListEntry);
         current_entry = current_entry->Flink;
-
-        CcRosVacbIncRefCount(current);
+        SharedCacheMap = current->SharedCacheMap;
 
         /* When performing lazy write, don't handle temporary files */
         if (CalledFromLazy &&
-            BooleanFlagOn(current->SharedCacheMap->FileObject->Flags, FO_TEMPORARY_FILE))
+            BooleanFlagOn(SharedCacheMap->FileObject->Flags, FO_TEMPORARY_FILE))
         {
-            CcRosVacbDecRefCount(current);
             continue;
         }
 
-        Locked = current->SharedCacheMap->Callbacks->AcquireForLazyWrite(
-                     current->SharedCacheMap->LazyWriteContext, Wait);
+        CcRosVacbIncRefCount(current);
+
+        Locked = SharedCacheMap->Callbacks->AcquireForLazyWrite(
+                     SharedCacheMap->LazyWriteContext, Wait);
         if (!Locked)
         {
             CcRosVacbDecRefCount(current);
@@ -232,15 +430,23 @@ CcRosFlushDirtyPages (
 
         ASSERT(current->Dirty);
 
+        /* Take the dirty views which follow along, one big write is much
+         * cheaper than several small ones */
+        RunLength = CcRosGatherDirtyRun(current, Run);
+
         KeReleaseGuardedMutex(&ViewLock);
 
-        Status = CcRosFlushVacb(current);
+        StartTime = KeQueryInterruptTime();
+        Status = CcRosFlushVacbRun(Run, RunLength);
 
-        current->SharedCacheMap->Callbacks->ReleaseFromLazyWrite(
-            current->SharedCacheMap->LazyWriteContext);
+        SharedCacheMap->Callbacks->ReleaseFromLazyWrite(
+            SharedCacheMap->LazyWriteContext);
 
         KeAcquireGuardedMutex(&ViewLock);
-        CcRosVacbDecRefCount(current);
+        for (i = 0; i < RunLength; i++)
+        {
+            CcRosVacbDecRefCount(Run[i]);
+        }
 
         if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE) &&
             (Status != STATUS_MEDIA_WRITE_PROTECTED))
@@ -252,9 +458,16 @@ CcRosFlushDirtyPages (
             ULONG PagesFreed;
 
             /* How many pages did we free? */
-            PagesFreed = VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            PagesFreed = RunLength * (VACB_MAPPING_GRANULARITY / PAGE_SIZE);
             (*Count) += PagesFreed;
 
+            /* See how fast the device is going */
+            CcRosUpdateWriteRate(Volume, PagesFreed, KeQueryInterruptTime() - StartTime);
+            if (RunLength > 1)
+            {
+                ++CcWriteBehindRuns;
+            }
+
             /* Make sure we don't overflow target! */
             if (Target < PagesFreed)
             {
@@ -267,7 +480,76 @@ CcRosFlushDirtyPages (
             }
         }
 
-        current_entry = DirtyVacbListHead.Flink;
+        current_entry = Volume->DirtyVacbListHead.Flink;
+    }
+
+    DPRINT("CcRosFlushVolume() finished\n");
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+CcRosFlushDirtyPages (
+    ULONG Target,
+    PULONG Count,
+    BOOLEAN Wait,
+    BOOLEAN CalledFromLazy)
+{
+    PLIST_ENTRY ListEntry;
+    PROS_VOLUME_CACHE Volume, Next;
+    ULONG VolumeCount, VolumeTarget;
+
+    DPRINT("CcRosFlushDirtyPages(Target %lu)\n", Target);
+
+    (*Count) = 0;
+
+    KeEnterCriticalRegion();
+    KeAcquireGuardedMutex(&ViewLock);
+
+    /* Share the target between the volumes, according to their dirty pages */
+    ListEntry = CcVolumeCacheListHead.Flink;
+    if (ListEntry != &CcVolumeCacheListHead)
+    {
+        Volume = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+        Volume->ReferenceCount++;
+    }
+
+    while (ListEntry != &CcVolumeCacheListHead && Target > 0)
+    {
+        Volume = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+
+        if (Volume->DirtyPages != 0)
+        {
+            if (CcTotalDirtyPages == 0 || Target == MAXULONG)
+            {
+                VolumeTarget = Target;
+            }
+            else
+            {
+                VolumeTarget = (ULONG)((ULONGLONG)Target * Volume->DirtyPages / CcTotalDirtyPages);
+                VolumeTarget = max(VolumeTarget, 1);
+            }
+
+            CcRosFlushVolume(Volume, VolumeTarget, &VolumeCount, Wait, CalledFromLazy);
+            (*Count) += VolumeCount;
+            Target -= min(Target, VolumeCount);
+        }
+
+        /* Keep the next volume alive while we drop our reference on this one */
+        ListEntry = ListEntry->Flink;
+        if (ListEntry != &CcVolumeCacheListHead)
+        {
+            Next = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+            Next->ReferenceCount++;
+        }
+        CcRosDereferenceVolumeCache(Volume);
+    }
+
+    /* We stopped early, release the volume we kept */
+    if (ListEntry != &CcVolumeCacheListHead)
+    {
+        Volume = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+        CcRosDereferenceVolumeCache(Volume);
     }
 
     KeReleaseGuardedMutex(&ViewLock);
@@ -354,7 +636,7 @@ retry:
             ASSERT(!current->MappedCount);
             ASSERT(Refs == 1);
 
-            RemoveEntryList(&current->CacheMapVacbListEntry);
+            CcRosUnlinkVacb(current);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
@@ -443,6 +725,180 @@ CcRosReleaseVacb (
     return STATUS_SUCCESS;
 }
 
+static
+PVOID *
+CcRosAllocateVacbIndexNode (
+    VOID)
+{
+    PVOID *Node;
+
+    Node = ExAllocatePoolWithTag(NonPagedPool,
+                                 VACB_INDEX_LEVEL_SIZE * sizeof(PVOID),
+                                 TAG_VACB_INDEX);
+    if (Node != NULL)
+    {
+        RtlZeroMemory(Node, VACB_INDEX_LEVEL_SIZE * sizeof(PVOID));
+    }
+
+    return Node;
+}
+
+static
+VOID
+CcRosFreeVacbIndexNode (
+    PVOID *Node,
+    ULONG Level)
+{
+    ULONG i;
+
+    /* Level 1 nodes hold the VACBs themselves */
+    if (Level > 1)
+    {
+        for (i = 0; i < VACB_INDEX_LEVEL_SIZE; i++)
+        {
+            if (Node[i] != NULL)
+            {
+                CcRosFreeVacbIndexNode(Node[i], Level - 1);
+            }
+        }
+    }
+
+    ExFreePoolWithTag(Node, TAG_VACB_INDEX);
+}
+
+static
+BOOLEAN
+CcRosGrowVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    ULONGLONG Index)
+{
+    PVOID *Node;
+
+    /* Leaving the inline slots, move them to a first level node */
+    if (SharedCacheMap->VacbIndexLevels == 0)
+    {
+        Node = CcRosAllocateVacbIndexNode();
+        if (Node == NULL)
+        {
+            return FALSE;
+        }
+
+        RtlCopyMemory(Node, SharedCacheMap->InlineVacbs, sizeof(SharedCacheMap->InlineVacbs));
+        RtlZeroMemory(SharedCacheMap->InlineVacbs, sizeof(SharedCacheMap->InlineVacbs));
+        SharedCacheMap->VacbIndex = Node;
+        SharedCacheMap->VacbIndexLevels = 1;
+    }
+
+    /* Add levels on top until the index covers the requested slot */
+    while ((Index >> (SharedCacheMap->VacbIndexLevels * VACB_INDEX_LEVEL_SHIFT)) != 0)
+    {
+        Node = CcRosAllocateVacbIndexNode();
+        if (Node == NULL)
+        {
+            return FALSE;
+        }
+
+        Node[0] = SharedCacheMap->VacbIndex;
+        SharedCacheMap->VacbIndex = Node;
+        SharedCacheMap->VacbIndexLevels++;
+    }
+
+    return TRUE;
+}
+
+/*
+ * FUNCTION: Returns the index slot of the VACB mapping FileOffset,
+ * optionally creating the missing parts of the index.
+ * Must be called with the cache map lock held.
+ */
+static
+PVOID *
+CcRosGetVacbIndexSlot (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset,
+    BOOLEAN Create)
+{
+    ULONGLONG Index;
+    ULONG Level;
+    PVOID *Node;
+    PVOID *Slot;
+
+    ASSERT(FileOffset >= 0);
+    Index = (ULONGLONG)FileOffset / VACB_MAPPING_GRANULARITY;
+
+    if (SharedCacheMap->VacbIndexLevels == 0 &&
+        Index < VACB_INDEX_INLINE_SLOTS)
+    {
+        return &SharedCacheMap->InlineVacbs[Index];
+    }
+
+    if (SharedCacheMap->VacbIndexLevels == 0 ||
+        (Index >> (SharedCacheMap->VacbIndexLevels * VACB_INDEX_LEVEL_SHIFT)) != 0)
+    {
+        if (!Create || !CcRosGrowVacbIndex(SharedCacheMap, Index))
+        {
+            return NULL;
+        }
+    }
+
+    /* Walk down to the level 1 node */
+    Node = SharedCacheMap->VacbIndex;
+    for (Level = SharedCacheMap->VacbIndexLevels - 1; Level > 0; Level--)
+    {
+        Slot = &Node[(Index >> (Level * VACB_INDEX_LEVEL_SHIFT)) & (VACB_INDEX_LEVEL_SIZE - 1)];
+        if (*Slot == NULL)
+        {
+            if (!Create)
+            {
+                return NULL;
+            }
+
+            *Slot = CcRosAllocateVacbIndexNode();
+            if (*Slot == NULL)
+            {
+                return NULL;
+            }
+        }
+        Node = *Slot;
+    }
+
+    return &Node[Index & (VACB_INDEX_LEVEL_SIZE - 1)];
+}
+
+static
+VOID
+CcRosFreeVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap)
+{
+    if (SharedCacheMap->VacbIndexLevels != 0)
+    {
+        CcRosFreeVacbIndexNode(SharedCacheMap->VacbIndex, SharedCacheMap->VacbIndexLevels);
+        SharedCacheMap->VacbIndex = NULL;
+        SharedCacheMap->VacbIndexLevels = 0;
+    }
+}
+
+/*
+ * FUNCTION: Removes a VACB from the index and the VACB list of its shared
+ * cache map. Must be called with the cache map lock held.
+ */
+VOID
+NTAPI
+CcRosUnlinkVacb (
+    PROS_VACB Vacb)
+{
+    PVOID *Slot;
+
+    Slot = CcRosGetVacbIndexSlot(Vacb->SharedCacheMap, Vacb->FileOffset.QuadPart, FALSE);
+    ASSERT(Slot != NULL && *Slot == Vacb);
+    if (Slot != NULL)
+    {
+        *Slot = NULL;
+    }
+
+    RemoveEntryList(&Vacb->CacheMapVacbListEntry);
+}
+
 /* Returns with VACB Lock Held! */
 PROS_VACB
 NTAPI
@@ -450,8 +906,8 @@ CcRosLookupVacb (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset)
 {
-    PLIST_ENTRY current_entry;
     PROS_VACB current;
+    PVOID *Slot;
     KIRQL oldIrql;
 
     ASSERT(SharedCacheMap);
@@ -459,33 +915,24 @@ CcRosLookupVacb (
     DPRINT("CcRosLookupVacb(SharedCacheMap 0x%p, FileOffset %I64u)\n",
            SharedCacheMap, FileOffset);
 
-    KeAcquireGuardedMutex(&ViewLock);
+    /* VACBs are only inserted in and removed from the index with the cache
+     * map lock held, so it's enough to keep them alive while we reference it */
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
 
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    current = NULL;
+    Slot = CcRosGetVacbIndexSlot(SharedCacheMap, FileOffset, FALSE);
+    if (Slot != NULL && *Slot != NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-            KeReleaseGuardedMutex(&ViewLock);
-            return current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        current = *Slot;
+        ASSERT(IsPointInRange(current->FileOffset.QuadPart,
+                              VACB_MAPPING_GRANULARITY,
+                              FileOffset));
+        CcRosVacbIncRefCount(current);
     }
 
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-    KeReleaseGuardedMutex(&ViewLock);
 
-    return NULL;
+    return current;
 }
 
 VOID
@@ -503,8 +950,9 @@ CcRosMarkDirtyVacb (
 
     ASSERT(!Vacb->Dirty);
 
-    InsertTailList(&DirtyVacbListHead, &Vacb->DirtyVacbListEntry);
+    InsertTailList(&SharedCacheMap->Volume->DirtyVacbListHead, &Vacb->DirtyVacbListEntry);
     CcTotalDirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+    SharedCacheMap->Volume->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     Vacb->SharedCacheMap->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     CcRosVacbIncRefCount(Vacb);
 
@@ -550,6 +998,7 @@ CcRosUnmarkDirtyVacb (
     RemoveEntryList(&Vacb->DirtyVacbListEntry);
     InitializeListHead(&Vacb->DirtyVacbListEntry);
     CcTotalDirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+    SharedCacheMap->Volume->DirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     Vacb->SharedCacheMap->DirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     CcRosVacbDecRefCount(Vacb);
 
@@ -726,7 +1175,7 @@ CcRosFreeUnusedVacb (
             ASSERT(Refs == 1);
 
             /* Reset and move to free list */
-            RemoveEntryList(&current->CacheMapVacbListEntry);
+            CcRosUnlinkVacb(current);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
@@ -778,6 +1227,7 @@ CcRosCreateVacb (
     PROS_VACB current;
     PROS_VACB previous;
     PLIST_ENTRY current_entry;
+    PVOID *Slot;
     NTSTATUS Status;
     KIRQL oldIrql;
     ULONG Refs;
@@ -798,6 +1248,7 @@ CcRosCreateVacb (
     current->Valid = FALSE;
     current->Dirty = FALSE;
     current->PageOut = FALSE;
+    current->ReadAhead = FALSE;
     current->FileOffset.QuadPart = ROUND_DOWN(FileOffset, VACB_MAPPING_GRANULARITY);
     current->SharedCacheMap = SharedCacheMap;
 #if DBG
@@ -848,56 +1299,59 @@ Retry:
      * our newly created VACB and return the existing one.
      */
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    previous = NULL;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    Slot = CcRosGetVacbIndexSlot(SharedCacheMap, FileOffset, TRUE);
+    if (Slot == NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-#if DBG
-            if (SharedCacheMap->Trace)
-            {
-                DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
-                        SharedCacheMap,
-                        (*Vacb),
-                        current);
-            }
-#endif
-            KeReleaseGuardedMutex(&ViewLock);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+        KeReleaseGuardedMutex(&ViewLock);
 
-            Refs = CcRosVacbDecRefCount(*Vacb);
-            ASSERT(Refs == 0);
+        DPRINT1("Failed to extend the VACB index of %p\n", SharedCacheMap);
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
 
-            *Vacb = current;
-            return STATUS_SUCCESS;
-        }
-        if (current->FileOffset.QuadPart < FileOffset)
+        *Vacb = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (*Slot != NULL)
+    {
+        current = *Slot;
+        CcRosVacbIncRefCount(current);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+#if DBG
+        if (SharedCacheMap->Trace)
         {
-            ASSERT(previous == NULL ||
-                   previous->FileOffset.QuadPart < current->FileOffset.QuadPart);
-            previous = current;
+            DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
+                    SharedCacheMap,
+                    (*Vacb),
+                    current);
         }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+#endif
+        KeReleaseGuardedMutex(&ViewLock);
+
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
+
+        *Vacb = current;
+        return STATUS_SUCCESS;
     }
-    /* There was no existing VACB. */
+
+    /* There was no existing VACB. Keep the list sorted by offset, walking it
+     * backwards since views are mostly created while the file is read or
+     * written sequentially. */
     current = *Vacb;
-    if (previous)
-    {
-        InsertHeadList(&previous->CacheMapVacbListEntry, &current->CacheMapVacbListEntry);
-    }
-    else
+    *Slot = current;
+    current_entry = SharedCacheMap->CacheMapVacbListHead.Blink;
+    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
     {
-        InsertHeadList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
+        previous = CONTAINING_RECORD(current_entry,
+                                     ROS_VACB,
+                                     CacheMapVacbListEntry);
+        if (previous->FileOffset.QuadPart < current->FileOffset.QuadPart)
+            break;
+        current_entry = current_entry->Blink;
     }
+    InsertHeadList(current_entry, &current->CacheMapVacbListEntry);
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
     InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
     KeReleaseGuardedMutex(&ViewLock);
@@ -1185,10 +1639,11 @@ CcRosDeleteFileCache (
         KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
         while (!IsListEmpty(&SharedCacheMap->CacheMapVacbListHead))
         {
-            current_entry = RemoveTailList(&SharedCacheMap->CacheMapVacbListHead);
+            current_entry = SharedCacheMap->CacheMapVacbListHead.Blink;
+            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
+            CcRosUnlinkVacb(current);
             KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
 
-            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             if (current->Dirty)
@@ -1256,8 +1711,10 @@ CcRosDeleteFileCache (
         RemoveEntryList(&SharedCacheMap->SharedCacheMapLinks);
         KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
-        ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
+        CcRosFreeVacbIndex(SharedCacheMap);
         KeAcquireGuardedMutex(&ViewLock);
+        CcRosDereferenceVolumeCache(SharedCacheMap->Volume);
+        ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
     }
     return STATUS_SUCCESS;
 }
@@ -1324,7 +1781,7 @@ CcRosReleaseFileCache (
  */
 {
     KIRQL OldIrql;
-    PPRIVATE_CACHE_MAP PrivateMap;
+    PROS_PRIVATE_CACHE_MAP PrivateMap;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
 
     KeAcquireGuardedMutex(&ViewLock);
@@ -1424,6 +1881,15 @@ CcRosInitializeFileCache (
     {
         if (FileObject->SectionObjectPointer->SharedCacheMap == NULL)
         {
+            /* Its dirty pages will be accounted to its volume */
+            SharedCacheMap->Volume = CcRosReferenceVolumeCache(IoGetRelatedDeviceObject(FileObject));
+            if (SharedCacheMap->Volume == NULL)
+            {
+                KeReleaseGuardedMutex(&ViewLock);
+                ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
             ObReferenceObjectByPointer(FileObject,
                                        FILE_ALL_ACCESS,
                                        NULL,
@@ -1442,12 +1908,12 @@ CcRosInitializeFileCache (
     }
     if (FileObject->PrivateCacheMap == NULL)
     {
-        PPRIVATE_CACHE_MAP PrivateMap;
+        PROS_PRIVATE_CACHE_MAP PrivateMap;
 
         /* Allocate the private cache map for this handle */
         if (SharedCacheMap->PrivateCacheMap.NodeTypeCode != 0)
         {
-            PrivateMap = ExAllocatePoolWithTag(NonPagedPool, sizeof(PRIVATE_CACHE_MAP), TAG_PRIVATE_CACHE_MAP);
+            PrivateMap = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROS_PRIVATE_CACHE_MAP), TAG_PRIVATE_CACHE_MAP);
         }
         else
         {
@@ -1464,6 +1930,7 @@ CcRosInitializeFileCache (
                 KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
                 FileObject->SectionObjectPointer->SharedCacheMap = NULL;
+                CcRosDereferenceVolumeCache(SharedCacheMap->Volume);
                 ObDereferenceObject(FileObject);
                 ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
             }
@@ -1473,7 +1940,7 @@ CcRosInitializeFileCache (
         }
 
         /* Initialize it */
-        RtlZeroMemory(PrivateMap, sizeof(PRIVATE_CACHE_MAP));
+        RtlZeroMemory(PrivateMap, sizeof(ROS_PRIVATE_CACHE_MAP));
         PrivateMap->NodeTypeCode = NODE_TYPE_PRIVATE_MAP;
         PrivateMap->ReadAheadMask = PAGE_SIZE - 1;
         PrivateMap->FileObject = FileObject;
@@ -1521,7 +1988,7 @@ CcInitView (
 {
     DPRINT("CcInitView()\n");
 
-    InitializeListHead(&DirtyVacbListHead);
+    InitializeListHead(&CcVolumeCacheListHead);
     InitializeListHead(&VacbLruListHead);
     InitializeListHead(&CcDeferredWrites);
     InitializeListHead(&CcCleanSharedCacheMapList);
@@ -1562,7 +2029,7 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
     UNICODE_STRING NoName = RTL_CONSTANT_STRING(L"No name for File");
 
     KdbpPrint("  Usage Summary (in kb)\n");
-    KdbpPrint("Shared\t\tValid\tDirty\tName\n");
+    KdbpPrint("Shared\t\tValid\tDirty\tRAHits\tMisses\tName\n");
     /* No need to lock the spin lock here, we're in DBG */
     for (ListEntry = CcCleanSharedCacheMapList.Flink;
          ListEntry != &CcCleanSharedCacheMapList;
@@ -1614,15 +2081,21 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
         }
 
         /* And print */
-        KdbpPrint("%p\t%d\t%d\t%wZ%S\n", SharedCacheMap, Valid, Dirty, FileName, Extra);
+        KdbpPrint("%p\t%d\t%d\t%lu\t%lu\t%wZ%S\n", SharedCacheMap, Valid, Dirty,
+                  SharedCacheMap->ReadAheadHits, SharedCacheMap->ReadAheadMisses,
+                  FileName, Extra);
     }
 
+    KdbpPrint("Read ahead: %lu reads, window up to %lu kb\n", CcReadAheadIos, CcReadAheadMaximum / 1024);
+
     return TRUE;
 }
 
 BOOLEAN
 ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[])
 {
+    PLIST_ENTRY ListEntry;
+
     KdbpPrint("CcTotalDirtyPages:\t%lu (%lu Kb)\n", CcTotalDirtyPages,
               (CcTotalDirtyPages * PAGE_SIZE) / 1024);
     KdbpPrint("CcDirtyPageThreshold:\t%lu (%lu Kb)\n", CcDirtyPageThreshold,
@@ -1636,6 +2109,22 @@ ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[])
     KdbpPrint("MmModifiedPageListHead.Total:\t%lu (%lu Kb)\n", MmModifiedPageListHead.Total,
               (MmModifiedPageListHead.Total * PAGE_SIZE) / 1024);
 
+    KdbpPrint("CcWriteBehindRuns:\t%lu\n", CcWriteBehindRuns);
+
+    for (ListEntry = CcVolumeCacheListHead.Flink;
+         ListEntry != &CcVolumeCacheListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        PROS_VOLUME_CACHE Volume;
+
+        Volume = CONTAINING_RECORD(ListEntry, ROS_VOLUME_CACHE, VolumeCacheLinks);
+        KdbpPrint("Volume %p:\tdirty %lu/%lu Kb, %lu Kb/s%s\n", Volume->DeviceObject,
+                  (Volume->DirtyPages * PAGE_SIZE) / 1024,
+                  (Volume->DirtyPageThreshold * PAGE_SIZE) / 1024,
+                  (Volume->WriteRate * PAGE_SIZE) / 1024,
+                  Volume->WriteBehindActive ? ", writing" : "");
+    }
+
     if (CcTotalDirtyPages >= CcDirtyPageThreshold)
     {
         KdbpPrint("CcTotalDirtyPages above the threshold, writes should be throttled\n");
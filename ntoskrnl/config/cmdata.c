@@ -338,6 +338,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management",
+        L"CacheReadAheadMaximum",
+        &CcReadAheadMaximum,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Memory Management",
         L"LargeStackSize",
@@ -370,6 +378,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management",
+        L"ZeroedPageTarget",
+        &MmZeroedPageTargetInMb,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Memory Management",
         L"DisablePagingExecutive",
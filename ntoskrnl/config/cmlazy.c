@@ -35,10 +35,9 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
                    _Out_ PBOOLEAN Error,
                    _Out_ PULONG DirtyCount)
 {
-    NTSTATUS Status;
     PLIST_ENTRY NextEntry;
     PCMHIVE CmHive;
-    BOOLEAN Result;
+    BOOLEAN Result, Synced;
     ULONG HiveCount = CmpLazyFlushHiveCount;
 
     /* Set Defaults */
@@ -80,12 +79,16 @@ CmpDoFlushNextHive(_In_  BOOLEAN ForceFlush,
                 /* Do the sync */
                 DPRINT("Flushing: %wZ\n", &CmHive->FileFullPath);
                 DPRINT("Handle: %p\n", CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
-                Status = HvSyncHive(&CmHive->Hive);
-                if(!NT_SUCCESS(Status))
+                /* Lazy flushes may leave the primary file to a later, batched write */
+                if (ForceFlush)
+                    Synced = HvSyncHive(&CmHive->Hive);
+                else
+                    Synced = HvLazySyncHive(&CmHive->Hive);
+                if (!Synced)
                 {
                     /* Let them know we failed */
-                    DPRINT1("Failed to flush %wZ on handle %p (status 0x%08lx)\n",
-                        &CmHive->FileFullPath,  CmHive->FileHandles[HFILE_TYPE_PRIMARY], Status);
+                    DPRINT1("Failed to flush %wZ on handle %p\n",
+                        &CmHive->FileFullPath,  CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
                     *Error = TRUE;
                     Result = FALSE;
                     break;
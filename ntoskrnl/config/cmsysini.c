@@ -1361,6 +1361,9 @@ CmpLoadHiveThread(IN PVOID StartContext)
             CmHive->FileHandles[HFILE_TYPE_LOG] = LogHandle;
             CmHive->FileHandles[HFILE_TYPE_PRIMARY] = PrimaryHandle;
 
+            /* The hive has a log from now on, so flushes go through it */
+            CmHive->Hive.Log = TRUE;
+
             /* Allow lazy flushing since the handles are there -- remove sync hacks */
             //ASSERT(CmHive->Hive.HiveFlags & HIVE_NOLAZYFLUSH);
             CmHive->Hive.HiveFlags &= ~HIVE_NOLAZYFLUSH;
@@ -1554,6 +1554,12 @@ Phase1InitializationDiscard(IN PVOID Context)
     /* Initialize all processors */
     if (!HalAllProcessorsStarted()) KeBugCheck(HAL1_INITIALIZATION_FAILED);
 
+    /* Split the pool tag counters per processor */
+    ExpInitializePoolTagTables();
+
+    /* Give every processor its own pool lookaside lists */
+    ExpInitializeProcessorPoolLookasideLists();
+
 #ifdef CONFIG_SMP
     /* HACK: We should use RtlFindMessage and not only fallback to this */
     MpString = "MultiProcessor Kernel\r\n";
@@ -14,8 +14,16 @@
 
 #if defined (ALLOC_PRAGMA)
 #pragma alloc_text(INIT, ExpInitLookasideLists)
+#pragma alloc_text(INIT, ExpInitializeProcessorPoolLookasideLists)
 #endif
 
+/* Depth adjustment, done once a second by the balance set manager */
+#define MINIMUM_LOOKASIDE_DEPTH         4
+#define MINIMUM_ALLOCATION_THRESHOLD    25
+
+/* Pool blocks are as large as the list entry linking them when free */
+#define POOL_BLOCK_SIZE                 sizeof(LIST_ENTRY)
+
 /* GLOBALS *******************************************************************/
 
 LIST_ENTRY ExpNonPagedLookasideListHead;
@@ -24,8 +32,11 @@ LIST_ENTRY ExpPagedLookasideListHead;
 KSPIN_LOCK ExpPagedLookasideListLock;
 LIST_ENTRY ExSystemLookasideListHead;
 LIST_ENTRY ExPoolLookasideListHead;
-GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
-GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
+GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[NUMBER_POOL_LOOKASIDE_LISTS];
+GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[NUMBER_POOL_LOOKASIDE_LISTS];
+GENERAL_LOOKASIDE ExpMediumNPagedPoolLookasideLists[EXP_MEDIUM_POOL_LISTS];
+GENERAL_LOOKASIDE ExpMediumPagedPoolLookasideLists[EXP_MEDIUM_POOL_LISTS];
+PEXP_POOL_LOOKASIDE_LISTS ExpProcessorPoolLookasideLists[MAXIMUM_PROCESSORS];
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
@@ -67,7 +78,7 @@ ExInitPoolLookasidePointers(VOID)
     PGENERAL_LOOKASIDE Entry;
 
     /* Loop for all pool lists */
-    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
     {
         /* Initialize the non-paged list */
         Entry = &ExpSmallNPagedPoolLookasideLists[i];
@@ -103,12 +114,12 @@ ExpInitLookasideLists(VOID)
     KeInitializeSpinLock(&ExpPagedLookasideListLock);
 
     /* Initialize the system lookaside lists */
-    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
     {
         /* Initialize the non-paged list */
         ExInitializeSystemLookasideList(&ExpSmallNPagedPoolLookasideLists[i],
                                         NonPagedPool,
-                                        (i + 1) * 8,
+                                        (i + 1) * POOL_BLOCK_SIZE,
                                         'looP',
                                         256,
                                         &ExPoolLookasideListHead);
@@ -116,11 +127,184 @@ ExpInitLookasideLists(VOID)
         /* Initialize the paged list */
         ExInitializeSystemLookasideList(&ExpSmallPagedPoolLookasideLists[i],
                                         PagedPool,
-                                        (i + 1) * 8,
+                                        (i + 1) * POOL_BLOCK_SIZE,
                                         'looP',
                                         256,
                                         &ExPoolLookasideListHead);
     }
+
+    /* And the ones shared by all processors for medium sized blocks */
+    for (i = 0; i < EXP_MEDIUM_POOL_LISTS; i++)
+    {
+        ExInitializeSystemLookasideList(&ExpMediumNPagedPoolLookasideLists[i],
+                                        NonPagedPool,
+                                        EXP_MEDIUM_POOL_BLOCK_SIZE(i) * POOL_BLOCK_SIZE,
+                                        'looP',
+                                        EXP_MEDIUM_POOL_MAXIMUM_DEPTH,
+                                        &ExPoolLookasideListHead);
+        ExInitializeSystemLookasideList(&ExpMediumPagedPoolLookasideLists[i],
+                                        PagedPool,
+                                        EXP_MEDIUM_POOL_BLOCK_SIZE(i) * POOL_BLOCK_SIZE,
+                                        'looP',
+                                        EXP_MEDIUM_POOL_MAXIMUM_DEPTH,
+                                        &ExPoolLookasideListHead);
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+ExpInitializeProcessorPoolLookasideLists(VOID)
+{
+    PEXP_POOL_LOOKASIDE_LISTS Lists;
+    PKPRCB Prcb;
+    ULONG i, j;
+
+    /* Give every processor its own pool lookaside lists */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        /* Allocate them from nonpaged pool */
+        Prcb = KiProcessorBlock[i];
+        Lists = ExAllocatePoolWithTag(NonPagedPool,
+                                      sizeof(EXP_POOL_LOOKASIDE_LISTS),
+                                      'looP');
+        if (!Lists)
+        {
+            /* Keep using the shared lists only */
+            DPRINT1("No per-processor pool lookaside lists for CPU %lu\n", i);
+            continue;
+        }
+
+        /* Initialize the small block lists and bind them to the PRCB */
+        for (j = 0; j < NUMBER_POOL_LOOKASIDE_LISTS; j++)
+        {
+            ExInitializeSystemLookasideList(&Lists->SmallNPaged[j],
+                                            NonPagedPool,
+                                            (j + 1) * POOL_BLOCK_SIZE,
+                                            'looP',
+                                            256,
+                                            &ExPoolLookasideListHead);
+            ExInitializeSystemLookasideList(&Lists->SmallPaged[j],
+                                            PagedPool,
+                                            (j + 1) * POOL_BLOCK_SIZE,
+                                            'looP',
+                                            256,
+                                            &ExPoolLookasideListHead);
+            Prcb->PPNPagedLookasideList[j].P = &Lists->SmallNPaged[j];
+            Prcb->PPPagedLookasideList[j].P = &Lists->SmallPaged[j];
+        }
+
+        /* Initialize the medium block lists */
+        for (j = 0; j < EXP_MEDIUM_POOL_LISTS; j++)
+        {
+            ExInitializeSystemLookasideList(&Lists->MediumNPaged[j],
+                                            NonPagedPool,
+                                            EXP_MEDIUM_POOL_BLOCK_SIZE(j) * POOL_BLOCK_SIZE,
+                                            'looP',
+                                            EXP_MEDIUM_POOL_MAXIMUM_DEPTH,
+                                            &ExPoolLookasideListHead);
+            ExInitializeSystemLookasideList(&Lists->MediumPaged[j],
+                                            PagedPool,
+                                            EXP_MEDIUM_POOL_BLOCK_SIZE(j) * POOL_BLOCK_SIZE,
+                                            'looP',
+                                            EXP_MEDIUM_POOL_MAXIMUM_DEPTH,
+                                            &ExPoolLookasideListHead);
+        }
+
+        /* The pool can use them now */
+        ExpProcessorPoolLookasideLists[i] = Lists;
+    }
+}
+
+static
+USHORT
+ExpComputeLookasideDepth(IN PGENERAL_LOOKASIDE Lookaside,
+                         IN ULONG Allocates,
+                         IN ULONG Misses)
+{
+    ULONG Depth, Ratio;
+
+    /* Shrink lists which are barely used */
+    Depth = Lookaside->Depth;
+    if (Allocates < MINIMUM_ALLOCATION_THRESHOLD)
+    {
+        if (Depth > MINIMUM_LOOKASIDE_DEPTH + 10) return (USHORT)(Depth - 10);
+        return MINIMUM_LOOKASIDE_DEPTH;
+    }
+
+    /* Get the miss ratio in tenths of a percent */
+    Ratio = (ULONG)(((ULONGLONG)Misses * 1000) / Allocates);
+    if (Ratio < 5)
+    {
+        /* Almost everything hit, so the list is deep enough: give one back */
+        if (Depth > MINIMUM_LOOKASIDE_DEPTH) return (USHORT)(Depth - 1);
+        return MINIMUM_LOOKASIDE_DEPTH;
+    }
+
+    /* Grow in proportion to the misses and the room left */
+    Depth += ((Ratio * (Lookaside->MaximumDepth - Depth)) / (1000 * 2)) + 5;
+    if (Depth > Lookaside->MaximumDepth) Depth = Lookaside->MaximumDepth;
+    return (USHORT)Depth;
+}
+
+static
+VOID
+ExpScanLookasideList(IN PLIST_ENTRY ListHead,
+                     IN BOOLEAN CountsHits)
+{
+    PLIST_ENTRY ListEntry;
+    PGENERAL_LOOKASIDE Lookaside;
+    ULONG TotalAllocates, AllocateCount, Allocates, Misses;
+
+    /* Loop the lists */
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        /* Snapshot the counters, they are updated without any lock */
+        Lookaside = CONTAINING_RECORD(ListEntry, GENERAL_LOOKASIDE, ListEntry);
+        TotalAllocates = Lookaside->TotalAllocates;
+        AllocateCount = Lookaside->AllocateMisses;
+
+        /* The pool lists count hits, everyone else counts misses */
+        Allocates = TotalAllocates - Lookaside->LastTotalAllocates;
+        if (CountsHits)
+        {
+            Misses = Allocates - (AllocateCount - Lookaside->LastAllocateHits);
+        }
+        else
+        {
+            Misses = AllocateCount - Lookaside->LastAllocateMisses;
+        }
+
+        /* The counters can move between our reads, don't let a wrapped
+           difference make the miss ratio overflow */
+        if (Misses > Allocates) Misses = Allocates;
+
+        /* Set the new depth and start the next period */
+        Lookaside->Depth = ExpComputeLookasideDepth(Lookaside, Allocates, Misses);
+        Lookaside->LastTotalAllocates = TotalAllocates;
+        Lookaside->LastAllocateMisses = AllocateCount;
+    }
+}
+
+VOID
+ExAdjustLookasideDepth(VOID)
+{
+    KIRQL OldIrql;
+
+    /* The pool and system lists are all set up before we first run */
+    ExpScanLookasideList(&ExPoolLookasideListHead, TRUE);
+    ExpScanLookasideList(&ExSystemLookasideListHead, FALSE);
+
+    /* Driver lists come and go, so hold their locks */
+    KeAcquireSpinLock(&ExpNonPagedLookasideListLock, &OldIrql);
+    ExpScanLookasideList(&ExpNonPagedLookasideListHead, FALSE);
+    KeReleaseSpinLock(&ExpNonPagedLookasideListLock, OldIrql);
+
+    KeAcquireSpinLock(&ExpPagedLookasideListLock, &OldIrql);
+    ExpScanLookasideList(&ExpPagedLookasideListHead, FALSE);
+    KeReleaseSpinLock(&ExpPagedLookasideListLock, OldIrql);
 }
 
 /* PUBLIC FUNCTIONS **********************************************************/
@@ -40,7 +40,7 @@
 // Global Cc Data
 //
 extern ULONG CcRosTraceLevel;
-extern LIST_ENTRY DirtyVacbListHead;
+extern LIST_ENTRY CcVolumeCacheListHead;
 extern ULONG CcDirtyPageThreshold;
 extern ULONG CcTotalDirtyPages;
 extern LIST_ENTRY CcDeferredWrites;
@@ -64,6 +64,23 @@ extern ULONG CcPinReadWait;
 extern ULONG CcPinReadNoWait;
 extern ULONG CcDataPages;
 extern ULONG CcDataFlushes;
+extern ULONG CcReadAheadIos;
+extern ULONG CcWriteBehindRuns;
+
+//
+// Read ahead window ceiling, configurable through the registry
+//
+extern ULONG CcReadAheadMaximum;
+#define CC_DEFAULT_READ_AHEAD_MAXIMUM (8 * VACB_MAPPING_GRANULARITY)
+#define CC_MAX_READ_AHEAD_MAXIMUM (64 * VACB_MAPPING_GRANULARITY)
+
+//
+// Write behind: adjacent dirty views of a file are written together, and
+// each volume may only hold as many dirty pages as it can write in a few
+// seconds, according to the bandwidth the lazy writer measured for it
+//
+#define CC_MAX_WRITE_BEHIND_VACBS 8
+#define CC_VOLUME_DIRTY_SECONDS 4
 
 typedef struct _PF_SCENARIO_ID
 {
@@ -166,6 +183,59 @@ typedef struct _PFSN_PREFETCHER_GLOBALS
     LONG ActivePrefetches;
 } PFSN_PREFETCHER_GLOBALS, *PPFSN_PREFETCHER_GLOBALS;
 
+typedef struct _ROS_PRIVATE_CACHE_MAP
+{
+    union
+    {
+        CSHORT NodeTypeCode;
+        PRIVATE_CACHE_MAP_FLAGS Flags;
+        ULONG UlongFlags;
+    };
+    ULONG ReadAheadMask;
+    PFILE_OBJECT FileObject;
+    LARGE_INTEGER FileOffset1;
+    LARGE_INTEGER BeyondLastByte1;
+    LARGE_INTEGER FileOffset2;
+    LARGE_INTEGER BeyondLastByte2;
+    LARGE_INTEGER ReadAheadOffset[2];
+    ULONG ReadAheadLength[2];
+    KSPIN_LOCK ReadAheadSpinLock;
+    LIST_ENTRY PrivateLinks;
+    PVOID ReadAheadWorkItem;
+
+    /* ROS specific */
+    ULONG ReadAheadWindow; /* size of the sequential read ahead, grows while the pattern holds */
+} ROS_PRIVATE_CACHE_MAP, *PROS_PRIVATE_CACHE_MAP;
+
+/* Per volume write behind state, shared by the cache maps of all the
+ * files living on the same file system device */
+typedef struct _ROS_VOLUME_CACHE
+{
+    LIST_ENTRY VolumeCacheLinks;
+    PDEVICE_OBJECT DeviceObject;
+    /* Number of shared cache maps using it, protected by ViewLock */
+    ULONG ReferenceCount;
+    /* Dirty VACBs of the volume, oldest first, protected by ViewLock */
+    LIST_ENTRY DirtyVacbListHead;
+    ULONG DirtyPages;
+    /* How many dirty pages we tolerate before throttling writers */
+    ULONG DirtyPageThreshold;
+    /* Is a worker already writing behind for this volume? */
+    BOOLEAN WriteBehindActive;
+    /* Write bandwidth, in pages per second, and the sample being measured */
+    ULONG WriteRate;
+    ULONG SamplePages;
+    ULONGLONG SampleTime;
+} ROS_VOLUME_CACHE, *PROS_VOLUME_CACHE;
+
+/* VACB index of a shared cache map: one slot per VACB_MAPPING_GRANULARITY
+ * chunk of the file. Small files use the slots embedded in the shared cache
+ * map, bigger ones get a tree of VACB_INDEX_LEVEL_SIZE slot arrays, which
+ * gets deeper as the file grows. */
+#define VACB_INDEX_INLINE_SLOTS 4
+#define VACB_INDEX_LEVEL_SHIFT 7
+#define VACB_INDEX_LEVEL_SIZE (1 << VACB_INDEX_LEVEL_SHIFT)
+
 typedef struct _ROS_SHARED_CACHE_MAP
 {
     CSHORT NodeTypeCode;
@@ -181,13 +251,23 @@ typedef struct _ROS_SHARED_CACHE_MAP
     PVOID LazyWriteContext;
     LIST_ENTRY PrivateList;
     ULONG DirtyPageThreshold;
-    PRIVATE_CACHE_MAP PrivateCacheMap;
+    ROS_PRIVATE_CACHE_MAP PrivateCacheMap;
 
     /* ROS specific */
     LIST_ENTRY CacheMapVacbListHead;
     ULONG TimeStamp;
     BOOLEAN PinAccess;
     KSPIN_LOCK CacheMapLock;
+    /* VACB index, protected by CacheMapLock */
+    ULONG VacbIndexLevels;
+    PVOID *VacbIndex;
+    PVOID InlineVacbs[VACB_INDEX_INLINE_SLOTS];
+    /* Read ahead statistics: reads served by views brought in by read
+     * ahead, and reads which had to wait for the disk */
+    ULONG ReadAheadHits;
+    ULONG ReadAheadMisses;
+    /* Volume the file lives on */
+    PROS_VOLUME_CACHE Volume;
 #if DBG
     BOOLEAN Trace; /* enable extra trace output for this cache map and it's VACBs */
 #endif
@@ -208,10 +288,12 @@ typedef struct _ROS_VACB
     BOOLEAN Dirty;
     /* Page out in progress */
     BOOLEAN PageOut;
+    /* Was the view brought in by read ahead, and not read yet? */
+    BOOLEAN ReadAhead;
     ULONG MappedCount;
     /* Entry in the list of VACBs for this shared cache map. */
     LIST_ENTRY CacheMapVacbListEntry;
-    /* Entry in the list of VACBs which are dirty. */
+    /* Entry in the list of VACBs of the volume which are dirty. */
     LIST_ENTRY DirtyVacbListEntry;
     /* Entry in the list of VACBs. */
     LIST_ENTRY VacbLruListEntry;
@@ -265,6 +347,11 @@ typedef struct _WORK_QUEUE_ENTRY
             KEVENT *Event;
         } Event;
         struct
+        {
+            struct _ROS_VOLUME_CACHE *Volume;
+            ULONG Target;
+        } Flush;
+        struct
         {
             unsigned long Reason;
         } Notification;
@@ -338,6 +425,12 @@ NTSTATUS
 NTAPI
 CcWriteVirtualAddress(PROS_VACB Vacb);
 
+NTSTATUS
+NTAPI
+CcWriteVirtualAddressRun(
+    PROS_VACB *Vacbs,
+    ULONG Count);
+
 BOOLEAN
 NTAPI
 CcInitializeCacheManager(VOID);
@@ -357,6 +450,12 @@ CcRosLookupVacb(
     LONGLONG FileOffset
 );
 
+VOID
+NTAPI
+CcRosUnlinkVacb(
+    PROS_VACB Vacb
+);
+
 VOID
 NTAPI
 CcInitCacheZeroPage(VOID);
@@ -388,6 +487,22 @@ CcRosFlushDirtyPages(
     BOOLEAN CalledFromLazy
 );
 
+NTSTATUS
+NTAPI
+CcRosFlushVolume(
+    PROS_VOLUME_CACHE Volume,
+    ULONG Target,
+    PULONG Count,
+    BOOLEAN Wait,
+    BOOLEAN CalledFromLazy
+);
+
+VOID
+NTAPI
+CcRosDereferenceVolumeCache(
+    PROS_VOLUME_CACHE Volume
+);
+
 VOID
 NTAPI
 CcRosDereferenceCache(PFILE_OBJECT FileObject);
@@ -467,6 +582,11 @@ VOID
 CcPerformReadAhead(
     IN PFILE_OBJECT FileObject);
 
+VOID
+CcWriteBehind(
+    IN PROS_VOLUME_CACHE Volume,
+    IN ULONG Target);
+
 NTSTATUS
 CcRosInternalFreeVacb(
     IN PROS_VACB Vacb);
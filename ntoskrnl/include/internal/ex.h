@@ -112,6 +112,32 @@ typedef struct _ETIMER
     LIST_ENTRY WakeTimerListEntry;
 } ETIMER, *PETIMER;
 
+//
+// Mid sized pool blocks also get lookaside lists, one per size class. The
+// classes are EXP_MEDIUM_POOL_GRANULARITY blocks apart and start right after
+// the small block lists of the PRCB. Sizes are in pool blocks.
+//
+#define EXP_MEDIUM_POOL_LISTS           12
+#define EXP_MEDIUM_POOL_GRANULARITY     8
+#define EXP_MEDIUM_POOL_MAXIMUM_DEPTH   64
+#define EXP_MEDIUM_POOL_BLOCK_SIZE(i)   \
+    (NUMBER_POOL_LOOKASIDE_LISTS + ((i) + 1) * EXP_MEDIUM_POOL_GRANULARITY)
+#define EXP_MEDIUM_POOL_INDEX(s)        \
+    (((s) - NUMBER_POOL_LOOKASIDE_LISTS - 1) / EXP_MEDIUM_POOL_GRANULARITY)
+#define EXP_MEDIUM_POOL_MAXIMUM_SIZE    EXP_MEDIUM_POOL_BLOCK_SIZE(EXP_MEDIUM_POOL_LISTS - 1)
+
+typedef struct _EXP_POOL_LOOKASIDE_LISTS
+{
+    GENERAL_LOOKASIDE SmallNPaged[NUMBER_POOL_LOOKASIDE_LISTS];
+    GENERAL_LOOKASIDE SmallPaged[NUMBER_POOL_LOOKASIDE_LISTS];
+    GENERAL_LOOKASIDE MediumNPaged[EXP_MEDIUM_POOL_LISTS];
+    GENERAL_LOOKASIDE MediumPaged[EXP_MEDIUM_POOL_LISTS];
+} EXP_POOL_LOOKASIDE_LISTS, *PEXP_POOL_LOOKASIDE_LISTS;
+
+extern GENERAL_LOOKASIDE ExpMediumNPagedPoolLookasideLists[];
+extern GENERAL_LOOKASIDE ExpMediumPagedPoolLookasideLists[];
+extern PEXP_POOL_LOOKASIDE_LISTS ExpProcessorPoolLookasideLists[];
+
 typedef struct
 {
     PCALLBACK_OBJECT *CallbackObject;
@@ -271,6 +297,14 @@ VOID
 NTAPI
 ExInitPoolLookasidePointers(VOID);
 
+VOID
+NTAPI
+ExpInitializePoolTagTables(VOID);
+
+VOID
+NTAPI
+ExpInitializeProcessorPoolLookasideLists(VOID);
+
 /* Callback Functions ********************************************************/
 
 VOID
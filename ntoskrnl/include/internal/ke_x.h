@@ -226,6 +226,30 @@ KiReleasePrcbLock(IN PKPRCB Prcb)
     UNREFERENCED_PARAMETER(Prcb);
 }
 
+//
+// This routine protects against multiple CPU acquires, it's meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiAcquireTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    UNREFERENCED_PARAMETER(FirstPrcb);
+    UNREFERENCED_PARAMETER(SecondPrcb);
+}
+
+//
+// This routine protects against multiple CPU acquires, it's meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiReleaseTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    UNREFERENCED_PARAMETER(FirstPrcb);
+    UNREFERENCED_PARAMETER(SecondPrcb);
+}
+
 //
 // This routine protects against multiple CPU acquires, it's meaningless on UP.
 //
@@ -469,6 +493,44 @@ KiReleasePrcbLock(IN PKPRCB Prcb)
     InterlockedAnd((PLONG)&Prcb->PrcbLock, 0);
 }
 
+//
+// This routine acquires the PRCB locks of two CPUs, lowest CPU number first
+// so that two CPUs locking the same pair can't deadlock.
+//
+FORCEINLINE
+VOID
+KiAcquireTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    /* Sanity check */
+    ASSERT(FirstPrcb != SecondPrcb);
+
+    /* Acquire them in CPU order */
+    if (FirstPrcb->Number < SecondPrcb->Number)
+    {
+        KiAcquirePrcbLock(FirstPrcb);
+        KiAcquirePrcbLock(SecondPrcb);
+    }
+    else
+    {
+        KiAcquirePrcbLock(SecondPrcb);
+        KiAcquirePrcbLock(FirstPrcb);
+    }
+}
+
+//
+// This routine releases the PRCB locks taken by KiAcquireTwoPrcbLocks.
+//
+FORCEINLINE
+VOID
+KiReleaseTwoPrcbLocks(IN PKPRCB FirstPrcb,
+                      IN PKPRCB SecondPrcb)
+{
+    /* Release them in any order */
+    KiReleasePrcbLock(FirstPrcb);
+    KiReleasePrcbLock(SecondPrcb);
+}
+
 //
 // This routine acquires the thread lock so that only one caller can touch
 // volatile thread data.
@@ -595,6 +657,32 @@ KiReleaseTimerLock(IN PKSPIN_LOCK_QUEUE LockQueue)
 
 #endif
 
+//
+// These routines add and remove the CPU from the idle summary, the set of
+// CPUs that the dispatcher can give a ready thread to without preempting.
+//
+FORCEINLINE
+VOID
+KiSetIdleSummary(IN PKPRCB Prcb)
+{
+#ifdef _WIN64
+    InterlockedOr64((PLONG64)&KiIdleSummary, Prcb->SetMember);
+#else
+    InterlockedOr((PLONG)&KiIdleSummary, Prcb->SetMember);
+#endif
+}
+
+FORCEINLINE
+VOID
+KiClearIdleSummary(IN PKPRCB Prcb)
+{
+#ifdef _WIN64
+    InterlockedAnd64((PLONG64)&KiIdleSummary, ~(LONG64)Prcb->SetMember);
+#else
+    InterlockedAnd((PLONG)&KiIdleSummary, ~(LONG)Prcb->SetMember);
+#endif
+}
+
 FORCEINLINE
 VOID
 KiAcquireApcLock(IN PKTHREAD Thread,
@@ -1389,13 +1477,14 @@ KxQueueReadyThread(IN PKTHREAD Thread,
     }
     else
     {
-        /* Otherwise, prepare this thread to be deferred */
-        Thread->State = DeferredReady;
-        Thread->DeferredProcessor = Prcb->Number;
-
-        /* Release the lock and defer scheduling */
+        /*
+         * Otherwise, add this thread to the deferred ready list. It is still
+         * switching out here, so it can only be given to another CPU once
+         * the swap is done. Request a DPC interrupt to process it then.
+         */
+        KiInsertDeferredReadyList(Thread);
         KiReleasePrcbLock(Prcb);
-        KiDeferredReadyThread(Thread);
+        HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
     }
 }
 
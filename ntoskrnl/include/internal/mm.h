@@ -45,7 +45,7 @@ extern PMMPTE MmDebugPte; // internal
 struct _KTRAP_FRAME;
 struct _EPROCESS;
 struct _MM_RMAP_ENTRY;
-typedef ULONG_PTR SWAPENTRY;
+typedef ULONG_PTR SWAPENTRY, *PSWAPENTRY;
 
 //
 // MmDbgCopyMemory Flags
@@ -242,6 +242,31 @@ typedef struct _MM_RMAP_ENTRY
 }
 MM_RMAP_ENTRY, *PMM_RMAP_ENTRY;
 
+/* Number of dirty pages the balancer gathers into one paging file write */
+#define MI_PAGEOUT_CLUSTER_SIZE 16
+
+typedef struct _MM_PAGEOUT_PAGE
+{
+    PMMSUPPORT AddressSpace;
+    PMEMORY_AREA MemoryArea;
+    PVOID Address;
+    PMM_SECTION_SEGMENT Segment;
+    LARGE_INTEGER Offset;
+    ULONG_PTR Entry;            // Section entry to put back for private pages
+    PFN_NUMBER Page;
+    SWAPENTRY SwapEntry;
+    BOOLEAN Private;
+} MM_PAGEOUT_PAGE, *PMM_PAGEOUT_PAGE;
+
+typedef struct _MM_PAGEOUT_CLUSTER
+{
+    ULONG Count;
+    ULONG ReservedCount;        // Paging file slots allocated in one go...
+    ULONG NextReserved;         // ...and the first one not handed out yet
+    SWAPENTRY Reserved[MI_PAGEOUT_CLUSTER_SIZE];
+    MM_PAGEOUT_PAGE Pages[MI_PAGEOUT_CLUSTER_SIZE];
+} MM_PAGEOUT_CLUSTER, *PMM_PAGEOUT_CLUSTER;
+
 #if MI_TRACE_PFNS
 extern ULONG MI_PFN_CURRENT_USAGE;
 extern CHAR MI_PFN_CURRENT_PROCESS_NAME[16];
@@ -602,6 +627,13 @@ SWAPENTRY
 NTAPI
 MmAllocSwapPage(VOID);
 
+ULONG
+NTAPI
+MmAllocSwapPages(
+    ULONG Count,
+    PSWAPENTRY Entries
+);
+
 VOID
 NTAPI
 MmFreeSwapPage(SWAPENTRY Entry);
@@ -628,6 +660,14 @@ MmWriteToSwapPage(
     PFN_NUMBER Page
 );
 
+NTSTATUS
+NTAPI
+MmWriteToSwapPages(
+    PSWAPENTRY SwapEntries,
+    PPFN_NUMBER Pages,
+    ULONG Count
+);
+
 VOID
 NTAPI
 MmShowOutOfSpaceMessagePagingFile(VOID);
@@ -868,6 +908,17 @@ NTSTATUS
 NTAPI
 MmPageOutPhysicalAddress(PFN_NUMBER Page);
 
+NTSTATUS
+NTAPI
+MmPageOutPhysicalAddressCluster(
+    PFN_NUMBER Page,
+    PMM_PAGEOUT_CLUSTER Cluster
+);
+
+VOID
+NTAPI
+MmFlushPageOutCluster(PMM_PAGEOUT_CLUSTER Cluster);
+
 /* freelist.c **********************************************************/
 
 FORCEINLINE
@@ -1305,7 +1356,15 @@ MmPageOutSectionView(
     PMMSUPPORT AddressSpace,
     PMEMORY_AREA MemoryArea,
     PVOID Address,
-    ULONG_PTR Entry
+    ULONG_PTR Entry,
+    PMM_PAGEOUT_CLUSTER Cluster
+);
+
+NTSTATUS
+NTAPI
+MmFinishPageOutSectionView(
+    PMM_PAGEOUT_PAGE PageOut,
+    NTSTATUS WriteStatus
 );
 
 NTSTATUS
@@ -112,7 +112,12 @@ KiSystemStartupBootStack(VOID)
 
     /* If there's no thread scheduled, put this CPU in the Idle summary */
     KiAcquirePrcbLock(Prcb);
-    if (!Prcb->NextThread) KiIdleSummary |= (ULONG_PTR)1 << Prcb->Number;
+    if (!Prcb->NextThread)
+    {
+        /* Let it look for work on the other CPUs too */
+        KiSetIdleSummary(Prcb);
+        Prcb->IdleSchedule = TRUE;
+    }
     KiReleasePrcbLock(Prcb);
 
     /* Raise back to HIGH_LEVEL and clear the PRCB for the loader block */
@@ -52,23 +52,36 @@ KiDpcInterruptHandler(VOID)
     }
     else if (Prcb->NextThread)
     {
+        /* Lock the PRCB, another CPU may take the next thread away */
+        KiAcquirePrcbLock(Prcb);
+
         /* Capture current thread data */
         OldThread = Prcb->CurrentThread;
         NewThread = Prcb->NextThread;
+        if (NewThread)
+        {
+            /* Keep other CPUs off the old thread until its context is saved */
+            KiSetThreadSwapBusy(OldThread);
 
-        /* Set new thread data */
-        Prcb->NextThread = NULL;
-        Prcb->CurrentThread = NewThread;
+            /* Set new thread data */
+            Prcb->NextThread = NULL;
+            Prcb->CurrentThread = NewThread;
 
-        /* The thread is now running */
-        NewThread->State = Running;
-        OldThread->WaitReason = WrDispatchInt;
+            /* The thread is now running */
+            NewThread->State = Running;
+            OldThread->WaitReason = WrDispatchInt;
 
-        /* Make the old thread ready */
-        KxQueueReadyThread(OldThread, Prcb);
+            /* Make the old thread ready */
+            KxQueueReadyThread(OldThread, Prcb);
 
-        /* Swap to the new thread */
-        KiSwapContext(APC_LEVEL, OldThread);
+            /* Swap to the new thread */
+            KiSwapContext(APC_LEVEL, OldThread);
+        }
+        else
+        {
+            /* It was taken away, keep running the current thread */
+            KiReleasePrcbLock(Prcb);
+        }
     }
 
     /* Go back to old irql and disable interrupts */
@@ -86,6 +99,39 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesNonTemporal(IN PVOID Address,
+                       IN ULONG Size)
+{
+    PULONG64 Current, End;
+
+    ASSERT((Size % PAGE_SIZE) == 0);
+
+    /*
+     * Write around the caches with MOVNTI, for pages nobody is waiting on.
+     * Every x64 processor has it.
+     */
+    End = (PULONG64)((ULONG_PTR)Address + Size);
+    for (Current = Address; Current < End; Current += 4)
+    {
+#ifdef _MSC_VER
+        _mm_stream_si64x((__int64*)&Current[0], 0);
+        _mm_stream_si64x((__int64*)&Current[1], 0);
+        _mm_stream_si64x((__int64*)&Current[2], 0);
+        _mm_stream_si64x((__int64*)&Current[3], 0);
+#else
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[0]) : "r"(0ULL));
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[1]) : "r"(0ULL));
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[2]) : "r"(0ULL));
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[3]) : "r"(0ULL));
+#endif
+    }
+
+    /* Make the stores visible before the pages are handed out */
+    _mm_sfence();
+}
+
 PVOID
 NTAPI
 KeSwitchKernelStack(PVOID StackBase, PVOID StackLimit)
@@ -136,15 +182,27 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Look for a thread the other CPUs have ready if none was given to us */
+        if ((Prcb->IdleSchedule) && !(Prcb->NextThread)) KiIdleSchedule(Prcb);
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
             /* Enable interrupts */
             _enable();
 
+            /* Lock the PRCB, the dispatcher may be changing the next thread */
+            KiAcquirePrcbLock(Prcb);
+
             /* Capture current thread data */
             OldThread = Prcb->CurrentThread;
             NewThread = Prcb->NextThread;
+            if (!NewThread)
+            {
+                /* It was taken away again, stay idle */
+                KiReleasePrcbLock(Prcb);
+                continue;
+            }
 
             /* Set new thread data */
             Prcb->NextThread = NULL;
@@ -153,6 +211,11 @@ KiIdleLoop(VOID)
             /* The thread is now running */
             NewThread->State = Running;
 
+            /* We are not idle anymore */
+            Prcb->IdleSchedule = FALSE;
+            KiClearIdleSummary(Prcb);
+            KiReleasePrcbLock(Prcb);
+
             /* Do the swap at SYNCH_LEVEL */
             KfRaiseIrql(SYNCH_LEVEL);
 
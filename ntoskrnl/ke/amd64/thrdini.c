@@ -183,6 +183,9 @@ KiSwapContextResume(
                      0);
     }
 
+    /* We are off the old thread's stack, so other CPUs may switch to it now */
+    OldThread->SwapBusy = FALSE;
+
     /* Kernel APCs may be pending */
     if (NewThread->ApcState.KernelApcPending)
     {
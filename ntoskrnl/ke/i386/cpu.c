@@ -1138,6 +1138,47 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesNonTemporal(IN PVOID Address,
+                       IN ULONG Size)
+{
+    PULONG Current, End;
+
+    ASSERT((Size % PAGE_SIZE) == 0);
+
+    /* Non-temporal stores came with SSE2 */
+    if (!(KeFeatureBits & KF_XMMI64))
+    {
+        RtlZeroMemory(Address, Size);
+        return;
+    }
+
+    /*
+     * Write around the caches with MOVNTI, for pages nobody is waiting on.
+     * It only needs general purpose registers, so there's no FPU state to
+     * worry about.
+     */
+    End = (PULONG)((ULONG_PTR)Address + Size);
+    for (Current = Address; Current < End; Current += 4)
+    {
+#ifdef _MSC_VER
+        _mm_stream_si32((int*)&Current[0], 0);
+        _mm_stream_si32((int*)&Current[1], 0);
+        _mm_stream_si32((int*)&Current[2], 0);
+        _mm_stream_si32((int*)&Current[3], 0);
+#else
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[0]) : "r"(0));
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[1]) : "r"(0));
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[2]) : "r"(0));
+        __asm__ __volatile__("movnti %1, %0" : "=m"(Current[3]) : "r"(0));
+#endif
+    }
+
+    /* Make the stores visible before the pages are handed out */
+    _mm_sfence();
+}
+
 VOID
 NTAPI
 KiSaveProcessorState(IN PKTRAP_FRAME TrapFrame,
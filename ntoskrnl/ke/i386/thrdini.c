@@ -294,15 +294,27 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Look for a thread the other CPUs have ready if none was given to us */
+        if ((Prcb->IdleSchedule) && !(Prcb->NextThread)) KiIdleSchedule(Prcb);
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
             /* Enable interrupts */
             _enable();
 
+            /* Lock the PRCB, the dispatcher may be changing the next thread */
+            KiAcquirePrcbLock(Prcb);
+
             /* Capture current thread data */
             OldThread = Prcb->CurrentThread;
             NewThread = Prcb->NextThread;
+            if (!NewThread)
+            {
+                /* It was taken away again, stay idle */
+                KiReleasePrcbLock(Prcb);
+                continue;
+            }
 
             /* Set new thread data */
             Prcb->NextThread = NULL;
@@ -311,6 +323,11 @@ KiIdleLoop(VOID)
             /* The thread is now running */
             NewThread->State = Running;
 
+            /* We are not idle anymore */
+            Prcb->IdleSchedule = FALSE;
+            KiClearIdleSummary(Prcb);
+            KiReleasePrcbLock(Prcb);
+
             /* Switch away from the idle thread */
             KiSwapContext(APC_LEVEL, OldThread);
         }
@@ -391,6 +408,9 @@ KiSwapContextExit(IN PKTHREAD OldThread,
                      0);
     }
 
+    /* We are off the old thread's stack, so other CPUs may switch to it now */
+    OldThread->SwapBusy = FALSE;
+
     /* Kernel APCs may be pending */
     if (NewThread->ApcState.KernelApcPending)
     {
@@ -438,6 +458,9 @@ KiSwapContextEntry(IN PKSWITCHFRAME SwitchFrame,
     /* Get the old thread and set its kernel stack */
     OldThread->KernelStack = SwitchFrame;
 
+    /* Wait until the CPU the new thread last ran on is off its stack */
+    while (NewThread->SwapBusy) YieldProcessor();
+
     /* ISRs can change FPU state, so disable interrupts while checking */
     _disable();
 
@@ -493,23 +516,36 @@ KiDispatchInterrupt(VOID)
     }
     else if (Prcb->NextThread)
     {
+        /* Lock the PRCB, another CPU may take the next thread away */
+        KiAcquirePrcbLock(Prcb);
+
         /* Capture current thread data */
         OldThread = Prcb->CurrentThread;
         NewThread = Prcb->NextThread;
+        if (NewThread)
+        {
+            /* Keep other CPUs off the old thread until its context is saved */
+            KiSetThreadSwapBusy(OldThread);
 
-        /* Set new thread data */
-        Prcb->NextThread = NULL;
-        Prcb->CurrentThread = NewThread;
+            /* Set new thread data */
+            Prcb->NextThread = NULL;
+            Prcb->CurrentThread = NewThread;
 
-        /* The thread is now running */
-        NewThread->State = Running;
-        OldThread->WaitReason = WrDispatchInt;
+            /* The thread is now running */
+            NewThread->State = Running;
+            OldThread->WaitReason = WrDispatchInt;
 
-        /* Make the old thread ready */
-        KxQueueReadyThread(OldThread, Prcb);
+            /* Make the old thread ready */
+            KxQueueReadyThread(OldThread, Prcb);
 
-        /* Swap to the new thread */
-        KiSwapContext(APC_LEVEL, OldThread);
+            /* Swap to the new thread */
+            KiSwapContext(APC_LEVEL, OldThread);
+        }
+        else
+        {
+            /* It was taken away, keep running the current thread */
+            KiReleasePrcbLock(Prcb);
+        }
     }
 }
 
@@ -30,19 +30,24 @@ ULONG KiMask32Array[MAXIMUM_PRIORITY] =
 UCHAR
 NTAPI
 KeFindNextRightSetAffinity(IN UCHAR Number,
-                           IN ULONG Set)
+                           IN KAFFINITY Set)
 {
-    ULONG Bit, Result;
+    KAFFINITY Bit;
+    ULONG Result;
     ASSERT(Set != 0);
 
     /* Calculate the mask */
-    Bit = (AFFINITY_MASK(Number) - 1) & Set;
+    Bit = ((KAFFINITY)AFFINITY_MASK(Number) - 1) & Set;
 
     /* If it's 0, use the one we got */
     if (!Bit) Bit = Set;
 
     /* Now find the right set and return it */
+#ifdef _WIN64
+    BitScanReverse64(&Result, Bit);
+#else
     BitScanReverse(&Result, Bit);
+#endif
     return (UCHAR)Result;
 }
 
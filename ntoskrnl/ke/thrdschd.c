@@ -12,14 +12,6 @@
 #define NDEBUG
 #include <debug.h>
 
-#ifdef _WIN64
-# define InterlockedOrSetMember(Destination, SetMember) \
-    InterlockedOr64((PLONG64)Destination, SetMember);
-#else
-# define InterlockedOrSetMember(Destination, SetMember) \
-    InterlockedOr((PLONG)Destination, SetMember);
-#endif
-
 /* GLOBALS *******************************************************************/
 
 ULONG_PTR KiIdleSummary;
@@ -27,13 +19,115 @@ ULONG_PTR KiIdleSMTSummary;
 
 /* FUNCTIONS *****************************************************************/
 
+static
+UCHAR
+KiSelectCandidateProcessor(IN PKTHREAD Thread,
+                           IN KAFFINITY Set)
+{
+    ASSERT(Set != 0);
+
+    /* Prefer the ideal processor */
+    if (Set & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+
+    /* Then the one the thread last ran on, its cache may still be warm */
+    if (Set & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+
+    /* Otherwise take the next one after the ideal processor */
+    return KeFindNextRightSetAffinity(Thread->IdealProcessor, Set);
+}
+
+static
+PKTHREAD
+KiFindStealableThread(IN PKPRCB Prcb,
+                      IN PKPRCB TargetPrcb)
+{
+    ULONG PrioritySet;
+    LONG HighPriority;
+    PLIST_ENTRY ListHead, ListEntry;
+    PKTHREAD Thread;
+
+    /* Go from the highest priority down */
+    PrioritySet = TargetPrcb->ReadySummary;
+    while (PrioritySet)
+    {
+        BitScanReverse((PULONG)&HighPriority, PrioritySet);
+        PrioritySet ^= PRIORITY_MASK(HighPriority);
+
+        /* Look for the first thread that is allowed to run on this CPU */
+        ListHead = &TargetPrcb->DispatcherReadyListHead[HighPriority];
+        for (ListEntry = ListHead->Flink;
+             ListEntry != ListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Thread = CONTAINING_RECORD(ListEntry, KTHREAD, WaitListEntry);
+            ASSERT(Thread->NextProcessor == TargetPrcb->Number);
+            if (!(Thread->Affinity & Prcb->SetMember)) continue;
+
+            /* Leave threads that are still switching out on their CPU */
+            if (Thread->SwapBusy) continue;
+
+            /* Remove it from the list */
+            if (RemoveEntryList(&Thread->WaitListEntry))
+            {
+                /* The list is empty now, reset the ready summary */
+                TargetPrcb->ReadySummary ^= PRIORITY_MASK(HighPriority);
+            }
+
+            return Thread;
+        }
+    }
+
+    /* Nothing this CPU can run */
+    return NULL;
+}
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
-    return NULL;
+    PKPRCB TargetPrcb;
+    PKTHREAD Thread = NULL;
+    ULONG Number, Count;
+
+    /* Only the idle loop looks for work */
+    ASSERT(Prcb->CurrentThread == Prcb->IdleThread);
+
+    /* Go through the other CPUs, starting with the next one */
+    Number = Prcb->Number;
+    for (Count = 1; Count < (ULONG)KeNumberProcessors; Count++)
+    {
+        if (++Number == (ULONG)KeNumberProcessors) Number = 0;
+
+        /* Skip CPUs with nothing ready without touching their lock */
+        TargetPrcb = KiProcessorBlock[Number];
+        if (!(TargetPrcb) || !(TargetPrcb->ReadySummary)) continue;
+
+        /* Lock both CPUs, and give up if we got a thread meanwhile */
+        KiAcquireTwoPrcbLocks(Prcb, TargetPrcb);
+        if (Prcb->NextThread)
+        {
+            KiReleaseTwoPrcbLocks(Prcb, TargetPrcb);
+            break;
+        }
+
+        /* Take the best thread it has for us */
+        Thread = KiFindStealableThread(Prcb, TargetPrcb);
+        if (Thread)
+        {
+            /* Leave the idle summary and make it our next thread */
+            KiClearIdleSummary(Prcb);
+            Thread->NextProcessor = Prcb->Number;
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
+        }
+
+        /* Release the locks and stop if we found one */
+        KiReleaseTwoPrcbLocks(Prcb, TargetPrcb);
+        if (Thread) break;
+    }
+
+    /* Return the thread we will switch to, if any */
+    return Thread;
 }
 
 VOID
@@ -80,7 +174,8 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
 {
     PKPRCB Prcb;
     BOOLEAN Preempted;
-    ULONG Processor = 0;
+    ULONG Processor;
+    KAFFINITY Affinity, IdleSet;
     KPRIORITY OldPriority;
     PKTHREAD NextThread;
 
@@ -228,24 +323,66 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     OldPriority = Thread->Priority;
     Thread->Preempted = FALSE;
 
-    /* Queue the thread on CPU 0 and get the PRCB and lock it */
-    Thread->NextProcessor = 0;
-    Prcb = KiProcessorBlock[0];
-    KiAcquirePrcbLock(Prcb);
+    /* Only look at the processors the thread may run on */
+    Affinity = Thread->Affinity & KeActiveProcessors;
+    ASSERT(Affinity != 0);
 
-    /* Check if we have an idle summary */
-    if (KiIdleSummary)
+    /* Check if the thread is still switching out on its last processor */
+    if (Thread->SwapBusy)
     {
-        /* Clear it and set this thread as the next one */
-        KiIdleSummary = 0;
-        Thread->State = Standby;
-        Prcb->NextThread = Thread;
+        if (Affinity & AFFINITY_MASK(Thread->NextProcessor))
+        {
+            /* No other processor may switch to it yet, so keep it there */
+            Affinity = AFFINITY_MASK(Thread->NextProcessor);
+        }
+        else
+        {
+            /* It has to move, wait until its context is saved */
+            ASSERT(Thread != KeGetCurrentThread());
+            while (Thread->SwapBusy) YieldProcessor();
+        }
+    }
+
+    /* Give the thread to an idle processor if there is one */
+    IdleSet = KiIdleSummary & Affinity;
+    while (IdleSet)
+    {
+        /* Get the PRCB of the best one and lock it */
+        Processor = KiSelectCandidateProcessor(Thread, IdleSet);
+        Prcb = KiProcessorBlock[Processor];
+        KiAcquirePrcbLock(Prcb);
+
+        /* Make sure it is still idle and nobody gave it a thread yet */
+        if ((KiIdleSummary & AFFINITY_MASK(Processor)) && !(Prcb->NextThread))
+        {
+            /* Take it out of the idle summary and set this thread as the next one */
+            KiClearIdleSummary(Prcb);
+            Thread->NextProcessor = (UCHAR)Processor;
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
 
-        /* Unlock the PRCB and return */
+            /* Release the lock */
+            KiReleasePrcbLock(Prcb);
+
+            /* Check if we're running on another CPU */
+            if (KeGetCurrentProcessorNumber() != Processor)
+            {
+                /* We are, send an IPI to wake it up */
+                KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+            }
+            return;
+        }
+
+        /* Another CPU got there first, try the others that are still idle */
         KiReleasePrcbLock(Prcb);
-        return;
+        IdleSet &= KiIdleSummary & ~AFFINITY_MASK(Processor);
     }
 
+    /* All of them are busy, queue the thread on the best one and lock it */
+    Processor = KiSelectCandidateProcessor(Thread, Affinity);
+    Prcb = KiProcessorBlock[Processor];
+    KiAcquirePrcbLock(Prcb);
+
     /* Set the CPU number */
     Thread->NextProcessor = (UCHAR)Processor;
 
@@ -336,12 +473,9 @@ KiSelectNextThread(IN PKPRCB Prcb)
         /* Didn't find any, get the current idle thread */
         Thread = Prcb->IdleThread;
 
-        /* Enable idle scheduling */
-        InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+        /* Enable idle scheduling, the idle loop will look at the other CPUs */
+        KiSetIdleSummary(Prcb);
         Prcb->IdleSchedule = TRUE;
-
-        /* FIXME: SMT support */
-        ASSERTMSG("SMP: Not yet implemented\n", FALSE);
     }
 
     /* Sanity checks and return the thread */
@@ -385,8 +519,9 @@ KiSwapThread(IN PKTHREAD CurrentThread,
         }
         else
         {
-            /* Set the idle summary */
-            InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+            /* Set the idle summary and enable idle scheduling */
+            KiSetIdleSummary(Prcb);
+            Prcb->IdleSchedule = TRUE;
 
             /* Schedule the idle thread */
             NextThread = Prcb->IdleThread;
@@ -402,8 +537,24 @@ KiSwapThread(IN PKTHREAD CurrentThread,
     /* Save the wait IRQL */
     WaitIrql = CurrentThread->WaitIrql;
 
-    /* Swap contexts */
-    ApcState = KiSwapContext(WaitIrql, CurrentThread);
+    /* Check if we were readied again on this CPU before we could switch out */
+    if (NextThread == CurrentThread)
+    {
+        /* Keep running, there is no context to save */
+        CurrentThread->SwapBusy = FALSE;
+
+        /* Kernel APCs may have been queued meanwhile, request their delivery */
+        if ((CurrentThread->ApcState.KernelApcPending) &&
+            !(CurrentThread->SpecialApcDisable))
+        {
+            HalRequestSoftwareInterrupt(APC_LEVEL);
+        }
+    }
+    else
+    {
+        /* Swap contexts */
+        ApcState = KiSwapContext(WaitIrql, CurrentThread);
+    }
 
     /* Get the wait status */
     WaitStatus = CurrentThread->WaitStatus;
@@ -680,6 +831,122 @@ KiSetPriorityThread(IN PKTHREAD Thread,
     }
 }
 
+static
+VOID
+KiMoveThreadToAffinity(IN PKTHREAD Thread)
+{
+    PKPRCB Prcb;
+    ULONG Processor;
+    PKTHREAD NewThread;
+    BOOLEAN RequestInterrupt = FALSE;
+
+    /* Loop in case the thread changes state under us */
+    for (;;)
+    {
+        /* Nothing to do if the thread may stay where it is */
+        Processor = Thread->NextProcessor;
+        if (Thread->Affinity & AFFINITY_MASK(Processor)) break;
+
+        /* Choose action based on thread's state */
+        if ((Thread->State == Ready) && !(Thread->ProcessReadyQueue))
+        {
+            /* Get the PRCB for the thread and lock it */
+            Prcb = KiProcessorBlock[Processor];
+            KiAcquirePrcbLock(Prcb);
+
+            /* Make sure the thread is still ready and on this CPU */
+            if ((Thread->State == Ready) &&
+                (Thread->NextProcessor == Prcb->Number))
+            {
+                /* Remove it from the current queue */
+                if (RemoveEntryList(&Thread->WaitListEntry))
+                {
+                    /* Update the ready summary */
+                    Prcb->ReadySummary ^= PRIORITY_MASK(Thread->Priority);
+                }
+
+                /* Dispatch it again, to a CPU it may use */
+                KiInsertDeferredReadyList(Thread);
+                KiReleasePrcbLock(Prcb);
+            }
+            else
+            {
+                /* Release the lock and loop again */
+                KiReleasePrcbLock(Prcb);
+                continue;
+            }
+        }
+        else if (Thread->State == Standby)
+        {
+            /* Get the PRCB for the thread and lock it */
+            Prcb = KiProcessorBlock[Processor];
+            KiAcquirePrcbLock(Prcb);
+
+            /* Check if we're still the next thread to run */
+            if (Thread == Prcb->NextThread)
+            {
+                /* Find another thread for the CPU, if it has one */
+                NewThread = KiSelectReadyThread(0, Prcb);
+                if (NewThread) NewThread->State = Standby;
+                Prcb->NextThread = NewThread;
+
+                /* An idle CPU that lost its thread is idle again */
+                if (!(NewThread) && (Prcb->CurrentThread == Prcb->IdleThread))
+                {
+                    KiSetIdleSummary(Prcb);
+                }
+
+                /* Dispatch our thread again */
+                KiInsertDeferredReadyList(Thread);
+                KiReleasePrcbLock(Prcb);
+            }
+            else
+            {
+                /* Release the lock and try again */
+                KiReleasePrcbLock(Prcb);
+                continue;
+            }
+        }
+        else if (Thread->State == Running)
+        {
+            /* Get the PRCB for the thread and lock it */
+            Prcb = KiProcessorBlock[Processor];
+            KiAcquirePrcbLock(Prcb);
+
+            /* Check if we're still the current thread running */
+            if (Thread == Prcb->CurrentThread)
+            {
+                /* Switch the CPU to another thread unless one is already set */
+                if (!Prcb->NextThread)
+                {
+                    NewThread = KiSelectNextThread(Prcb);
+                    NewThread->State = Standby;
+                    Prcb->NextThread = NewThread;
+                    RequestInterrupt = TRUE;
+                }
+
+                /* Release the lock and check if we need an interrupt */
+                KiReleasePrcbLock(Prcb);
+                if ((RequestInterrupt) &&
+                    (KeGetCurrentProcessorNumber() != Processor))
+                {
+                    /* We are on another CPU, send an IPI */
+                    KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+                }
+            }
+            else
+            {
+                /* Thread changed, release lock and restart */
+                KiReleasePrcbLock(Prcb);
+                continue;
+            }
+        }
+
+        /* If we got here, then thread state was consistent, so bail out */
+        break;
+    }
+}
+
 KAFFINITY
 FASTCALL
 KiSetAffinityThread(IN PKTHREAD Thread,
@@ -701,13 +968,24 @@ KiSetAffinityThread(IN PKTHREAD Thread,
     /* Update the new affinity */
     Thread->UserAffinity = Affinity;
 
+    /* Check if the ideal processor is still allowed */
+    if (!(Affinity & AFFINITY_MASK(Thread->UserIdealProcessor)))
+    {
+        /* It's not, pick the next one that is */
+        Thread->UserIdealProcessor =
+            KeFindNextRightSetAffinity(Thread->UserIdealProcessor,
+                                       Affinity & KeActiveProcessors);
+    }
+
     /* Check if system affinity is disabled */
     if (!Thread->SystemAffinityActive)
     {
-#ifdef CONFIG_SMP
-        /* FIXME: TODO */
-        DPRINT1("Affinity support disabled!\n");
-#endif
+        /* Make the new affinity effective */
+        Thread->Affinity = Affinity;
+        Thread->IdealProcessor = Thread->UserIdealProcessor;
+
+        /* Move the thread away from a CPU it can't use anymore */
+        KiMoveThreadToAffinity(Thread);
     }
 
     /* Return the old affinity */
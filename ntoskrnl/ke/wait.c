@@ -232,6 +232,13 @@ KiExitDispatcher(IN KIRQL OldIrql)
     NextThread = Prcb->NextThread;
     Thread = Prcb->CurrentThread;
 
+    /* Another CPU may have taken the next thread away meanwhile */
+    if (!NextThread)
+    {
+        KiReleasePrcbLock(Prcb);
+        goto Quickie;
+    }
+
     /* Set current thread's swap busy to true */
     KiSetThreadSwapBusy(Thread);
 
@@ -38,6 +38,7 @@ PKGUARDED_MUTEX ExpPagedPoolMutex;
 SIZE_T PoolTrackTableSize, PoolTrackTableMask;
 SIZE_T PoolBigPageTableSize, PoolBigPageTableHash;
 PPOOL_TRACKER_TABLE PoolTrackTable;
+PPOOL_TRACKER_TABLE ExPoolTagTables[MAXIMUM_PROCESSORS];
 PPOOL_TRACKER_BIG_PAGES PoolBigPageTable;
 KSPIN_LOCK ExpTaggedPoolLock;
 ULONG PoolHitTag;
@@ -460,6 +461,52 @@ ExpComputePartialHashForAddress(IN PVOID BaseAddress)
     return (Result >> 24) ^ (Result >> 16) ^ (Result >> 8) ^ Result;
 }
 
+FORCEINLINE
+PPOOL_TRACKER_TABLE
+ExpGetPoolTagTable(VOID)
+{
+    PPOOL_TRACKER_TABLE Table;
+
+    //
+    // Tags live in PoolTrackTable, but each processor keeps its own counters
+    // at the same index so that busy tags don't bounce cache lines between
+    // processors. Until the processor has its table, the counters also go to
+    // PoolTrackTable
+    //
+    Table = ExPoolTagTables[KeGetCurrentProcessorNumber()];
+    return Table ? Table : PoolTrackTable;
+}
+
+static
+VOID
+ExpGetPoolTagTotals(IN SIZE_T Index,
+                    OUT PPOOL_TRACKER_TABLE Totals)
+{
+    PPOOL_TRACKER_TABLE TableEntry;
+    ULONG i;
+
+    //
+    // Start with the tag and the counters kept in the shared table
+    //
+    *Totals = PoolTrackTable[Index];
+
+    //
+    // And add the counters of every processor
+    //
+    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    {
+        if (!ExPoolTagTables[i]) continue;
+
+        TableEntry = &ExPoolTagTables[i][Index];
+        Totals->NonPagedAllocs += TableEntry->NonPagedAllocs;
+        Totals->NonPagedFrees += TableEntry->NonPagedFrees;
+        Totals->NonPagedBytes += TableEntry->NonPagedBytes;
+        Totals->PagedAllocs += TableEntry->PagedAllocs;
+        Totals->PagedFrees += TableEntry->PagedFrees;
+        Totals->PagedBytes += TableEntry->PagedBytes;
+    }
+}
+
 #if DBG
 FORCEINLINE
 BOOLEAN
@@ -533,8 +580,10 @@ MiDumpPoolConsumers(BOOLEAN CalledFromDbg, ULONG Tag, ULONG Mask, ULONG Flags)
     for (i = 0; i < PoolTrackTableSize; ++i)
     {
         PPOOL_TRACKER_TABLE TableEntry;
+        POOL_TRACKER_TABLE Totals;
 
-        TableEntry = &PoolTrackTable[i];
+        ExpGetPoolTagTotals(i, &Totals);
+        TableEntry = &Totals;
 
         //
         // We only care about tags which have allocated memory
@@ -796,6 +845,11 @@ ExpRemovePoolTracker(IN ULONG Key,
         TableEntry = &Table[Hash];
         if (TableEntry->Key == Key)
         {
+            //
+            // Switch to this processor's counters for the tag
+            //
+            TableEntry = &ExpGetPoolTagTable()[Hash];
+
             //
             // Decrement the counters depending on if this was paged or nonpaged
             // pool
@@ -871,7 +925,6 @@ ExpInsertPoolTracker(IN ULONG Key,
     // ASSERT on ReactOS features not yet supported
     //
     ASSERT(!(PoolType & SESSION_POOL_MASK));
-    ASSERT(KeGetCurrentProcessorNumber() == 0);
 
     //
     // Why the double indirection? Because normally this function is also used
@@ -899,6 +952,11 @@ ExpInsertPoolTracker(IN ULONG Key,
         TableEntry = &Table[Hash];
         if (TableEntry->Key == Key)
         {
+            //
+            // Switch to this processor's counters for the tag
+            //
+            TableEntry = &ExpGetPoolTagTable()[Hash];
+
             //
             // Increment the counters depending on if this was paged or nonpaged
             // pool
@@ -1260,6 +1318,37 @@ InitializePool(IN POOL_TYPE PoolType,
     }
 }
 
+VOID
+NTAPI
+INIT_SECTION
+ExpInitializePoolTagTables(VOID)
+{
+    PPOOL_TRACKER_TABLE Table;
+    ULONG i;
+
+    //
+    // Now that all processors are running, give each of them its own tag
+    // counters. The tags themselves stay in PoolTrackTable
+    //
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Table = ExAllocatePoolWithTag(NonPagedPool,
+                                      PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE),
+                                      'looP');
+        if (!Table)
+        {
+            //
+            // This processor will keep counting in the shared table
+            //
+            DPRINT1("EXPOOL: No tag counters for processor %lu\n", i);
+            continue;
+        }
+
+        RtlZeroMemory(Table, PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE));
+        ExPoolTagTables[i] = Table;
+    }
+}
+
 FORCEINLINE
 KIRQL
 ExLockPool(IN PPOOL_DESCRIPTOR Descriptor)
@@ -1316,6 +1405,7 @@ ExpGetPoolTagInfoTarget(IN PKDPC Dpc,
                         IN PVOID SystemArgument2)
 {
     PPOOL_DPC_CONTEXT Context = DeferredContext;
+    SIZE_T i;
     UNREFERENCED_PARAMETER(Dpc);
     ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
 
@@ -1324,9 +1414,14 @@ ExpGetPoolTagInfoTarget(IN PKDPC Dpc,
     //
     if (KeSignalCallDpcSynchronize(SystemArgument2))
     {
-        RtlCopyMemory(Context->PoolTrackTable,
-                      PoolTrackTable,
-                      Context->PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE));
+        //
+        // Every processor is waiting in this DPC, so the counters can't move
+        // while we add them up
+        //
+        for (i = 0; i < Context->PoolTrackTableSize; i++)
+        {
+            ExpGetPoolTagTotals(i, &Context->PoolTrackTable[i]);
+        }
 
         //
         // This is here because ReactOS does not yet support expansion
@@ -1740,7 +1835,9 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
     USHORT BlockSize, i;
     ULONG OriginalType;
     PKPRCB Prcb = KeGetCurrentPrcb();
-    PGENERAL_LOOKASIDE LookasideList;
+    PGENERAL_LOOKASIDE LookasideList, GlobalList;
+    PEXP_POOL_LOOKASIDE_LISTS ProcessorLists;
+    ULONG Index;
 
     //
     // Some sanity checks
@@ -1908,24 +2005,61 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
     //
     // Handle lookaside list optimization for both paged and nonpaged pool
     //
+    LookasideList = NULL;
+    GlobalList = NULL;
     if (i <= NUMBER_POOL_LOOKASIDE_LISTS)
     {
         //
-        // Try popping it from the per-CPU lookaside list
+        // Small blocks have their lists in the PRCB
         //
         LookasideList = (PoolType == PagedPool) ?
                          Prcb->PPPagedLookasideList[i - 1].P :
                          Prcb->PPNPagedLookasideList[i - 1].P;
-        LookasideList->TotalAllocates++;
-        Entry = (PPOOL_HEADER)InterlockedPopEntrySList(&LookasideList->ListHead);
+        GlobalList = (PoolType == PagedPool) ?
+                      Prcb->PPPagedLookasideList[i - 1].L :
+                      Prcb->PPNPagedLookasideList[i - 1].L;
+    }
+    else if (i <= EXP_MEDIUM_POOL_MAXIMUM_SIZE)
+    {
+        //
+        // Mid sized blocks are rounded up to their size class, so that they
+        // can go back on the same lookaside list once they are freed
+        //
+        Index = EXP_MEDIUM_POOL_INDEX(i);
+        i = (USHORT)EXP_MEDIUM_POOL_BLOCK_SIZE(Index);
+        GlobalList = (PoolType == PagedPool) ?
+                      &ExpMediumPagedPoolLookasideLists[Index] :
+                      &ExpMediumNPagedPoolLookasideLists[Index];
+
+        //
+        // The per-CPU lists only exist once all processors are started
+        //
+        ProcessorLists = ExpProcessorPoolLookasideLists[Prcb->Number];
+        if (ProcessorLists)
+        {
+            LookasideList = (PoolType == PagedPool) ?
+                             &ProcessorLists->MediumPaged[Index] :
+                             &ProcessorLists->MediumNPaged[Index];
+        }
+    }
+
+    if (GlobalList)
+    {
+        //
+        // Try popping it from the per-CPU lookaside list
+        //
+        Entry = NULL;
+        if (LookasideList)
+        {
+            LookasideList->TotalAllocates++;
+            Entry = (PPOOL_HEADER)InterlockedPopEntrySList(&LookasideList->ListHead);
+        }
         if (!Entry)
         {
             //
             // We failed, try popping it from the global list
             //
-            LookasideList = (PoolType == PagedPool) ?
-                             Prcb->PPPagedLookasideList[i - 1].L :
-                             Prcb->PPNPagedLookasideList[i - 1].L;
+            LookasideList = GlobalList;
             LookasideList->TotalAllocates++;
             Entry = (PPOOL_HEADER)InterlockedPopEntrySList(&LookasideList->ListHead);
         }
@@ -2325,7 +2459,9 @@ ExFreePoolWithTag(IN PVOID P,
     BOOLEAN Combined = FALSE;
     PFN_NUMBER PageCount, RealPageCount;
     PKPRCB Prcb = KeGetCurrentPrcb();
-    PGENERAL_LOOKASIDE LookasideList;
+    PGENERAL_LOOKASIDE LookasideList, GlobalList;
+    PEXP_POOL_LOOKASIDE_LISTS ProcessorLists;
+    ULONG Index;
     PEPROCESS Process;
 
     //
@@ -2544,28 +2680,58 @@ ExFreePoolWithTag(IN PVOID P,
     //
     // Is this allocation small enough to have come from a lookaside list?
     //
+    LookasideList = NULL;
+    GlobalList = NULL;
     if (BlockSize <= NUMBER_POOL_LOOKASIDE_LISTS)
     {
-        //
-        // Try pushing it into the per-CPU lookaside list
-        //
         LookasideList = (PoolType == PagedPool) ?
                          Prcb->PPPagedLookasideList[BlockSize - 1].P :
                          Prcb->PPNPagedLookasideList[BlockSize - 1].P;
-        LookasideList->TotalFrees++;
-        if (ExQueryDepthSList(&LookasideList->ListHead) < LookasideList->Depth)
+        GlobalList = (PoolType == PagedPool) ?
+                      Prcb->PPPagedLookasideList[BlockSize - 1].L :
+                      Prcb->PPNPagedLookasideList[BlockSize - 1].L;
+    }
+    else if (BlockSize <= EXP_MEDIUM_POOL_MAXIMUM_SIZE)
+    {
+        //
+        // Only blocks of exactly the class size may go on a mid sized list
+        //
+        Index = EXP_MEDIUM_POOL_INDEX(BlockSize);
+        if (BlockSize == EXP_MEDIUM_POOL_BLOCK_SIZE(Index))
         {
-            LookasideList->FreeHits++;
-            InterlockedPushEntrySList(&LookasideList->ListHead, P);
-            return;
+            GlobalList = (PoolType == PagedPool) ?
+                          &ExpMediumPagedPoolLookasideLists[Index] :
+                          &ExpMediumNPagedPoolLookasideLists[Index];
+            ProcessorLists = ExpProcessorPoolLookasideLists[Prcb->Number];
+            if (ProcessorLists)
+            {
+                LookasideList = (PoolType == PagedPool) ?
+                                 &ProcessorLists->MediumPaged[Index] :
+                                 &ProcessorLists->MediumNPaged[Index];
+            }
+        }
+    }
+
+    if (GlobalList)
+    {
+        //
+        // Try pushing it into the per-CPU lookaside list
+        //
+        if (LookasideList)
+        {
+            LookasideList->TotalFrees++;
+            if (ExQueryDepthSList(&LookasideList->ListHead) < LookasideList->Depth)
+            {
+                LookasideList->FreeHits++;
+                InterlockedPushEntrySList(&LookasideList->ListHead, P);
+                return;
+            }
         }
 
         //
         // We failed, try to push it into the global lookaside list
         //
-        LookasideList = (PoolType == PagedPool) ?
-                         Prcb->PPPagedLookasideList[BlockSize - 1].L :
-                         Prcb->PPNPagedLookasideList[BlockSize - 1].L;
+        LookasideList = GlobalList;
         LookasideList->TotalFrees++;
         if (ExQueryDepthSList(&LookasideList->ListHead) < LookasideList->Depth)
         {
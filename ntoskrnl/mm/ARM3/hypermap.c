@@ -19,6 +19,7 @@
 
 PMMPTE MmFirstReservedMappingPte, MmLastReservedMappingPte;
 PMMPTE MiFirstReservedZeroingPte;
+PMMPTE MiReservedZeroingPtes[MAXIMUM_PROCESSORS];
 MMPTE HyperTemplatePte;
 PEPROCESS HyperProcess;
 KIRQL HyperIrql;
@@ -125,9 +126,12 @@ MiMapPagesInZeroSpace(IN PMMPFN Pfn1,
     ASSERT(NumberOfPages <= (MI_ZERO_PTES - 1));
 
     //
-    // Pick the first zeroing PTE
+    // Pick the first zeroing PTE of this processor. Each zero page thread
+    // is bound to its processor and has its own set, so no lock is needed
+    // and the local TB flush below is enough
     //
-    PointerPte = MiFirstReservedZeroingPte;
+    PointerPte = MiReservedZeroingPtes[KeGetCurrentProcessorNumber()];
+    ASSERT(PointerPte != NULL);
 
     //
     // Now get the first free PTE
@@ -539,6 +539,7 @@ extern PVOID MmSessionBase;
 extern SIZE_T MmSessionSize;
 extern PMMPTE MmFirstReservedMappingPte, MmLastReservedMappingPte;
 extern PMMPTE MiFirstReservedZeroingPte;
+extern PMMPTE MiReservedZeroingPtes[MAXIMUM_PROCESSORS];
 extern MI_PFN_CACHE_ATTRIBUTE MiPlatformCacheAttributes[2][MmMaximumCacheType];
 extern PPHYSICAL_MEMORY_DESCRIPTOR MmPhysicalMemoryBlock;
 extern SIZE_T MmBootImageSize;
@@ -612,8 +613,10 @@ extern PMMPDE MiHighestUserPde;
 extern PFN_NUMBER MmSystemPageDirectory[PD_COUNT];
 extern PMMPTE MmSharedUserDataPte;
 extern LIST_ENTRY MmProcessList;
-extern BOOLEAN MmZeroingPageThreadActive;
+extern ULONG MmZeroingPageThreadActive;
 extern KEVENT MmZeroingPageEvent;
+extern PFN_NUMBER MmZeroedPageTarget;
+extern ULONG MmZeroedPageTargetInMb;
 extern ULONG MmSystemPageColor;
 extern ULONG MmProcessColorSeed;
 extern PMMWSL MmWorkingSetList;
@@ -658,6 +661,18 @@ MiIsMemoryTypeInvisible(TYPE_OF_MEMORY MemoryType)
             (MemoryType == LoaderBBTMemory));
 }
 
+//
+// Returns whether the zero page threads should keep zeroing free pages
+//
+FORCEINLINE
+BOOLEAN
+MiIsZeroedPageListShort(VOID)
+{
+    /* Without a target, every free page gets zeroed */
+    return ((MmZeroedPageTarget == 0) ||
+            (MmZeroedPageListHead.Total < MmZeroedPageTarget));
+}
+
 #ifdef _M_AMD64
 FORCEINLINE
 BOOLEAN
@@ -2072,6 +2072,11 @@ MmArmInitSystem(IN ULONG Phase,
         /* Count physical pages on the system */
         MiScanMemoryDescriptors(LoaderBlock);
 
+        /* Convert the zeroed page target to pages, it can't be more than the RAM we have */
+        MmZeroedPageTarget = min((PFN_NUMBER)MmZeroedPageTargetInMb,
+                                 MmNumberOfPhysicalPages / (_1MB / PAGE_SIZE));
+        MmZeroedPageTarget *= (_1MB / PAGE_SIZE);
+
         /* Initialize the phase 0 temporary event */
         KeInitializeEvent(&MiTempEvent, NotificationEvent, FALSE);
 
@@ -2183,7 +2188,7 @@ MmArmInitSystem(IN ULONG Phase,
 
         /* Set the zero page event */
         KeInitializeEvent(&MmZeroingPageEvent, SynchronizationEvent, FALSE);
-        MmZeroingPageThreadActive = FALSE;
+        MmZeroingPageThreadActive = 0;
 
         /* Initialize the dead stack S-LIST */
         InitializeSListHead(&MmDeadStackSListHead);
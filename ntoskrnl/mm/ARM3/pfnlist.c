@@ -584,7 +584,16 @@ MiRemoveZeroPage(IN ULONG Color)
     ASSERT(Pfn1 == MI_PFN_ELEMENT(PageIndex));
 
     /* Zero it, if needed */
-    if (Zero) MiZeroPhysicalPage(PageIndex);
+    if (Zero)
+    {
+        MiZeroPhysicalPage(PageIndex);
+
+        /* The zeroed list ran dry, get the zero page threads going again */
+        if ((MmFreePageListHead.Total) && !(MmZeroingPageThreadActive))
+        {
+            KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
+        }
+    }
 
     /* Sanity checks */
     ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
@@ -701,7 +710,9 @@ MiInsertPageInFreeList(IN PFN_NUMBER PageFrameIndex)
     ColorTable->Count++;
 
     /* Notify zero page thread if enough pages are on the free list now */
-    if ((ListHead->Total >= 8) && !(MmZeroingPageThreadActive))
+    if ((ListHead->Total >= 8) &&
+        !(MmZeroingPageThreadActive) &&
+        (MiIsZeroedPageListShort()))
     {
         /* Set the event */
         KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
@@ -17,9 +17,21 @@
 
 /* GLOBALS ********************************************************************/
 
-BOOLEAN MmZeroingPageThreadActive;
+ULONG MmZeroingPageThreadActive;
 KEVENT MmZeroingPageEvent;
 
+/* Number of zeroed pages to keep around, 0 to zero every free page */
+PFN_NUMBER MmZeroedPageTarget;
+
+/* The same target as the registry gives it, in MB */
+ULONG MmZeroedPageTargetInMb;
+
+/* Number of free pages zeroed per PFN lock round trip */
+#define MI_ZERO_PAGE_BATCH 16
+C_ASSERT(MI_ZERO_PAGE_BATCH <= (MI_ZERO_PTES - 1));
+
+static ULONG MiZeroPageThreadCount;
+
 /* PRIVATE FUNCTIONS **********************************************************/
 
 VOID
@@ -32,53 +44,32 @@ NTAPI
 MiFreeInitializationCode(IN PVOID StartVa,
 IN PVOID EndVa);
 
+static
 VOID
-NTAPI
-MmZeroPageThread(VOID)
+MiZeroFreePages(VOID)
 {
-    PKTHREAD Thread = KeGetCurrentThread();
-    PVOID StartAddress, EndAddress;
-    PVOID WaitObjects[2];
     KIRQL OldIrql;
     PVOID ZeroAddress;
-    PFN_NUMBER PageIndex, FreePage;
-    PMMPFN Pfn1;
-
-    /* Get the discardable sections to free them */
-    MiFindInitializationCode(&StartAddress, &EndAddress);
-    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
-    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+    PFN_NUMBER PageIndex, FreePage, PageCount;
+    PMMPFN Pfn1, PfnList;
 
-    /* Set our priority to 0 */
-    Thread->BasePriority = 0;
-    KeSetPriorityThread(Thread, 0);
-
-    /* Setup the wait objects */
-    WaitObjects[0] = &MmZeroingPageEvent;
-//    WaitObjects[1] = &PoSystemIdleTimer; FIXME: Implement idle timer
+    OldIrql = MiAcquirePfnLock();
+    MmZeroingPageThreadActive++;
 
-    while (TRUE)
+    while ((MmFreePageListHead.Total) && (MiIsZeroedPageListShort()))
     {
-        KeWaitForMultipleObjects(1, // 2
-                                 WaitObjects,
-                                 WaitAny,
-                                 WrFreePage,
-                                 KernelMode,
-                                 FALSE,
-                                 NULL,
-                                 NULL);
-        OldIrql = MiAcquirePfnLock();
-        MmZeroingPageThreadActive = TRUE;
-
-        while (TRUE)
+        /* Get another zero page thread going if there's more than one batch */
+        if ((MmFreePageListHead.Total > MI_ZERO_PAGE_BATCH) &&
+            (MmZeroingPageThreadActive < MiZeroPageThreadCount))
         {
-            if (!MmFreePageListHead.Total)
-            {
-                MmZeroingPageThreadActive = FALSE;
-                MiReleasePfnLock(OldIrql);
-                break;
-            }
+            KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
+        }
 
+        /* Take a batch of free pages, chained through their Flink for the mapping */
+        PfnList = (PMMPFN)LIST_HEAD;
+        PageCount = 0;
+        while ((PageCount < MI_ZERO_PAGE_BATCH) && (MmFreePageListHead.Total))
+        {
             PageIndex = MmFreePageListHead.Flink;
             ASSERT(PageIndex != LIST_HEAD);
             Pfn1 = MiGetPfnEntry(PageIndex);
@@ -96,19 +87,121 @@ MmZeroPageThread(VOID)
                              0);
             }
 
-            Pfn1->u1.Flink = LIST_HEAD;
-            MiReleasePfnLock(OldIrql);
+            Pfn1->u1.Flink = (ULONG_PTR)PfnList;
+            PfnList = Pfn1;
+            PageCount++;
+        }
+        MiReleasePfnLock(OldIrql);
 
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, 1);
-            ASSERT(ZeroAddress);
-            RtlZeroMemory(ZeroAddress, PAGE_SIZE);
-            MiUnmapPagesInZeroSpace(ZeroAddress, 1);
+        /* Zero the whole batch through one mapping, around the caches
+           since nobody is waiting for these pages */
+        ZeroAddress = MiMapPagesInZeroSpace(PfnList, PageCount);
+        ASSERT(ZeroAddress);
+        KeZeroPagesNonTemporal(ZeroAddress, PageCount * PAGE_SIZE);
+        MiUnmapPagesInZeroSpace(ZeroAddress, PageCount);
 
-            OldIrql = MiAcquirePfnLock();
+        OldIrql = MiAcquirePfnLock();
 
-            MiInsertPageInList(&MmZeroedPageListHead, PageIndex);
+        while (PfnList != (PMMPFN)LIST_HEAD)
+        {
+            Pfn1 = PfnList;
+            PfnList = (PMMPFN)Pfn1->u1.Flink;
+            MiInsertPageInList(&MmZeroedPageListHead, MiGetPfnEntryIndex(Pfn1));
         }
     }
+
+    MmZeroingPageThreadActive--;
+    MiReleasePfnLock(OldIrql);
+}
+
+static
+VOID
+MiZeroPageLoop(IN ULONG Processor)
+{
+    PKTHREAD Thread = KeGetCurrentThread();
+    PMMPTE PointerPte;
+
+    /* Stay on our processor, the zeroing PTEs belong to it */
+    KeSetSystemAffinityThread(AFFINITY_MASK(Processor));
+
+    /* Set our priority to 0, so we only run when the processor is idle */
+    Thread->BasePriority = 0;
+    KeSetPriorityThread(Thread, 0);
+
+    /* Get the zeroing PTEs of this processor */
+    if (!MiReservedZeroingPtes[Processor])
+    {
+        PointerPte = MiReserveSystemPtes(MI_ZERO_PTES, SystemPteSpace);
+        if (!PointerPte)
+        {
+            DPRINT1("No zeroing PTEs for processor %lu\n", Processor);
+            PsTerminateSystemThread(STATUS_INSUFFICIENT_RESOURCES);
+        }
+
+        /* Clear them and set the counter to maximum */
+        RtlZeroMemory(PointerPte, MI_ZERO_PTES * sizeof(MMPTE));
+        PointerPte->u.Hard.PageFrameNumber = MI_ZERO_PTES - 1;
+        MiReservedZeroingPtes[Processor] = PointerPte;
+    }
+
+    InterlockedIncrement((PLONG)&MiZeroPageThreadCount);
+
+    while (TRUE)
+    {
+        KeWaitForSingleObject(&MmZeroingPageEvent,
+                              WrFreePage,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+        MiZeroFreePages();
+    }
+}
+
+static
+VOID
+NTAPI
+MiZeroPageWorkerThread(IN PVOID Context)
+{
+    MiZeroPageLoop((ULONG)(ULONG_PTR)Context);
+}
+
+VOID
+NTAPI
+MmZeroPageThread(VOID)
+{
+    PVOID StartAddress, EndAddress;
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+    ULONG i;
+
+    /* Get the discardable sections to free them */
+    MiFindInitializationCode(&StartAddress, &EndAddress);
+    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+
+    /* The boot processor uses the zeroing PTEs set up at init */
+    MiReservedZeroingPtes[0] = MiFirstReservedZeroingPte;
+
+    /* Start a zero page thread for every other processor */
+    for (i = 1; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      MiZeroPageWorkerThread,
+                                      (PVOID)(ULONG_PTR)i);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to start the zero page thread for processor %lu: 0x%lx\n", i, Status);
+            continue;
+        }
+        ZwClose(ThreadHandle);
+    }
+
+    /* And become the one of the boot processor */
+    MiZeroPageLoop(0);
 }
 
 /* EOF */
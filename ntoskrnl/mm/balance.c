@@ -180,13 +180,19 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
     PFN_NUMBER CurrentPage;
     PFN_NUMBER NextPage;
     NTSTATUS Status;
+    MM_PAGEOUT_CLUSTER Cluster;
 
     (*NrFreedPages) = 0;
 
+    /* Dirty pages are gathered and written to the paging file together */
+    Cluster.Count = 0;
+    Cluster.ReservedCount = 0;
+    Cluster.NextReserved = 0;
+
     CurrentPage = MmGetLRUFirstUserPage();
     while (CurrentPage != 0 && Target > 0)
     {
-        Status = MmPageOutPhysicalAddress(CurrentPage);
+        Status = MmPageOutPhysicalAddressCluster(CurrentPage, &Cluster);
         if (NT_SUCCESS(Status))
         {
             DPRINT("Succeeded\n");
@@ -203,6 +209,8 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
         CurrentPage = NextPage;
     }
 
+    MmFlushPageOutCluster(&Cluster);
+
     return STATUS_SUCCESS;
 }
 
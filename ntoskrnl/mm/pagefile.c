@@ -50,9 +50,9 @@ typedef struct _PAGINGFILE
     LARGE_INTEGER CurrentSize;
     PFN_NUMBER FreePages;
     PFN_NUMBER UsedPages;
-    PULONG AllocMap;
+    RTL_BITMAP AllocMap;
     KSPIN_LOCK AllocMapLock;
-    ULONG AllocMapSize;
+    ULONG AllocHint;
     PRETRIEVAL_POINTERS_BUFFER RetrievalPointers;
 }
 PAGINGFILE, *PPAGINGFILE;
@@ -217,46 +217,27 @@ MmGetOffsetPageFile(PRETRIEVAL_POINTERS_BUFFER RetrievalPointers, LARGE_INTEGER
 #endif
 }
 
-NTSTATUS
-NTAPI
-MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+static NTSTATUS
+MiWriteToPagingFile(PPAGINGFILE PagingFile, ULONG_PTR Offset, PPFN_NUMBER Pages, ULONG Count)
 {
-    ULONG i;
-    ULONG_PTR offset;
     LARGE_INTEGER file_offset;
     IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(ULONG)];
+    UCHAR MdlBase[sizeof(MDL) + MI_PAGEOUT_CLUSTER_SIZE * sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
 
-    DPRINT("MmWriteToSwapPage\n");
-
-    if (SwapEntry == 0)
-    {
-        KeBugCheck(MEMORY_MANAGEMENT);
-        return(STATUS_UNSUCCESSFUL);
-    }
-
-    i = FILE_FROM_ENTRY(SwapEntry);
-    offset = OFFSET_FROM_ENTRY(SwapEntry) - 1;
+    ASSERT(Count <= MI_PAGEOUT_CLUSTER_SIZE);
 
-    if (PagingFileList[i]->FileObject == NULL ||
-            PagingFileList[i]->FileObject->DeviceObject == NULL)
-    {
-        DPRINT1("Bad paging file 0x%.8X\n", SwapEntry);
-        KeBugCheck(MEMORY_MANAGEMENT);
-    }
-
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
+    MmInitializeMdl(Mdl, NULL, Count * PAGE_SIZE);
+    MmBuildMdlFromPages(Mdl, Pages);
     Mdl->MdlFlags |= MDL_PAGES_LOCKED;
 
-    file_offset.QuadPart = offset * PAGE_SIZE;
-    file_offset = MmGetOffsetPageFile(PagingFileList[i]->RetrievalPointers, file_offset);
+    file_offset.QuadPart = Offset * PAGE_SIZE;
+    file_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, file_offset);
 
     KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoSynchronousPageWrite(PagingFileList[i]->FileObject,
+    Status = IoSynchronousPageWrite(PagingFile->FileObject,
                                     Mdl,
                                     &file_offset,
                                     &Event,
@@ -274,6 +255,73 @@ MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
     return(Status);
 }
 
+NTSTATUS
+NTAPI
+MmWriteToSwapPages(PSWAPENTRY SwapEntries, PPFN_NUMBER Pages, ULONG Count)
+{
+    ULONG i, First, Run;
+    ULONG_PTR offset;
+    LARGE_INTEGER file_offset, next_offset;
+    PPAGINGFILE PagingFile;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT("MmWriteToSwapPages %lu\n", Count);
+
+    for (First = 0; First < Count; First += Run)
+    {
+        if (SwapEntries[First] == 0)
+        {
+            KeBugCheck(MEMORY_MANAGEMENT);
+            return(STATUS_UNSUCCESSFUL);
+        }
+
+        i = FILE_FROM_ENTRY(SwapEntries[First]);
+        offset = OFFSET_FROM_ENTRY(SwapEntries[First]) - 1;
+        PagingFile = PagingFileList[i];
+
+        if (PagingFile->FileObject == NULL ||
+                PagingFile->FileObject->DeviceObject == NULL)
+        {
+            DPRINT1("Bad paging file 0x%.8X\n", SwapEntries[First]);
+            KeBugCheck(MEMORY_MANAGEMENT);
+        }
+
+        /*
+         * Extend the run over the following slots of the same file, as long as
+         * they are also next to each other on the volume.
+         */
+        file_offset.QuadPart = offset * PAGE_SIZE;
+        file_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, file_offset);
+        for (Run = 1; First + Run < Count && Run < MI_PAGEOUT_CLUSTER_SIZE; Run++)
+        {
+            if (SwapEntries[First + Run] != ENTRY_FROM_FILE_OFFSET(i, offset + Run + 1))
+                break;
+
+            next_offset.QuadPart = (offset + Run) * PAGE_SIZE;
+            next_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, next_offset);
+            if (next_offset.QuadPart != file_offset.QuadPart + Run * PAGE_SIZE)
+                break;
+        }
+
+        Status = MiWriteToPagingFile(PagingFile, offset, &Pages[First], Run);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+    }
+
+    return(Status);
+}
+
+NTSTATUS
+NTAPI
+MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+{
+    DPRINT("MmWriteToSwapPage\n");
+
+    return MmWriteToSwapPages(&SwapEntry, &Page, 1);
+}
+
 
 NTSTATUS
 NTAPI
@@ -361,30 +409,45 @@ MmInitPagingFile(VOID)
 }
 
 static ULONG
-MiAllocPageFromPagingFile(PPAGINGFILE PagingFile)
+MiAllocPagesFromPagingFile(PPAGINGFILE PagingFile, ULONG Count, PULONG Allocated)
 {
     KIRQL oldIrql;
-    ULONG i, j;
+    ULONG Index;
 
     KeAcquireSpinLock(&PagingFile->AllocMapLock, &oldIrql);
 
-    for (i = 0; i < PagingFile->AllocMapSize; i++)
+    /*
+     * Look for a run of free slots after the last one handed out, which keeps
+     * the pages of one page out run together. Settle for a shorter one if the
+     * file is too fragmented.
+     */
+    Count = (ULONG)min(Count, PagingFile->FreePages);
+    Index = 0xFFFFFFFF;
+    while (Count > 0)
     {
-        for (j = 0; j < 32; j++)
+        Index = RtlFindClearBitsAndSet(&PagingFile->AllocMap, Count, PagingFile->AllocHint);
+        if (Index != 0xFFFFFFFF)
         {
-            if (!(PagingFile->AllocMap[i] & (1 << j)))
-            {
-                PagingFile->AllocMap[i] |= (1 << j);
-                PagingFile->UsedPages++;
-                PagingFile->FreePages--;
-                KeReleaseSpinLock(&PagingFile->AllocMapLock, oldIrql);
-                return((i * 32) + j);
-            }
+            break;
         }
+        Count /= 2;
+    }
+
+    if (Index != 0xFFFFFFFF)
+    {
+        PagingFile->AllocHint = Index + Count;
+        if (PagingFile->AllocHint >= PagingFile->AllocMap.SizeOfBitMap)
+        {
+            PagingFile->AllocHint = 0;
+        }
+        PagingFile->UsedPages += Count;
+        PagingFile->FreePages -= Count;
     }
 
     KeReleaseSpinLock(&PagingFile->AllocMapLock, oldIrql);
-    return(0xFFFFFFFF);
+
+    *Allocated = Count;
+    return(Index);
 }
 
 VOID
@@ -405,7 +468,8 @@ MmFreeSwapPage(SWAPENTRY Entry)
     }
     KeAcquireSpinLockAtDpcLevel(&PagingFileList[i]->AllocMapLock);
 
-    PagingFileList[i]->AllocMap[off >> 5] &= (~(1 << (off % 32)));
+    ASSERT(RtlTestBit(&PagingFileList[i]->AllocMap, (ULONG)off));
+    RtlClearBit(&PagingFileList[i]->AllocMap, (ULONG)off);
 
     PagingFileList[i]->FreePages++;
     PagingFileList[i]->UsedPages--;
@@ -417,14 +481,16 @@ MmFreeSwapPage(SWAPENTRY Entry)
     KeReleaseSpinLock(&PagingFileListLock, oldIrql);
 }
 
-SWAPENTRY
+ULONG
 NTAPI
-MmAllocSwapPage(VOID)
+MmAllocSwapPages(ULONG Count, PSWAPENTRY Entries)
 {
     KIRQL oldIrql;
-    ULONG i;
+    ULONG i, j;
     ULONG off;
-    SWAPENTRY entry;
+    ULONG Allocated;
+    ULONG FileIndex = 0;
+    PPAGINGFILE PagingFile;
 
     KeAcquireSpinLock(&PagingFileListLock, &oldIrql);
 
@@ -434,30 +500,59 @@ MmAllocSwapPage(VOID)
         return(0);
     }
 
+    /* Prefer a paging file that can take the whole run */
+    PagingFile = NULL;
     for (i = 0; i < MAX_PAGING_FILES; i++)
     {
         if (PagingFileList[i] != NULL &&
                 PagingFileList[i]->FreePages >= 1)
         {
-            off = MiAllocPageFromPagingFile(PagingFileList[i]);
-            if (off == 0xFFFFFFFF)
+            PagingFile = PagingFileList[i];
+            FileIndex = i;
+            if (PagingFile->FreePages >= Count)
             {
-                KeBugCheck(MEMORY_MANAGEMENT);
-                KeReleaseSpinLock(&PagingFileListLock, oldIrql);
-                return(STATUS_UNSUCCESSFUL);
+                break;
             }
-            MiUsedSwapPages++;
-            MiFreeSwapPages--;
-            KeReleaseSpinLock(&PagingFileListLock, oldIrql);
-
-            entry = ENTRY_FROM_FILE_OFFSET(i, off + 1);
-            return(entry);
         }
     }
 
+    if (PagingFile == NULL)
+    {
+        KeReleaseSpinLock(&PagingFileListLock, oldIrql);
+        KeBugCheck(MEMORY_MANAGEMENT);
+        return(0);
+    }
+
+    off = MiAllocPagesFromPagingFile(PagingFile, Count, &Allocated);
+    if (off == 0xFFFFFFFF)
+    {
+        KeBugCheck(MEMORY_MANAGEMENT);
+        KeReleaseSpinLock(&PagingFileListLock, oldIrql);
+        return(0);
+    }
+    MiUsedSwapPages += Allocated;
+    MiFreeSwapPages -= Allocated;
     KeReleaseSpinLock(&PagingFileListLock, oldIrql);
-    KeBugCheck(MEMORY_MANAGEMENT);
-    return(0);
+
+    for (j = 0; j < Allocated; j++)
+    {
+        Entries[j] = ENTRY_FROM_FILE_OFFSET(FileIndex, off + j + 1);
+    }
+    return(Allocated);
+}
+
+SWAPENTRY
+NTAPI
+MmAllocSwapPage(VOID)
+{
+    SWAPENTRY entry;
+
+    if (MmAllocSwapPages(1, &entry) == 0)
+    {
+        return(0);
+    }
+
+    return(entry);
 }
 
 static PRETRIEVEL_DESCRIPTOR_LIST FASTCALL
@@ -490,6 +585,7 @@ NtCreatePagingFile(IN PUNICODE_STRING FileName,
     PPAGINGFILE PagingFile;
     KIRQL oldIrql;
     ULONG AllocMapSize;
+    PULONG AllocMapBuffer;
     FILE_FS_SIZE_INFORMATION FsSizeInformation;
     PRETRIEVEL_DESCRIPTOR_LIST RetDescList;
     PRETRIEVEL_DESCRIPTOR_LIST CurrentRetDescList;
@@ -725,11 +821,10 @@ NtCreatePagingFile(IN PUNICODE_STRING FileName,
     KeInitializeSpinLock(&PagingFile->AllocMapLock);
 
     AllocMapSize = (PagingFile->FreePages / 32) + 1;
-    PagingFile->AllocMap = ExAllocatePool(NonPagedPool,
-                                          AllocMapSize * sizeof(ULONG));
-    PagingFile->AllocMapSize = AllocMapSize;
+    AllocMapBuffer = ExAllocatePool(NonPagedPool,
+                                    AllocMapSize * sizeof(ULONG));
 
-    if (PagingFile->AllocMap == NULL)
+    if (AllocMapBuffer == NULL)
     {
         while (RetDescList)
         {
@@ -753,14 +848,15 @@ NtCreatePagingFile(IN PUNICODE_STRING FileName,
             RetDescList = RetDescList->Next;
             ExFreePool(CurrentRetDescList);
         }
-        ExFreePool(PagingFile->AllocMap);
+        ExFreePool(AllocMapBuffer);
         ExFreePool(PagingFile);
         ObDereferenceObject(FileObject);
         ZwClose(FileHandle);
         return(STATUS_NO_MEMORY);
     }
 
-    RtlZeroMemory(PagingFile->AllocMap, AllocMapSize * sizeof(ULONG));
+    RtlInitializeBitMap(&PagingFile->AllocMap, AllocMapBuffer, (ULONG)PagingFile->FreePages);
+    RtlClearAllBits(&PagingFile->AllocMap);
     RtlZeroMemory(PagingFile->RetrievalPointers, Size);
 
     Count = 0;
@@ -782,7 +878,7 @@ NtCreatePagingFile(IN PUNICODE_STRING FileName,
             PagingFile->RetrievalPointers->Extents[ExtentCount - 1].NextVcn.QuadPart != MaxVcn.QuadPart)
     {
         ExFreePool(PagingFile->RetrievalPointers);
-        ExFreePool(PagingFile->AllocMap);
+        ExFreePool(AllocMapBuffer);
         ExFreePool(PagingFile);
         ObDereferenceObject(FileObject);
         ZwClose(FileHandle);
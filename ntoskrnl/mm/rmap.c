@@ -55,6 +55,71 @@ MmInitializeRmapList(VOID)
 NTSTATUS
 NTAPI
 MmPageOutPhysicalAddress(PFN_NUMBER Page)
+{
+    return MmPageOutPhysicalAddressCluster(Page, NULL);
+}
+
+VOID
+NTAPI
+MmFlushPageOutCluster(PMM_PAGEOUT_CLUSTER Cluster)
+{
+    SWAPENTRY SwapEntries[MI_PAGEOUT_CLUSTER_SIZE];
+    PFN_NUMBER Pages[MI_PAGEOUT_CLUSTER_SIZE];
+    PMM_PAGEOUT_PAGE PageOut;
+    PEPROCESS Process;
+    NTSTATUS Status, WriteStatus;
+    ULONG i;
+
+    if (Cluster->Count != 0)
+    {
+        for (i = 0; i < Cluster->Count; i++)
+        {
+            SwapEntries[i] = Cluster->Pages[i].SwapEntry;
+            Pages[i] = Cluster->Pages[i].Page;
+        }
+
+        Status = MmWriteToSwapPages(SwapEntries, Pages, Cluster->Count);
+
+        for (i = 0; i < Cluster->Count; i++)
+        {
+            PageOut = &Cluster->Pages[i];
+
+            /*
+             * We don't know which part of the cluster made it to the paging
+             * file, give every page another go on its own.
+             */
+            WriteStatus = Status;
+            if (!NT_SUCCESS(WriteStatus))
+            {
+                WriteStatus = MmWriteToSwapPage(PageOut->SwapEntry, PageOut->Page);
+            }
+            MmFinishPageOutSectionView(PageOut, WriteStatus);
+
+            /* Drop what MmPageOutPhysicalAddressCluster kept for this page */
+            if (PageOut->Address < MmSystemRangeStart)
+            {
+                Process = MmGetAddressSpaceOwner(PageOut->AddressSpace);
+                ExReleaseRundownProtection(&Process->RundownProtect);
+                ObDereferenceObject(Process);
+            }
+        }
+    }
+
+    /* Give back the paging file slots nobody took */
+    for (i = Cluster->NextReserved; i < Cluster->ReservedCount; i++)
+    {
+        MmFreeSwapPage(Cluster->Reserved[i]);
+    }
+
+    Cluster->Count = 0;
+    Cluster->ReservedCount = 0;
+    Cluster->NextReserved = 0;
+}
+
+NTSTATUS
+NTAPI
+MmPageOutPhysicalAddressCluster(PFN_NUMBER Page,
+                                PMM_PAGEOUT_CLUSTER Cluster)
 {
     PMM_RMAP_ENTRY entry;
     PMEMORY_AREA MemoryArea;
@@ -169,7 +234,19 @@ MmPageOutPhysicalAddress(PFN_NUMBER Page)
         /*
          * Do the actual page out work.
          */
-        Status = MmPageOutSectionView(AddressSpace, MemoryArea, Address, Entry);
+        Status = MmPageOutSectionView(AddressSpace, MemoryArea, Address, Entry, Cluster);
+        if (Status == STATUS_PENDING)
+        {
+            /*
+             * The page waits in the cluster, with the process still referenced
+             * until the cluster is flushed.
+             */
+            if (Cluster->Count == MI_PAGEOUT_CLUSTER_SIZE)
+            {
+                MmFlushPageOutCluster(Cluster);
+            }
+            return(STATUS_SUCCESS);
+        }
     }
     else if (Type == MEMORY_AREA_CACHE)
     {
@@ -1854,14 +1854,144 @@ MmPageOutDeleteMapping(PVOID Context, PEPROCESS Process, PVOID Address)
     }
 }
 
+static SWAPENTRY
+MiAllocClusterSwapPage(PMM_PAGEOUT_CLUSTER Cluster)
+{
+    /*
+     * Allocate paging file slots for the rest of the cluster at once, so the
+     * pages end up next to each other and go out in a single write.
+     */
+    if (Cluster->NextReserved == Cluster->ReservedCount)
+    {
+        ASSERT(Cluster->Count < MI_PAGEOUT_CLUSTER_SIZE);
+        Cluster->ReservedCount = MmAllocSwapPages(MI_PAGEOUT_CLUSTER_SIZE - Cluster->Count,
+                                                  Cluster->Reserved);
+        Cluster->NextReserved = 0;
+        if (Cluster->ReservedCount == 0)
+        {
+            return 0;
+        }
+    }
+
+    return Cluster->Reserved[Cluster->NextReserved++];
+}
+
+NTSTATUS
+NTAPI
+MmFinishPageOutSectionView(PMM_PAGEOUT_PAGE PageOut,
+                           NTSTATUS WriteStatus)
+{
+    PMMSUPPORT AddressSpace = PageOut->AddressSpace;
+    PEPROCESS Process = MmGetAddressSpaceOwner(AddressSpace);
+    PVOID Address = PageOut->Address;
+    PFN_NUMBER Page = PageOut->Page;
+    SWAPENTRY SwapEntry = PageOut->SwapEntry;
+    ULONG_PTR Entry = PageOut->Entry;
+    NTSTATUS Status;
+
+    if (!NT_SUCCESS(WriteStatus))
+    {
+        DPRINT1("MM: Failed to write to swap page (Status was 0x%.8X)\n",
+                WriteStatus);
+        /*
+         * Undo our actions, as MmPageOutSectionView does when the paging
+         * file is full.
+         * FIXME: Also free the swap page.
+         */
+        MmLockAddressSpace(AddressSpace);
+        if (PageOut->Private)
+        {
+            Status = MmCreateVirtualMapping(Process,
+                                            Address,
+                                            PageOut->MemoryArea->Protect,
+                                            &Page,
+                                            1);
+            MmSetDirtyPage(Process, Address);
+            MmInsertRmap(Page,
+                         Process,
+                         Address);
+        }
+        else
+        {
+            MmLockSectionSegment(PageOut->Segment);
+            Status = MmCreateVirtualMapping(Process,
+                                            Address,
+                                            PageOut->MemoryArea->Protect,
+                                            &Page,
+                                            1);
+            MmSetDirtyPage(Process, Address);
+            MmInsertRmap(Page,
+                         Process,
+                         Address);
+            Entry = MAKE_SSE(Page << PAGE_SHIFT, 1);
+            MmSetPageEntrySectionSegment(PageOut->Segment, &PageOut->Offset, Entry);
+            MmUnlockSectionSegment(PageOut->Segment);
+        }
+        MmUnlockAddressSpace(AddressSpace);
+        MiSetPageEvent(NULL, NULL);
+        return(STATUS_UNSUCCESSFUL);
+    }
+
+    /*
+     * Otherwise we have succeeded.
+     */
+    DPRINT("MM: Wrote section page 0x%.8X to swap!\n", Page << PAGE_SHIFT);
+    MmSetSavedSwapEntryPage(Page, 0);
+    if (PageOut->Segment->Flags & MM_PAGEFILE_SEGMENT ||
+            PageOut->Segment->Image.Characteristics & IMAGE_SCN_MEM_SHARED)
+    {
+        MmLockSectionSegment(PageOut->Segment);
+        MmSetPageEntrySectionSegment(PageOut->Segment, &PageOut->Offset, MAKE_SWAP_SSE(SwapEntry));
+        MmUnlockSectionSegment(PageOut->Segment);
+    }
+    else
+    {
+        MmReleasePageMemoryConsumer(MC_USER, Page);
+    }
+
+    if (PageOut->Private)
+    {
+        MmLockAddressSpace(AddressSpace);
+        MmLockSectionSegment(PageOut->Segment);
+        Status = MmCreatePageFileMapping(Process,
+                                         Address,
+                                         SwapEntry);
+        /* We had placed a wait entry upon entry ... replace it before leaving */
+        MmSetPageEntrySectionSegment(PageOut->Segment, &PageOut->Offset, Entry);
+        MmUnlockSectionSegment(PageOut->Segment);
+        MmUnlockAddressSpace(AddressSpace);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Status %x Creating page file mapping for %p:%p\n", Status, Process, Address);
+            KeBugCheckEx(MEMORY_MANAGEMENT, Status, (ULONG_PTR)Process, (ULONG_PTR)Address, SwapEntry);
+        }
+    }
+    else
+    {
+        MmLockAddressSpace(AddressSpace);
+        MmLockSectionSegment(PageOut->Segment);
+        Entry = MAKE_SWAP_SSE(SwapEntry);
+        /* We had placed a wait entry upon entry ... replace it before leaving */
+        MmSetPageEntrySectionSegment(PageOut->Segment, &PageOut->Offset, Entry);
+        MmUnlockSectionSegment(PageOut->Segment);
+        MmUnlockAddressSpace(AddressSpace);
+    }
+
+    MiSetPageEvent(NULL, NULL);
+    return(STATUS_SUCCESS);
+}
+
 NTSTATUS
 NTAPI
 MmPageOutSectionView(PMMSUPPORT AddressSpace,
                      MEMORY_AREA* MemoryArea,
-                     PVOID Address, ULONG_PTR Entry)
+                     PVOID Address, ULONG_PTR Entry,
+                     PMM_PAGEOUT_CLUSTER Cluster)
 {
     PFN_NUMBER Page;
     MM_SECTION_PAGEOUT_CONTEXT Context;
+    MM_PAGEOUT_PAGE PageOut;
+    PMM_PAGEOUT_PAGE QueuedPage;
     SWAPENTRY SwapEntry;
     NTSTATUS Status;
 #ifndef NEWCC
@@ -2112,7 +2242,14 @@ MmPageOutSectionView(PMMSUPPORT AddressSpace,
      */
     if (SwapEntry == 0)
     {
-        SwapEntry = MmAllocSwapPage();
+        if (Cluster != NULL)
+        {
+            SwapEntry = MiAllocClusterSwapPage(Cluster);
+        }
+        else
+        {
+            SwapEntry = MmAllocSwapPage();
+        }
         if (SwapEntry == 0)
         {
             MmShowOutOfSpaceMessagePagingFile();
@@ -2165,99 +2302,41 @@ MmPageOutSectionView(PMMSUPPORT AddressSpace,
         }
     }
 
-    /*
-     * Write the page to the pagefile
-     */
-    Status = MmWriteToSwapPage(SwapEntry, Page);
-    if (!NT_SUCCESS(Status))
+    if (Cluster != NULL)
     {
-        DPRINT1("MM: Failed to write to swap page (Status was 0x%.8X)\n",
-                Status);
         /*
-         * As above: undo our actions.
-         * FIXME: Also free the swap page.
+         * Leave the write to MmFlushPageOutCluster, which sends the pages of
+         * the cluster out together.
          */
-        MmLockAddressSpace(AddressSpace);
-        if (Context.Private)
-        {
-            Status = MmCreateVirtualMapping(Process,
-                                            Address,
-                                            MemoryArea->Protect,
-                                            &Page,
-                                            1);
-            MmSetDirtyPage(Process, Address);
-            MmInsertRmap(Page,
-                         Process,
-                         Address);
-        }
-        else
-        {
-            MmLockSectionSegment(Context.Segment);
-            Status = MmCreateVirtualMapping(Process,
-                                            Address,
-                                            MemoryArea->Protect,
-                                            &Page,
-                                            1);
-            MmSetDirtyPage(Process, Address);
-            MmInsertRmap(Page,
-                         Process,
-                         Address);
-            Entry = MAKE_SSE(Page << PAGE_SHIFT, 1);
-            MmSetPageEntrySectionSegment(Context.Segment, &Context.Offset, Entry);
-            MmUnlockSectionSegment(Context.Segment);
-        }
-        MmUnlockAddressSpace(AddressSpace);
-        MiSetPageEvent(NULL, NULL);
-        return(STATUS_UNSUCCESSFUL);
+        ASSERT(Cluster->Count < MI_PAGEOUT_CLUSTER_SIZE);
+        QueuedPage = &Cluster->Pages[Cluster->Count++];
+        QueuedPage->AddressSpace = AddressSpace;
+        QueuedPage->MemoryArea = MemoryArea;
+        QueuedPage->Address = Address;
+        QueuedPage->Segment = Context.Segment;
+        QueuedPage->Offset = Context.Offset;
+        QueuedPage->Entry = Entry;
+        QueuedPage->Page = Page;
+        QueuedPage->SwapEntry = SwapEntry;
+        QueuedPage->Private = Context.Private;
+        return(STATUS_PENDING);
     }
 
     /*
-     * Otherwise we have succeeded.
+     * Write the page to the pagefile
      */
-    DPRINT("MM: Wrote section page 0x%.8X to swap!\n", Page << PAGE_SHIFT);
-    MmSetSavedSwapEntryPage(Page, 0);
-    if (Context.Segment->Flags & MM_PAGEFILE_SEGMENT ||
-            Context.Segment->Image.Characteristics & IMAGE_SCN_MEM_SHARED)
-    {
-        MmLockSectionSegment(Context.Segment);
-        MmSetPageEntrySectionSegment(Context.Segment, &Context.Offset, MAKE_SWAP_SSE(SwapEntry));
-        MmUnlockSectionSegment(Context.Segment);
-    }
-    else
-    {
-        MmReleasePageMemoryConsumer(MC_USER, Page);
-    }
-
-    if (Context.Private)
-    {
-        MmLockAddressSpace(AddressSpace);
-        MmLockSectionSegment(Context.Segment);
-        Status = MmCreatePageFileMapping(Process,
-                                         Address,
-                                         SwapEntry);
-        /* We had placed a wait entry upon entry ... replace it before leaving */
-        MmSetPageEntrySectionSegment(Context.Segment, &Context.Offset, Entry);
-        MmUnlockSectionSegment(Context.Segment);
-        MmUnlockAddressSpace(AddressSpace);
-        if (!NT_SUCCESS(Status))
-        {
-            DPRINT1("Status %x Creating page file mapping for %p:%p\n", Status, Process, Address);
-            KeBugCheckEx(MEMORY_MANAGEMENT, Status, (ULONG_PTR)Process, (ULONG_PTR)Address, SwapEntry);
-        }
-    }
-    else
-    {
-        MmLockAddressSpace(AddressSpace);
-        MmLockSectionSegment(Context.Segment);
-        Entry = MAKE_SWAP_SSE(SwapEntry);
-        /* We had placed a wait entry upon entry ... replace it before leaving */
-        MmSetPageEntrySectionSegment(Context.Segment, &Context.Offset, Entry);
-        MmUnlockSectionSegment(Context.Segment);
-        MmUnlockAddressSpace(AddressSpace);
-    }
+    PageOut.AddressSpace = AddressSpace;
+    PageOut.MemoryArea = MemoryArea;
+    PageOut.Address = Address;
+    PageOut.Segment = Context.Segment;
+    PageOut.Offset = Context.Offset;
+    PageOut.Entry = Entry;
+    PageOut.Page = Page;
+    PageOut.SwapEntry = SwapEntry;
+    PageOut.Private = Context.Private;
 
-    MiSetPageEvent(NULL, NULL);
-    return(STATUS_SUCCESS);
+    Status = MmWriteToSwapPage(SwapEntry, Page);
+    return MmFinishPageOutSectionView(&PageOut, Status);
 }
 
 NTSTATUS
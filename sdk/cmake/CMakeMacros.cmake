@@ -446,6 +446,18 @@ function(create_iso_lists)
     add_custom_target(reactos_cab DEPENDS ${CMAKE_CURRENT_BINARY_DIR}/reactos.cab)
     add_dependencies(reactos_cab reactos_cab_inf)
 
+    # times building reactos.cab with each codec, not part of the build
+    add_custom_target(reactos_cab_benchmark
+        COMMAND ${CMAKE_COMMAND}
+            -DCABMAN=$<TARGET_FILE:native-cabman>
+            -DDFF=${REACTOS_BINARY_DIR}/boot/bootdata/packages/reactos.dff
+            -DSOURCE_DIR=${REACTOS_SOURCE_DIR}
+            -DOUTPUT_DIR=${CMAKE_CURRENT_BINARY_DIR}/cabbench
+            -P ${REACTOS_SOURCE_DIR}/sdk/tools/cabman/cabbench.cmake
+        DEPENDS ${CMAKE_CURRENT_BINARY_DIR}/reactos.inf native-cabman ${_filelist}
+        VERBATIM)
+    add_dependencies(reactos_cab_benchmark reactos_cab_inf)
+
     add_cd_file(
         TARGET reactos_cab
         FILE ${CMAKE_CURRENT_BINARY_DIR}/reactos.cab
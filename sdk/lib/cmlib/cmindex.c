@@ -24,6 +24,17 @@
     ((HBLOCK_SIZE - (sizeof(HBIN) + sizeof(HCELL) +     \
                      FIELD_OFFSET(CM_KEY_INDEX, List))) / sizeof(HCELL_INDEX) - 1)
 
+#define CmpBulkIndexPerLeaf                             \
+    (CmpMaxIndexPerHblock - CmpMaxIndexPerHblock / 4)
+
+#define CM_BULK_INSERT_MINIMUM  4
+
+typedef struct _CM_BULK_SUBKEY
+{
+    HCELL_INDEX Cell;
+    UNICODE_STRING Name;
+} CM_BULK_SUBKEY, *PCM_BULK_SUBKEY;
+
 /* FUNCTIONS *****************************************************************/
 
 LONG
@@ -918,6 +929,51 @@ Quickie:
     return FALSE;
 }
 
+static
+VOID
+CmpSetIndexHint(IN PCM_INDEX Entry,
+                IN USHORT Signature,
+                IN PCUNICODE_STRING Name)
+{
+    ULONG j;
+
+    /* Check if this is a hash leaf */
+    if (Signature == CM_KEY_HASH_LEAF)
+    {
+        /* Set our hash key */
+        Entry->HashKey = CmpComputeHashKey(0, Name, FALSE);
+        return;
+    }
+
+    /* First, clear the name */
+    Entry->NameHint[0] = 0;
+    Entry->NameHint[1] = 0;
+    Entry->NameHint[2] = 0;
+    Entry->NameHint[3] = 0;
+
+    /* Now, figure out if we can fit */
+    if (Name->Length / sizeof(WCHAR) < 4)
+    {
+        /* We can fit, use our length */
+        j = Name->Length / sizeof(WCHAR);
+    }
+    else
+    {
+        /* We can't, use a maximum of 4 */
+        j = 4;
+    }
+
+    /* Now fill out the name hint */
+    do
+    {
+        /* Look for invalid characters and break out if we found one */
+        if ((USHORT)Name->Buffer[j - 1] > (UCHAR)-1) break;
+
+        /* Otherwise, copy the a character */
+        Entry->NameHint[j - 1] = (UCHAR)Name->Buffer[j - 1];
+    } while (--j > 0);
+}
+
 HCELL_INDEX
 NTAPI
 CmpAddToLeaf(IN PHHIVE Hive,
@@ -927,7 +983,7 @@ CmpAddToLeaf(IN PHHIVE Hive,
 {
     PCM_KEY_INDEX Leaf;
     PCM_KEY_FAST_INDEX FastLeaf;
-    ULONG Size, OldSize, EntrySize, i, j;
+    ULONG Size, OldSize, EntrySize, i;
     HCELL_INDEX NewCell, Child;
     LONG Result;
 
@@ -1050,45 +1106,9 @@ CmpAddToLeaf(IN PHHIVE Hive,
     /* Check if this is a new-style leaf */
     if (FastLeaf)
     {
-        /* Set our cell */
+        /* Set our cell and its hash key or name hint */
         FastLeaf->List[i].Cell = NewKey;
-
-        /* Check if this is a hash leaf */
-        if( FastLeaf->Signature == CM_KEY_HASH_LEAF )
-        {
-            /* Set our hash key */
-            FastLeaf->List[i].HashKey = CmpComputeHashKey(0, Name, FALSE);
-        }
-        else
-        {
-            /* First, clear the name */
-            FastLeaf->List[i].NameHint[0] = 0;
-            FastLeaf->List[i].NameHint[1] = 0;
-            FastLeaf->List[i].NameHint[2] = 0;
-            FastLeaf->List[i].NameHint[3] = 0;
-
-            /* Now, figure out if we can fit */
-            if (Name->Length / sizeof(WCHAR) < 4)
-            {
-                /* We can fit, use our length */
-                j = Name->Length / sizeof(WCHAR);
-            }
-            else
-            {
-                /* We can't, use a maximum of 4 */
-                j = 4;
-            }
-
-            /* Now fill out the name hint */
-            do
-            {
-                /* Look for invalid characters and break out if we found one */
-                if ((USHORT)Name->Buffer[j - 1] > (UCHAR)-1) break;
-
-                /* Otherwise, copy the a character */
-                FastLeaf->List[i].NameHint[j - 1] = (UCHAR)Name->Buffer[j - 1];
-            } while (--j > 0);
-        }
+        CmpSetIndexHint(&FastLeaf->List[i], FastLeaf->Signature, Name);
     }
     else
     {
@@ -1691,6 +1711,398 @@ CmpAddSubKey(IN PHHIVE Hive,
     return TRUE;
 }
 
+static
+BOOLEAN
+CmpGetSubKeyName(IN PHHIVE Hive,
+                 IN HCELL_INDEX Cell,
+                 OUT PUNICODE_STRING Name)
+{
+    PCM_KEY_NODE KeyNode;
+
+    /* Get the key node */
+    KeyNode = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
+    if (!KeyNode) return FALSE;
+
+    /* Check if the name is compressed */
+    if (KeyNode->Flags & KEY_COMP_NAME)
+    {
+        /* Allocate and copy the uncompressed name */
+        Name->Length = CmpCompressedNameSize(KeyNode->Name, KeyNode->NameLength);
+        Name->MaximumLength = Name->Length;
+        Name->Buffer = Hive->Allocate(Name->Length, TRUE, TAG_CM);
+        if (!Name->Buffer)
+        {
+            HvReleaseCell(Hive, Cell);
+            return FALSE;
+        }
+
+        CmpCopyCompressedName(Name->Buffer,
+                              Name->MaximumLength,
+                              KeyNode->Name,
+                              KeyNode->NameLength);
+    }
+    else
+    {
+        /* Point into the key node; a zero maximum length means "not ours" */
+        Name->Length = KeyNode->NameLength;
+        Name->MaximumLength = 0;
+        Name->Buffer = &KeyNode->Name[0];
+    }
+
+    /* Release the cell */
+    HvReleaseCell(Hive, Cell);
+    return TRUE;
+}
+
+static
+VOID
+CmpMergeSubKeys(IN PCM_BULK_SUBKEY Left,
+                IN ULONG LeftCount,
+                IN PCM_BULK_SUBKEY Right,
+                IN ULONG RightCount,
+                OUT PCM_BULK_SUBKEY Destination)
+{
+    /* Take the smaller head until one of the runs is exhausted */
+    while (LeftCount && RightCount)
+    {
+        if (RtlCompareUnicodeString(&Right->Name, &Left->Name, TRUE) < 0)
+        {
+            *Destination++ = *Right++;
+            RightCount--;
+        }
+        else
+        {
+            *Destination++ = *Left++;
+            LeftCount--;
+        }
+    }
+
+    /* Copy whatever is left over */
+    while (LeftCount--) *Destination++ = *Left++;
+    while (RightCount--) *Destination++ = *Right++;
+}
+
+static
+VOID
+CmpSortSubKeys(IN OUT PCM_BULK_SUBKEY SubKeys,
+               IN PCM_BULK_SUBKEY Temp,
+               IN ULONG Count)
+{
+    ULONG Half;
+
+    /* Merge sort the two halves, then merge them back in place */
+    if (Count < 2) return;
+    Half = Count / 2;
+    CmpSortSubKeys(SubKeys, Temp, Half);
+    CmpSortSubKeys(SubKeys + Half, Temp, Count - Half);
+    CmpMergeSubKeys(SubKeys, Half, SubKeys + Half, Count - Half, Temp);
+    RtlCopyMemory(SubKeys, Temp, Count * sizeof(CM_BULK_SUBKEY));
+}
+
+static
+ULONG
+CmpGetLeafSubKeys(IN PHHIVE Hive,
+                  IN HCELL_INDEX LeafCell,
+                  OUT PCM_BULK_SUBKEY SubKeys)
+{
+    PCM_KEY_INDEX Leaf;
+    ULONG i, Count;
+
+    /* Get the leaf */
+    Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
+    if (!Leaf) return 0;
+
+    /* Copy its cells, whatever the kind of leaf */
+    Count = Leaf->Count;
+    for (i = 0; i < Count; i++)
+    {
+        if (Leaf->Signature == CM_KEY_INDEX_LEAF)
+            SubKeys[i].Cell = Leaf->List[i];
+        else
+            SubKeys[i].Cell = ((PCM_KEY_FAST_INDEX)Leaf)->List[i].Cell;
+    }
+
+    /* Release the leaf */
+    HvReleaseCell(Hive, LeafCell);
+    return Count;
+}
+
+static
+VOID
+CmpFreeIndex(IN PHHIVE Hive,
+             IN HCELL_INDEX IndexCell)
+{
+    PCM_KEY_INDEX Index;
+    ULONG i;
+
+    /* Get the index */
+    Index = (PCM_KEY_INDEX)HvGetCell(Hive, IndexCell);
+    if (!Index) return;
+
+    /* If this is a root, free its leaves first */
+    if (Index->Signature == CM_KEY_INDEX_ROOT)
+    {
+        for (i = 0; i < Index->Count; i++) HvFreeCell(Hive, Index->List[i]);
+    }
+
+    /* Release and free the index itself */
+    HvReleaseCell(Hive, IndexCell);
+    HvFreeCell(Hive, IndexCell);
+}
+
+static
+HCELL_INDEX
+CmpBuildIndex(IN PHHIVE Hive,
+              IN PCM_BULK_SUBKEY SubKeys,
+              IN ULONG Count,
+              IN HSTORAGE_TYPE Type)
+{
+    PCM_KEY_INDEX Root = NULL, Leaf;
+    HCELL_INDEX RootCell = HCELL_NIL, LeafCell;
+    USHORT Signature;
+    ULONG EntrySize, LeafCount, LeafSize, i, j;
+
+    /* Use the same kind of leaf as CmpAddSubKey would */
+    if (Hive->Version >= 5)
+    {
+        Signature = CM_KEY_HASH_LEAF;
+    }
+    else if ((Hive->Version >= 3) && (Count <= CmpMaxFastIndexPerHblock))
+    {
+        Signature = CM_KEY_FAST_LEAF;
+    }
+    else
+    {
+        Signature = CM_KEY_INDEX_LEAF;
+    }
+    EntrySize = (Signature == CM_KEY_INDEX_LEAF) ?
+                sizeof(HCELL_INDEX) : sizeof(CM_INDEX);
+
+    /* Check if everything fits a single leaf, otherwise root the leaves */
+    if (Count <= CmpMaxIndexPerHblock)
+    {
+        LeafCount = 1;
+    }
+    else
+    {
+        /* Leave some room in every leaf so that the next inserts don't split */
+        LeafCount = (Count + CmpBulkIndexPerLeaf - 1) / CmpBulkIndexPerLeaf;
+
+        RootCell = HvAllocateCell(Hive,
+                                  FIELD_OFFSET(CM_KEY_INDEX, List) +
+                                  LeafCount * sizeof(HCELL_INDEX),
+                                  Type,
+                                  HCELL_NIL);
+        if (RootCell == HCELL_NIL) return HCELL_NIL;
+
+        Root = (PCM_KEY_INDEX)HvGetCell(Hive, RootCell);
+        if (!Root)
+        {
+            HvFreeCell(Hive, RootCell);
+            return HCELL_NIL;
+        }
+
+        Root->Signature = CM_KEY_INDEX_ROOT;
+        Root->Count = 0;
+    }
+
+    /* Spread the subkeys evenly over the leaves, in order */
+    for (i = 0; i < LeafCount; i++)
+    {
+        LeafSize = Count / LeafCount + ((i < Count % LeafCount) ? 1 : 0);
+
+        LeafCell = HvAllocateCell(Hive,
+                                  FIELD_OFFSET(CM_KEY_INDEX, List) +
+                                  LeafSize * EntrySize,
+                                  Type,
+                                  HCELL_NIL);
+        if (LeafCell == HCELL_NIL) break;
+
+        Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
+        if (!Leaf)
+        {
+            HvFreeCell(Hive, LeafCell);
+            break;
+        }
+
+        /* Fill the leaf */
+        Leaf->Signature = Signature;
+        Leaf->Count = (USHORT)LeafSize;
+        for (j = 0; j < LeafSize; j++, SubKeys++)
+        {
+            if (Signature == CM_KEY_INDEX_LEAF)
+            {
+                Leaf->List[j] = SubKeys->Cell;
+            }
+            else
+            {
+                ((PCM_KEY_FAST_INDEX)Leaf)->List[j].Cell = SubKeys->Cell;
+                CmpSetIndexHint(&((PCM_KEY_FAST_INDEX)Leaf)->List[j],
+                                Signature,
+                                &SubKeys->Name);
+            }
+        }
+        HvReleaseCell(Hive, LeafCell);
+
+        /* A single leaf is the whole index */
+        if (!Root) return LeafCell;
+        Root->List[Root->Count++] = LeafCell;
+    }
+
+    /* We failed before building a single leaf */
+    if (!Root) return HCELL_NIL;
+
+    /* Check if we failed half-way, and undo what we built if so */
+    HvReleaseCell(Hive, RootCell);
+    if (i != LeafCount)
+    {
+        CmpFreeIndex(Hive, RootCell);
+        return HCELL_NIL;
+    }
+
+    return RootCell;
+}
+
+/*
+ * Adds a batch of subkeys to a parent key in one go. The new subkeys are
+ * sorted, merged with the subkeys already present, and the whole index is
+ * rebuilt with all its leaves written once, instead of shifting and
+ * re-marking a leaf for every single key like CmpAddSubKey does.
+ * All the children must have the same storage type and names that don't
+ * exist yet under the parent. As for CmpAddSubKey, the caller is expected
+ * to have marked the parent cell dirty. On failure none of the children are
+ * left linked into the parent.
+ */
+BOOLEAN
+NTAPI
+CmpAddSubKeys(IN PHHIVE Hive,
+              IN HCELL_INDEX Parent,
+              IN PHCELL_INDEX Children,
+              IN ULONG Count)
+{
+    PCM_KEY_NODE KeyNode;
+    PCM_KEY_INDEX Index;
+    PCM_BULK_SUBKEY SubKeys, Temp;
+    HCELL_INDEX OldIndexCell, NewIndexCell;
+    HSTORAGE_TYPE Type;
+    ULONG Existing, Total, Named = 0, i, j;
+    BOOLEAN Result = FALSE;
+    PAGED_CODE();
+
+    if (!Count) return TRUE;
+
+    /* All the children must go to the same storage */
+    Type = HvGetCellType(Children[0]);
+    for (i = 1; i < Count; i++)
+    {
+        if (HvGetCellType(Children[i]) != Type) return FALSE;
+    }
+
+    /* Get the parent node */
+    KeyNode = (PCM_KEY_NODE)HvGetCell(Hive, Parent);
+    if (!KeyNode) return FALSE;
+    Existing = KeyNode->SubKeyCounts[Type];
+    OldIndexCell = KeyNode->SubKeyLists[Type];
+
+    /* For a handful of keys, or a few keys into a big index, plain inserts are cheaper */
+    if ((Count < CM_BULK_INSERT_MINIMUM) || (Count * 8 < Existing))
+    {
+        HvReleaseCell(Hive, Parent);
+        for (i = 0; i < Count; i++)
+        {
+            if (!CmpAddSubKey(Hive, Parent, Children[i]))
+            {
+                /* Unlink the ones already added, so the caller can free them all */
+                while (i--) CmpRemoveSubKey(Hive, Parent, Children[i]);
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    /* Allocate the subkey array and the merge buffer */
+    Total = Existing + Count;
+    SubKeys = Hive->Allocate(2 * Total * sizeof(CM_BULK_SUBKEY), TRUE, TAG_CM);
+    if (!SubKeys)
+    {
+        HvReleaseCell(Hive, Parent);
+        return FALSE;
+    }
+    Temp = SubKeys + Total;
+
+    /* Gather the existing subkeys, which are already sorted */
+    if (Existing)
+    {
+        Index = (PCM_KEY_INDEX)HvGetCell(Hive, OldIndexCell);
+        if (!Index) goto Quickie;
+
+        i = 0;
+        if (Index->Signature == CM_KEY_INDEX_ROOT)
+        {
+            for (j = 0; j < Index->Count; j++)
+            {
+                i += CmpGetLeafSubKeys(Hive, Index->List[j], &SubKeys[i]);
+            }
+        }
+        else
+        {
+            i = CmpGetLeafSubKeys(Hive, OldIndexCell, SubKeys);
+        }
+        HvReleaseCell(Hive, OldIndexCell);
+
+        if (i != Existing)
+        {
+            DPRINT1("Subkey count mismatch: %lu in the index, %lu expected\n",
+                    (unsigned long)i, (unsigned long)Existing);
+            goto Quickie;
+        }
+    }
+
+    /* Append the new ones */
+    for (i = 0; i < Count; i++) SubKeys[Existing + i].Cell = Children[i];
+
+    /* Get all the names */
+    for (Named = 0; Named < Total; Named++)
+    {
+        if (!CmpGetSubKeyName(Hive, SubKeys[Named].Cell, &SubKeys[Named].Name))
+            goto Quickie;
+    }
+
+    /* Sort the new subkeys and merge them with the existing ones */
+    CmpSortSubKeys(&SubKeys[Existing], Temp, Count);
+    CmpMergeSubKeys(SubKeys, Existing, &SubKeys[Existing], Count, Temp);
+
+    /* Refuse duplicates, they would corrupt the index */
+    for (i = 1; i < Total; i++)
+    {
+        if (!RtlCompareUnicodeString(&Temp[i - 1].Name, &Temp[i].Name, TRUE))
+        {
+            DPRINT1("Duplicate subkey at position %lu\n", (unsigned long)i);
+            goto Quickie;
+        }
+    }
+
+    /* Build the new index */
+    NewIndexCell = CmpBuildIndex(Hive, Temp, Total, Type);
+    if (NewIndexCell == HCELL_NIL) goto Quickie;
+
+    /* Free the old one and link the new one */
+    if (Existing) CmpFreeIndex(Hive, OldIndexCell);
+    KeyNode->SubKeyLists[Type] = NewIndexCell;
+    KeyNode->SubKeyCounts[Type] = Total;
+    Result = TRUE;
+
+Quickie:
+    /* Free the names we allocated, and the arrays */
+    for (i = 0; i < Named; i++)
+    {
+        if (SubKeys[i].Name.MaximumLength) Hive->Free(SubKeys[i].Name.Buffer, 0);
+    }
+    Hive->Free(SubKeys, 0);
+    HvReleaseCell(Hive, Parent);
+    return Result;
+}
+
 BOOLEAN
 NTAPI
 CmpRemoveSubKey(IN PHHIVE Hive,
@@ -60,6 +60,7 @@
     #define STATUS_NO_MEMORY                 ((NTSTATUS)0xC0000017)
     #define STATUS_INSUFFICIENT_RESOURCES    ((NTSTATUS)0xC000009A)
     #define STATUS_REGISTRY_CORRUPT          ((NTSTATUS)0xC000014C)
+    #define STATUS_REGISTRY_IO_FAILED        ((NTSTATUS)0xC000014D)
     #define STATUS_NOT_REGISTRY_FILE         ((NTSTATUS)0xC000015C)
     #define STATUS_REGISTRY_RECOVERED        ((NTSTATUS)0x40000009)
 
@@ -120,6 +121,10 @@
     RtlClearAllBits(
         IN PRTL_BITMAP BitMapHeader);
 
+    ULONG NTAPI
+    RtlNumberOfSetBits(
+        IN PRTL_BITMAP BitMapHeader);
+
     #define RtlCheckBit(BMH,BP) (((((PLONG)(BMH)->Buffer)[(BP) / 32]) >> ((BP) % 32)) & 0x1)
     #define UNREFERENCED_PARAMETER(P) {(P)=(P);}
 
@@ -444,6 +449,10 @@ BOOLEAN CMAPI
 HvSyncHive(
    PHHIVE RegistryHive);
 
+BOOLEAN CMAPI
+HvLazySyncHive(
+   PHHIVE RegistryHive);
+
 BOOLEAN CMAPI
 HvWriteHive(
    PHHIVE RegistryHive);
@@ -530,6 +539,15 @@ CmpAddSubKey(
     IN HCELL_INDEX Child
 );
 
+BOOLEAN
+NTAPI
+CmpAddSubKeys(
+    IN PHHIVE Hive,
+    IN HCELL_INDEX Parent,
+    IN PHCELL_INDEX Children,
+    IN ULONG Count
+);
+
 BOOLEAN
 NTAPI
 CmpRemoveSubKey(
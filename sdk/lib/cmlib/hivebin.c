@@ -98,6 +98,7 @@ HvpAddBin(
         RtlSetBits(&RegistryHive->DirtyVector,
                    Bin->FileOffset / HBLOCK_SIZE,
                    BlockCount);
+        RegistryHive->DirtyCount++;
 
         /* Update size in the base block */
         RegistryHive->BaseBlock->Length += BinSize;
@@ -9,6 +9,12 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Smallest free cell that can hold both free list links */
+#define HV_MIN_LISTED_FREE_CELL     (sizeof(HCELL) + 2 * sizeof(HCELL_INDEX))
+
+/* How many fitting cells to consider for a best fit in a list */
+#define HV_BEST_FIT_SCAN_LIMIT      16
+
 static __inline PHCELL CMAPI
 HvpGetCellHeader(
     PHHIVE RegistryHive,
@@ -104,6 +110,7 @@ HvMarkCellDirty(
 {
     ULONG CellBlock;
     ULONG CellLastBlock;
+    LONG CellSize;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
@@ -113,11 +120,21 @@ HvMarkCellDirty(
     if (HvGetCellType(CellIndex) != Stable)
         return TRUE;
 
+    /*
+     * An allocated cell can span several blocks, all of them have to be
+     * written. Of a free cell only the header and the free list link matter.
+     */
+    CellSize = HvpGetCellHeader(RegistryHive, CellIndex)->Size;
+    if (CellSize < 0)
+        CellSize = -CellSize;
+    else
+        CellSize = sizeof(HCELL) + sizeof(HCELL_INDEX);
+
     CellBlock     = HvGetCellBlock(CellIndex);
-    CellLastBlock = HvGetCellBlock(CellIndex + HBLOCK_SIZE - 1);
+    CellLastBlock = HvGetCellBlock(CellIndex + CellSize - 1);
 
     RtlSetBits(&RegistryHive->DirtyVector,
-               CellBlock, CellLastBlock - CellBlock);
+               CellBlock, CellLastBlock - CellBlock + 1);
     RegistryHive->DirtyCount++;
     return TRUE;
 }
@@ -171,6 +188,45 @@ HvpComputeFreeListIndex(
     return Index;
 }
 
+static __inline ULONG CMAPI
+HvpFindFirstSetBit(
+    ULONG Set)
+{
+    static CCHAR LowestSet[16] = {
+        0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
+    ULONG Index = 0;
+
+    ASSERT(Set != 0);
+    while (!(Set & 0xF))
+    {
+        Set >>= 4;
+        Index += 4;
+    }
+
+    return Index + LowestSet[Set & 0xF];
+}
+
+/*
+ * The free cells of a bin are only put on the free lists once the bin has
+ * been scanned. Bins present when the hive was loaded are scanned lazily,
+ * in order, when the lists run out; bins added later are always listed.
+ */
+static __inline BOOLEAN CMAPI
+HvpIsBinListed(
+    PHHIVE RegistryHive,
+    HSTORAGE_TYPE Storage,
+    ULONG BlockIndex)
+{
+    return (BlockIndex < RegistryHive->Storage[Storage].FreeScanBlock ||
+            BlockIndex >= RegistryHive->Storage[Storage].FreeScanLimit);
+}
+
+/*
+ * Free cells are kept on doubly linked lists, the first HCELL_INDEX of
+ * their data being the next cell and the second one the previous cell.
+ * Cells too small to hold both links can never be allocated anyway and
+ * are left off the lists.
+ */
 static NTSTATUS CMAPI
 HvpAddFree(
     PHHIVE RegistryHive,
@@ -178,18 +234,30 @@ HvpAddFree(
     HCELL_INDEX FreeIndex)
 {
     PHCELL_INDEX FreeBlockData;
+    PHCELL_INDEX NextCellData;
     HSTORAGE_TYPE Storage;
     ULONG Index;
 
     ASSERT(RegistryHive != NULL);
     ASSERT(FreeBlock != NULL);
 
+    if ((ULONG)FreeBlock->Size < HV_MIN_LISTED_FREE_CELL)
+        return STATUS_SUCCESS;
+
     Storage = HvGetCellType(FreeIndex);
     Index = HvpComputeFreeListIndex((ULONG)FreeBlock->Size);
 
     FreeBlockData = (PHCELL_INDEX)(FreeBlock + 1);
-    *FreeBlockData = RegistryHive->Storage[Storage].FreeDisplay[Index];
+    FreeBlockData[0] = RegistryHive->Storage[Storage].FreeDisplay[Index];
+    FreeBlockData[1] = HCELL_NIL;
+    if (FreeBlockData[0] != HCELL_NIL)
+    {
+        NextCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, FreeBlockData[0]);
+        NextCellData[1] = FreeIndex;
+    }
+
     RegistryHive->Storage[Storage].FreeDisplay[Index] = FreeIndex;
+    RegistryHive->Storage[Storage].FreeSummary |= (1 << Index);
 
     /* FIXME: Eventually get rid of free bins. */
 
@@ -203,27 +271,48 @@ HvpRemoveFree(
     HCELL_INDEX CellIndex)
 {
     PHCELL_INDEX FreeCellData;
+    PHCELL_INDEX LinkedCellData;
     PHCELL_INDEX pFreeCellOffset;
     HSTORAGE_TYPE Storage;
     ULONG Index, FreeListIndex;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
+    if ((ULONG)CellBlock->Size < HV_MIN_LISTED_FREE_CELL)
+        return;
+
     Storage = HvGetCellType(CellIndex);
     Index = HvpComputeFreeListIndex((ULONG)CellBlock->Size);
 
-    pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-    while (*pFreeCellOffset != HCELL_NIL)
+    FreeCellData = (PHCELL_INDEX)(CellBlock + 1);
+    if (FreeCellData[1] != HCELL_NIL)
     {
-        FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-        if (*pFreeCellOffset == CellIndex)
-        {
-            *pFreeCellOffset = *FreeCellData;
-            return;
-        }
-        pFreeCellOffset = FreeCellData;
+        /* Unlink from the previous cell */
+        LinkedCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, FreeCellData[1]);
+        ASSERT(LinkedCellData[0] == CellIndex);
+        LinkedCellData[0] = FreeCellData[0];
     }
+    else if (RegistryHive->Storage[Storage].FreeDisplay[Index] == CellIndex)
+    {
+        /* This is the head of the list */
+        RegistryHive->Storage[Storage].FreeDisplay[Index] = FreeCellData[0];
+        if (FreeCellData[0] == HCELL_NIL)
+            RegistryHive->Storage[Storage].FreeSummary &= ~(1 << Index);
+    }
+    else
+    {
+        goto NotListed;
+    }
+
+    if (FreeCellData[0] != HCELL_NIL)
+    {
+        LinkedCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, FreeCellData[0]);
+        LinkedCellData[1] = FreeCellData[1];
+    }
+
+    return;
 
+NotListed:
     /* Something bad happened, print a useful trace info and bugcheck */
     CMLTRACE(CMLIB_HCELL_DEBUG, "-- beginning of HvpRemoveFree trace --\n");
     CMLTRACE(CMLIB_HCELL_DEBUG, "block we are about to free: %08x\n", CellIndex);
@@ -245,46 +334,143 @@ HvpRemoveFree(
     ASSERT(FALSE);
 }
 
+static NTSTATUS CMAPI
+HvpListBinFreeCells(
+    PHHIVE Hive,
+    HSTORAGE_TYPE Storage)
+{
+    PHCELL FreeBlock;
+    ULONG BlockIndex;
+    ULONG FreeOffset;
+    PHBIN Bin;
+    NTSTATUS Status;
+
+    /* Take the next bin that hasn't been scanned yet */
+    BlockIndex = Hive->Storage[Storage].FreeScanBlock;
+    ASSERT(BlockIndex < Hive->Storage[Storage].FreeScanLimit);
+    Bin = (PHBIN)Hive->Storage[Storage].BlockList[BlockIndex].BinAddress;
+
+    /* Mark it listed first, so that HvpAddFree sees it as such */
+    Hive->Storage[Storage].FreeScanBlock = BlockIndex + Bin->Size / HBLOCK_SIZE;
+
+    /* Search free blocks and add to list */
+    FreeOffset = sizeof(HBIN);
+    while (FreeOffset < Bin->Size)
+    {
+        FreeBlock = (PHCELL)((ULONG_PTR)Bin + FreeOffset);
+        if (FreeBlock->Size > 0)
+        {
+            Status = HvpAddFree(Hive, FreeBlock,
+                                (Bin->FileOffset + FreeOffset) | (Storage << HCELL_TYPE_SHIFT));
+            if (!NT_SUCCESS(Status))
+                return Status;
+
+            FreeOffset += FreeBlock->Size;
+        }
+        else
+        {
+            FreeOffset -= FreeBlock->Size;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
 static HCELL_INDEX CMAPI
-HvpFindFree(
+HvpFindFreeInLists(
     PHHIVE RegistryHive,
     ULONG Size,
     HSTORAGE_TYPE Storage)
 {
     PHCELL_INDEX FreeCellData;
-    HCELL_INDEX FreeCellOffset;
-    PHCELL_INDEX pFreeCellOffset;
-    ULONG Index;
+    HCELL_INDEX FreeCellOffset, BestCellOffset;
+    ULONG Index, CellSize, BestSize, Scanned;
+    ULONG Summary;
+
+    Index = HvpComputeFreeListIndex(Size);
 
-    for (Index = HvpComputeFreeListIndex(Size); Index < 24; Index++)
+    /*
+     * The lists above 16 hold a range of sizes. Look for the best fit among
+     * the first few cells of the list matching the request, then fall back
+     * to any cell of the next bigger non-empty list, which is sure to fit.
+     */
+    if (Index >= 16)
     {
-        pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-        while (*pFreeCellOffset != HCELL_NIL)
+        BestCellOffset = HCELL_NIL;
+        BestSize = MAXULONG;
+        Scanned = 0;
+
+        FreeCellOffset = RegistryHive->Storage[Storage].FreeDisplay[Index];
+        while (FreeCellOffset != HCELL_NIL && Scanned < HV_BEST_FIT_SCAN_LIMIT)
         {
-            FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-            if ((ULONG)HvpGetCellFullSize(RegistryHive, FreeCellData) >= Size)
+            FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, FreeCellOffset);
+            CellSize = (ULONG)HvpGetCellFullSize(RegistryHive, FreeCellData);
+            if (CellSize >= Size)
             {
-                FreeCellOffset = *pFreeCellOffset;
-                *pFreeCellOffset = *FreeCellData;
-                return FreeCellOffset;
+                if (CellSize < BestSize)
+                {
+                    BestCellOffset = FreeCellOffset;
+                    BestSize = CellSize;
+                    if (CellSize == Size)
+                        break;
+                }
+                Scanned++;
             }
-            pFreeCellOffset = FreeCellData;
+            FreeCellOffset = FreeCellData[0];
         }
+
+        if (BestCellOffset != HCELL_NIL)
+            return BestCellOffset;
+
+        Index++;
     }
 
-    return HCELL_NIL;
+    /* Find the first non-empty list from there, any of its cells fits */
+    if (Index >= 24)
+        return HCELL_NIL;
+
+    Summary = RegistryHive->Storage[Storage].FreeSummary & ~((1 << Index) - 1);
+    if (!Summary)
+        return HCELL_NIL;
+
+    return RegistryHive->Storage[Storage].FreeDisplay[HvpFindFirstSetBit(Summary)];
+}
+
+static HCELL_INDEX CMAPI
+HvpFindFree(
+    PHHIVE RegistryHive,
+    ULONG Size,
+    HSTORAGE_TYPE Storage)
+{
+    HCELL_INDEX FreeCellOffset;
+
+    for (;;)
+    {
+        FreeCellOffset = HvpFindFreeInLists(RegistryHive, Size, Storage);
+        if (FreeCellOffset != HCELL_NIL)
+        {
+            HvpRemoveFree(RegistryHive,
+                          HvpGetCellHeader(RegistryHive, FreeCellOffset),
+                          FreeCellOffset);
+            return FreeCellOffset;
+        }
+
+        /* Nothing fits in the lists, list the free cells of one more bin */
+        if (RegistryHive->Storage[Storage].FreeScanBlock >=
+            RegistryHive->Storage[Storage].FreeScanLimit)
+        {
+            return HCELL_NIL;
+        }
+
+        if (!NT_SUCCESS(HvpListBinFreeCells(RegistryHive, Storage)))
+            return HCELL_NIL;
+    }
 }
 
 NTSTATUS CMAPI
 HvpCreateHiveFreeCellList(
     PHHIVE Hive)
 {
-    HCELL_INDEX BlockOffset;
-    PHCELL FreeBlock;
-    ULONG BlockIndex;
-    ULONG FreeOffset;
-    PHBIN Bin;
-    NTSTATUS Status;
     ULONG Index;
 
     /* Initialize the free cell list */
@@ -293,35 +479,17 @@ HvpCreateHiveFreeCellList(
         Hive->Storage[Stable].FreeDisplay[Index] = HCELL_NIL;
         Hive->Storage[Volatile].FreeDisplay[Index] = HCELL_NIL;
     }
+    Hive->Storage[Stable].FreeSummary = 0;
+    Hive->Storage[Volatile].FreeSummary = 0;
 
-    BlockOffset = 0;
-    BlockIndex = 0;
-    while (BlockIndex < Hive->Storage[Stable].Length)
-    {
-        Bin = (PHBIN)Hive->Storage[Stable].BlockList[BlockIndex].BinAddress;
-
-        /* Search free blocks and add to list */
-        FreeOffset = sizeof(HBIN);
-        while (FreeOffset < Bin->Size)
-        {
-            FreeBlock = (PHCELL)((ULONG_PTR)Bin + FreeOffset);
-            if (FreeBlock->Size > 0)
-            {
-                Status = HvpAddFree(Hive, FreeBlock, Bin->FileOffset + FreeOffset);
-                if (!NT_SUCCESS(Status))
-                    return Status;
-
-                FreeOffset += FreeBlock->Size;
-            }
-            else
-            {
-                FreeOffset -= FreeBlock->Size;
-            }
-        }
-
-        BlockIndex += Bin->Size / HBLOCK_SIZE;
-        BlockOffset += Bin->Size;
-    }
+    /*
+     * Don't walk the bins now, that would make loading a hive as slow as
+     * its size; their free cells get listed when allocations need them.
+     */
+    Hive->Storage[Stable].FreeScanBlock = 0;
+    Hive->Storage[Stable].FreeScanLimit = Hive->Storage[Stable].Length;
+    Hive->Storage[Volatile].FreeScanBlock = 0;
+    Hive->Storage[Volatile].FreeScanLimit = 0;
 
     return STATUS_SUCCESS;
 }
@@ -447,6 +615,7 @@ HvFreeCell(
     PHBIN Bin;
     ULONG CellType;
     ULONG CellBlock;
+    BOOLEAN Listed;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
@@ -465,15 +634,21 @@ HvFreeCell(
     /* FIXME: Merge free blocks */
     Bin = (PHBIN)RegistryHive->Storage[CellType].BlockList[CellBlock].BinAddress;
 
+    /* The free cells of a bin that wasn't scanned yet are on no list */
+    Listed = HvpIsBinListed(RegistryHive, CellType, CellBlock);
+
     if ((CellIndex & ~HCELL_TYPE_MASK) + Free->Size <
         Bin->FileOffset + Bin->Size)
     {
         Neighbor = (PHCELL)((ULONG_PTR)Free + Free->Size);
         if (Neighbor->Size > 0)
         {
-            HvpRemoveFree(RegistryHive, Neighbor,
-                          ((HCELL_INDEX)((ULONG_PTR)Neighbor - (ULONG_PTR)Bin +
-                            Bin->FileOffset)) | (CellIndex & HCELL_TYPE_MASK));
+            if (Listed)
+            {
+                HvpRemoveFree(RegistryHive, Neighbor,
+                              ((HCELL_INDEX)((ULONG_PTR)Neighbor - (ULONG_PTR)Bin +
+                                Bin->FileOffset)) | (CellIndex & HCELL_TYPE_MASK));
+            }
             Free->Size += Neighbor->Size;
         }
     }
@@ -489,7 +664,8 @@ HvFreeCell(
                     ((HCELL_INDEX)((ULONG_PTR)Neighbor - (ULONG_PTR)Bin +
                      Bin->FileOffset)) | (CellIndex & HCELL_TYPE_MASK);
 
-                if (HvpComputeFreeListIndex(Neighbor->Size) !=
+                if (Listed &&
+                    HvpComputeFreeListIndex(Neighbor->Size) !=
                     HvpComputeFreeListIndex(Neighbor->Size + Free->Size))
                 {
                    HvpRemoveFree(RegistryHive, Neighbor, NeighborCellIndex);
@@ -513,7 +689,8 @@ HvFreeCell(
     }
 
     /* Add block to the list of free blocks */
-    HvpAddFree(RegistryHive, Free, CellIndex);
+    if (Listed)
+        HvpAddFree(RegistryHive, Free, CellIndex);
 
     if (CellType == Stable)
         HvMarkCellDirty(RegistryHive, CellIndex, FALSE);
@@ -45,6 +45,12 @@
 #define HV_LOG_HEADER_SIZE              FIELD_OFFSET(HBASE_BLOCK, Reserved2)
 #define HV_SIGNATURE                    0x66676572  // "regf"
 #define HV_BIN_SIGNATURE                0x6e696268  // "hbin"
+#define HV_LOG_DIRT_SIGNATURE           0x54524944  // "DIRT"
+
+//
+// Number of logged blocks after which a lazy flush also updates the primary file
+//
+#define HV_LAZY_LOG_MAX_BLOCKS          64
 
 //
 // Hive versions
@@ -275,6 +281,9 @@ typedef struct _DUAL
     HCELL_INDEX FreeDisplay[24]; // FREE_DISPLAY FreeDisplay[24];
     ULONG FreeSummary;
     LIST_ENTRY FreeBins;
+    /* ReactOS-specific: free cells of the bins loaded from the file are listed lazily */
+    ULONG FreeScanBlock;
+    ULONG FreeScanLimit;
 } DUAL, *PDUAL;
 
 typedef struct _HHIVE
@@ -400,10 +400,32 @@ HvpGetHiveHeader(IN PHHIVE Hive,
                             Hive->Cluster * HSECTOR_SIZE);
 
     /* Couldn't read: assume it's not a hive */
-    if (!Result) return NotHive;
+    if (!Result)
+    {
+        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+        return NotHive;
+    }
 
     /* Do validation */
-    if (!HvpVerifyHiveHeader(BaseBlock)) return NotHive;
+    if (!HvpVerifyHiveHeader(BaseBlock))
+    {
+        /* Without a log there is nothing to recover from */
+        if (!Hive->Log || BaseBlock->Signature != HV_SIGNATURE)
+        {
+            Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+            return NotHive;
+        }
+
+        /* An intact header with mismatching sequences means the data write got interrupted */
+        *HiveBaseBlock = BaseBlock;
+        if ((BaseBlock->Sequence1 != BaseBlock->Sequence2) &&
+            (HvpHiveHeaderChecksum(BaseBlock) == BaseBlock->CheckSum))
+        {
+            return RecoverData;
+        }
+
+        return RecoverHeader;
+    }
 
     /* Return information */
     *HiveBaseBlock = BaseBlock;
@@ -411,12 +433,150 @@ HvpGetHiveHeader(IN PHHIVE Hive,
     return HiveSuccess;
 }
 
+/**
+ * @name HvpReadLog
+ *
+ * Internal function to read the header and the dirty vector of the hive
+ * log file. Returns NULL if there is no complete log to replay.
+ */
+static PHBASE_BLOCK
+HvpReadLog(
+    IN PHHIVE Hive,
+    OUT PULONG LogHeaderSize)
+{
+    PHBASE_BLOCK LogBaseBlock;
+    ULONG BitmapSize;
+    ULONG HeaderSize;
+    ULONG Offset = 0;
+
+    LogBaseBlock = Hive->Allocate(HV_LOG_HEADER_SIZE, TRUE, TAG_CM);
+    if (!LogBaseBlock) return NULL;
+
+    /* An empty or missing log simply fails to read */
+    if (!Hive->FileRead(Hive, HFILE_TYPE_LOG, &Offset,
+                        LogBaseBlock, HV_LOG_HEADER_SIZE) ||
+        LogBaseBlock->Signature != HV_SIGNATURE ||
+        LogBaseBlock->Type != HFILE_TYPE_LOG ||
+        LogBaseBlock->Format != HBASE_FORMAT_MEMORY ||
+        LogBaseBlock->Sequence1 != LogBaseBlock->Sequence2 ||
+        HvpHiveHeaderChecksum(LogBaseBlock) != LogBaseBlock->CheckSum ||
+        LogBaseBlock->Length == 0 ||
+        (LogBaseBlock->Length % HBLOCK_SIZE) != 0)
+    {
+        Hive->Free(LogBaseBlock, HV_LOG_HEADER_SIZE);
+        return NULL;
+    }
+
+    /* The dirty vector follows the header, its size depends on the hive length */
+    BitmapSize = ROUND_UP(LogBaseBlock->Length / HBLOCK_SIZE,
+                          sizeof(ULONG) * 8) / 8;
+    HeaderSize = ROUND_UP(HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize,
+                          HBLOCK_SIZE);
+    Hive->Free(LogBaseBlock, HV_LOG_HEADER_SIZE);
+
+    LogBaseBlock = Hive->Allocate(HeaderSize, TRUE, TAG_CM);
+    if (!LogBaseBlock) return NULL;
+
+    Offset = 0;
+    if (!Hive->FileRead(Hive, HFILE_TYPE_LOG, &Offset,
+                        LogBaseBlock, HeaderSize) ||
+        *(PULONG)((PUCHAR)LogBaseBlock + HV_LOG_HEADER_SIZE) != HV_LOG_DIRT_SIGNATURE)
+    {
+        DPRINT1("Hive log has no valid dirty vector\n");
+        Hive->Free(LogBaseBlock, HeaderSize);
+        return NULL;
+    }
+
+    *LogHeaderSize = HeaderSize;
+    return LogBaseBlock;
+}
+
+/**
+ * @name HvpReplayLog
+ *
+ * Internal function to rebuild the hive file image from the logged blocks
+ * and the unchanged blocks of the primary file.
+ */
+static PHBASE_BLOCK
+HvpReplayLog(
+    IN PHHIVE Hive,
+    IN PHBASE_BLOCK LogBaseBlock,
+    IN ULONG LogHeaderSize,
+    IN PRTL_BITMAP LogVector)
+{
+    PHBASE_BLOCK HiveData;
+    ULONG FileSize;
+    ULONG BlockCount;
+    ULONG BlockIndex;
+    ULONG RunLength;
+    ULONG LogOffset;
+    ULONG Offset;
+
+    FileSize = HBLOCK_SIZE + LogBaseBlock->Length;
+    HiveData = Hive->Allocate(FileSize, TRUE, TAG_CM);
+    if (!HiveData) return NULL;
+
+    /* The logged header is the one of the hive as it was being flushed */
+    RtlZeroMemory(HiveData, HBLOCK_SIZE);
+    RtlCopyMemory(HiveData, LogBaseBlock, HV_LOG_HEADER_SIZE);
+    HiveData->Type = HFILE_TYPE_PRIMARY;
+    HiveData->CheckSum = HvpHiveHeaderChecksum(HiveData);
+
+    BlockCount = LogBaseBlock->Length / HBLOCK_SIZE;
+    LogOffset = LogHeaderSize;
+    for (BlockIndex = 0; BlockIndex < BlockCount; BlockIndex += RunLength)
+    {
+        /* Logged blocks are stored back to back */
+        if (RtlCheckBit(LogVector, BlockIndex))
+        {
+            RunLength = 1;
+            if (!Hive->FileRead(Hive, HFILE_TYPE_LOG, &LogOffset,
+                                (PUCHAR)HiveData + (BlockIndex + 1) * HBLOCK_SIZE,
+                                HBLOCK_SIZE))
+            {
+                break;
+            }
+
+            LogOffset += HBLOCK_SIZE;
+            continue;
+        }
+
+        /* The others didn't change since the primary file was last written */
+        RunLength = 1;
+        while (BlockIndex + RunLength < BlockCount &&
+               !RtlCheckBit(LogVector, BlockIndex + RunLength))
+        {
+            RunLength++;
+        }
+
+        Offset = (BlockIndex + 1) * HBLOCK_SIZE;
+        if (!Hive->FileRead(Hive, HFILE_TYPE_PRIMARY, &Offset,
+                            (PUCHAR)HiveData + Offset,
+                            RunLength * HBLOCK_SIZE))
+        {
+            break;
+        }
+    }
+
+    if (BlockIndex < BlockCount)
+    {
+        DPRINT1("Replaying the hive log failed at block %lu\n", (unsigned long)BlockIndex);
+        Hive->Free(HiveData, FileSize);
+        return NULL;
+    }
+
+    return HiveData;
+}
+
 NTSTATUS CMAPI
 HvLoadHive(IN PHHIVE Hive,
            IN PCUNICODE_STRING FileName OPTIONAL)
 {
     NTSTATUS Status;
     PHBASE_BLOCK BaseBlock = NULL;
+    PHBASE_BLOCK LogBaseBlock = NULL;
+    ULONG LogHeaderSize = 0;
+    RTL_BITMAP LogVector;
     ULONG Result;
     LARGE_INTEGER TimeStamp;
     ULONG Offset = 0;
@@ -438,13 +598,35 @@ HvLoadHive(IN PHHIVE Hive,
 
             /* Fail */
             return STATUS_NOT_REGISTRY_FILE;
+    }
 
-        /* Has recovery data */
-        case RecoverData:
-        case RecoverHeader:
+    /* Check if the log holds changes the primary file doesn't have */
+    if (Hive->Log)
+    {
+        LogBaseBlock = HvpReadLog(Hive, &LogHeaderSize);
+
+        /*
+         * The log is written before the primary file, using the sequence
+         * number the primary header has in its second field while its data
+         * is being written. A log that is newer than an intact primary file
+         * holds lazily flushed changes. A torn header can't be trusted at all.
+         */
+        if (LogBaseBlock &&
+            (((Result == HiveSuccess) && (LogBaseBlock->Sequence1 <= BaseBlock->Sequence2)) ||
+             ((Result == RecoverData) && (LogBaseBlock->Sequence1 < BaseBlock->Sequence2))))
+        {
+            Hive->Free(LogBaseBlock, LogHeaderSize);
+            LogBaseBlock = NULL;
+        }
+    }
 
-            /* Fail */
-            return STATUS_REGISTRY_CORRUPT;
+    /* Has recovery data */
+    if ((Result == RecoverData || Result == RecoverHeader) && !LogBaseBlock)
+    {
+        /* Fail */
+        DPRINT1("Hive is damaged and there is no log to recover it from\n");
+        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+        return STATUS_REGISTRY_CORRUPT;
     }
 
     /* Set default boot type */
@@ -454,26 +636,46 @@ HvLoadHive(IN PHHIVE Hive,
     Hive->BaseBlock = BaseBlock;
     Hive->Version = BaseBlock->Minor;
 
-    /* Allocate a buffer large enough to hold the hive */
-    FileSize = HBLOCK_SIZE + BaseBlock->Length; // == sizeof(HBASE_BLOCK) + BaseBlock->Length;
-    HiveData = Hive->Allocate(FileSize, TRUE, TAG_CM);
-    if (!HiveData)
+    if (LogBaseBlock)
     {
-        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
-        return STATUS_INSUFFICIENT_RESOURCES;
+        DPRINT1("Recovering hive from its log, sequence %lu\n", (unsigned long)LogBaseBlock->Sequence1);
+
+        /* Rebuild the hive image from the primary and the log files */
+        RtlInitializeBitMap(&LogVector,
+                            (PULONG)((PUCHAR)LogBaseBlock + HV_LOG_HEADER_SIZE + sizeof(ULONG)),
+                            ROUND_UP(LogBaseBlock->Length / HBLOCK_SIZE, sizeof(ULONG) * 8));
+        FileSize = HBLOCK_SIZE + LogBaseBlock->Length;
+        HiveData = HvpReplayLog(Hive, LogBaseBlock, LogHeaderSize, &LogVector);
+        if (!HiveData)
+        {
+            Hive->Free(LogBaseBlock, LogHeaderSize);
+            Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+            return STATUS_REGISTRY_IO_FAILED;
+        }
     }
-
-    /* Now read the whole hive */
-    Result = Hive->FileRead(Hive,
-                            HFILE_TYPE_PRIMARY,
-                            &Offset,
-                            HiveData,
-                            FileSize);
-    if (!Result)
+    else
     {
-        Hive->Free(HiveData, FileSize);
-        Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
-        return STATUS_NOT_REGISTRY_FILE;
+        /* Allocate a buffer large enough to hold the hive */
+        FileSize = HBLOCK_SIZE + BaseBlock->Length; // == sizeof(HBASE_BLOCK) + BaseBlock->Length;
+        HiveData = Hive->Allocate(FileSize, TRUE, TAG_CM);
+        if (!HiveData)
+        {
+            Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        /* Now read the whole hive */
+        Result = Hive->FileRead(Hive,
+                                HFILE_TYPE_PRIMARY,
+                                &Offset,
+                                HiveData,
+                                FileSize);
+        if (!Result)
+        {
+            Hive->Free(HiveData, FileSize);
+            Hive->Free(BaseBlock, Hive->BaseBlockAlloc);
+            return STATUS_NOT_REGISTRY_FILE;
+        }
     }
 
     // This is a HACK!
@@ -483,7 +685,22 @@ HvLoadHive(IN PHHIVE Hive,
     /* Initialize the hive directly from memory */
     Status = HvpInitializeMemoryHive(Hive, HiveData, FileName);
     if (!NT_SUCCESS(Status))
+    {
         Hive->Free(HiveData, FileSize);
+        if (LogBaseBlock) Hive->Free(LogBaseBlock, LogHeaderSize);
+        return Status;
+    }
+
+    if (LogBaseBlock)
+    {
+        /* The primary file still lacks the replayed blocks, keep them dirty */
+        ASSERT(Hive->DirtyVector.SizeOfBitMap == LogVector.SizeOfBitMap);
+        RtlCopyMemory(Hive->DirtyVector.Buffer, LogVector.Buffer, LogVector.SizeOfBitMap / 8);
+        Hive->DirtyCount = RtlNumberOfSetBits(&Hive->DirtyVector);
+
+        Hive->Free(LogBaseBlock, LogHeaderSize);
+        Status = STATUS_REGISTRY_RECOVERED;
+    }
 
     return Status;
 }
@@ -584,7 +801,8 @@ HvInitialize(
             }
 
             /* Check for previous damage */
-            ASSERT(Status != STATUS_REGISTRY_RECOVERED);
+            if (Status == STATUS_REGISTRY_RECOVERED)
+                DPRINT1("Hive was recovered from its log file\n");
             break;
         }
 
@@ -9,28 +9,221 @@
 #define NDEBUG
 #include <debug.h>
 
+/* Largest write gathered from blocks that aren't contiguous in memory */
+#define HV_FLUSH_BUFFER_BLOCKS  16
+
+/*
+ * A flush writes the hive in runs of consecutive blocks. The same run
+ * list is used for the log and for the primary file, so that a change
+ * costs one write per run rather than one per block.
+ */
+typedef struct _HV_DIRTY_RUN
+{
+    ULONG BlockIndex;
+    ULONG BlockCount;
+} HV_DIRTY_RUN, *PHV_DIRTY_RUN;
+
+typedef struct _HV_FLUSH_CONTEXT
+{
+    PHV_DIRTY_RUN Runs;
+    ULONG RunCount;
+    ULONG BlockCount;
+    HV_DIRTY_RUN WholeHive;
+    PUCHAR Buffer;
+} HV_FLUSH_CONTEXT, *PHV_FLUSH_CONTEXT;
+
+static ULONG CMAPI
+HvpFindDirtyRun(
+    PHHIVE RegistryHive,
+    ULONG FromIndex,
+    PULONG StartIndex)
+{
+    ULONG Length = RegistryHive->Storage[Stable].Length;
+    ULONG RunLength;
+
+    /* RtlFindSetBits wraps around, so check that we moved forward */
+    *StartIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, FromIndex);
+    if (*StartIndex == ~0U || *StartIndex < FromIndex || *StartIndex >= Length)
+        return 0;
+
+    for (RunLength = 1; *StartIndex + RunLength < Length; RunLength++)
+    {
+        if (!RtlCheckBit(&RegistryHive->DirtyVector, *StartIndex + RunLength))
+            break;
+    }
+
+    return RunLength;
+}
+
+static BOOLEAN CMAPI
+HvpInitFlushContext(
+    PHHIVE RegistryHive,
+    PHV_FLUSH_CONTEXT Context,
+    BOOLEAN OnlyDirty)
+{
+    ULONG Length = RegistryHive->Storage[Stable].Length;
+    ULONG MaxRunLength = 0;
+    ULONG StartIndex;
+    ULONG RunLength;
+    ULONG Index;
+
+    RtlZeroMemory(Context, sizeof(*Context));
+
+    if (!OnlyDirty)
+    {
+        /* The whole storage is a single run */
+        Context->WholeHive.BlockIndex = 0;
+        Context->WholeHive.BlockCount = Length;
+        Context->Runs = &Context->WholeHive;
+        Context->RunCount = (Length != 0) ? 1 : 0;
+        Context->BlockCount = Length;
+        MaxRunLength = Length;
+    }
+    else
+    {
+        /* Count the runs first */
+        for (Index = 0; Index < Length; Index = StartIndex + RunLength)
+        {
+            RunLength = HvpFindDirtyRun(RegistryHive, Index, &StartIndex);
+            if (RunLength == 0)
+                break;
+
+            Context->RunCount++;
+        }
+
+        if (Context->RunCount == 0)
+            return TRUE;
+
+        Context->Runs = RegistryHive->Allocate(Context->RunCount * sizeof(HV_DIRTY_RUN),
+                                               TRUE, TAG_CM);
+        if (Context->Runs == NULL)
+            return FALSE;
+
+        /* And then record them */
+        Context->RunCount = 0;
+        for (Index = 0; Index < Length; Index = StartIndex + RunLength)
+        {
+            RunLength = HvpFindDirtyRun(RegistryHive, Index, &StartIndex);
+            if (RunLength == 0)
+                break;
+
+            Context->Runs[Context->RunCount].BlockIndex = StartIndex;
+            Context->Runs[Context->RunCount].BlockCount = RunLength;
+            Context->RunCount++;
+            Context->BlockCount += RunLength;
+            if (RunLength > MaxRunLength)
+                MaxRunLength = RunLength;
+        }
+    }
+
+    DPRINT("Flushing %lu blocks in %lu runs\n",
+           (unsigned long)Context->BlockCount, (unsigned long)Context->RunCount);
+
+    /* Runs spanning several bins are gathered, without the buffer they are just split */
+    if (MaxRunLength > 1)
+    {
+        Context->Buffer = RegistryHive->Allocate(HV_FLUSH_BUFFER_BLOCKS * HBLOCK_SIZE,
+                                                 TRUE, TAG_CM);
+    }
+
+    return TRUE;
+}
+
+static VOID CMAPI
+HvpFreeFlushContext(
+    PHHIVE RegistryHive,
+    PHV_FLUSH_CONTEXT Context)
+{
+    if (Context->Buffer)
+        RegistryHive->Free(Context->Buffer, 0);
+
+    if (Context->Runs && Context->Runs != &Context->WholeHive)
+        RegistryHive->Free(Context->Runs, 0);
+}
+
+/*
+ * Writes BlockCount blocks starting at BlockIndex to the given file offset.
+ * Blocks of one bin are contiguous in memory and go out straight away,
+ * blocks of different bins are gathered into the flush buffer.
+ */
+static BOOLEAN CMAPI
+HvpWriteBlocks(
+    PHHIVE RegistryHive,
+    PHV_FLUSH_CONTEXT Context,
+    ULONG FileType,
+    ULONG FileOffset,
+    ULONG BlockIndex,
+    ULONG BlockCount)
+{
+    PHMAP_ENTRY BlockList = RegistryHive->Storage[Stable].BlockList;
+    ULONG_PTR BlockAddress;
+    PVOID Buffer;
+    ULONG Count;
+    ULONG i;
+
+    while (BlockCount != 0)
+    {
+        BlockAddress = BlockList[BlockIndex].BlockAddress;
+        for (Count = 1; Count < BlockCount; Count++)
+        {
+            if (BlockList[BlockIndex + Count].BlockAddress !=
+                BlockAddress + Count * HBLOCK_SIZE)
+            {
+                break;
+            }
+        }
+
+        if (Count < BlockCount && Count < HV_FLUSH_BUFFER_BLOCKS && Context->Buffer)
+        {
+            Count = min(BlockCount, HV_FLUSH_BUFFER_BLOCKS);
+            for (i = 0; i < Count; i++)
+            {
+                RtlCopyMemory(Context->Buffer + i * HBLOCK_SIZE,
+                              (PVOID)BlockList[BlockIndex + i].BlockAddress,
+                              HBLOCK_SIZE);
+            }
+            Buffer = Context->Buffer;
+        }
+        else
+        {
+            Buffer = (PVOID)BlockAddress;
+        }
+
+        if (!RegistryHive->FileWrite(RegistryHive, FileType, &FileOffset,
+                                     Buffer, Count * HBLOCK_SIZE))
+        {
+            return FALSE;
+        }
+
+        FileOffset += Count * HBLOCK_SIZE;
+        BlockIndex += Count;
+        BlockCount -= Count;
+    }
+
+    return TRUE;
+}
+
+/*
+ * The log file holds a copy of the base block, the dirty vector and all dirty
+ * blocks of the hive, so that the primary file can be brought up to date again
+ * if it gets torn by a crash, or if the primary writes were deferred.
+ */
 static BOOLEAN CMAPI
 HvpWriteLog(
-    PHHIVE RegistryHive)
+    PHHIVE RegistryHive,
+    PHV_FLUSH_CONTEXT Context)
 {
     ULONG FileOffset;
     UINT32 BufferSize;
     UINT32 BitmapSize;
     PUCHAR Buffer;
     PUCHAR Ptr;
-    ULONG BlockIndex;
-    ULONG LastIndex;
-    PVOID BlockPtr;
+    PHBASE_BLOCK LogHeader;
+    ULONG Run;
     BOOLEAN Success;
-    static ULONG PrintCount = 0;
-
-    if (PrintCount++ == 0)
-    {
-        UNIMPLEMENTED;
-    }
-    return TRUE;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
+    ASSERT(RegistryHive->Log);
     ASSERT(RegistryHive->BaseBlock->Length ==
            RegistryHive->Storage[Stable].Length * HBLOCK_SIZE);
 
@@ -42,7 +235,10 @@ HvpWriteLog(
         return FALSE;
     }
 
-    BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap;
+    /* The bitmap has one bit per block of the stable storage, in whole ULONGs */
+    BitmapSize = ROUND_UP(RegistryHive->Storage[Stable].Length,
+                          sizeof(ULONG) * 8) / 8;
+    ASSERT(BitmapSize <= RegistryHive->DirtyVector.SizeOfBitMap / 8);
     BufferSize = HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize;
     BufferSize = ROUND_UP(BufferSize, HBLOCK_SIZE);
 
@@ -53,15 +249,17 @@ HvpWriteLog(
     {
         return FALSE;
     }
+    RtlZeroMemory(Buffer, BufferSize);
 
-    /* Update first update counter and CheckSum */
-    RegistryHive->BaseBlock->Type = HFILE_TYPE_LOG;
+    /* Update first update counter, the in-memory base block stays a primary one */
     RegistryHive->BaseBlock->Sequence1++;
-    RegistryHive->BaseBlock->CheckSum =
-        HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
 
     /* Copy hive header */
-    RtlCopyMemory(Buffer, RegistryHive->BaseBlock, HV_LOG_HEADER_SIZE);
+    LogHeader = (PHBASE_BLOCK)Buffer;
+    RtlCopyMemory(LogHeader, RegistryHive->BaseBlock, HV_LOG_HEADER_SIZE);
+    LogHeader->Type = HFILE_TYPE_LOG;
+    LogHeader->CheckSum = HvpHiveHeaderChecksum(LogHeader);
+
     Ptr = Buffer + HV_LOG_HEADER_SIZE;
     RtlCopyMemory(Ptr, "DIRT", 4);
     Ptr += 4;
@@ -71,45 +269,34 @@ HvpWriteLog(
     FileOffset = 0;
     Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
                                       &FileOffset, Buffer, BufferSize);
-    RegistryHive->Free(Buffer, 0);
-
     if (!Success)
     {
-        return FALSE;
+        goto Cleanup;
     }
 
-    /* Write dirty blocks */
+    /* Write dirty blocks, back to back */
     FileOffset = BufferSize;
-    BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    for (Run = 0; Run < Context->RunCount; Run++)
     {
-        LastIndex = BlockIndex;
-        BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-        if (BlockIndex == ~0U || BlockIndex < LastIndex)
-        {
-            break;
-        }
-
-        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
-
-        /* Write hive block */
-        Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                         &FileOffset, BlockPtr, HBLOCK_SIZE);
+        Success = HvpWriteBlocks(RegistryHive, Context, HFILE_TYPE_LOG, FileOffset,
+                                 Context->Runs[Run].BlockIndex,
+                                 Context->Runs[Run].BlockCount);
         if (!Success)
         {
-            return FALSE;
+            goto Cleanup;
         }
 
-        BlockIndex++;
-        FileOffset += HBLOCK_SIZE;
+        FileOffset += Context->Runs[Run].BlockCount * HBLOCK_SIZE;
     }
 
-    Success = RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG, FileOffset, FileOffset);
+    Success = RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG,
+                                        FileOffset, RegistryHive->LogSize);
     if (!Success)
     {
         DPRINT("FileSetSize failed\n");
-        return FALSE;
+        goto Cleanup;
     }
+    RegistryHive->LogSize = FileOffset;
 
     /* Flush the log file */
     Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0);
@@ -118,19 +305,19 @@ HvpWriteLog(
         DPRINT("FileFlush failed\n");
     }
 
-    /* Update second update counter and CheckSum */
+    /* Update second update counter and CheckSum, the log is complete now */
     RegistryHive->BaseBlock->Sequence2++;
-    RegistryHive->BaseBlock->CheckSum =
-        HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
+    LogHeader->Sequence2 = RegistryHive->BaseBlock->Sequence2;
+    LogHeader->CheckSum = HvpHiveHeaderChecksum(LogHeader);
 
     /* Write hive header again with updated sequence counter. */
     FileOffset = 0;
     Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                      &FileOffset, RegistryHive->BaseBlock,
+                                      &FileOffset, LogHeader,
                                       HV_LOG_HEADER_SIZE);
     if (!Success)
     {
-        return FALSE;
+        goto Cleanup;
     }
 
     /* Flush the log file */
@@ -140,18 +327,30 @@ HvpWriteLog(
         DPRINT("FileFlush failed\n");
     }
 
-    return TRUE;
+    Success = TRUE;
+
+Cleanup:
+    /*
+     * A log left with mismatching sequence numbers is never replayed, so
+     * just roll back the counter and let the next flush try again.
+     */
+    if (!Success)
+    {
+        DPRINT1("Writing the hive log failed\n");
+        RegistryHive->BaseBlock->Sequence1 = RegistryHive->BaseBlock->Sequence2;
+    }
+
+    RegistryHive->Free(Buffer, 0);
+    return Success;
 }
 
 static BOOLEAN CMAPI
 HvpWriteHive(
     PHHIVE RegistryHive,
-    BOOLEAN OnlyDirty)
+    PHV_FLUSH_CONTEXT Context)
 {
     ULONG FileOffset;
-    ULONG BlockIndex;
-    ULONG LastIndex;
-    PVOID BlockPtr;
+    ULONG Run;
     BOOLEAN Success;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
@@ -182,31 +381,17 @@ HvpWriteHive(
         return FALSE;
     }
 
-    BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    /* Write the runs at their place in the file */
+    for (Run = 0; Run < Context->RunCount; Run++)
     {
-        if (OnlyDirty)
-        {
-            LastIndex = BlockIndex;
-            BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-            if (BlockIndex == ~0U || BlockIndex < LastIndex)
-            {
-                break;
-            }
-        }
-
-        BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
-        FileOffset = (BlockIndex + 1) * HBLOCK_SIZE;
-
-        /* Write hive block */
-        Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                          &FileOffset, BlockPtr, HBLOCK_SIZE);
+        FileOffset = (Context->Runs[Run].BlockIndex + 1) * HBLOCK_SIZE;
+        Success = HvpWriteBlocks(RegistryHive, Context, HFILE_TYPE_PRIMARY, FileOffset,
+                                 Context->Runs[Run].BlockIndex,
+                                 Context->Runs[Run].BlockCount);
         if (!Success)
         {
             return FALSE;
         }
-
-        BlockIndex++;
     }
 
     Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_PRIMARY, NULL, 0);
@@ -243,6 +428,9 @@ BOOLEAN CMAPI
 HvSyncHive(
     PHHIVE RegistryHive)
 {
+    HV_FLUSH_CONTEXT Context;
+    BOOLEAN Success = FALSE;
+
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
     if (RtlFindSetBits(&RegistryHive->DirtyVector, 1, 0) == ~0U)
@@ -250,26 +438,105 @@ HvSyncHive(
         return TRUE;
     }
 
+    /* Collect the dirty runs, both files get the same ones */
+    if (!HvpInitFlushContext(RegistryHive, &Context, TRUE))
+    {
+        return FALSE;
+    }
+
     /* Update hive header modification time */
     KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
-    /* Update log file */
-    if (!HvpWriteLog(RegistryHive))
+    /* Update log file, unless a lazy flush already logged every dirty block */
+    if (RegistryHive->Log && RegistryHive->DirtyCount != 0)
     {
-        return FALSE;
+        if (!HvpWriteLog(RegistryHive, &Context))
+        {
+            goto Cleanup;
+        }
+        RegistryHive->DirtyCount = 0;
     }
 
     /* Update hive file */
-    if (!HvpWriteHive(RegistryHive, TRUE))
+    if (!HvpWriteHive(RegistryHive, &Context))
     {
-        return FALSE;
+        goto Cleanup;
     }
 
     /* Clear dirty bitmap. */
     RtlClearAllBits(&RegistryHive->DirtyVector);
     RegistryHive->DirtyCount = 0;
+    Success = TRUE;
 
-    return TRUE;
+Cleanup:
+    HvpFreeFlushContext(RegistryHive, &Context);
+    return Success;
+}
+
+/**
+ * @name HvLazySyncHive
+ *
+ * Flushes the changes made since the last flush to the log file only. The
+ * scattered writes to the primary file are batched up and done only once
+ * HV_LAZY_LOG_MAX_BLOCKS blocks are waiting, or when HvSyncHive is called.
+ * Until then, HvLoadHive replays the log over the primary file.
+ */
+BOOLEAN CMAPI
+HvLazySyncHive(
+    PHHIVE RegistryHive)
+{
+    HV_FLUSH_CONTEXT Context;
+    BOOLEAN Success = FALSE;
+
+    ASSERT(RegistryHive->ReadOnly == FALSE);
+
+    /* Without a log there is nothing to defer the primary writes to */
+    if (!RegistryHive->Log)
+    {
+        return HvSyncHive(RegistryHive);
+    }
+
+    /* Nothing changed since the last flush */
+    if (RegistryHive->DirtyCount == 0)
+    {
+        return TRUE;
+    }
+
+    if (!HvpInitFlushContext(RegistryHive, &Context, TRUE))
+    {
+        return FALSE;
+    }
+
+    /* Update hive header modification time */
+    KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
+
+    /* Log all blocks the primary file is missing */
+    if (!HvpWriteLog(RegistryHive, &Context))
+    {
+        goto Cleanup;
+    }
+    RegistryHive->DirtyCount = 0;
+    Success = TRUE;
+
+    /* Keep batching while the log stays small */
+    if (Context.BlockCount < HV_LAZY_LOG_MAX_BLOCKS)
+    {
+        goto Cleanup;
+    }
+
+    /* Update hive file */
+    if (!HvpWriteHive(RegistryHive, &Context))
+    {
+        Success = FALSE;
+        goto Cleanup;
+    }
+
+    /* Clear dirty bitmap. */
+    RtlClearAllBits(&RegistryHive->DirtyVector);
+
+Cleanup:
+    HvpFreeFlushContext(RegistryHive, &Context);
+    return Success;
 }
 
 BOOLEAN
@@ -285,16 +552,22 @@ BOOLEAN CMAPI
 HvWriteHive(
     PHHIVE RegistryHive)
 {
+    HV_FLUSH_CONTEXT Context;
+    BOOLEAN Success;
+
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
+    if (!HvpInitFlushContext(RegistryHive, &Context, FALSE))
+    {
+        return FALSE;
+    }
+
     /* Update hive header modification time */
     KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
     /* Update hive file */
-    if (!HvpWriteHive(RegistryHive, FALSE))
-    {
-        return FALSE;
-    }
+    Success = HvpWriteHive(RegistryHive, &Context);
 
-    return TRUE;
+    HvpFreeFlushContext(RegistryHive, &Context);
+    return Success;
 }
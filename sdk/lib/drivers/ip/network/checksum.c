@@ -24,6 +24,11 @@ ULONG ChecksumFold(
   return Sum;
 }
 
+/* Folds a wide sum to 32 bits without losing the carries */
+#define ChecksumFold64(Sum) \
+  ((Sum) = ((Sum) & 0xFFFFFFFF) + ((Sum) >> 32), \
+   (Sum) = ((Sum) & 0xFFFFFFFF) + ((Sum) >> 32))
+
 ULONG ChecksumCompute(
   PVOID Data,
   UINT Count,
@@ -36,24 +41,167 @@ ULONG ChecksumCompute(
  *     Seed  = Previously calculated checksum (if any)
  * RETURNS:
  *     Checksum of buffer
+ * NOTES:
+ *     The words are summed 32 bits at a time into a 64-bit accumulator,
+ *     which holds the carries until the end. A buffer starting on an odd
+ *     address is summed in the other byte order and swapped back (RFC 1071)
  */
 {
-  register ULONG Sum = Seed;
+  PUCHAR Buffer = Data;
+  PULONG Words;
+  ULONGLONG Sum = 0;
+  ULONG Result;
+  BOOLEAN Odd;
+
+  /* The first byte is the low half of a word, the rest are read one off */
+  Odd = ((ULONG_PTR)Buffer & 1) && Count > 0;
+  if (Odd)
+    {
+      Sum = (ULONG)*Buffer << 8;
+      Buffer++;
+      Count--;
+    }
+
+  /* Get to a ULONG boundary */
+  if (((ULONG_PTR)Buffer & 2) && Count > 1)
+    {
+      Sum += *(PUSHORT)Buffer;
+      Buffer += 2;
+      Count -= 2;
+    }
 
-  while (Count > 1)
+  /* Each ULONG holds two words, and 2^16 == 1 in one's complement */
+  Words = (PULONG)Buffer;
+  while (Count >= 32)
     {
-      Sum += *(PUSHORT)Data;
+      Sum += Words[0];
+      Sum += Words[1];
+      Sum += Words[2];
+      Sum += Words[3];
+      Sum += Words[4];
+      Sum += Words[5];
+      Sum += Words[6];
+      Sum += Words[7];
+      Words += 8;
+      Count -= 32;
+    }
+
+  while (Count >= 4)
+    {
+      Sum += *Words++;
+      Count -= 4;
+    }
+
+  Buffer = (PUCHAR)Words;
+  if (Count > 1)
+    {
+      Sum += *(PUSHORT)Buffer;
+      Buffer += 2;
       Count -= 2;
-      Data = (PVOID)((ULONG_PTR) Data + 2);
     }
 
   /* Add left-over byte, if any */
   if (Count > 0)
     {
-      Sum += *(PUCHAR)Data;
+      Sum += *Buffer;
     }
 
-  return Sum;
+  ChecksumFold64(Sum);
+  Result = ChecksumFold((ULONG)Sum);
+  if (Odd)
+    {
+      Result = WN2H(Result);
+    }
+
+  Sum = (ULONGLONG)Result + Seed;
+  ChecksumFold64(Sum);
+
+  return (ULONG)Sum;
+}
+
+ULONG ChecksumCopy(
+  PVOID Destination,
+  PVOID Source,
+  UINT Count,
+  ULONG Seed)
+/*
+ * FUNCTION: Copy a buffer and calculate its checksum in the same pass
+ * ARGUMENTS:
+ *     Destination = Pointer to buffer to copy to
+ *     Source      = Pointer to buffer with data
+ *     Count       = Number of bytes to copy
+ *     Seed        = Previously calculated checksum (if any)
+ * RETURNS:
+ *     Checksum of the data, to be folded like the ChecksumCompute one
+ */
+{
+  ULONG UNALIGNED *Target = Destination;
+  ULONG UNALIGNED *Words = Source;
+  PUCHAR Buffer;
+  ULONGLONG Sum = Seed;
+  ULONG Word;
+
+  while (Count >= 16)
+    {
+      Word = Words[0]; Target[0] = Word; Sum += Word;
+      Word = Words[1]; Target[1] = Word; Sum += Word;
+      Word = Words[2]; Target[2] = Word; Sum += Word;
+      Word = Words[3]; Target[3] = Word; Sum += Word;
+      Words += 4;
+      Target += 4;
+      Count -= 16;
+    }
+
+  while (Count >= 4)
+    {
+      Word = *Words++;
+      *Target++ = Word;
+      Sum += Word;
+      Count -= 4;
+    }
+
+  /* The tail is at an even offset, so its bytes keep their place in a word */
+  Buffer = (PUCHAR)Words;
+  if (Count > 1)
+    {
+      Sum += *(USHORT UNALIGNED *)Buffer;
+    }
+  if (Count & 1)
+    {
+      Sum += Buffer[Count - 1];
+    }
+  RtlCopyMemory(Target, Buffer, Count);
+
+  ChecksumFold64(Sum);
+
+  return (ULONG)Sum;
+}
+
+ULONG
+UDPv4ChecksumFinish(
+  PIPv4_HEADER IPHeader,
+  ULONG DataLength,
+  ULONG Sum)
+/*
+ * FUNCTION: Add the pseudo header to the checksum of a UDP datagram
+ * ARGUMENTS:
+ *     IPHeader   = Pointer to IPv4 header of the datagram
+ *     DataLength = Length of the UDP header and data
+ *     Sum        = ChecksumCompute value of the UDP header and data
+ * RETURNS:
+ *     One's complement of the checksum, in host byte order
+ */
+{
+  /* Add the addresses, the proto number and length */
+  Sum = ChecksumCompute(&IPHeader->SrcAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+  Sum = ChecksumCompute(&IPHeader->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+  Sum += WH2N(IPPROTO_UDP) + WH2N((USHORT)DataLength);
+
+  /* Fold the checksum, it was summed in network byte order */
+  Sum = ChecksumFold(Sum);
+
+  /* Return the one's complement */
+  return ~(ULONG)WN2H(Sum);
 }
 
 ULONG
@@ -62,44 +210,7 @@ UDPv4ChecksumCalculate(
   PUCHAR PacketBuffer,
   ULONG DataLength)
 {
-  ULONG Sum = 0;
-  USHORT TmpSum;
-  ULONG i;
-  BOOLEAN Pad;
-
-  /* Pad the data if needed */
-  Pad = (DataLength & 1);
-  if (Pad)
-      DataLength++;
-
-  /* Add from the UDP header and data */
-  for (i = 0; i < DataLength; i += 2)
-  {
-       TmpSum = ((PacketBuffer[i] << 8) & 0xFF00) +
-                ((Pad && i == DataLength - 2) ? 0 : (PacketBuffer[i+1] & 0x00FF));
-       Sum += TmpSum;
-  }
-
-  /* Add the source address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->SrcAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->SrcAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the destination address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->DstAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->DstAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the proto number and length */
-  Sum += IPPROTO_UDP + (DataLength - (Pad ? 1 : 0));
-
-  /* Fold the checksum and return the one's complement */
-  return ~ChecksumFold(Sum);
+  return UDPv4ChecksumFinish(IPHeader,
+                             DataLength,
+                             ChecksumCompute(PacketBuffer, DataLength, 0));
 }
-
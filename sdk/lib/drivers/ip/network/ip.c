@@ -440,15 +440,6 @@ NTSTATUS IPStartup(PUNICODE_STRING RegistryPath)
 	    DATAGRAM_FRAGMENT_TAG,          /* Tag */
 	    0);                             /* Depth */
 
-    ExInitializeNPagedLookasideList(
-      &IPHoleList,                    /* Lookaside list */
-	    NULL,                           /* Allocate routine */
-	    NULL,                           /* Free routine */
-	    0,                              /* Flags */
-	    sizeof(IPDATAGRAM_HOLE),        /* Size of each entry */
-	    DATAGRAM_HOLE_TAG,              /* Tag */
-	    0);                             /* Depth */
-
     /* Start routing subsystem */
     RouterStartup();
 
@@ -464,8 +455,10 @@ NTSTATUS IPStartup(PUNICODE_STRING RegistryPath)
     InitializeListHead(&NetTableListHead);
     TcpipInitializeSpinLock(&NetTableListLock);
 
-    /* Initialize reassembly list and protecting lock */
+    /* Initialize reassembly list, hash table and protecting lock */
     InitializeListHead(&ReassemblyListHead);
+    for (i = 0; i < IP_REASSEMBLY_BUCKETS; i++)
+        InitializeListHead(&ReassemblyHashTable[i]);
     TcpipInitializeSpinLock(&ReassemblyListLock);
 
     IPInitialized = TRUE;
@@ -496,7 +489,6 @@ NTSTATUS IPShutdown(
     IPFreeReassemblyList();
 
     /* Destroy lookaside lists */
-    ExDeleteNPagedLookasideList(&IPHoleList);
     ExDeleteNPagedLookasideList(&IPDRList);
     ExDeleteNPagedLookasideList(&IPFragmentList);
 
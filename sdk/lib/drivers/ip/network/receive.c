@@ -4,8 +4,9 @@
  * FILE:        network/receive.c
  * PURPOSE:     Internet Protocol receive routines
  * PROGRAMMERS: Casper S. Hornstrup (chorns@users.sourceforge.net)
- * NOTES:       The IP datagram reassembly algorithm is taken from
- *              from RFC 815
+ * NOTES:       Fragments are kept sorted by offset and a datagram is
+ *              complete once they cover it, instead of tracking holes
+ *              as in RFC 815
  * REVISIONS:
  *   CSH 01/08-2000 Created
  */
@@ -13,40 +14,35 @@
 #include "precomp.h"
 
 LIST_ENTRY ReassemblyListHead;
+LIST_ENTRY ReassemblyHashTable[IP_REASSEMBLY_BUCKETS];
 KSPIN_LOCK ReassemblyListLock;
 NPAGED_LOOKASIDE_LIST IPDRList;
 NPAGED_LOOKASIDE_LIST IPFragmentList;
-NPAGED_LOOKASIDE_LIST IPHoleList;
 
-PIPDATAGRAM_HOLE CreateHoleDescriptor(
-  ULONG First,
-  ULONG Last)
+/* Fragment data held by all reassembly structures, protected by ReassemblyListLock */
+static UINT ReassemblyBytes;
+
+static ULONG ReassemblyHash(
+  IPv4_RAW_ADDRESS SrcAddr,
+  IPv4_RAW_ADDRESS DstAddr,
+  USHORT Id,
+  UCHAR Protocol)
 /*
- * FUNCTION: Returns a pointer to a IP datagram hole descriptor
+ * FUNCTION: Returns the hash bucket of a datagram
  * ARGUMENTS:
- *     First = Offset of first octet of the hole
- *     Last  = Offset of last octet of the hole
- * RETURNS:
- *     Pointer to descriptor, NULL if there was not enough free
- *     resources
+ *     SrcAddr  = Source address
+ *     DstAddr  = Destination address
+ *     Id       = Identification number
+ *     Protocol = Internet Protocol number
  */
 {
-	PIPDATAGRAM_HOLE Hole;
-
-	TI_DbgPrint(DEBUG_IP, ("Called. First (%d)  Last (%d).\n", First, Last));
+  ULONG Hash;
 
-	Hole = ExAllocateFromNPagedLookasideList(&IPHoleList);
-	if (!Hole) {
-	    TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
-	    return NULL;
-	}
+  Hash = SrcAddr ^ DstAddr ^ Id ^ ((ULONG)Protocol << 16);
+  Hash ^= Hash >> 16;
+  Hash ^= Hash >> 8;
 
-	Hole->First = First;
-	Hole->Last  = Last;
-
-	TI_DbgPrint(DEBUG_IP, ("Returning hole descriptor at (0x%X).\n", Hole));
-
-	return Hole;
+  return Hash & (IP_REASSEMBLY_BUCKETS - 1);
 }
 
 
@@ -60,27 +56,10 @@ VOID FreeIPDR(
 {
   PLIST_ENTRY CurrentEntry;
   PLIST_ENTRY NextEntry;
-  PIPDATAGRAM_HOLE CurrentH;
   PIP_FRAGMENT CurrentF;
 
   TI_DbgPrint(DEBUG_IP, ("Freeing IP datagram reassembly descriptor (0x%X).\n", IPDR));
 
-  /* Free all descriptors */
-  CurrentEntry = IPDR->HoleListHead.Flink;
-  while (CurrentEntry != &IPDR->HoleListHead) {
-    NextEntry = CurrentEntry->Flink;
-	  CurrentH = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_HOLE, ListEntry);
-    /* Unlink it from the list */
-    RemoveEntryList(CurrentEntry);
-
-    TI_DbgPrint(DEBUG_IP, ("Freeing hole descriptor at (0x%X).\n", CurrentH));
-
-    /* And free the hole descriptor */
-    ExFreeToNPagedLookasideList(&IPHoleList, CurrentH);
-
-    CurrentEntry = NextEntry;
-  }
-
   /* Free all fragments */
   CurrentEntry = IPDR->FragmentListHead.Flink;
   while (CurrentEntry != &IPDR->FragmentListHead) {
@@ -126,15 +105,17 @@ VOID RemoveIPDR(
  * FUNCTION: Removes an IP datagram reassembly structure from the global list
  * ARGUMENTS:
  *     IPDR = Pointer to IP datagram reassembly structure
+ * NOTES:
+ *     The lock is held when this routine is called
  */
 {
-  KIRQL OldIrql;
-
   TI_DbgPrint(DEBUG_IP, ("Removing IPDR at (0x%X).\n", IPDR));
 
-  TcpipAcquireSpinLock(&ReassemblyListLock, &OldIrql);
   RemoveEntryList(&IPDR->ListEntry);
-  TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
+  RemoveEntryList(&IPDR->HashEntry);
+
+  ASSERT(ReassemblyBytes >= IPDR->ReceivedSize);
+  ReassemblyBytes -= IPDR->ReceivedSize;
 }
 
 
@@ -147,40 +128,114 @@ PIPDATAGRAM_REASSEMBLY GetReassemblyInfo(
  * NOTES:
  *     A datagram is identified by four paramters, which are
  *     Source and destination address, protocol number and
- *     identification number
+ *     identification number.
+ *     The lock is held when this routine is called
  */
 {
-  KIRQL OldIrql;
-  PLIST_ENTRY CurrentEntry;
+  PLIST_ENTRY CurrentEntry, BucketHead;
   PIPDATAGRAM_REASSEMBLY Current;
   PIPv4_HEADER Header = (PIPv4_HEADER)IPPacket->Header;
 
   TI_DbgPrint(DEBUG_IP, ("Searching for IPDR for IP packet at (0x%X).\n", IPPacket));
 
-  TcpipAcquireSpinLock(&ReassemblyListLock, &OldIrql);
-
   /* FIXME: Assume IPv4 */
 
-  CurrentEntry = ReassemblyListHead.Flink;
-  while (CurrentEntry != &ReassemblyListHead) {
-	  Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
+  BucketHead = &ReassemblyHashTable[ReassemblyHash(Header->SrcAddr,
+                                                   Header->DstAddr,
+                                                   Header->Id,
+                                                   Header->Protocol)];
+
+  CurrentEntry = BucketHead->Flink;
+  while (CurrentEntry != BucketHead) {
+	  Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, HashEntry);
     if (AddrIsEqual(&IPPacket->SrcAddr, &Current->SrcAddr) &&
       (Header->Id == Current->Id) &&
       (Header->Protocol == Current->Protocol) &&
       (AddrIsEqual(&IPPacket->DstAddr, &Current->DstAddr))) {
-      TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
-
       return Current;
     }
     CurrentEntry = CurrentEntry->Flink;
   }
 
-  TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
-
   return NULL;
 }
 
 
+static PIPDATAGRAM_REASSEMBLY CreateIPDR(
+  PIP_PACKET IPPacket)
+/*
+ * FUNCTION: Creates a reassembly structure and puts it in the hash table
+ * ARGUMENTS:
+ *     IPPacket = Pointer to the first fragment received of the datagram
+ * RETURNS:
+ *     Pointer to the structure, NULL if there was not enough free resources
+ * NOTES:
+ *     The lock is held when this routine is called
+ */
+{
+  PIPDATAGRAM_REASSEMBLY IPDR;
+  PIPv4_HEADER IPv4Header = (PIPv4_HEADER)IPPacket->Header;
+
+  IPDR = ExAllocateFromNPagedLookasideList(&IPDRList);
+  if (!IPDR)
+    return NULL;
+
+  AddrInitIPv4(&IPDR->SrcAddr, IPv4Header->SrcAddr);
+  AddrInitIPv4(&IPDR->DstAddr, IPv4Header->DstAddr);
+  IPDR->Id           = IPv4Header->Id;
+  IPDR->Protocol     = IPv4Header->Protocol;
+  IPDR->TimeoutCount = 0;
+  IPDR->DataSize     = 0;
+  IPDR->ReceivedSize = 0;
+  IPDR->IPv4Header   = NULL;
+  IPDR->HeaderSize   = 0;
+  InitializeListHead(&IPDR->FragmentListHead);
+
+  InsertTailList(&ReassemblyListHead, &IPDR->ListEntry);
+  InsertTailList(&ReassemblyHashTable[ReassemblyHash(IPv4Header->SrcAddr,
+                                                     IPv4Header->DstAddr,
+                                                     IPv4Header->Id,
+                                                     IPv4Header->Protocol)],
+                 &IPDR->HashEntry);
+
+  return IPDR;
+}
+
+
+static VOID EvictIPDRs(
+  PIPDATAGRAM_REASSEMBLY Keep,
+  UINT Size)
+/*
+ * FUNCTION: Makes room for more fragment data under the reassembly limit
+ * ARGUMENTS:
+ *     Keep = Reassembly structure the data is for, which is not evicted
+ *     Size = Number of bytes that are about to be added
+ * NOTES:
+ *     The least recently active datagrams go first, since they are the
+ *     ones most likely to have lost a fragment.
+ *     The lock is held when this routine is called
+ */
+{
+  PLIST_ENTRY CurrentEntry;
+  PIPDATAGRAM_REASSEMBLY Oldest;
+
+  CurrentEntry = ReassemblyListHead.Flink;
+  while (ReassemblyBytes + Size > IP_REASSEMBLY_MAX_BYTES &&
+         CurrentEntry != &ReassemblyListHead) {
+    Oldest = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
+    CurrentEntry = CurrentEntry->Flink;
+
+    if (Oldest == Keep)
+      continue;
+
+    TI_DbgPrint(MID_TRACE, ("Evicting IPDR at (0x%X).\n", Oldest));
+
+    RemoveIPDR(Oldest);
+    FreeIPDR(Oldest);
+  }
+}
+
+
 BOOLEAN
 ReassembleDatagram(
   PIP_PACKET             IPPacket,
@@ -191,7 +246,8 @@ ReassembleDatagram(
  *     IPDR = Pointer to IP datagram reassembly structure
  * NOTES:
  *     This routine concatenates fragments into a complete IP datagram.
- *     The lock is held when this routine is called
+ *     The fragments still live in the packets they arrived in, so this
+ *     is the only copy of their data
  * RETURNS:
  *     Pointer to IP packet, NULL if there was not enough free resources
  * NOTES:
@@ -235,10 +291,14 @@ ReassembleDatagram(
     Fragment = CONTAINING_RECORD(CurrentEntry, IP_FRAGMENT, ListEntry);
 
     /* Copy fragment data into datagram buffer */
-    CopyPacketToBuffer(Data + Fragment->Offset,
-                       Fragment->Packet,
-                       Fragment->PacketOffset,
-                       Fragment->Size);
+    if (CopyPacketToBuffer(Data + Fragment->Offset,
+                           Fragment->Packet,
+                           Fragment->PacketOffset,
+                           Fragment->Size) != Fragment->Size) {
+      TI_DbgPrint(MIN_TRACE, ("Fragment is shorter than its header says.\n"));
+      (*IPPacket->Free)(IPPacket);
+      return FALSE;
+    }
 
     CurrentEntry = CurrentEntry->Flink;
   }
@@ -247,24 +307,162 @@ ReassembleDatagram(
 }
 
 
-__inline VOID Cleanup(
-  PKSPIN_LOCK Lock,
-  KIRQL OldIrql,
-  PIPDATAGRAM_REASSEMBLY IPDR)
+static BOOLEAN
+CopyDatagram(
+  PIP_PACKET Datagram,
+  PIP_PACKET IPPacket)
 /*
- * FUNCTION: Performs cleaning operations on errors
+ * FUNCTION: Makes a datagram that arrived in one piece contiguous
  * ARGUMENTS:
- *     Lock     = Pointer to spin lock to be released
- *     OldIrql  = Value of IRQL when spin lock was acquired
- *     IPDR     = Pointer to IP datagram reassembly structure to free
- *     Buffer   = Optional pointer to a buffer to free
+ *     Datagram = Pointer to IP packet to initialize
+ *     IPPacket = Pointer to the received IP packet
+ * RETURNS:
+ *     FALSE if there was not enough free resources or the packet is truncated
  */
 {
-  TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+  UINT DataSize = IPPacket->TotalSize - IPPacket->HeaderSize;
 
-  TcpipReleaseSpinLock(Lock, OldIrql);
-  RemoveIPDR(IPDR);
-  FreeIPDR(IPDR);
+  PAGED_CODE();
+
+  Datagram->TotalSize  = IPPacket->TotalSize;
+  Datagram->HeaderSize = IPPacket->HeaderSize;
+
+  RtlCopyMemory(&Datagram->SrcAddr, &IPPacket->SrcAddr, sizeof(IP_ADDRESS));
+  RtlCopyMemory(&Datagram->DstAddr, &IPPacket->DstAddr, sizeof(IP_ADDRESS));
+
+  Datagram->Header = ExAllocatePoolWithTag(PagedPool, Datagram->TotalSize, PACKET_BUFFER_TAG);
+  if (!Datagram->Header) {
+    TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+    return FALSE;
+  }
+  Datagram->MappedHeader = FALSE;
+
+  RtlCopyMemory(Datagram->Header, IPPacket->Header, IPPacket->HeaderSize);
+
+  Datagram->Data = (PVOID)((ULONG_PTR)Datagram->Header + Datagram->HeaderSize);
+
+  if (CopyPacketToBuffer(Datagram->Data,
+                         IPPacket->NdisPacket,
+                         IPPacket->Position + IPPacket->HeaderSize,
+                         DataSize) != DataSize) {
+    TI_DbgPrint(MIN_TRACE, ("Datagram is shorter than its header says.\n"));
+    (*Datagram->Free)(Datagram);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+static BOOLEAN
+InsertFragment(
+  PIPDATAGRAM_REASSEMBLY IPDR,
+  PIP_PACKET IPPacket,
+  UINT FragFirst,
+  UINT Size,
+  BOOLEAN MoreFragments)
+/*
+ * FUNCTION: Adds a fragment to a datagram being reassembled
+ * ARGUMENTS:
+ *     IPDR          = Pointer to IP datagram reassembly structure
+ *     IPPacket      = Pointer to the fragment
+ *     FragFirst     = Offset of the fragment data in the datagram
+ *     Size          = Number of data bytes in the fragment
+ *     MoreFragments = TRUE unless this is the last fragment
+ * RETURNS:
+ *     FALSE if the fragment was not used
+ * NOTES:
+ *     Duplicates and fragments overlapping data we already have are
+ *     dropped, so the held fragments never overlap and the datagram is
+ *     complete when they add up to its size.
+ *     The lock is held when this routine is called
+ */
+{
+  PLIST_ENTRY CurrentEntry;
+  PIP_FRAGMENT Fragment, Previous, Next;
+  UINT FragLast = FragFirst + Size;
+
+  /* The last fragment fixes the size, everything else has to fit in it */
+  if (!MoreFragments) {
+    if (IPDR->DataSize != 0)
+      return FALSE;
+
+    if (!IsListEmpty(&IPDR->FragmentListHead)) {
+      Previous = CONTAINING_RECORD(IPDR->FragmentListHead.Blink, IP_FRAGMENT, ListEntry);
+      if (Previous->Offset + Previous->Size > FragLast)
+        return FALSE;
+    }
+  } else if (IPDR->DataSize != 0 && FragLast > IPDR->DataSize) {
+    return FALSE;
+  }
+
+  /* Fragments mostly arrive in order, so search from the end */
+  CurrentEntry = IPDR->FragmentListHead.Blink;
+  while (CurrentEntry != &IPDR->FragmentListHead) {
+    Previous = CONTAINING_RECORD(CurrentEntry, IP_FRAGMENT, ListEntry);
+    if (Previous->Offset < FragFirst)
+      break;
+    CurrentEntry = CurrentEntry->Blink;
+  }
+
+  if (CurrentEntry != &IPDR->FragmentListHead) {
+    Previous = CONTAINING_RECORD(CurrentEntry, IP_FRAGMENT, ListEntry);
+    if (Previous->Offset + Previous->Size > FragFirst)
+      return FALSE;
+  }
+
+  if (CurrentEntry->Flink != &IPDR->FragmentListHead) {
+    Next = CONTAINING_RECORD(CurrentEntry->Flink, IP_FRAGMENT, ListEntry);
+    if (FragLast > Next->Offset)
+      return FALSE;
+  }
+
+  /* If this is the first fragment, save the IP header */
+  if (FragFirst == 0) {
+    IPDR->IPv4Header = ExAllocatePoolWithTag(NonPagedPool,
+                                             IPPacket->HeaderSize,
+                                             PACKET_BUFFER_TAG);
+    if (!IPDR->IPv4Header)
+      return FALSE;
+
+    RtlCopyMemory(IPDR->IPv4Header, IPPacket->Header, IPPacket->HeaderSize);
+    IPDR->HeaderSize = IPPacket->HeaderSize;
+
+    TI_DbgPrint(DEBUG_IP, ("First fragment found. Header buffer is at (0x%X). "
+                           "Header size is (%d).\n", &IPDR->IPv4Header, IPPacket->HeaderSize));
+  }
+
+  Fragment = ExAllocateFromNPagedLookasideList(&IPFragmentList);
+  if (!Fragment) {
+    if (FragFirst == 0) {
+      ExFreePoolWithTag(IPDR->IPv4Header, PACKET_BUFFER_TAG);
+      IPDR->IPv4Header = NULL;
+    }
+    return FALSE;
+  }
+
+  TI_DbgPrint(DEBUG_IP, ("Fragment descriptor allocated at (0x%X).\n", Fragment));
+
+  Fragment->Size = Size;
+  Fragment->Packet = IPPacket->NdisPacket;
+  Fragment->ReturnPacket = IPPacket->ReturnPacket;
+  Fragment->PacketOffset = IPPacket->Position + IPPacket->HeaderSize;
+  Fragment->Offset = FragFirst;
+
+  /* Disassociate the NDIS packet so it isn't freed upon return from IPReceive() */
+  IPPacket->NdisPacket = NULL;
+
+  /* If this is the last fragment, save the datagram data size */
+  if (!MoreFragments)
+    IPDR->DataSize = FragLast;
+
+  /* Link the fragment in after the one before it */
+  InsertHeadList(CurrentEntry, &Fragment->ListEntry);
+
+  IPDR->ReceivedSize += Size;
+  ReassemblyBytes += Size;
+
+  return TRUE;
 }
 
 
@@ -283,183 +481,99 @@ VOID ProcessFragment(
 {
   KIRQL OldIrql;
   PIPDATAGRAM_REASSEMBLY IPDR;
-  PLIST_ENTRY CurrentEntry;
-  PIPDATAGRAM_HOLE Hole, NewHole;
-  USHORT FragFirst;
-  USHORT FragLast;
+  UINT FragFirst;
+  UINT Size;
   BOOLEAN MoreFragments;
   PIPv4_HEADER IPv4Header;
   IP_PACKET Datagram;
-  PIP_FRAGMENT Fragment;
   BOOLEAN Success;
 
   /* FIXME: Assume IPv4 */
 
   IPv4Header = (PIPv4_HEADER)IPPacket->Header;
 
-  /* Check if we already have an reassembly structure for this datagram */
-  IPDR = GetReassemblyInfo(IPPacket);
-  if (IPDR) {
-    TI_DbgPrint(DEBUG_IP, ("Continueing assembly.\n"));
-    /* We have a reassembly structure */
-    TcpipAcquireSpinLock(&IPDR->Lock, &OldIrql);
-      
-    /* Reset the timeout since we received a fragment */
-    IPDR->TimeoutCount = 0;
-  } else {
-    TI_DbgPrint(DEBUG_IP, ("Starting new assembly.\n"));
-
-    /* We don't have a reassembly structure, create one */
-    IPDR = ExAllocateFromNPagedLookasideList(&IPDRList);
-    if (!IPDR)
-      /* We don't have the resources to process this packet, discard it */
-      return;
-
-    /* Create a descriptor spanning from zero to infinity.
-       Actually, we use a value slightly greater than the
-       maximum number of octets an IP datagram can contain */
-    Hole = CreateHoleDescriptor(0, 65536);
-    if (!Hole) {
-      /* We don't have the resources to process this packet, discard it */
-      ExFreeToNPagedLookasideList(&IPDRList, IPDR);
-      return;
-    }
-    AddrInitIPv4(&IPDR->SrcAddr, IPv4Header->SrcAddr);
-    AddrInitIPv4(&IPDR->DstAddr, IPv4Header->DstAddr);
-    IPDR->Id         = IPv4Header->Id;
-    IPDR->Protocol   = IPv4Header->Protocol;
-    IPDR->TimeoutCount = 0;
-    InitializeListHead(&IPDR->FragmentListHead);
-    InitializeListHead(&IPDR->HoleListHead);
-    InsertTailList(&IPDR->HoleListHead, &Hole->ListEntry);
-
-    TcpipInitializeSpinLock(&IPDR->Lock);
-
-    TcpipAcquireSpinLock(&IPDR->Lock, &OldIrql);
-
-    /* Update the reassembly list */
-    TcpipInterlockedInsertTailList(
-	&ReassemblyListHead,
-	&IPDR->ListEntry,
-	&ReassemblyListLock);
+  if (IPPacket->TotalSize < IPPacket->HeaderSize) {
+    TI_DbgPrint(MIN_TRACE, ("Datagram received with a bad total length (%d).\n",
+      IPPacket->TotalSize));
+    /* Discard packet */
+    return;
   }
 
   FragFirst     = (WN2H(IPv4Header->FlagsFragOfs) & IPv4_FRAGOFS_MASK) << 3;
-  FragLast      = FragFirst + WN2H(IPv4Header->TotalLength);
+  Size          = IPPacket->TotalSize - IPPacket->HeaderSize;
   MoreFragments = (WN2H(IPv4Header->FlagsFragOfs) & IPv4_MF_MASK) > 0;
 
-  CurrentEntry = IPDR->HoleListHead.Flink;
-  for (;;) {
-    if (CurrentEntry == &IPDR->HoleListHead)
-        break;
-
-    Hole = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_HOLE, ListEntry);
+  /* FIXME: Assumes IPv4 */
+  IPInitializePacket(&Datagram, IP_ADDRESS_V4);
 
-    TI_DbgPrint(DEBUG_IP, ("Comparing Fragment (%d,%d) to Hole (%d,%d).\n",
-      FragFirst, FragLast, Hole->First, Hole->Last));
-
-    if ((FragFirst > Hole->Last) || (FragLast < Hole->First)) {
-      TI_DbgPrint(MID_TRACE, ("No overlap.\n"));
-      /* The fragment does not overlap with the hole, try next
-         descriptor in the list */
-
-      CurrentEntry = CurrentEntry->Flink;
-      continue;
+  if (FragFirst == 0 && !MoreFragments) {
+    /* Not a fragment, so there is nothing to reassemble */
+    if (!CopyDatagram(&Datagram, IPPacket))
+      /* Not enough free resources, discard the packet */
+      return;
+  } else {
+    /* Every fragment but the last carries a multiple of 8 bytes, and
+       none may reach past the largest datagram */
+    if (Size == 0 ||
+        (MoreFragments && (Size & 7)) ||
+        FragFirst + Size > 0xFFFF - IPPacket->HeaderSize) {
+      TI_DbgPrint(MIN_TRACE, ("Invalid fragment (%d,%d).\n", FragFirst, Size));
+      /* Discard packet */
+      return;
     }
 
-    /* The fragment overlap with the hole, unlink the descriptor */
-    RemoveEntryList(CurrentEntry);
+    TcpipAcquireSpinLock(&ReassemblyListLock, &OldIrql);
 
-    if (FragFirst > Hole->First) {
-      NewHole = CreateHoleDescriptor(Hole->First, FragFirst - 1);
-      if (!NewHole) {
-        /* We don't have the resources to process this packet, discard it */
-        ExFreeToNPagedLookasideList(&IPHoleList, Hole);
-        Cleanup(&IPDR->Lock, OldIrql, IPDR);
-        return;
-      }
+    /* Check if we already have an reassembly structure for this datagram */
+    IPDR = GetReassemblyInfo(IPPacket);
+    if (IPDR) {
+      TI_DbgPrint(DEBUG_IP, ("Continueing assembly.\n"));
 
-      /* Put the new descriptor in the list */
-      InsertTailList(&IPDR->HoleListHead, &NewHole->ListEntry);
-    }
+      /* Reset the timeout since we received a fragment */
+      IPDR->TimeoutCount = 0;
+
+      /* And make it the most recently active */
+      RemoveEntryList(&IPDR->ListEntry);
+      InsertTailList(&ReassemblyListHead, &IPDR->ListEntry);
+    } else {
+      TI_DbgPrint(DEBUG_IP, ("Starting new assembly.\n"));
 
-    if ((FragLast < Hole->Last) && MoreFragments) {
-      NewHole = CreateHoleDescriptor(FragLast + 1, Hole->Last);
-      if (!NewHole) {
+      IPDR = CreateIPDR(IPPacket);
+      if (!IPDR) {
         /* We don't have the resources to process this packet, discard it */
-        ExFreeToNPagedLookasideList(&IPHoleList, Hole);
-        Cleanup(&IPDR->Lock, OldIrql, IPDR);
+        TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
         return;
       }
-
-      /* Put the new hole descriptor in the list */
-      InsertTailList(&IPDR->HoleListHead, &NewHole->ListEntry);
     }
 
-    ExFreeToNPagedLookasideList(&IPHoleList, Hole);
+    /* Stay within the reassembly limit */
+    EvictIPDRs(IPDR, Size);
 
-    /* If this is the first fragment, save the IP header */
-    if (FragFirst == 0) {
-        IPDR->IPv4Header = ExAllocatePoolWithTag(NonPagedPool,
-                                                 IPPacket->HeaderSize,
-                                                 PACKET_BUFFER_TAG);
-        if (!IPDR->IPv4Header)
-        {
-            Cleanup(&IPDR->Lock, OldIrql, IPDR);
-            return;
-        }
+    if (!InsertFragment(IPDR, IPPacket, FragFirst, Size, MoreFragments)) {
+      TI_DbgPrint(MID_TRACE, ("Fragment (%d,%d) not used.\n", FragFirst, Size));
 
-        RtlCopyMemory(IPDR->IPv4Header, IPPacket->Header, IPPacket->HeaderSize);
-        IPDR->HeaderSize = IPPacket->HeaderSize;
-
-        TI_DbgPrint(DEBUG_IP, ("First fragment found. Header buffer is at (0x%X). "
-                               "Header size is (%d).\n", &IPDR->IPv4Header, IPPacket->HeaderSize));
+      if (IsListEmpty(&IPDR->FragmentListHead)) {
+        RemoveIPDR(IPDR);
+        FreeIPDR(IPDR);
+      }
 
+      TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
+      return;
     }
 
-    /* Create a buffer, copy the data into it and put it
-       in the fragment list */
-
-    Fragment = ExAllocateFromNPagedLookasideList(&IPFragmentList);
-    if (!Fragment) {
-      /* We don't have the resources to process this packet, discard it */
-      Cleanup(&IPDR->Lock, OldIrql, IPDR);
+    if (IPDR->DataSize == 0 || IPDR->ReceivedSize != IPDR->DataSize) {
+      /* Still waiting for fragments */
+      TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
       return;
     }
 
-    TI_DbgPrint(DEBUG_IP, ("Fragment descriptor allocated at (0x%X).\n", Fragment));
-
-    Fragment->Size = IPPacket->TotalSize - IPPacket->HeaderSize;
-    Fragment->Packet = IPPacket->NdisPacket;
-    Fragment->ReturnPacket = IPPacket->ReturnPacket;
-    Fragment->PacketOffset = IPPacket->Position + IPPacket->HeaderSize;
-    Fragment->Offset = FragFirst;
-
-    /* Disassociate the NDIS packet so it isn't freed upon return from IPReceive() */
-    IPPacket->NdisPacket = NULL;
-
-    /* If this is the last fragment, compute and save the datagram data size */
-    if (!MoreFragments)
-      IPDR->DataSize = FragFirst + Fragment->Size;
-
-    /* Put the fragment in the list */
-    InsertTailList(&IPDR->FragmentListHead, &Fragment->ListEntry);
-    break;
-  }
-
-  TI_DbgPrint(DEBUG_IP, ("Done searching for hole descriptor.\n"));
-
-  if (IsListEmpty(&IPDR->HoleListHead)) {
-    /* Hole list is empty which means a complete datagram can be assembled.
-       Assemble the datagram and pass it to an upper layer protocol */
+    /* The fragments cover the whole datagram. Assemble it and pass
+       it to an upper layer protocol */
 
     TI_DbgPrint(DEBUG_IP, ("Complete datagram received.\n"));
-      
-    RemoveIPDR(IPDR);
-    TcpipReleaseSpinLock(&IPDR->Lock, OldIrql);
 
-    /* FIXME: Assumes IPv4 */
-    IPInitializePacket(&Datagram, IP_ADDRESS_V4);
+    RemoveIPDR(IPDR);
+    TcpipReleaseSpinLock(&ReassemblyListLock, OldIrql);
 
     Success = ReassembleDatagram(&Datagram, IPDR);
 
@@ -468,17 +582,16 @@ VOID ProcessFragment(
     if (!Success)
       /* Not enough free resources, discard the packet */
       return;
+  }
 
-    DISPLAY_IP_PACKET(&Datagram);
+  DISPLAY_IP_PACKET(&Datagram);
 
-    /* Give the packet to the protocol dispatcher */
-    IPDispatchProtocol(IF, &Datagram);
+  /* Give the packet to the protocol dispatcher */
+  IPDispatchProtocol(IF, &Datagram);
 
-    /* We're done with this datagram */
-    TI_DbgPrint(MAX_TRACE, ("Freeing datagram at (0x%X).\n", Datagram));
-    Datagram.Free(&Datagram);
-  } else
-    TcpipReleaseSpinLock(&IPDR->Lock, OldIrql);
+  /* We're done with this datagram */
+  TI_DbgPrint(MAX_TRACE, ("Freeing datagram at (0x%X).\n", Datagram));
+  Datagram.Free(&Datagram);
 }
 
 
@@ -499,8 +612,8 @@ VOID IPFreeReassemblyList(
     NextEntry = CurrentEntry->Flink;
     Current = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
 
-    /* Unlink it from the list */
-    RemoveEntryList(CurrentEntry);
+    /* Unlink it from the lists */
+    RemoveIPDR(Current);
 
     /* And free the descriptor */
     FreeIPDR(Current);
@@ -532,18 +645,14 @@ VOID IPDatagramReassemblyTimeout(
        NextEntry = CurrentEntry->Flink;
        CurrentIPDR = CONTAINING_RECORD(CurrentEntry, IPDATAGRAM_REASSEMBLY, ListEntry);
 
-       TcpipAcquireSpinLockAtDpcLevel(&CurrentIPDR->Lock);
-
        if (++CurrentIPDR->TimeoutCount == MAX_TIMEOUT_COUNT)
        {
-           TcpipReleaseSpinLockFromDpcLevel(&CurrentIPDR->Lock);
-           RemoveEntryList(CurrentEntry);
+           RemoveIPDR(CurrentIPDR);
            FreeIPDR(CurrentIPDR);
-       } 
+       }
        else
        {
            ASSERT(CurrentIPDR->TimeoutCount < MAX_TIMEOUT_COUNT);
-           TcpipReleaseSpinLockFromDpcLevel(&CurrentIPDR->Lock);
        }
 
        CurrentEntry = NextEntry;
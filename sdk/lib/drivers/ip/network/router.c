@@ -17,6 +17,13 @@
 LIST_ENTRY FIBListHead;
 KSPIN_LOCK FIBLock;
 
+/* Snapshot of FIBListHead used by the transmit path without taking FIBLock.
+ * Readers announce themselves in FIBReaders[FIBEpoch] at DISPATCH_LEVEL, and
+ * a replaced table is only freed once the readers of its epoch are gone. */
+PFIB_TABLE FIBTable = NULL;
+volatile LONG FIBReaders[2];
+volatile LONG FIBEpoch = 0;
+
 void RouterDumpRoutes() {
     PLIST_ENTRY CurrentEntry;
     PLIST_ENTRY NextEntry;
@@ -186,6 +193,208 @@ UINT CommonPrefixLength(
 }
 
 
+#define FIB_CACHE_HASH(Address) \
+    (((Address) ^ ((Address) >> 8) ^ ((Address) >> 16) ^ ((Address) >> 24)) & (FIB_CACHE_SIZE - 1))
+
+static BOOLEAN RouterIsUsable(
+    PNEIGHBOR_CACHE_ENTRY NCE)
+{
+    return !(NCE->State & NUD_STALE) && !(NCE->State & NUD_INCOMPLETE);
+}
+
+
+static PFIB_TABLE RouterBuildFIBTable(
+    VOID)
+/*
+ * FUNCTION: Builds a FIB table from the IPv4 routes of the FIB
+ * RETURNS:
+ *     Pointer to the new table, NULL if there wasn't enough memory
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PLIST_ENTRY CurrentEntry;
+    PFIB_ENTRY Current;
+    PFIB_TABLE Table;
+    PFIB_NODE Node;
+    PFIB_ROUTE Route;
+    ULONG RouteCount = 0, MaxNodes = 1, NodeIndex, Bit, Host, *Link;
+    UINT MaskLength;
+
+    /* Each route needs at most one node per prefix bit */
+    for (CurrentEntry = FIBListHead.Flink;
+         CurrentEntry != &FIBListHead;
+         CurrentEntry = CurrentEntry->Flink) {
+        Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
+        if (Current->NetworkAddress.Type != IP_ADDRESS_V4)
+            continue;
+        RouteCount++;
+        MaxNodes += AddrCountPrefixBits(&Current->Netmask);
+    }
+
+    Table = ExAllocatePoolWithTag(NonPagedPool,
+                                  FIELD_OFFSET(FIB_TABLE, Nodes[MaxNodes]) +
+                                  RouteCount * sizeof(FIB_ROUTE),
+                                  FIB_TABLE_TAG);
+    if (!Table) {
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        return NULL;
+    }
+
+    RtlZeroMemory(Table, FIELD_OFFSET(FIB_TABLE, Nodes[MaxNodes]));
+    Table->Routes = (PFIB_ROUTE)&Table->Nodes[MaxNodes];
+    Table->NodeCount = 1;
+    Route = Table->Routes;
+
+    for (CurrentEntry = FIBListHead.Flink;
+         CurrentEntry != &FIBListHead;
+         CurrentEntry = CurrentEntry->Flink) {
+        Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
+        if (Current->NetworkAddress.Type != IP_ADDRESS_V4)
+            continue;
+
+        /* Walk the prefix down from the root, adding the missing nodes */
+        MaskLength = AddrCountPrefixBits(&Current->Netmask);
+        Host = IPv4NToHl(Current->NetworkAddress.Address.IPv4Address);
+        Node = &Table->Nodes[0];
+        for (Bit = 0; Bit < MaskLength; Bit++) {
+            Link = &Node->Child[(Host >> (31 - Bit)) & 1];
+            if (!*Link)
+                *Link = ++Table->NodeCount;
+            Node = &Table->Nodes[*Link - 1];
+        }
+
+        /* Keep the routes of a prefix sorted by metric */
+        Route->Router = Current->Router;
+        Route->Metric = Current->Metric;
+        for (Link = &Node->Routes;
+             *Link && Table->Routes[*Link - 1].Metric <= Route->Metric;
+             Link = &Table->Routes[*Link - 1].Next);
+        Route->Next = *Link;
+        *Link = (ULONG)(Route - Table->Routes) + 1;
+        Route++;
+    }
+
+    /* Nodes come after their parent, so one pass links the shorter prefixes */
+    for (NodeIndex = 0; NodeIndex < Table->NodeCount; NodeIndex++) {
+        Node = &Table->Nodes[NodeIndex];
+        for (Bit = 0; Bit < 2; Bit++) {
+            if (!Node->Child[Bit])
+                continue;
+            Table->Nodes[Node->Child[Bit] - 1].Parent =
+                Node->Routes ? NodeIndex + 1 : Node->Parent;
+        }
+    }
+
+    return Table;
+}
+
+
+static VOID RouterReplaceFIBTable(
+    PFIB_TABLE Table)
+/*
+ * FUNCTION: Makes a FIB table visible to the readers and frees the old one
+ * ARGUMENTS:
+ *     Table = Pointer to the new table, NULL makes readers use the FIB list
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_TABLE OldTable;
+    LONG Epoch;
+
+    OldTable = InterlockedExchangePointer((PVOID*)&FIBTable, Table);
+
+    /* Readers that saw the previous epoch change are retrying, let them */
+    Epoch = FIBEpoch;
+    while (FIBReaders[Epoch ^ 1])
+        YieldProcessor();
+
+    /* Send new readers to the other counter and wait for the old ones */
+    InterlockedExchange(&FIBEpoch, Epoch ^ 1);
+    while (FIBReaders[Epoch])
+        YieldProcessor();
+
+    if (OldTable)
+        ExFreePoolWithTag(OldTable, FIB_TABLE_TAG);
+}
+
+
+static VOID RouterPublishRoutes(
+    VOID)
+/*
+ * FUNCTION: Rebuilds the FIB table after the FIB has changed
+ * NOTES:
+ *     The forward information base lock must be held when called.
+ *     Without memory for the table, readers fall back to the FIB list
+ */
+{
+    RouterReplaceFIBTable(RouterBuildFIBTable());
+}
+
+
+static PNEIGHBOR_CACHE_ENTRY RouterLookupFIBTable(
+    PFIB_TABLE Table,
+    IPv4_RAW_ADDRESS Destination)
+/*
+ * FUNCTION: Finds the longest prefix route to an IPv4 destination
+ * ARGUMENTS:
+ *     Table       = Pointer to FIB table
+ *     Destination = Destination address in network byte order
+ * RETURNS:
+ *     Pointer to NCE for router, NULL if none was found
+ * NOTES:
+ *     A longer prefix wins unless none of its routers are usable
+ */
+{
+    PLONGLONG Slot;
+    LONGLONG Cached;
+    PFIB_ROUTE Route;
+    PNEIGHBOR_CACHE_ENTRY NCE, Fallback = NULL;
+    ULONG Host, Bit, NodeIndex, Deepest, RouteIndex;
+
+    /* See if we routed this destination before */
+    Slot = &Table->Cache[FIB_CACHE_HASH(Destination)];
+    Cached = InterlockedCompareExchange64(Slot, 0, 0);
+    Deepest = (ULONG)((ULONGLONG)Cached >> 32);
+    if (!Deepest || (ULONG)Cached != Destination) {
+        /* Walk the trie along the destination bits */
+        Host = IPv4NToHl(Destination);
+        NodeIndex = 0;
+        Deepest = Table->Nodes[0].Routes ? 1 : 0;
+        for (Bit = 0; Bit < 32; Bit++) {
+            NodeIndex = Table->Nodes[NodeIndex].Child[(Host >> (31 - Bit)) & 1];
+            if (!NodeIndex)
+                break;
+            NodeIndex--;
+            if (Table->Nodes[NodeIndex].Routes)
+                Deepest = NodeIndex + 1;
+        }
+
+        if (!Deepest)
+            return NULL;
+
+        InterlockedCompareExchange64(Slot,
+                                     ((LONGLONG)Deepest << 32) | Destination,
+                                     Cached);
+    }
+
+    /* Take the cheapest usable router of the longest prefix which has one */
+    for (NodeIndex = Deepest; NodeIndex; NodeIndex = Table->Nodes[NodeIndex - 1].Parent) {
+        for (RouteIndex = Table->Nodes[NodeIndex - 1].Routes; RouteIndex; RouteIndex = Route->Next) {
+            Route = &Table->Routes[RouteIndex - 1];
+            NCE = Route->Router;
+            if (RouterIsUsable(NCE))
+                return NCE;
+            if (!Fallback)
+                Fallback = NCE;
+        }
+    }
+
+    return Fallback;
+}
+
+
 PFIB_ENTRY RouterAddRoute(
     PIP_ADDRESS NetworkAddress,
     PIP_ADDRESS Netmask,
@@ -206,6 +415,7 @@ PFIB_ENTRY RouterAddRoute(
  *     these references
  */
 {
+    KIRQL OldIrql;
     PFIB_ENTRY FIBE;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. NetworkAddress (0x%X)  Netmask (0x%X) "
@@ -230,7 +440,10 @@ PFIB_ENTRY RouterAddRoute(
     FIBE->Metric         = Metric;
 
     /* Add FIB to the forward information base */
-    TcpipInterlockedInsertTailList(&FIBListHead, &FIBE->ListEntry, &FIBLock);
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+    InsertTailList(&FIBListHead, &FIBE->ListEntry);
+    RouterPublishRoutes();
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return FIBE;
 }
@@ -249,25 +462,48 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 {
     KIRQL OldIrql;
     PLIST_ENTRY CurrentEntry;
-    PLIST_ENTRY NextEntry;
     PFIB_ENTRY Current;
-    UCHAR State;
-    UINT Length, BestLength = 0, MaskLength;
+    PFIB_TABLE Table;
+    LONG Epoch;
+    BOOLEAN Usable, BestUsable = FALSE;
+    UINT Length, BestLength = 0, MaskLength, BestMetric = 0;
     PNEIGHBOR_CACHE_ENTRY NCE, BestNCE = NULL;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. Destination (0x%X)\n", Destination));
 
     TI_DbgPrint(DEBUG_ROUTER, ("Destination (%s)\n", A2S(Destination)));
 
+    if (Destination->Type == IP_ADDRESS_V4) {
+        /* Enter the current epoch, so our table stays around */
+        TcpipRaiseIrqlToDpcLevel(&OldIrql);
+        for (;;) {
+            Epoch = FIBEpoch;
+            InterlockedIncrement(&FIBReaders[Epoch]);
+            if (FIBEpoch == Epoch)
+                break;
+            InterlockedDecrement(&FIBReaders[Epoch]);
+        }
+
+        Table = FIBTable;
+        if (Table)
+            BestNCE = RouterLookupFIBTable(Table, Destination->Address.IPv4Address);
+
+        InterlockedDecrement(&FIBReaders[Epoch]);
+        TcpipLowerIrql(OldIrql);
+
+        if (Table)
+            goto Done;
+    }
+
+    /* No table to use, so search the whole FIB */
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
 
-    CurrentEntry = FIBListHead.Flink;
-    while (CurrentEntry != &FIBListHead) {
-        NextEntry = CurrentEntry->Flink;
-	    Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
+    for (CurrentEntry = FIBListHead.Flink;
+         CurrentEntry != &FIBListHead;
+         CurrentEntry = CurrentEntry->Flink) {
+	Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
 
-        NCE   = Current->Router;
-        State = NCE->State;
+        NCE = Current->Router;
 
 	Length = CommonPrefixLength(Destination, &Current->NetworkAddress);
 	MaskLength = AddrCountPrefixBits(&Current->Netmask);
@@ -275,19 +511,28 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 	TI_DbgPrint(DEBUG_ROUTER,("This-Route: %s (Sharing %d bits)\n",
 				  A2S(&NCE->Address), Length));
 
-	if(Length >= MaskLength && (Length > BestLength || !BestNCE) &&
-           ((!(State & NUD_STALE) && !(State & NUD_INCOMPLETE)) || !BestNCE)) {
+        if (Length < MaskLength)
+            continue;
+
+        /* Same choice as the FIB table: a usable router first, then the
+         * longest prefix, then the cheapest route */
+        Usable = RouterIsUsable(NCE);
+        if (!BestNCE || (Usable && !BestUsable) ||
+            (Usable == BestUsable &&
+             (MaskLength > BestLength ||
+              (MaskLength == BestLength && Current->Metric < BestMetric)))) {
 	    /* This seems to be a better router */
 	    BestNCE    = NCE;
-	    BestLength = Length;
+	    BestLength = MaskLength;
+	    BestMetric = Current->Metric;
+	    BestUsable = Usable;
 	    TI_DbgPrint(DEBUG_ROUTER,("Route selected\n"));
 	}
-
-        CurrentEntry = NextEntry;
     }
 
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
+Done:
     if( BestNCE ) {
 	TI_DbgPrint(DEBUG_ROUTER,("Routing to %s\n", A2S(&BestNCE->Address)));
     } else {
@@ -357,6 +602,8 @@ VOID RouterRemoveRoutesForInterface(PIP_INTERFACE Interface)
 
         CurrentEntry = NextEntry;
     }
+
+    RouterPublishRoutes();
     
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 }
@@ -406,6 +653,7 @@ NTSTATUS RouterRemoveRoute(PIP_ADDRESS Target, PIP_ADDRESS Router)
     if( Found ) {
         TI_DbgPrint(DEBUG_ROUTER, ("Deleting route\n"));
         DestroyFIBE( Current );
+        RouterPublishRoutes();
     }
 
     RouterDumpRoutes();
@@ -487,12 +735,19 @@ NTSTATUS RouterStartup(
  *     Status of operation
  */
 {
+    KIRQL OldIrql;
+
     TI_DbgPrint(DEBUG_ROUTER, ("Called.\n"));
 
     /* Initialize the Forward Information Base */
     InitializeListHead(&FIBListHead);
     TcpipInitializeSpinLock(&FIBLock);
 
+    /* Start with an empty table */
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+    RouterPublishRoutes();
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
+
     return STATUS_SUCCESS;
 }
 
@@ -512,6 +767,7 @@ NTSTATUS RouterShutdown(
     /* Clear Forward Information Base */
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
     DestroyFIBEs();
+    RouterReplaceFIBTable(NULL);
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return STATUS_SUCCESS;
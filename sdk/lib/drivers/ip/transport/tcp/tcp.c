@@ -164,6 +164,30 @@ NTSTATUS TCPClose( PCONNECTION_ENDPOINT Connection )
     return STATUS_SUCCESS;
 }
 
+static BOOLEAN TCPCorrectChecksum(PIP_PACKET IPPacket)
+/*
+ * FUNCTION: Verifies the checksum of a received TCP segment
+ * ARGUMENTS:
+ *     IPPacket = Pointer to an IP packet with the header and segment in one buffer
+ * RETURNS:
+ *     TRUE if the checksum is correct
+ * NOTES:
+ *     lwIP leaves this to us so the segment is summed on the processor that
+ *     received it rather than on the tcpip thread
+ */
+{
+    PIPv4_HEADER IPHeader = IPPacket->Header;
+    UINT Length = IPPacket->TotalSize - IPPacket->HeaderSize;
+    ULONG Sum;
+
+    Sum = ChecksumCompute((PUCHAR)IPPacket->Header + IPPacket->HeaderSize, Length, 0);
+    Sum = ChecksumCompute(&IPHeader->SrcAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+    Sum = ChecksumCompute(&IPHeader->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
+    Sum += WH2N(IPPROTO_TCP) + WH2N((USHORT)Length);
+
+    return ChecksumFold(Sum) == 0xFFFF;
+}
+
 VOID TCPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
 /*
  * FUNCTION: Receives and queues TCP data
@@ -176,7 +200,14 @@ VOID TCPReceive(PIP_INTERFACE Interface, PIP_PACKET IPPacket)
     TI_DbgPrint(DEBUG_TCP,("Sending packet %d (%d) to lwIP\n",
                            IPPacket->TotalSize,
                            IPPacket->HeaderSize));
-    
+
+    if (!TCPCorrectChecksum(IPPacket))
+    {
+        TI_DbgPrint(MIN_TRACE, ("Segment received with bad checksum\n"));
+        /* Discard packet */
+        return;
+    }
+
     LibIPInsertPacket(Interface->TCPContext, IPPacket->Header, IPPacket->TotalSize);
 }
 
@@ -35,6 +35,7 @@ NTSTATUS AddUDPHeaderIPv4(
 {
     PUDP_HEADER UDPHeader;
     NTSTATUS Status;
+    ULONG Sum;
 
     TI_DbgPrint(MID_TRACE, ("Packet: %x NdisPacket %x\n",
 			    IPPacket, IPPacket->NdisPacket));
@@ -59,11 +60,13 @@ NTSTATUS AddUDPHeaderIPv4(
 			    IPPacket->Header, IPPacket->Data,
 			    (PCHAR)IPPacket->Data - (PCHAR)IPPacket->Header));
 
-    RtlCopyMemory(IPPacket->Data, Data, DataLength);
+    /* Checksum the data while we copy it, then add the header */
+    Sum = ChecksumCopy(IPPacket->Data, Data, DataLength, 0);
+    Sum = ChecksumCompute(UDPHeader, sizeof(UDP_HEADER), Sum);
 
-    UDPHeader->Checksum = UDPv4ChecksumCalculate((PIPv4_HEADER)IPPacket->Header,
-                                                 (PUCHAR)UDPHeader,
-                                                 DataLength + sizeof(UDP_HEADER));
+    UDPHeader->Checksum = UDPv4ChecksumFinish((PIPv4_HEADER)IPPacket->Header,
+                                              DataLength + sizeof(UDP_HEADER),
+                                              Sum);
     UDPHeader->Checksum = WH2N(UDPHeader->Checksum);
 
     TI_DbgPrint(MID_TRACE, ("Packet: %d ip %d udp %d payload\n",
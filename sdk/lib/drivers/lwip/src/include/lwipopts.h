@@ -96,6 +96,10 @@
 
 #define PPPOS_SUPPORT                   0
 
+/* TCPReceive verifies incoming segments on the receiving processor
+ * before they are queued to the tcpip thread */
+#define CHECKSUM_CHECK_TCP              0
+
 /*
    ---------------------------------------
    ---------- Debugging options ----------
@@ -1928,6 +1928,7 @@ RtlAllocateHeap(IN PVOID HeapPtr,
     BOOLEAN HeapLocked = FALSE;
     PHEAP_VIRTUAL_ALLOC_ENTRY VirtualBlock = NULL;
     PHEAP_ENTRY_EXTRA Extra;
+    PVOID FrontEndBlock;
     NTSTATUS Status;
 
     /* Force flags */
@@ -1977,6 +1978,17 @@ RtlAllocateHeap(IN PVOID HeapPtr,
 
     Index = AllocationSize >> HEAP_ENTRY_SHIFT;
 
+    /* Small blocks without extra stuff are served by the front end heap without locking */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP &&
+        EntryFlags == HEAP_ENTRY_BUSY &&
+        Index < HEAP_LFH_BUCKETS)
+    {
+        FrontEndBlock = RtlpLowFragHeapAllocate(Heap, Flags, Size, AllocationSize, Index);
+        if (FrontEndBlock) return FrontEndBlock;
+
+        /* The front end couldn't grow, let the back end try */
+    }
+
     /* Acquire the lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2147,46 +2159,17 @@ RtlAllocateHeap(IN PVOID HeapPtr,
 }
 
 
-/***********************************************************************
- *           HeapFree   (KERNEL32.338)
- * RETURNS
- * TRUE: Success
- * FALSE: Failure
- *
- * @implemented
- */
-BOOLEAN NTAPI RtlFreeHeap(
-   HANDLE HeapPtr, /* [in] Handle of heap */
-   ULONG Flags,   /* [in] Heap freeing flags */
-   PVOID Ptr     /* [in] Address of memory to free */
-)
+static
+BOOLEAN
+RtlpFreeHeapBlock(PHEAP Heap,
+                  PVOID Ptr)
 {
-    PHEAP Heap;
     PHEAP_ENTRY HeapEntry;
     USHORT TagIndex = 0;
     SIZE_T BlockSize;
     PHEAP_VIRTUAL_ALLOC_ENTRY VirtualEntry;
-    BOOLEAN Locked = FALSE;
     NTSTATUS Status;
 
-    /* Freeing NULL pointer is a legal operation */
-    if (!Ptr) return TRUE;
-
-    /* Get pointer to the heap and force flags */
-    Heap = (PHEAP)HeapPtr;
-    Flags |= Heap->ForceFlags;
-
-    /* Call special heap */
-    if (RtlpHeapIsSpecial(Flags))
-        return RtlDebugFreeHeap(Heap, Flags, Ptr);
-
-    /* Lock if necessary */
-    if (!(Flags & HEAP_NO_SERIALIZE))
-    {
-        RtlEnterHeapLock(Heap->LockVariable, TRUE);
-        Locked = TRUE;
-    }
-
     /* Get pointer to the heap entry */
     HeapEntry = (PHEAP_ENTRY)Ptr - 1;
 
@@ -2198,9 +2181,6 @@ BOOLEAN NTAPI RtlFreeHeap(
         /* This is an invalid block */
         DPRINT1("HEAP: Trying to free an invalid address %p!\n", Ptr);
         RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
-
-        /* Release the heap lock */
-        if (Locked) RtlLeaveHeapLock(Heap->LockVariable);
         return FALSE;
     }
 
@@ -2284,10 +2264,60 @@ BOOLEAN NTAPI RtlFreeHeap(
         }
     }
 
+    return TRUE;
+}
+
+/***********************************************************************
+ *           HeapFree   (KERNEL32.338)
+ * RETURNS
+ * TRUE: Success
+ * FALSE: Failure
+ *
+ * @implemented
+ */
+BOOLEAN NTAPI RtlFreeHeap(
+   HANDLE HeapPtr, /* [in] Handle of heap */
+   ULONG Flags,   /* [in] Heap freeing flags */
+   PVOID Ptr     /* [in] Address of memory to free */
+)
+{
+    PHEAP Heap;
+    BOOLEAN Locked = FALSE;
+    BOOLEAN Freed;
+
+    /* Freeing NULL pointer is a legal operation */
+    if (!Ptr) return TRUE;
+
+    /* Get pointer to the heap and force flags */
+    Heap = (PHEAP)HeapPtr;
+    Flags |= Heap->ForceFlags;
+
+    /* Call special heap */
+    if (RtlpHeapIsSpecial(Flags))
+        return RtlDebugFreeHeap(Heap, Flags, Ptr);
+
+    /* Front end heap blocks are freed without taking the lock */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP &&
+        RtlpIsLowFragHeapEntry((PHEAP_ENTRY)Ptr - 1))
+    {
+        RtlpLowFragHeapFree(Heap, (PHEAP_ENTRY)Ptr - 1);
+        return TRUE;
+    }
+
+    /* Lock if necessary */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        Locked = TRUE;
+    }
+
+    /* Free the block */
+    Freed = RtlpFreeHeapBlock(Heap, Ptr);
+
     /* Release the heap lock */
     if (Locked) RtlLeaveHeapLock(Heap->LockVariable);
 
-    return TRUE;
+    return Freed;
 }
 
 BOOLEAN NTAPI
@@ -2605,6 +2635,13 @@ RtlReAllocateHeap(HANDLE HeapPtr,
         AllocationSize += sizeof(HEAP_ENTRY_EXTRA);
     }
 
+    /* Front end heap blocks have a fixed size and are handled there */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP &&
+        RtlpIsLowFragHeapEntry((PHEAP_ENTRY)Ptr - 1))
+    {
+        return RtlpLowFragHeapReAllocate(Heap, Flags, Ptr, Size, AllocationSize);
+    }
+
     /* Acquire the lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -3155,6 +3192,12 @@ RtlpValidateHeapEntry(
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY)) goto invalid_entry;
 
     BigAllocation = HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC;
+
+    /* Front end blocks live inside back end blocks, just check the segment range below */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP &&
+        RtlpIsLowFragHeapEntry(HeapEntry))
+        goto find_segment;
+
     Segment = Heap->Segments[HeapEntry->SegmentOffset];
 
     if (BigAllocation &&
@@ -3174,6 +3217,7 @@ RtlpValidateHeapEntry(
     /* Checks are done, if this is a virtual entry, that's all */
     if (HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC) return TRUE;
 
+find_segment:
     /* Go through segments and check if this entry fits into any of them */
     for (SegmentOffset = 0; SegmentOffset < HEAP_SEGMENTS; SegmentOffset++)
     {
@@ -3918,13 +3962,15 @@ RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
         }
 
         /* Check for a special magic value for enabling LFH */
-        if (*(PULONG)HeapInformation != 2)
+        if (*(PULONG)HeapInformation != HEAP_FRONT_LOWFRAGHEAP)
         {
             return STATUS_UNSUCCESSFUL;
         }
 
-        DPRINT1("RtlSetHeapInformation() needs to enable LFH\n");
-        return STATUS_SUCCESS;
+        /* A heap is required here */
+        if (!HeapHandle) return STATUS_INVALID_PARAMETER;
+
+        return RtlpActivateLowFragHeap((PHEAP)HeapHandle);
     }
 
     return STATUS_SUCCESS;
@@ -3963,6 +4009,65 @@ RtlQueryHeapInformation(HANDLE HeapHandle,
     return STATUS_UNSUCCESSFUL;
 }
 
+static
+PHEAP_FREE_ENTRY
+RtlpFindFreeBlock(PHEAP Heap,
+                  SIZE_T Index)
+{
+    PLIST_ENTRY FreeListHead, Next;
+    PHEAP_FREE_ENTRY FreeBlock;
+    ULONG FreeListsInUseUlong, InUseIndex, i;
+
+    /* Look for the smallest fitting dedicated list first */
+    if (Index < HEAP_FREELISTS)
+    {
+        /* This bit magic disables all sizes which are less than the requested size */
+        InUseIndex = (ULONG)Index >> 5;
+        FreeListsInUseUlong = Heap->u.FreeListsInUseUlong[InUseIndex] & ~((1 << ((ULONG)Index & 0x1f)) - 1);
+
+        for (i = InUseIndex; i < HEAP_FREELISTS / 32; i++)
+        {
+            if (i != InUseIndex)
+                FreeListsInUseUlong = Heap->u.FreeListsInUseUlong[i];
+
+            if (FreeListsInUseUlong)
+            {
+                FreeListHead = &Heap->FreeLists[i * 32 + RtlpFindLeastSetBit(FreeListsInUseUlong)];
+                FreeBlock = CONTAINING_RECORD(FreeListHead->Blink, HEAP_FREE_ENTRY, FreeList);
+                RtlpRemoveFreeBlock(Heap, FreeBlock, TRUE, FALSE);
+                return FreeBlock;
+            }
+        }
+    }
+
+    /* Then the non-dedicated list, if its largest entry is big enough */
+    FreeListHead = &Heap->FreeLists[0];
+    Next = FreeListHead->Blink;
+    if (FreeListHead != Next &&
+        CONTAINING_RECORD(Next, HEAP_FREE_ENTRY, FreeList)->Size >= Index)
+    {
+        for (Next = FreeListHead->Flink; Next != FreeListHead; Next = Next->Flink)
+        {
+            FreeBlock = CONTAINING_RECORD(Next, HEAP_FREE_ENTRY, FreeList);
+            if (FreeBlock->Size >= Index)
+            {
+                RtlpRemoveFreeBlock(Heap, FreeBlock, FALSE, FALSE);
+                return FreeBlock;
+            }
+        }
+    }
+
+    /* Nothing suitable, extend the heap */
+    FreeBlock = RtlpExtendHeap(Heap, Index << HEAP_ENTRY_SHIFT);
+    if (FreeBlock)
+        RtlpRemoveFreeBlock(Heap, FreeBlock, FALSE, FALSE);
+
+    return FreeBlock;
+}
+
+/*
+ * @implemented
+ */
 NTSTATUS
 NTAPI
 RtlMultipleAllocateHeap(IN PVOID HeapHandle,
@@ -3971,10 +4076,147 @@ RtlMultipleAllocateHeap(IN PVOID HeapHandle,
                         IN ULONG Count,
                         OUT PVOID *Array)
 {
-    UNIMPLEMENTED;
-    return 0;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    SIZE_T AllocationSize, Index, RunCount, RunSize, i;
+    PHEAP_FREE_ENTRY FreeBlock;
+    PHEAP_ENTRY RunEntry, InUseEntry;
+    EXCEPTION_RECORD ExceptionRecord;
+    BOOLEAN HeapLocked = FALSE;
+    UCHAR LastEntryFlag;
+    ULONG Allocated = 0;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Calculate allocation size and index */
+    if (Size)
+        AllocationSize = Size;
+    else
+        AllocationSize = 1;
+
+    /* Only plain back end blocks can be carved in runs, everything else goes block by block */
+    if (RtlpHeapIsSpecial(Flags) ||
+        (Flags & (HEAP_EXTRA_FLAGS_MASK | HEAP_SETTABLE_USER_FLAGS)) ||
+        (Heap->Flags & (HEAP_FREE_CHECKING_ENABLED | HEAP_TAIL_CHECKING_ENABLED)) ||
+        Heap->PseudoTagEntries ||
+        Size >= 0x80000000)
+    {
+        Index = MAXULONG_PTR;
+    }
+    else
+    {
+        AllocationSize = (AllocationSize + Heap->AlignRound) & Heap->AlignMask;
+        Index = AllocationSize >> HEAP_ENTRY_SHIFT;
+    }
+
+    /* The front end is lock-free already and big blocks are virtual allocations */
+    if (Index > Heap->VirtualMemoryThreshold ||
+        (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP && Index < HEAP_LFH_BUCKETS))
+    {
+        for (Allocated = 0; Allocated < Count; Allocated++)
+        {
+            Array[Allocated] = RtlAllocateHeap(Heap, Flags, Size);
+            if (!Array[Allocated]) break;
+        }
+    }
+    else
+    {
+        /* Acquire the lock once for all blocks */
+        if (!(Flags & HEAP_NO_SERIALIZE))
+        {
+            RtlEnterHeapLock(Heap->LockVariable, TRUE);
+            HeapLocked = TRUE;
+        }
+
+        while (Allocated < Count)
+        {
+            /* Try to carve all remaining blocks out of one free block, halve the run if there is none */
+            RunCount = min(Count - Allocated, HEAP_MAX_BLOCK_SIZE / Index);
+            for (;;)
+            {
+                FreeBlock = RtlpFindFreeBlock(Heap, RunCount * Index);
+                if (FreeBlock || RunCount == 1) break;
+                RunCount = (RunCount + 1) / 2;
+            }
+
+            /* Out of memory */
+            if (!FreeBlock) break;
+
+            /* Take the whole run as one busy entry... */
+            RunEntry = RtlpSplitEntry(Heap,
+                                      Flags,
+                                      FreeBlock,
+                                      RunCount * AllocationSize,
+                                      RunCount * Index,
+                                      RunCount * AllocationSize - (AllocationSize - Size));
+            RunSize = RunEntry->Size;
+            LastEntryFlag = RunEntry->Flags & HEAP_ENTRY_LAST_ENTRY;
+
+            /* ...and cut it into blocks. The first one keeps the previous size of the run */
+            for (i = 0, InUseEntry = RunEntry; i < RunCount; i++, InUseEntry += Index)
+            {
+                if (i != 0)
+                {
+                    InUseEntry->PreviousSize = (USHORT)Index;
+                    InUseEntry->SegmentOffset = RunEntry->SegmentOffset;
+                }
+
+                InUseEntry->Size = (USHORT)Index;
+                InUseEntry->Flags = HEAP_ENTRY_BUSY;
+                InUseEntry->SmallTagIndex = 0;
+                InUseEntry->UnusedBytes = (UCHAR)(AllocationSize - Size);
+
+                Array[Allocated++] = InUseEntry + 1;
+            }
+
+            /* The last block takes what the split left over, and the run's place in the segment */
+            InUseEntry -= Index;
+            InUseEntry->Size = (USHORT)(RunSize - (RunCount - 1) * Index);
+            InUseEntry->UnusedBytes += (UCHAR)((InUseEntry->Size - Index) << HEAP_ENTRY_SHIFT);
+            InUseEntry->Flags |= LastEntryFlag;
+
+            if (!LastEntryFlag)
+                (InUseEntry + InUseEntry->Size)->PreviousSize = InUseEntry->Size;
+        }
+
+        /* Release the lock */
+        if (HeapLocked) RtlLeaveHeapLock(Heap->LockVariable);
+
+        /* Zero memory if that was requested */
+        if (Flags & HEAP_ZERO_MEMORY)
+        {
+            for (i = 0; i < Allocated; i++)
+                RtlZeroMemory(Array[i], Size);
+        }
+    }
+
+    /* Everything has been allocated */
+    if (Allocated == Count) return STATUS_SUCCESS;
+
+    /* It's all or nothing, give back what we've got */
+    RtlMultipleFreeHeap(Heap, Flags, Allocated, Array);
+    RtlZeroMemory(Array, Count * sizeof(PVOID));
+    RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_NO_MEMORY);
+
+    /* Generate an exception */
+    if (Flags & HEAP_GENERATE_EXCEPTIONS)
+    {
+        ExceptionRecord.ExceptionCode = STATUS_NO_MEMORY;
+        ExceptionRecord.ExceptionRecord = NULL;
+        ExceptionRecord.NumberParameters = 1;
+        ExceptionRecord.ExceptionFlags = 0;
+        ExceptionRecord.ExceptionInformation[0] = AllocationSize;
+
+        RtlRaiseException(&ExceptionRecord);
+    }
+
+    DPRINT1("HEAP: Multiple allocation of %lu blocks failed!\n", Count);
+    return STATUS_NO_MEMORY;
 }
 
+/*
+ * @implemented
+ */
 NTSTATUS
 NTAPI
 RtlMultipleFreeHeap(IN PVOID HeapHandle,
@@ -3982,8 +4224,55 @@ RtlMultipleFreeHeap(IN PVOID HeapHandle,
                     IN ULONG Count,
                     OUT PVOID *Array)
 {
-    UNIMPLEMENTED;
-    return 0;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    NTSTATUS Status = STATUS_SUCCESS;
+    BOOLEAN HeapLocked = FALSE;
+    ULONG i;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Special heaps do their own checks, free block by block there */
+    if (RtlpHeapIsSpecial(Flags))
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (!RtlFreeHeap(Heap, Flags, Array[i]))
+                Status = STATUS_INVALID_PARAMETER;
+        }
+
+        return Status;
+    }
+
+    /* Acquire the lock once for all blocks */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        /* Freeing NULL pointer is a legal operation */
+        if (!Array[i]) continue;
+
+        /* Front end heap blocks don't need the lock, but don't mind it either */
+        if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP &&
+            RtlpIsLowFragHeapEntry((PHEAP_ENTRY)Array[i] - 1))
+        {
+            RtlpLowFragHeapFree(Heap, (PHEAP_ENTRY)Array[i] - 1);
+            continue;
+        }
+
+        /* Keep going on errors, but report them */
+        if (!RtlpFreeHeapBlock(Heap, Array[i]))
+            Status = STATUS_INVALID_PARAMETER;
+    }
+
+    /* Release the lock */
+    if (HeapLocked) RtlLeaveHeapLock(Heap->LockVariable);
+
+    return Status;
 }
 
 /* EOF */
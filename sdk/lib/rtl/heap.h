@@ -55,6 +55,17 @@
 /* Segment flags */
 #define HEAP_USER_ALLOCATED    0x1
 
+/* Front end heap types, as reported by HeapCompatibilityInformation */
+#define HEAP_FRONT_NONE        0
+#define HEAP_FRONT_LOWFRAGHEAP 2
+
+/* Low fragmentation heap parameters */
+#define HEAP_LFH_INDEX            0xFF /* LFHFlags value marking a front end block */
+#define HEAP_LFH_BUCKETS          HEAP_FREELISTS
+#define HEAP_LFH_AFFINITY_SLOTS   8
+#define HEAP_LFH_SUBSEGMENT_SIZE  (16 * 1024)
+#define HEAP_LFH_MIN_BLOCKS       8
+
 /* A handy inline to distinguis normal heap, special "debug heap" and special "page heap" */
 FORCEINLINE BOOLEAN
 RtlpHeapIsSpecial(ULONG Flags)
@@ -327,6 +338,28 @@ typedef struct _HEAP_VIRTUAL_ALLOC_ENTRY
     HEAP_ENTRY BusyBlock;
 } HEAP_VIRTUAL_ALLOC_ENTRY, *PHEAP_VIRTUAL_ALLOC_ENTRY;
 
+/* Low fragmentation heap. Every affinity slot keeps one lock-free list of
+   free blocks per size class, so threads hashed to different slots don't
+   share cache lines or the heap lock on the fast path */
+typedef struct _HEAP_LFH_AFFINITY_SLOT
+{
+    SLIST_HEADER FreeBlocks[HEAP_LFH_BUCKETS];
+} HEAP_LFH_AFFINITY_SLOT, *PHEAP_LFH_AFFINITY_SLOT;
+
+typedef struct _HEAP_LFH
+{
+    HEAP_LFH_AFFINITY_SLOT AffinitySlots[HEAP_LFH_AFFINITY_SLOTS];
+    PHEAP Heap;
+    LONG SubSegmentCount;
+} HEAP_LFH, *PHEAP_LFH;
+
+FORCEINLINE BOOLEAN
+RtlpIsLowFragHeapEntry(PHEAP_ENTRY HeapEntry)
+{
+    return ((HeapEntry->Flags & (HEAP_ENTRY_BUSY | HEAP_ENTRY_VIRTUAL_ALLOC)) == HEAP_ENTRY_BUSY) &&
+           (HeapEntry->LFHFlags == HEAP_LFH_INDEX);
+}
+
 /* Global variables */
 extern RTL_CRITICAL_SECTION RtlpProcessHeapsListLock;
 extern BOOLEAN RtlpPageHeapEnabled;
@@ -352,6 +385,28 @@ RtlpValidateHeapEntry(PHEAP Heap, PHEAP_ENTRY HeapEntry);
 BOOLEAN NTAPI
 RtlpValidateHeapHeaders(PHEAP Heap, BOOLEAN Recalculate);
 
+/* heaplfh.c */
+NTSTATUS NTAPI
+RtlpActivateLowFragHeap(PHEAP Heap);
+
+PVOID NTAPI
+RtlpLowFragHeapAllocate(PHEAP Heap,
+                        ULONG Flags,
+                        SIZE_T Size,
+                        SIZE_T AllocationSize,
+                        SIZE_T Index);
+
+VOID NTAPI
+RtlpLowFragHeapFree(PHEAP Heap,
+                    PHEAP_ENTRY HeapEntry);
+
+PVOID NTAPI
+RtlpLowFragHeapReAllocate(PHEAP Heap,
+                          ULONG Flags,
+                          PVOID Ptr,
+                          SIZE_T Size,
+                          SIZE_T AllocationSize);
+
 /* heapdbg.c */
 HANDLE NTAPI
 RtlDebugCreateHeap(ULONG Flags,
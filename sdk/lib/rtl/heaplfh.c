@@ -0,0 +1,269 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS system libraries
+ * FILE:            lib/rtl/heaplfh.c
+ * PURPOSE:         RTL Low Fragmentation Heap (front end allocator)
+ */
+
+/* Useful references:
+   http://illmatics.com/Understanding_the_LFH.pdf
+   http://msdn.microsoft.com/en-us/library/aa366750(VS.85).aspx
+*/
+
+/* The front end serves small blocks without extra stuff. Blocks of one size
+   class are carved out of subsegments, which are ordinary busy blocks of the
+   back end allocator, so heap validation and destruction don't need to know
+   about the front end at all. Free blocks are kept in lock-free lists, one
+   per size class and affinity slot, and are never handed back to the back
+   end: this keeps the interlocked list pops safe without any locking, since
+   the memory of a popped entry is always still committed. */
+
+/* INCLUDES *****************************************************************/
+
+#include <rtl.h>
+#include <heap.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS *****************************************************************/
+
+FORCEINLINE
+ULONG
+RtlpLowFragHeapAffinitySlot(VOID)
+{
+    /* Spread threads over the slots, thread IDs are multiples of 4 */
+    return ((ULONG)(ULONG_PTR)NtCurrentTeb()->ClientId.UniqueThread >> 2) % HEAP_LFH_AFFINITY_SLOTS;
+}
+
+static
+PSLIST_ENTRY
+RtlpLowFragHeapCreateSubSegment(PHEAP_LFH Lfh,
+                                ULONG Slot,
+                                SIZE_T Index)
+{
+    PHEAP Heap = Lfh->Heap;
+    PSLIST_HEADER FreeBlocks = &Lfh->AffinitySlots[Slot].FreeBlocks[Index];
+    SIZE_T BlockSize, BlockCount, FirstOffset, i;
+    PUCHAR SubSegment;
+    PHEAP_ENTRY FirstBlock, Block;
+
+    /* Calculate how many blocks of this size class go into one subsegment */
+    BlockSize = Index << HEAP_ENTRY_SHIFT;
+    BlockCount = max(HEAP_LFH_SUBSEGMENT_SIZE / BlockSize, HEAP_LFH_MIN_BLOCKS);
+
+    /* User data of 16-byte aligned heaps must stay aligned, not the entry header */
+    if (Heap->Flags & HEAP_CREATE_ALIGN_16)
+        FirstOffset = (16 - sizeof(HEAP_ENTRY)) & 15;
+    else
+        FirstOffset = 0;
+
+    /* Get the subsegment from the back end. It is far bigger than any
+       front end size class, so this doesn't recurse into the front end */
+    SubSegment = RtlAllocateHeap(Heap, 0, FirstOffset + BlockCount * BlockSize);
+    if (!SubSegment) return NULL;
+
+    /* Initialize all blocks, keep the first one for the caller and publish the rest */
+    FirstBlock = (PHEAP_ENTRY)(SubSegment + FirstOffset);
+    for (i = 0, Block = FirstBlock; i < BlockCount; i++, Block += Index)
+    {
+        Block->Size = (USHORT)Index;
+        Block->Flags = 0;
+        Block->SmallTagIndex = 0;
+        Block->PreviousSize = 0;
+        Block->LFHFlags = HEAP_LFH_INDEX;
+        Block->UnusedBytes = 0;
+
+        if (Block != FirstBlock)
+            RtlInterlockedPushEntrySList(FreeBlocks, (PSLIST_ENTRY)(Block + 1));
+    }
+
+    InterlockedIncrement(&Lfh->SubSegmentCount);
+    DPRINT("LFH %p: new subsegment %p for index %Iu, %Iu blocks\n", Lfh, SubSegment, Index, BlockCount);
+
+    return (PSLIST_ENTRY)(FirstBlock + 1);
+}
+
+NTSTATUS NTAPI
+RtlpActivateLowFragHeap(PHEAP Heap)
+{
+    PHEAP_LFH Lfh;
+    ULONG Slot, Index;
+
+    /* Page heaps don't have a front end */
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS) return STATUS_UNSUCCESSFUL;
+
+    /* Nothing to do if it's already enabled */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP) return STATUS_SUCCESS;
+
+    /* The front end is user mode only, relies on the heap being serialized
+       and would hide blocks from the debug heap and from fill pattern checks */
+    if (RtlpGetMode() != UserMode ||
+        RtlpHeapIsSpecial(Heap->Flags) ||
+        (Heap->Flags & (HEAP_NO_SERIALIZE |
+                        HEAP_FREE_CHECKING_ENABLED |
+                        HEAP_TAIL_CHECKING_ENABLED)))
+    {
+        DPRINT1("HEAP: LFH can't be enabled for heap %p with flags 0x%08x\n", Heap, Heap->Flags);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    /* Allocate the front end from the heap itself, it goes away with its segments */
+    Lfh = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, sizeof(HEAP_LFH));
+    if (!Lfh) return STATUS_NO_MEMORY;
+
+    for (Slot = 0; Slot < HEAP_LFH_AFFINITY_SLOTS; Slot++)
+    {
+        for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+            RtlInitializeSListHead(&Lfh->AffinitySlots[Slot].FreeBlocks[Index]);
+    }
+    Lfh->Heap = Heap;
+
+    /* Publish it, making sure the pointer is visible before the type */
+    RtlEnterHeapLock(Heap->LockVariable, TRUE);
+    if (Heap->FrontEndHeapType != HEAP_FRONT_LOWFRAGHEAP)
+    {
+        InterlockedExchangePointer(&Heap->FrontEndHeap, Lfh);
+        Heap->FrontEndHeapType = HEAP_FRONT_LOWFRAGHEAP;
+        Lfh = NULL;
+    }
+    RtlLeaveHeapLock(Heap->LockVariable);
+
+    /* Somebody else was faster */
+    if (Lfh) RtlFreeHeap(Heap, 0, Lfh);
+
+    return STATUS_SUCCESS;
+}
+
+PVOID NTAPI
+RtlpLowFragHeapAllocate(PHEAP Heap,
+                        ULONG Flags,
+                        SIZE_T Size,
+                        SIZE_T AllocationSize,
+                        SIZE_T Index)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    PSLIST_ENTRY FreeEntry;
+    PHEAP_ENTRY InUseEntry;
+    ULONG Slot, i;
+
+    ASSERT(Index < HEAP_LFH_BUCKETS);
+
+    /* Take a free block from our own slot first */
+    Slot = RtlpLowFragHeapAffinitySlot();
+    FreeEntry = RtlInterlockedPopEntrySList(&Lfh->AffinitySlots[Slot].FreeBlocks[Index]);
+
+    /* Blocks freed by other threads end up in their slots, take them back before growing */
+    for (i = 1; !FreeEntry && i < HEAP_LFH_AFFINITY_SLOTS; i++)
+    {
+        FreeEntry = RtlInterlockedPopEntrySList(&Lfh->AffinitySlots[(Slot + i) % HEAP_LFH_AFFINITY_SLOTS].FreeBlocks[Index]);
+    }
+
+    /* Nothing cached at all, carve a new subsegment */
+    if (!FreeEntry)
+    {
+        FreeEntry = RtlpLowFragHeapCreateSubSegment(Lfh, Slot, Index);
+
+        /* Let the back end handle this request and the failure, if any */
+        if (!FreeEntry) return NULL;
+    }
+
+    /* Make this block an in-use one */
+    InUseEntry = (PHEAP_ENTRY)FreeEntry - 1;
+    ASSERT(InUseEntry->LFHFlags == HEAP_LFH_INDEX && InUseEntry->Size == Index);
+    InUseEntry->Flags = HEAP_ENTRY_BUSY;
+    InUseEntry->UnusedBytes = (UCHAR)(AllocationSize - Size);
+
+    /* Zero memory if that was requested */
+    if (Flags & HEAP_ZERO_MEMORY)
+        RtlZeroMemory(InUseEntry + 1, Size);
+
+    return InUseEntry + 1;
+}
+
+VOID NTAPI
+RtlpLowFragHeapFree(PHEAP Heap,
+                    PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    ULONG Slot;
+
+    ASSERT(RtlpIsLowFragHeapEntry(HeapEntry));
+    ASSERT(HeapEntry->Size < HEAP_LFH_BUCKETS);
+
+    /* Mark it free, so that double frees are caught by the busy check */
+    HeapEntry->Flags = 0;
+    HeapEntry->UnusedBytes = 0;
+
+    /* Cache it in the slot of the freeing thread */
+    Slot = RtlpLowFragHeapAffinitySlot();
+    RtlInterlockedPushEntrySList(&Lfh->AffinitySlots[Slot].FreeBlocks[HeapEntry->Size],
+                                 (PSLIST_ENTRY)(HeapEntry + 1));
+}
+
+PVOID NTAPI
+RtlpLowFragHeapReAllocate(PHEAP Heap,
+                          ULONG Flags,
+                          PVOID Ptr,
+                          SIZE_T Size,
+                          SIZE_T AllocationSize)
+{
+    PHEAP_ENTRY InUseEntry = (PHEAP_ENTRY)Ptr - 1;
+    SIZE_T OldSize, BlockSize;
+    PVOID NewBaseAddress;
+    EXCEPTION_RECORD ExceptionRecord;
+
+    BlockSize = (SIZE_T)InUseEntry->Size << HEAP_ENTRY_SHIFT;
+    OldSize = BlockSize - InUseEntry->UnusedBytes;
+
+    /* Front end blocks can't be split or grown, but they can be reused if the new size still fits */
+    if (AllocationSize <= BlockSize && BlockSize - Size <= MAXUCHAR)
+    {
+        InUseEntry->UnusedBytes = (UCHAR)(BlockSize - Size);
+
+        /* Zero out the additional space if required */
+        if (Size > OldSize && (Flags & HEAP_ZERO_MEMORY))
+            RtlZeroMemory((PCHAR)Ptr + OldSize, Size - OldSize);
+
+        return Ptr;
+    }
+
+    if (Flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        DPRINT1("Realloc in place failed, but it was the only option\n");
+        NewBaseAddress = NULL;
+    }
+    else
+    {
+        /* Move it to a block of the right size, wherever it comes from */
+        NewBaseAddress = RtlAllocateHeap(Heap, Flags & ~HEAP_ZERO_MEMORY, Size);
+        if (NewBaseAddress)
+        {
+            /* Copy actual user bits */
+            RtlMoveMemory(NewBaseAddress, Ptr, min(Size, OldSize));
+
+            /* Zero remaining part if required */
+            if (Size > OldSize && (Flags & HEAP_ZERO_MEMORY))
+                RtlZeroMemory((PCHAR)NewBaseAddress + OldSize, Size - OldSize);
+
+            /* Free the old block */
+            RtlpLowFragHeapFree(Heap, InUseEntry);
+        }
+    }
+
+    /* Generate an exception if required */
+    if (!NewBaseAddress && (Flags & HEAP_GENERATE_EXCEPTIONS))
+    {
+        ExceptionRecord.ExceptionCode = STATUS_NO_MEMORY;
+        ExceptionRecord.ExceptionRecord = NULL;
+        ExceptionRecord.NumberParameters = 1;
+        ExceptionRecord.ExceptionFlags = 0;
+        ExceptionRecord.ExceptionInformation[0] = AllocationSize;
+
+        RtlRaiseException(&ExceptionRecord);
+    }
+
+    return NewBaseAddress;
+}
+
+/* EOF */
@@ -0,0 +1,107 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Host test of the btrfs crc32c routines against the byte-at-a-time table
+ */
+
+#include "precomp.h"
+
+BOOL have_sse42;
+
+/* The slicing tables and crc32c_sw are static, so build crc32c.c here */
+#include "../../../drivers/filesystems/btrfs/crc32c.c"
+
+#define BUFFER_SIZE     (16 * 4096)
+#define MAX_OFFSET      8
+#define MAX_SECTORS     10
+
+static UINT8 Buffer[BUFFER_SIZE + MAX_OFFSET];
+static UINT32 Csums[MAX_SECTORS + 1];
+
+// The loop crc32c_sw used before slicing-by-8, one table lookup per byte
+static UINT32 crc32c_byte(const UINT8* msg, ULONG msglen, UINT32 crc) {
+    for (; msglen > 0; msglen--, msg++) {
+        crc = crctable[(crc ^ *msg) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static void TestCrc(const char* Mode, UINT8* Data, ULONG Length, UINT32 Seed) {
+    UINT32 Expected = crc32c_byte(Data, Length, Seed), Result;
+
+    Result = crc32c_sw(Data, Length, Seed);
+    ok(Result == Expected, "%s: offset %u length %u seed %08x: crc32c_sw gave %08x, expected %08x\n",
+       Mode, (ULONG)(Data - Buffer), Length, Seed, Result, Expected);
+
+    Result = calc_crc32c(Seed, Data, Length);
+    ok(Result == Expected, "%s: offset %u length %u seed %08x: calc_crc32c gave %08x, expected %08x\n",
+       Mode, (ULONG)(Data - Buffer), Length, Seed, Result, Expected);
+}
+
+static void TestSectors(const char* Mode, UINT8* Data, UINT32 Sectors, ULONG SectorSize) {
+    UINT32 i, Expected;
+
+    memset(Csums, 0xcc, sizeof(Csums));
+    calc_sector_csums(Data, Sectors, SectorSize, Csums);
+
+    for (i = 0; i < Sectors; i++) {
+        Expected = ~crc32c_byte(Data + ((SIZE_T)i * SectorSize), SectorSize, 0xffffffff);
+        ok(Csums[i] == Expected, "%s: offset %u, %u sectors of %u: sector %u is %08x, expected %08x\n",
+           Mode, (ULONG)(Data - Buffer), Sectors, SectorSize, i, Csums[i], Expected);
+    }
+
+    ok(Csums[Sectors] == 0xcccccccc, "%s: %u sectors of %u: wrote past the end\n", Mode, Sectors, SectorSize);
+}
+
+static void TestMode(const char* Mode) {
+    static const ULONG SectorSizes[] = { 512, 1001, 4096 };
+    ULONG Length, Offset, Trial, i;
+    UINT32 Sectors;
+
+    // The check value of CRC-32C
+    ok(~calc_crc32c(0xffffffff, (UINT8*)"123456789", 9) == 0xe3069283, "%s: wrong check value\n", Mode);
+
+    // Every short length at every alignment, around the eight byte steps
+    for (Offset = 0; Offset < MAX_OFFSET; Offset++) {
+        for (Length = 0; Length <= 300; Length++) {
+            TestCrc(Mode, Buffer + Offset, Length, 0xffffffff);
+        }
+    }
+
+    // Then random lengths, alignments and seeds
+    for (Trial = 0; Trial < 500; Trial++) {
+        Length = (ULONG)rand() % BUFFER_SIZE;
+        Offset = (ULONG)rand() % MAX_OFFSET;
+
+        TestCrc(Mode, Buffer + Offset, Length, ((UINT32)rand() << 16) ^ (UINT32)rand());
+    }
+
+    // Sector runs which aren't a multiple of three, from unaligned buffers
+    for (i = 0; i < sizeof(SectorSizes) / sizeof(SectorSizes[0]); i++) {
+        for (Sectors = 0; Sectors <= MAX_SECTORS && Sectors * SectorSizes[i] <= BUFFER_SIZE; Sectors++) {
+            TestSectors(Mode, Buffer + (Sectors % MAX_OFFSET), Sectors, SectorSizes[i]);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ULONG i;
+
+    srand(1982);
+    for (i = 0; i < sizeof(Buffer); i++) {
+        Buffer[i] = (UINT8)rand();
+    }
+
+    have_sse42 = FALSE;
+    TestMode("table");
+
+    if (HostHasSSE42()) {
+        have_sse42 = TRUE;
+        TestMode("SSE4.2");
+    } else {
+        printf("csumtest: host can't run SSE4.2, skipped\n");
+    }
+
+    return HostTestFinish("csumtest");
+}
@@ -0,0 +1,50 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Host definitions to build the btrfs checksum routines
+ */
+
+#pragma once
+
+#include "../hosttest.h"
+
+/* Build the SSE4.2 paths ReactOS leaves out, so they can be checked against the tables */
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_AMD64)
+#undef __REACTOS__
+#ifdef __GNUC__
+/* crc32c.c uses the crc32 intrinsics without target attributes */
+#pragma GCC target("sse4.2")
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+#define _AMD64_
+#endif
+
+typedef unsigned char UINT8;
+
+#define _In_
+#define _In_reads_bytes_(size)
+#define _Out_writes_(size)
+
+extern BOOL have_sse42;
+
+UINT32 calc_crc32c(UINT32 seed, UINT8* msg, ULONG msglen);
+void calc_sector_csums(UINT8* data, UINT32 sectors, ULONG sector_size, UINT32* csum);
+
+#ifndef __REACTOS__
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static inline BOOL HostHasSSE42(void) {
+    int Info[4];
+
+    __cpuid(Info, 1);
+    return (Info[2] >> 20) & 1;
+}
+#else
+#define HostHasSSE42() __builtin_cpu_supports("sse4.2")
+#endif
+#else
+#define HostHasSSE42() FALSE
+#endif
@@ -0,0 +1,9 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Stands in for the windef.h crc32c.c includes
+ */
+
+#pragma once
+
+#include "precomp.h"
@@ -0,0 +1,22 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Builds galois.c against the host definitions
+ */
+
+#include "precomp.h"
+
+/* The kernel only uses AVX2 once it has saved the extended state, which the host does for us */
+static NTSTATUS SaveExtendedProcessorState(ULONG64 Mask, PXSTATE_SAVE XStateSave) {
+    XStateSave->Mask = Mask;
+    return 0;
+}
+
+static VOID RestoreExtendedProcessorState(PXSTATE_SAVE XStateSave) {
+}
+
+BOOL have_sse2, have_ssse3, have_avx2;
+tKeSaveExtendedProcessorState fKeSaveExtendedProcessorState = SaveExtendedProcessorState;
+tKeRestoreExtendedProcessorState fKeRestoreExtendedProcessorState = RestoreExtendedProcessorState;
+
+#include "../../../drivers/filesystems/btrfs/galois.c"
@@ -0,0 +1,101 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Host definitions to build the btrfs RAID5/6 parity routines
+ */
+
+#pragma once
+
+#include "../hosttest.h"
+
+/* Build the SIMD paths ReactOS leaves out, so they can be checked against the C code */
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_AMD64)
+#undef __REACTOS__
+#endif
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+#define _AMD64_
+#endif
+
+/* galois.c includes btrfs_drv.h, which needs the kernel headers */
+#define BTRFS_DRV_H_DEFINED
+
+typedef unsigned char UINT8;
+
+typedef struct _XSTATE_SAVE {
+    ULONG64 Mask;
+} XSTATE_SAVE, *PXSTATE_SAVE;
+
+#define XSTATE_MASK_AVX     (1ULL << 2)
+
+typedef NTSTATUS (*tKeSaveExtendedProcessorState)(ULONG64 Mask, PXSTATE_SAVE XStateSave);
+typedef VOID (*tKeRestoreExtendedProcessorState)(PXSTATE_SAVE XStateSave);
+
+extern BOOL have_sse2, have_ssse3, have_avx2;
+
+void galois_double(UINT8* data, UINT32 len);
+void galois_divpower(UINT8* data, UINT8 div, UINT32 len);
+void galois_recover2(UINT8* qxy, UINT8* pxy, UINT8* p, UINT8* q, UINT8 a, UINT8 b, UINT32 len);
+void do_xor(UINT8* buf1, UINT8* buf2, UINT32 len);
+UINT8 gpow2(UINT8 e);
+UINT8 gmul(UINT8 a, UINT8 b);
+UINT8 gdiv(UINT8 a, UINT8 b);
+
+#ifndef __REACTOS__
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static inline BOOL HostHasSSSE3(void) {
+    int Info[4];
+
+    __cpuid(Info, 1);
+    return (Info[2] >> 9) & 1;
+}
+
+static inline BOOL HostHasAVX2(void) {
+    int Info[4];
+
+    /* The OS has to save the YMM registers too */
+    __cpuid(Info, 1);
+    if (!(Info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return FALSE;
+
+    __cpuidex(Info, 7, 0);
+    return (Info[1] >> 5) & 1;
+}
+#else
+#define HostHasSSSE3() __builtin_cpu_supports("ssse3")
+#define HostHasAVX2() __builtin_cpu_supports("avx2")
+#endif
+#else
+#define HostHasSSSE3() FALSE
+#define HostHasAVX2() FALSE
+#endif
+
+/* One way of doing the parity work: which SIMD paths galois.c may take */
+typedef struct {
+    const char* Name;
+    BOOL Sse2;
+    BOOL Ssse3;
+    BOOL Avx2;
+} RAID_MODE;
+
+static const RAID_MODE RaidModes[] = {
+    { "scalar", FALSE, FALSE, FALSE },
+    { "SSSE3",  TRUE,  TRUE,  FALSE },
+    { "AVX2",   TRUE,  TRUE,  TRUE  },
+};
+
+#define RAID_MODES (sizeof(RaidModes) / sizeof(RaidModes[0]))
+
+/* Points galois.c at the paths of a mode, or returns FALSE if the host can't run them */
+static inline BOOL RaidSelectMode(const RAID_MODE* Mode) {
+    if ((Mode->Ssse3 && !HostHasSSSE3()) || (Mode->Avx2 && !HostHasAVX2()))
+        return FALSE;
+
+    have_sse2 = Mode->Sse2;
+    have_ssse3 = Mode->Ssse3;
+    have_avx2 = Mode->Avx2;
+
+    return TRUE;
+}
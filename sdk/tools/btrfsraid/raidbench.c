@@ -0,0 +1,72 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Host benchmark of the RAID5/6 parity routines
+ */
+
+#include <time.h>
+
+#include "precomp.h"
+
+#define STRIPES         4
+#define BUFFER_SIZE     65536
+#define ITERATIONS      2000
+
+static UINT8 Data[STRIPES][BUFFER_SIZE];
+static UINT8 P[BUFFER_SIZE];
+static UINT8 Q[BUFFER_SIZE];
+
+static double Seconds(clock_t Start) {
+    return (double)(clock() - Start) / CLOCKS_PER_SEC;
+}
+
+static void Report(const char* Name, ULONG Bytes, double Time) {
+    printf("%-28s %8.3f s %10.1f MB/s\n", Name, Time,
+           (double)Bytes * ITERATIONS / Time / (1024 * 1024));
+}
+
+int main(int argc, char* argv[]) {
+    clock_t Start;
+    ULONG m, i, j;
+    char Name[32];
+
+    for (i = 0; i < STRIPES; i++) {
+        for (j = 0; j < BUFFER_SIZE; j++) {
+            Data[i][j] = (UINT8)(i * 7 + j);
+        }
+    }
+
+    for (m = 0; m < RAID_MODES; m++) {
+        if (!RaidSelectMode(&RaidModes[m]))
+            continue;
+
+        // P and Q over all the data stripes, as write_data_raid6 does
+        Start = clock();
+        for (i = 0; i < ITERATIONS; i++) {
+            memcpy(P, Data[STRIPES - 1], BUFFER_SIZE);
+            memcpy(Q, Data[STRIPES - 1], BUFFER_SIZE);
+
+            for (j = STRIPES - 1; j > 0; j--) {
+                do_xor(P, Data[j - 1], BUFFER_SIZE);
+                galois_double(Q, BUFFER_SIZE);
+                do_xor(Q, Data[j - 1], BUFFER_SIZE);
+            }
+        }
+        sprintf(Name, "%s, P+Q parity", RaidModes[m].Name);
+        Report(Name, STRIPES * BUFFER_SIZE, Seconds(Start));
+
+        Start = clock();
+        for (i = 0; i < ITERATIONS; i++)
+            galois_divpower(Q, 3, BUFFER_SIZE);
+        sprintf(Name, "%s, galois_divpower", RaidModes[m].Name);
+        Report(Name, BUFFER_SIZE, Seconds(Start));
+
+        Start = clock();
+        for (i = 0; i < ITERATIONS; i++)
+            galois_recover2(Q, P, Data[0], Data[1], 0x1d, 0x8e, BUFFER_SIZE);
+        sprintf(Name, "%s, galois_recover2", RaidModes[m].Name);
+        Report(Name, BUFFER_SIZE, Seconds(Start));
+    }
+
+    return 0;
+}
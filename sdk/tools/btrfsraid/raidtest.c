@@ -0,0 +1,148 @@
+/*
+ * PROJECT:     ReactOS btrfs driver
+ * LICENSE:     LGPL-3.0-or-later (https://spdx.org/licenses/LGPL-3.0-or-later)
+ * PURPOSE:     Host test of the RAID5/6 parity routines against byte-at-a-time arithmetic
+ */
+
+#include "precomp.h"
+
+#define MAX_STRIPES     6
+#define BUFFER_SIZE     70000
+#define MAX_OFFSET      32
+
+static UINT8 Data[MAX_STRIPES][BUFFER_SIZE + MAX_OFFSET];
+static UINT8 P[BUFFER_SIZE + MAX_OFFSET];
+static UINT8 Q[BUFFER_SIZE + MAX_OFFSET];
+static UINT8 Work[BUFFER_SIZE + MAX_OFFSET];
+static UINT8 Work2[BUFFER_SIZE + MAX_OFFSET];
+
+static void Fill(UINT8* Buffer, UINT32 Length) {
+    UINT32 i;
+
+    for (i = 0; i < Length; i++) {
+        Buffer[i] = (UINT8)rand();
+    }
+}
+
+// Parity as write_data_raid6 builds it: P is the xor of the data stripes, and Q is
+// D0 + 2*D1 + 4*D2 + ..., doubled and added from the last stripe down.
+static void ComputeParity(UINT32 Stripes, UINT32 Offset, UINT32 Length) {
+    UINT32 i = Stripes - 1;
+
+    memcpy(P + Offset, Data[i] + Offset, Length);
+    memcpy(Q + Offset, Data[i] + Offset, Length);
+
+    while (i > 0) {
+        i--;
+
+        do_xor(P + Offset, Data[i] + Offset, Length);
+
+        galois_double(Q + Offset, Length);
+        do_xor(Q + Offset, Data[i] + Offset, Length);
+    }
+}
+
+static void TestParity(const RAID_MODE* Mode, UINT32 Stripes, UINT32 Offset, UINT32 Length) {
+    UINT32 i, j, Missing;
+    UINT8 ExpectedP, ExpectedQ;
+
+    for (i = 0; i < Stripes; i++) {
+        Fill(Data[i] + Offset, Length);
+    }
+
+    ComputeParity(Stripes, Offset, Length);
+
+    for (j = 0; j < Length; j++) {
+        ExpectedP = ExpectedQ = 0;
+
+        for (i = 0; i < Stripes; i++) {
+            ExpectedP ^= Data[i][Offset + j];
+            ExpectedQ ^= gmul(gpow2((UINT8)i), Data[i][Offset + j]);
+        }
+
+        if (P[Offset + j] != ExpectedP || Q[Offset + j] != ExpectedQ) {
+            ok(FALSE, "%s: %u stripes, offset %u, length %u: byte %u is P %02x Q %02x, expected %02x %02x\n",
+               Mode->Name, Stripes, Offset, Length, j, P[Offset + j], Q[Offset + j], ExpectedP, ExpectedQ);
+            return;
+        }
+    }
+
+    // Get one data stripe back from Q, as raid6_recover2 does when P is missing too
+    Missing = (UINT32)rand() % Stripes;
+    memcpy(Work + Offset, Q + Offset, Length);
+
+    for (i = 0; i < Stripes; i++) {
+        if (i != Missing) {
+            memcpy(Work2 + Offset, Data[i] + Offset, Length);
+
+            for (j = 0; j < i; j++) {
+                galois_double(Work2 + Offset, Length);
+            }
+
+            do_xor(Work + Offset, Work2 + Offset, Length);
+        }
+    }
+
+    if (Missing != 0)
+        galois_divpower(Work + Offset, (UINT8)Missing, Length);
+
+    ok(!memcmp(Work + Offset, Data[Missing] + Offset, Length),
+       "%s: %u stripes, offset %u, length %u: stripe %u not recovered from Q\n",
+       Mode->Name, Stripes, Offset, Length, Missing);
+}
+
+static void TestRecover2(const RAID_MODE* Mode, UINT32 Offset, UINT32 Length) {
+    UINT8 a = (UINT8)rand(), b = (UINT8)rand(), Expected;
+    UINT8 *qxy = Work + Offset, *pxy = Work2 + Offset, *p = P + Offset, *q = Q + Offset;
+    UINT32 j;
+
+    Fill(qxy, Length);
+    Fill(pxy, Length);
+    Fill(p, Length);
+    Fill(q, Length);
+    memcpy(Data[0] + Offset, qxy, Length);
+
+    galois_recover2(qxy, pxy, p, q, a, b, Length);
+
+    for (j = 0; j < Length; j++) {
+        Expected = gmul(a, p[j] ^ pxy[j]) ^ gmul(b, q[j] ^ Data[0][Offset + j]);
+
+        if (qxy[j] != Expected) {
+            ok(FALSE, "%s: a %02x b %02x, offset %u, length %u: byte %u is %02x, expected %02x\n",
+               Mode->Name, a, b, Offset, Length, j, qxy[j], Expected);
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ULONG m, Trial, Length, Offset;
+
+    srand(1961);
+
+    for (m = 0; m < RAID_MODES; m++) {
+        if (!RaidSelectMode(&RaidModes[m])) {
+            printf("raidtest: host can't run %s, skipped\n", RaidModes[m].Name);
+            continue;
+        }
+
+        // Every short length, including the odd ones which end in the scalar tail
+        for (Length = 0; Length <= 600; Length++) {
+            Offset = (ULONG)rand() % MAX_OFFSET;
+
+            TestParity(&RaidModes[m], 2 + (ULONG)rand() % (MAX_STRIPES - 1), Offset, Length);
+            TestRecover2(&RaidModes[m], Offset, Length);
+        }
+
+        // Then random ones, well past where AVX2 kicks in
+        for (Trial = 0; Trial < 200; Trial++) {
+            Length = (ULONG)rand() % BUFFER_SIZE;
+            Offset = (ULONG)rand() % MAX_OFFSET;
+
+            TestParity(&RaidModes[m], 2 + (ULONG)rand() % (MAX_STRIPES - 1), Offset, Length);
+            TestRecover2(&RaidModes[m], Offset, Length);
+        }
+    }
+
+    return HostTestFinish("raidtest");
+}
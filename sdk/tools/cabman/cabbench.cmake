@@ -0,0 +1,39 @@
+#
+# PROJECT:     ReactOS cabinet manager
+# LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+# PURPOSE:     Times the creation of a cabinet with each codec, on one thread
+#              and on all processors
+#
+# cmake -DCABMAN=<cabman> -DDFF=<directive file> -DSOURCE_DIR=<dir> -DOUTPUT_DIR=<dir> -P cabbench.cmake
+#
+
+foreach(_var CABMAN DFF SOURCE_DIR OUTPUT_DIR)
+    if(NOT DEFINED ${_var})
+        message(FATAL_ERROR "${_var} is not defined")
+    endif()
+endforeach()
+
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+
+foreach(_codec raw mszip lzx)
+    foreach(_threads 1 0)
+        if(_threads EQUAL 0)
+            set(_args "")
+            set(_name "${_codec}, all processors")
+        else()
+            set(_args -T ${_threads})
+            set(_name "${_codec}, ${_threads} thread")
+        endif()
+
+        execute_process(
+            COMMAND ${CABMAN} -V -M ${_codec} ${_args} -C ${DFF} -L ${OUTPUT_DIR} -N -P ${SOURCE_DIR}
+            OUTPUT_VARIABLE _output
+            RESULT_VARIABLE _result)
+        if(NOT _result EQUAL 0)
+            message(FATAL_ERROR "cabman failed for ${_name}:\n${_output}")
+        endif()
+
+        string(REGEX MATCH "Created [^\n]*" _summary "${_output}")
+        message(STATUS "${_name}: ${_summary}")
+    endforeach()
+endforeach()
@@ -24,7 +24,9 @@
 # include <sys/types.h>
 #endif
 #include "cabinet.h"
+#include "compress.h"
 #include "raw.h"
+#include "lzx.h"
 #include "mszip.h"
 
 #ifndef CAB_READ_ONLY
@@ -101,10 +103,17 @@ CCabinet::CCabinet()
     BlockIsSplit = false;
     ScratchFile  = NULL;
 
+    MaxFolderSize = 0;
+    ThreadCount   = CCompressionPool::GetProcessorCount();
+    Pool          = NULL;
+    CurrentStream = NULL;
+
     FolderUncompSize = 0;
     BytesLeftInBlock = 0;
     ReuseBlock       = false;
     CurrentDataNode  = NULL;
+    CodecFolderNode  = NULL;
+    CodecOffset      = 0;
 }
 
 
@@ -120,6 +129,13 @@ CCabinet::~CCabinet()
         CabinetReservedFileSize = 0;
     }
 
+    if (Pool)
+    {
+        if (CurrentStream)
+            Pool->CloseStream(CurrentStream);
+        delete Pool;
+    }
+
     if (CodecSelected)
         delete Codec;
 }
@@ -369,6 +385,13 @@ bool CCabinet::SetCompressionCodec(char* CodecName)
         SelectCodec(CAB_CODEC_RAW);
     else if( !strcasecmp(CodecName, "mszip") )
         SelectCodec(CAB_CODEC_MSZIP);
+    else if( !strcasecmp(CodecName, "lzx") )
+    {
+        SelectCodec(CAB_CODEC_LZX);
+        /* LZX folders are compressed as a whole, so split them up to keep all threads busy */
+        if (MaxFolderSize == 0)
+            SetMaxFolderSize(LZX_FOLDER_SIZE);
+    }
     else
     {
         printf("ERROR: Invalid codec specified!\n");
@@ -483,7 +506,7 @@ ULONG CCabinet::Open()
         ULONG BytesRead;
         ULONG Size;
 
-        OutputBuffer = malloc(CAB_BLOCKSIZE + 12);    // This should be enough
+        OutputBuffer = malloc(CAB_COMPBLOCKSIZE);    // This should be enough
         if (!OutputBuffer)
             return CAB_STATUS_NOMEMORY;
 
@@ -753,6 +776,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
     ULONG BytesToWrite;
     ULONG TotalBytesRead;
     ULONG CurrentOffset;
+    ULONG BlockOffset;
     PUCHAR Buffer;
     PUCHAR CurrentBuffer;
     FILE* DestFile;
@@ -785,6 +809,10 @@ ULONG CCabinet::ExtractFile(char* FileName)
             SelectCodec(CAB_CODEC_MSZIP);
             break;
 
+        case CAB_COMP_LZX:
+            SelectCodec(CAB_CODEC_LZX);
+            break;
+
         default:
             return CAB_STATUS_UNSUPPCOMP;
     }
@@ -835,7 +863,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
     SetAttributesOnFile(DestName, File->File.Attributes);
 
-    Buffer = (PUCHAR)malloc(CAB_BLOCKSIZE + 12); // This should be enough
+    Buffer = (PUCHAR)malloc(CAB_COMPBLOCKSIZE); // This should be enough
     if (!Buffer)
     {
         fclose(DestFile);
@@ -874,6 +902,21 @@ ULONG CCabinet::ExtractFile(char* FileName)
             {
                 DPRINT(MAX_TRACE, ("Filling buffer. ReuseBlock (%u)\n", (UINT)ReuseBlock));
 
+                /* A solid codec must decode the data blocks of a folder in order */
+                BlockOffset = (ULONG)ftell(FileHandle);
+                if (Codec->IsSolid() &&
+                    ((CodecFolderNode != CurrentFolderNode) || (CodecOffset != BlockOffset)))
+                {
+                    Status = RestartCodec(BlockOffset, Buffer);
+                    if (Status != CAB_STATUS_SUCCESS)
+                    {
+                        fclose(DestFile);
+                        free(Buffer);
+                        DPRINT(MIN_TRACE, ("Cannot restart codec (%u).\n", (UINT)Status));
+                        return Status;
+                    }
+                }
+
                 CurrentBuffer  = Buffer;
                 TotalBytesRead = 0;
                 do
@@ -894,7 +937,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                         CFData.CompSize,
                         CFData.UncompSize));
 
-                    ASSERT(CFData.CompSize <= CAB_BLOCKSIZE + 12);
+                    ASSERT(CFData.CompSize <= CAB_COMPBLOCKSIZE);
 
                     BytesToRead = CFData.CompSize;
 
@@ -995,6 +1038,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
                 DPRINT(MAX_TRACE, ("TotalBytesRead (%u).\n", (UINT)TotalBytesRead));
 
+                BytesToWrite = CFData.UncompSize;
                 Status = Codec->Uncompress(OutputBuffer, Buffer, TotalBytesRead, &BytesToWrite);
                 if (Status != CS_SUCCESS)
                 {
@@ -1015,6 +1059,17 @@ ULONG CCabinet::ExtractFile(char* FileName)
                     return CAB_STATUS_INVALID_CAB;
                 }
 
+                if (Codec->IsSolid())
+                {
+                    /* Remember the block, the next file likely starts in it */
+                    for (CurrentDataNode = CurrentFolderNode->DataListHead;
+                         CurrentDataNode && (CurrentDataNode->AbsoluteOffset != BlockOffset);
+                         CurrentDataNode = CurrentDataNode->Next);
+
+                    CodecFolderNode = CurrentFolderNode;
+                    CodecOffset     = (ULONG)ftell(FileHandle);
+                }
+
                 BytesLeftInBlock = BytesToWrite;
             }
             else
@@ -1121,22 +1176,39 @@ void CCabinet::SelectCodec(LONG Id)
         delete Codec;
     }
 
+    Codec = CreateCodec(Id);
+    if (!Codec)
+        return;
+
+    CodecId         = Id;
+    CodecSelected   = true;
+    CodecFolderNode = NULL;
+}
+
+
+CCABCodec* CreateCodec(LONG Id)
+/*
+ * FUNCTION: Creates a codec engine
+ * ARGUMENTS:
+ *     Id = Codec identifier
+ * RETURNS:
+ *     Pointer to codec, NULL if the identifier is unknown
+ */
+{
     switch (Id)
     {
         case CAB_CODEC_RAW:
-            Codec = new CRawCodec();
-            break;
+            return new CRawCodec();
+
+        case CAB_CODEC_LZX:
+            return new CLZXCodec();
 
         case CAB_CODEC_MSZIP:
-            Codec = new CMSZipCodec();
-            break;
+            return new CMSZipCodec();
 
         default:
-            return;
+            return NULL;
     }
-
-    CodecId       = Id;
-    CodecSelected = true;
 }
 
 
@@ -1155,8 +1227,8 @@ ULONG CCabinet::NewCabinet()
 
     CurrentDiskNumber = 0;
 
-    OutputBuffer = malloc(CAB_BLOCKSIZE + 12); // This should be enough
-    InputBuffer  = malloc(CAB_BLOCKSIZE + 12); // This should be enough
+    OutputBuffer = malloc(CAB_COMPBLOCKSIZE); // This should be enough
+    InputBuffer  = malloc(CAB_COMPBLOCKSIZE); // This should be enough
     if ((!OutputBuffer) || (!InputBuffer))
     {
         DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
@@ -1248,6 +1320,13 @@ ULONG CCabinet::NewFolder()
 {
     DPRINT(MAX_TRACE, ("Creating new folder.\n"));
 
+    /* Data blocks still being compressed keep their folder */
+    if (CurrentStream)
+    {
+        Pool->CloseStream(CurrentStream);
+        CurrentStream = NULL;
+    }
+
     CurrentFolderNode = NewFolderNode();
     if (!CurrentFolderNode)
     {
@@ -1264,10 +1343,16 @@ ULONG CCabinet::NewFolder()
             CurrentFolderNode->Folder.CompressionType = CAB_COMP_MSZIP;
             break;
 
+        case CAB_CODEC_LZX:
+            CurrentFolderNode->Folder.CompressionType = LZX_COMPRESSION_TYPE(LZX_WINDOW_BITS);
+            break;
+
         default:
             return CAB_STATUS_UNSUPPCOMP;
     }
 
+    Codec->Reset(CurrentFolderNode->Folder.CompressionType);
+
     /* FIXME: This won't work if no files are added to the new folder */
 
     DiskSize += sizeof(CFFOLDER);
@@ -1317,6 +1402,22 @@ ULONG CCabinet::WriteFileToScratchStorage(PCFFILE_NODE FileNode)
                 return Status;
             CreateNewFolder = false;
         }
+        else if ((MaxFolderSize > 0) && (MaxDiskSize == 0) &&
+                 (CurrentFolderNode->UncompOffset >= MaxFolderSize))
+        {
+            /* Folders are compressed independently, so start a new one
+               at the first file boundary after the size threshold */
+            if (CurrentIBufferSize > 0)
+            {
+                Status = WriteDataBlock();
+                if (Status != CAB_STATUS_SUCCESS)
+                    return Status;
+            }
+
+            Status = NewFolder();
+            if (Status != CAB_STATUS_SUCCESS)
+                return Status;
+        }
 
         /* Call OnAdd event handler */
         OnAdd(&FileNode->File, FileNode->FileName);
@@ -1478,6 +1579,11 @@ ULONG CCabinet::WriteDisk(ULONG MoreDisks)
             }
         } while (CreateNewDisk);
     }
+
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     CommitDisk(MoreDisks);
 
     return CAB_STATUS_SUCCESS;
@@ -1580,10 +1686,25 @@ ULONG CCabinet::CloseCabinet()
 {
     ULONG Status;
 
+    if (Pool)
+    {
+        if (CurrentStream)
+        {
+            Pool->CloseStream(CurrentStream);
+            CurrentStream = NULL;
+        }
+        delete Pool;
+        Pool = NULL;
+    }
+
     DestroyFileNodes();
 
     DestroyFolderNodes();
 
+    CurrentDataNode = NULL;
+    CodecFolderNode = NULL;
+    CodecOffset     = 0;
+
     if (InputBuffer)
     {
         free(InputBuffer);
@@ -1837,6 +1958,29 @@ void CCabinet::SetMaxDiskSize(ULONG Size)
     MaxDiskSize = Size;
 }
 
+void CCabinet::SetMaxFolderSize(ULONG Size)
+/*
+ * FUNCTION: Sets the uncompressed size after which a new folder is started
+ * ARGUMENTS:
+ *     Size = Folder size threshold (0 means one folder per cabinet)
+ * NOTES:
+ *     Folders are only split at file boundaries, and not in cabinets
+ *     that span several disks
+ */
+{
+    MaxFolderSize = Size;
+}
+
+void CCabinet::SetThreadCount(ULONG Count)
+/*
+ * FUNCTION: Sets the number of threads used to compress data blocks
+ * ARGUMENTS:
+ *     Count = Number of threads (1 compresses on the calling thread)
+ */
+{
+    ThreadCount = (Count > 0) ? Count : 1;
+}
+
 #endif /* CAB_READ_ONLY */
 
 
@@ -2546,6 +2690,70 @@ ULONG CCabinet::ReadBlock(void* Buffer,
     return CAB_STATUS_SUCCESS;
 }
 
+ULONG CCabinet::RestartCodec(ULONG Offset, PUCHAR Buffer)
+/*
+ * FUNCTION: Brings a solid codec to a data block of the current folder
+ * ARGUMENTS:
+ *     Offset = Absolute offset of the data block
+ *     Buffer = Pointer to buffer for compressed data
+ * RETURNS:
+ *     Status of operation
+ * NOTES:
+ *     The data blocks before the wanted one are decoded again,
+ *     their data goes to OutputBuffer and is thrown away
+ */
+{
+    PCFDATA_NODE Node;
+    ULONG BytesRead;
+    ULONG Status;
+    ULONG Size;
+
+    DPRINT(MAX_TRACE, ("Restarting codec at absolute offset (0x%X).\n", (UINT)Offset));
+
+    Codec->Reset(CurrentFolderNode->Folder.CompressionType);
+    CodecFolderNode = CurrentFolderNode;
+    CurrentDataNode = NULL;
+
+    for (Node = CurrentFolderNode->DataListHead;
+         Node && (Node->AbsoluteOffset < Offset);
+         Node = Node->Next)
+    {
+        if (fseek(FileHandle, (off_t)Node->AbsoluteOffset + sizeof(CFDATA), SEEK_SET) != 0)
+        {
+            DPRINT(MIN_TRACE, ("fseek() failed.\n"));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        if (((Status = ReadBlock(Buffer, Node->Data.CompSize, &BytesRead)) !=
+            CAB_STATUS_SUCCESS) || (BytesRead != Node->Data.CompSize))
+        {
+            DPRINT(MIN_TRACE, ("Cannot read from file (%u).\n", (UINT)Status));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        Size = Node->Data.UncompSize;
+        Status = Codec->Uncompress(OutputBuffer, Buffer, BytesRead, &Size);
+        if (Status != CS_SUCCESS)
+        {
+            DPRINT(MID_TRACE, ("Cannot uncompress block.\n"));
+            if (Status == CS_NOMEMORY)
+                return CAB_STATUS_NOMEMORY;
+            return CAB_STATUS_INVALID_CAB;
+        }
+    }
+
+    if (fseek(FileHandle, (off_t)Offset, SEEK_SET) != 0)
+    {
+        DPRINT(MIN_TRACE, ("fseek() failed.\n"));
+        return CAB_STATUS_INVALID_CAB;
+    }
+
+    CodecOffset = Offset;
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
 bool CCabinet::MatchFileNamePattern(char* FileName, char* Pattern)
 /*
  * FUNCTION: Matches a wildcard character pattern against a file
@@ -2983,13 +3191,82 @@ ULONG CCabinet::WriteDataBlock()
     ULONG Status;
     ULONG BytesWritten;
     PCFDATA_NODE DataNode;
+    PCAB_BLOCK Block;
+    void* Buffer;
+
+    /* Data blocks that never have to be split across disks are compressed in the background */
+    if ((ThreadCount > 1) && (MaxDiskSize == 0))
+    {
+        if (!Pool)
+        {
+            Pool = new CCompressionPool;
+            if (!Pool)
+                return CAB_STATUS_NOMEMORY;
+
+            /* A solid codec only runs in parallel over several folders */
+            if (Codec->IsSolid() && (MaxFolderSize > 0))
+                Status = Pool->Start(CodecId, ThreadCount, ThreadCount * (MaxFolderSize / CAB_BLOCKSIZE + 1));
+            else
+                Status = Pool->Start(CodecId, ThreadCount, ThreadCount * 4);
+            if (Status != CAB_STATUS_SUCCESS)
+            {
+                delete Pool;
+                Pool = NULL;
+                return Status;
+            }
+        }
+
+        if (!CurrentStream)
+        {
+            CurrentStream = Pool->OpenStream(CurrentFolderNode, CurrentFolderNode->Folder.CompressionType);
+            if (!CurrentStream)
+                return CAB_STATUS_NOMEMORY;
+        }
+
+        Block = Pool->AllocateBlock();
+        if (!Block)
+            return CAB_STATUS_NOMEMORY;
+
+        /* Hand the input buffer over instead of copying it */
+        Buffer             = Block->InputBuffer;
+        Block->InputBuffer = InputBuffer;
+        Block->InputSize   = CurrentIBufferSize;
+        InputBuffer        = Buffer;
+        CurrentIBuffer     = InputBuffer;
+        CurrentIBufferSize = 0;
+
+        Pool->QueueBlock(CurrentStream, Block);
+
+        /* Commit what is done, and wait if enough is queued */
+        while ((Block = Pool->GetCompressedBlock(Pool->IsFull())) != NULL)
+        {
+            Status = CommitCompressedBlock(Block);
+            Pool->FreeBlock(Block);
+            if (Status != CAB_STATUS_SUCCESS)
+                return Status;
+        }
+
+        return CAB_STATUS_SUCCESS;
+    }
+
+    /* The rest must come after the blocks in the background */
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
 
     if (!BlockIsSplit)
     {
-        Status = Codec->Compress(OutputBuffer,
+        /* A solid codec is in the middle of the folder if it was in the background */
+        Status = ((CurrentStream && CurrentStream->Codec) ? CurrentStream->Codec : Codec)->Compress(
+            OutputBuffer,
             InputBuffer,
             CurrentIBufferSize,
             &TotalCompSize);
+        if (Status != CS_SUCCESS)
+        {
+            DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Status));
+            return (Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+        }
 
         DPRINT(MAX_TRACE, ("Block compressed. CurrentIBufferSize (%u)  TotalCompSize(%u).\n",
             (UINT)CurrentIBufferSize, (UINT)TotalCompSize));
@@ -3060,6 +3337,84 @@ ULONG CCabinet::WriteDataBlock()
     return CAB_STATUS_SUCCESS;
 }
 
+
+ULONG CCabinet::CommitCompressedBlock(PCAB_BLOCK Block)
+/*
+ * FUNCTION: Writes a data block compressed in the background to the scratch file
+ * ARGUMENTS:
+ *     Block = Pointer to compressed block
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PCFFOLDER_NODE FolderNode = (PCFFOLDER_NODE)Block->Stream->Context;
+    PCFDATA_NODE DataNode;
+    ULONG BytesWritten;
+    ULONG Status;
+
+    if (Block->Status != CS_SUCCESS)
+    {
+        DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Block->Status));
+        return (Block->Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+    }
+
+    DPRINT(MAX_TRACE, ("Block compressed. InputSize (%u)  OutputSize (%u).\n",
+        (UINT)Block->InputSize, (UINT)Block->OutputSize));
+
+    DataNode = NewDataNode(FolderNode);
+    if (!DataNode)
+    {
+        DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    DataNode->Data.Checksum   = 0;
+    DataNode->Data.CompSize   = (USHORT)Block->OutputSize;
+    DataNode->Data.UncompSize = (USHORT)Block->InputSize;
+    DataNode->ScratchFilePosition = ScratchFile->Position();
+
+    Status = ScratchFile->WriteBlock(&DataNode->Data,
+        Block->OutputBuffer, &BytesWritten);
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
+    DiskSize += sizeof(CFDATA) + BytesWritten;
+
+    FolderNode->TotalFolderSize += (BytesWritten + sizeof(CFDATA));
+    FolderNode->Folder.DataBlockCount++;
+
+    if (FolderNode == CurrentFolderNode)
+        LastBlockStart += DataNode->Data.UncompSize;
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::FlushDataBlocks()
+/*
+ * FUNCTION: Waits for the data blocks compressed in the background
+ *           and writes them to the scratch file
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PCAB_BLOCK Block;
+    ULONG Status;
+
+    if (!Pool)
+        return CAB_STATUS_SUCCESS;
+
+    while ((Block = Pool->GetCompressedBlock(true)) != NULL)
+    {
+        Status = CommitCompressedBlock(Block);
+        Pool->FreeBlock(Block);
+        if (Status != CAB_STATUS_SUCCESS)
+            return Status;
+    }
+
+    return CAB_STATUS_SUCCESS;
+}
+
 #if !defined(_WIN32)
 
 void CCabinet::ConvertDateAndTime(time_t* Time,
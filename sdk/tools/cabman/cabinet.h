@@ -101,6 +101,7 @@ extern ULONG DebugTraceLevel;
 #define CAB_SIGNATURE        0x4643534D // "MSCF"
 #define CAB_VERSION          0x0103
 #define CAB_BLOCKSIZE        32768
+#define CAB_COMPBLOCKSIZE    (CAB_BLOCKSIZE + 6144) // Largest compressed data block
 
 #define CAB_COMP_MASK        0x00FF
 #define CAB_COMP_NONE        0x0000
@@ -277,6 +278,10 @@ public:
                              void* InputBuffer,
                              ULONG InputLength,
                              PULONG OutputLength) = 0;
+    /* Restarts the codec at the beginning of a folder */
+    virtual void Reset(USHORT CompressionType) {};
+    /* Returns whether data blocks depend on the ones before them in the folder */
+    virtual bool IsSolid() { return false; };
 };
 
 
@@ -291,12 +296,19 @@ public:
 #define CAB_CODEC_LZX   0x01
 #define CAB_CODEC_MSZIP 0x02
 
+/* Creates a codec engine, NULL if the identifier is unknown */
+CCABCodec* CreateCodec(LONG Id);
+
 
 
 /* Classes */
 
 #ifndef CAB_READ_ONLY
 
+class CCompressionPool;
+typedef struct _CAB_BLOCK *PCAB_BLOCK;
+typedef struct _CAB_STREAM *PCAB_STREAM;
+
 class CCFDATAStorage
 {
 public:
@@ -395,6 +407,10 @@ public:
     ULONG AddFile(char* FileName);
     /* Sets the maximum size of the current disk */
     void SetMaxDiskSize(ULONG Size);
+    /* Sets the uncompressed size after which a new folder is started */
+    void SetMaxFolderSize(ULONG Size);
+    /* Sets the number of threads used to compress data blocks */
+    void SetThreadCount(ULONG Count);
 #endif /* CAB_READ_ONLY */
 
     /* Default event handlers */
@@ -430,6 +446,7 @@ private:
     void DestroyDeletedFolderNodes();
     ULONG ComputeChecksum(void* Buffer, ULONG Size, ULONG Seed);
     ULONG ReadBlock(void* Buffer, ULONG Size, PULONG BytesRead);
+    ULONG RestartCodec(ULONG Offset, PUCHAR Buffer);
     bool MatchFileNamePattern(char* FileName, char* Pattern);
 #ifndef CAB_READ_ONLY
     ULONG InitCabinetHeader();
@@ -438,6 +455,8 @@ private:
     ULONG WriteFileEntries();
     ULONG CommitDataBlocks(PCFFOLDER_NODE FolderNode);
     ULONG WriteDataBlock();
+    ULONG CommitCompressedBlock(PCAB_BLOCK Block);
+    ULONG FlushDataBlocks();
     ULONG GetAttributesOnFile(PCFFILE_NODE File);
     ULONG SetAttributesOnFile(char* FileName, USHORT FileAttributes);
     ULONG GetFileTimes(FILE* FileHandle, PCFFILE_NODE File);
@@ -489,6 +508,8 @@ private:
     ULONG BytesLeftInCabinet;
     bool RestartSearch;
     ULONG LastFileOffset;       // Uncompressed offset of last extracted file
+    PCFFOLDER_NODE CodecFolderNode; // Folder a solid codec is decoding
+    ULONG CodecOffset;          // Absolute offset of next data block the solid codec expects
 #ifndef CAB_READ_ONLY
     ULONG LastBlockStart;       // Uncompressed offset of last block in folder
     ULONG MaxDiskSize;
@@ -503,6 +524,10 @@ private:
     ULONG TotalBytesLeft;
     bool BlockIsSplit;                  // true if current data block is split
     ULONG NextFolderNumber;     // Zero based folder number
+    ULONG MaxFolderSize;        // Uncompressed size of a folder before a new one is started, 0 for no limit
+    ULONG ThreadCount;          // Number of compression threads
+    CCompressionPool *Pool;     // Compresses data blocks in parallel
+    PCAB_STREAM CurrentStream;  // Data blocks of the current folder in Pool
 #endif /* CAB_READ_ONLY */
 };
 
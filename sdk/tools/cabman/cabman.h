@@ -28,6 +28,7 @@ public:
     bool IsVerbose() { return Verbose; }
 private:
     void Usage();
+    void ShowStatistics(double StartTime);
     bool CreateCabinet();
     bool DisplayCabinet();
     bool ExtractFromCabinet();
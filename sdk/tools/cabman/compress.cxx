@@ -0,0 +1,518 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Worker threads compressing data blocks
+ * NOTES:       Data blocks come back in the order they were queued, so the
+ *              cabinet is the same whatever the number of threads. Blocks of
+ *              a solid stream (LZX) are compressed one after the other by a
+ *              codec owned by the stream; independent streams still run in
+ *              parallel. Other codecs compress any block on any worker.
+ */
+
+#include "compress.h"
+
+#if !defined(CAB_READ_ONLY)
+
+
+/* CCompressionPool */
+
+CCompressionPool::CCompressionPool()
+/*
+ * FUNCTION: Default constructor
+ */
+{
+    CodecId       = -1;
+    ThreadCount   = 0;
+    BlockListHead = NULL;
+    BlockListTail = NULL;
+    FreeListHead  = NULL;
+    PendingCount  = 0;
+    MaxPending    = 0;
+    Terminate     = false;
+
+#if defined(_WIN32)
+    InitializeCriticalSection(&QueueLock);
+    InitializeConditionVariable(&QueueChanged);
+#else
+    pthread_mutex_init(&QueueLock, NULL);
+    pthread_cond_init(&QueueChanged, NULL);
+#endif
+}
+
+
+CCompressionPool::~CCompressionPool()
+/*
+ * FUNCTION: Default destructor
+ * NOTES:
+ *     Blocks still queued are discarded
+ */
+{
+    PCAB_BLOCK Block;
+    ULONG i;
+
+    Lock();
+    Terminate = true;
+    SignalChange();
+    Unlock();
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(Threads[i], INFINITE);
+        CloseHandle(Threads[i]);
+#else
+        pthread_join(Threads[i], NULL);
+#endif
+    }
+
+    while (BlockListHead)
+    {
+        Block = BlockListHead;
+        BlockListHead = Block->Next;
+
+        Block->Next = FreeListHead;
+        FreeListHead = Block;
+
+        if ((--Block->Stream->BlockCount == 0) && Block->Stream->Closed)
+        {
+            delete Block->Stream->Codec;
+            free(Block->Stream);
+        }
+    }
+
+    while (FreeListHead)
+    {
+        Block = FreeListHead;
+        FreeListHead = Block->Next;
+
+        free(Block->InputBuffer);
+        free(Block->OutputBuffer);
+        free(Block);
+    }
+
+#if defined(_WIN32)
+    DeleteCriticalSection(&QueueLock);
+#else
+    pthread_cond_destroy(&QueueChanged);
+    pthread_mutex_destroy(&QueueLock);
+#endif
+}
+
+
+ULONG CCompressionPool::Start(LONG CodecId, ULONG ThreadCount, ULONG MaxPending)
+/*
+ * FUNCTION: Starts the worker threads
+ * ARGUMENTS:
+ *     CodecId     = Codec identifier
+ *     ThreadCount = Number of worker threads
+ *     MaxPending  = Number of queued data blocks IsFull() allows
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    CCABCodec* Codec;
+    ULONG i;
+
+    /* Make sure the codec exists before any thread needs it */
+    Codec = CreateCodec(CodecId);
+    if (!Codec)
+        return CAB_STATUS_UNSUPPCOMP;
+    delete Codec;
+
+    if (ThreadCount > CAB_MAX_THREADS)
+        ThreadCount = CAB_MAX_THREADS;
+    if (MaxPending > CAB_MAX_PENDING_BLOCKS)
+        MaxPending = CAB_MAX_PENDING_BLOCKS;
+    if (MaxPending < ThreadCount)
+        MaxPending = ThreadCount;
+
+    this->CodecId    = CodecId;
+    this->MaxPending = MaxPending;
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+#if defined(_WIN32)
+        Threads[i] = CreateThread(NULL, 0, WorkerThread, this, 0, NULL);
+        if (Threads[i] == NULL)
+            break;
+#else
+        if (pthread_create(&Threads[i], NULL, WorkerThread, this) != 0)
+            break;
+#endif
+        this->ThreadCount++;
+    }
+
+    if (this->ThreadCount == 0)
+    {
+        DPRINT(MIN_TRACE, ("Cannot create compression threads.\n"));
+        return CAB_STATUS_FAILURE;
+    }
+
+    DPRINT(MID_TRACE, ("Started (%u) compression threads.\n", (UINT)this->ThreadCount));
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+PCAB_STREAM CCompressionPool::OpenStream(void* Context, USHORT CompressionType)
+/*
+ * FUNCTION: Begins a new sequence of data blocks
+ * ARGUMENTS:
+ *     Context         = Caller's data for the stream
+ *     CompressionType = Compression type of the folder the blocks belong to
+ * RETURNS:
+ *     Pointer to stream, NULL if there is not enough free memory
+ */
+{
+    PCAB_STREAM Stream;
+    CCABCodec* Codec;
+
+    Stream = (PCAB_STREAM)malloc(sizeof(CAB_STREAM));
+    if (!Stream)
+        return NULL;
+
+    Stream->Context    = Context;
+    Stream->Codec      = NULL;
+    Stream->BlockCount = 0;
+    Stream->Busy       = false;
+    Stream->Closed     = false;
+
+    Codec = CreateCodec(CodecId);
+    if (!Codec)
+    {
+        free(Stream);
+        return NULL;
+    }
+
+    if (Codec->IsSolid())
+    {
+        Codec->Reset(CompressionType);
+        Stream->Codec = Codec;
+    }
+    else
+    {
+        delete Codec;
+    }
+
+    return Stream;
+}
+
+
+void CCompressionPool::CloseStream(PCAB_STREAM Stream)
+/*
+ * FUNCTION: Ends a sequence of data blocks
+ * ARGUMENTS:
+ *     Stream = Pointer to stream
+ * NOTES:
+ *     The stream goes away with its last data block
+ */
+{
+    bool Destroy;
+
+    Lock();
+    Stream->Closed = true;
+    Destroy = (Stream->BlockCount == 0);
+    Unlock();
+
+    if (Destroy)
+    {
+        delete Stream->Codec;
+        free(Stream);
+    }
+}
+
+
+PCAB_BLOCK CCompressionPool::AllocateBlock()
+/*
+ * FUNCTION: Returns an empty data block
+ * RETURNS:
+ *     Pointer to block, NULL if there is not enough free memory
+ */
+{
+    PCAB_BLOCK Block;
+
+    Lock();
+    Block = FreeListHead;
+    if (Block)
+        FreeListHead = Block->Next;
+    Unlock();
+
+    if (!Block)
+    {
+        Block = (PCAB_BLOCK)malloc(sizeof(CAB_BLOCK));
+        if (!Block)
+            return NULL;
+
+        Block->InputBuffer  = malloc(CAB_COMPBLOCKSIZE);
+        Block->OutputBuffer = malloc(CAB_COMPBLOCKSIZE);
+        if (!Block->InputBuffer || !Block->OutputBuffer)
+        {
+            free(Block->InputBuffer);
+            free(Block->OutputBuffer);
+            free(Block);
+            return NULL;
+        }
+    }
+
+    Block->Next       = NULL;
+    Block->Stream     = NULL;
+    Block->InputSize  = 0;
+    Block->OutputSize = 0;
+    Block->Status     = CS_SUCCESS;
+    Block->Started    = false;
+    Block->Done       = false;
+
+    return Block;
+}
+
+
+void CCompressionPool::QueueBlock(PCAB_STREAM Stream, PCAB_BLOCK Block)
+/*
+ * FUNCTION: Queues a data block for compression
+ * ARGUMENTS:
+ *     Stream = Pointer to stream the block belongs to
+ *     Block  = Pointer to block with InputBuffer and InputSize set
+ */
+{
+    Lock();
+
+    Block->Stream = Stream;
+    Block->Next   = NULL;
+    Stream->BlockCount++;
+
+    if (BlockListTail)
+        BlockListTail->Next = Block;
+    else
+        BlockListHead = Block;
+    BlockListTail = Block;
+    PendingCount++;
+
+    SignalChange();
+    Unlock();
+}
+
+
+PCAB_BLOCK CCompressionPool::GetCompressedBlock(bool Wait)
+/*
+ * FUNCTION: Returns the oldest queued data block once it is compressed
+ * ARGUMENTS:
+ *     Wait = true to wait for the block to be compressed
+ * RETURNS:
+ *     Pointer to block, NULL if the queue is empty or, when
+ *     not waiting, if the oldest block is not compressed yet
+ */
+{
+    PCAB_BLOCK Block;
+
+    Lock();
+
+    while (Wait && BlockListHead && !BlockListHead->Done)
+        WaitForChange();
+
+    Block = BlockListHead;
+    if (Block && Block->Done)
+    {
+        BlockListHead = Block->Next;
+        if (!BlockListHead)
+            BlockListTail = NULL;
+        PendingCount--;
+    }
+    else
+    {
+        Block = NULL;
+    }
+
+    Unlock();
+
+    return Block;
+}
+
+
+void CCompressionPool::FreeBlock(PCAB_BLOCK Block)
+/*
+ * FUNCTION: Releases a data block returned by GetCompressedBlock
+ * ARGUMENTS:
+ *     Block = Pointer to block
+ */
+{
+    PCAB_STREAM Stream = Block->Stream;
+    bool Destroy;
+
+    Lock();
+    Block->Next  = FreeListHead;
+    FreeListHead = Block;
+    Destroy = ((--Stream->BlockCount == 0) && Stream->Closed);
+    Unlock();
+
+    if (Destroy)
+    {
+        delete Stream->Codec;
+        free(Stream);
+    }
+}
+
+
+bool CCompressionPool::IsFull()
+/*
+ * FUNCTION: Returns whether the queue holds as many data blocks as it should
+ */
+{
+    bool Full;
+
+    Lock();
+    Full = (PendingCount >= MaxPending);
+    Unlock();
+
+    return Full;
+}
+
+
+ULONG CCompressionPool::GetProcessorCount()
+/*
+ * FUNCTION: Returns the number of processors in the system
+ */
+{
+#if defined(_WIN32)
+    SYSTEM_INFO SystemInfo;
+
+    GetSystemInfo(&SystemInfo);
+    return SystemInfo.dwNumberOfProcessors;
+#else
+    long Count;
+
+    Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (Count > 0) ? (ULONG)Count : 1;
+#endif
+}
+
+
+void CCompressionPool::Lock()
+{
+#if defined(_WIN32)
+    EnterCriticalSection(&QueueLock);
+#else
+    pthread_mutex_lock(&QueueLock);
+#endif
+}
+
+
+void CCompressionPool::Unlock()
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(&QueueLock);
+#else
+    pthread_mutex_unlock(&QueueLock);
+#endif
+}
+
+
+void CCompressionPool::WaitForChange()
+/*
+ * FUNCTION: Waits until a block is queued or compressed. The lock must be held
+ */
+{
+#if defined(_WIN32)
+    SleepConditionVariableCS(&QueueChanged, &QueueLock, INFINITE);
+#else
+    pthread_cond_wait(&QueueChanged, &QueueLock);
+#endif
+}
+
+
+void CCompressionPool::SignalChange()
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(&QueueChanged);
+#else
+    pthread_cond_broadcast(&QueueChanged);
+#endif
+}
+
+
+PCAB_BLOCK CCompressionPool::FindWork()
+/*
+ * FUNCTION: Returns the oldest block a worker may compress. The lock must be held
+ * RETURNS:
+ *     Pointer to block, NULL if there is none
+ * NOTES:
+ *     Blocks of a solid stream are queued in order, so the first one not
+ *     started is the next one of the stream. It can only be taken once
+ *     the block before it is done
+ */
+{
+    PCAB_BLOCK Block;
+
+    for (Block = BlockListHead; Block; Block = Block->Next)
+    {
+        if (Block->Started)
+            continue;
+
+        if (Block->Stream->Codec && Block->Stream->Busy)
+            continue;
+
+        return Block;
+    }
+
+    return NULL;
+}
+
+
+void CCompressionPool::Worker()
+/*
+ * FUNCTION: Compresses queued blocks until the pool is destroyed
+ */
+{
+    CCABCodec* WorkerCodec;
+    CCABCodec* Codec;
+    PCAB_BLOCK Block;
+    PCAB_STREAM Stream;
+    ULONG Status;
+
+    WorkerCodec = CreateCodec(CodecId);
+
+    Lock();
+    for (;;)
+    {
+        while (!Terminate && !(Block = FindWork()))
+            WaitForChange();
+
+        if (Terminate)
+            break;
+
+        Stream = Block->Stream;
+        Block->Started = true;
+        if (Stream->Codec)
+            Stream->Busy = true;
+        Unlock();
+
+        Codec = Stream->Codec ? Stream->Codec : WorkerCodec;
+        if (Codec)
+            Status = Codec->Compress(Block->OutputBuffer, Block->InputBuffer, Block->InputSize, &Block->OutputSize);
+        else
+            Status = CS_NOMEMORY;
+
+        Lock();
+        Block->Status = Status;
+        Block->Done   = true;
+        Stream->Busy  = false;
+        SignalChange();
+    }
+    Unlock();
+
+    delete WorkerCodec;
+}
+
+
+#if defined(_WIN32)
+DWORD WINAPI CCompressionPool::WorkerThread(LPVOID Parameter)
+#else
+void* CCompressionPool::WorkerThread(void* Parameter)
+#endif
+{
+    ((CCompressionPool*)Parameter)->Worker();
+    return 0;
+}
+
+#endif /* CAB_READ_ONLY */
+
+/* EOF */
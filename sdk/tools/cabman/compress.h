@@ -0,0 +1,103 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Worker threads compressing data blocks
+ */
+
+#pragma once
+
+#include "cabinet.h"
+
+#if !defined(_WIN32)
+    #include <pthread.h>
+#endif
+
+#define CAB_MAX_THREADS         64
+#define CAB_MAX_PENDING_BLOCKS  1024
+
+#if defined(_WIN32)
+typedef HANDLE CAB_THREAD;
+typedef CRITICAL_SECTION CAB_LOCK;
+typedef CONDITION_VARIABLE CAB_CONDITION;
+#else
+typedef pthread_t CAB_THREAD;
+typedef pthread_mutex_t CAB_LOCK;
+typedef pthread_cond_t CAB_CONDITION;
+#endif
+
+typedef struct _CAB_BLOCK
+{
+    struct _CAB_BLOCK *Next;
+    PCAB_STREAM Stream;         // Stream the block belongs to
+    void* InputBuffer;          // Uncompressed data, swapped with the caller's buffer
+    void* OutputBuffer;         // CAB_COMPBLOCKSIZE bytes of compressed data
+    ULONG InputSize;
+    ULONG OutputSize;
+    ULONG Status;               // Codec status code
+    bool Started;               // true if a worker has taken the block
+    bool Done;                  // true if OutputBuffer is valid
+} CAB_BLOCK;
+
+typedef struct _CAB_STREAM
+{
+    void* Context;              // Caller's data, usually the folder node
+    CCABCodec* Codec;           // Codec of the stream if it is solid, NULL otherwise
+    ULONG BlockCount;           // Number of blocks queued and not freed
+    bool Busy;                  // true if a worker is compressing a block of a solid stream
+    bool Closed;                // true if no more blocks will be queued
+} CAB_STREAM;
+
+
+/* Classes */
+
+class CCompressionPool
+{
+public:
+    /* Default constructor */
+    CCompressionPool();
+    /* Default destructor */
+    virtual ~CCompressionPool();
+    /* Starts the worker threads */
+    ULONG Start(LONG CodecId, ULONG ThreadCount, ULONG MaxPending);
+    /* Begins a new sequence of data blocks, like a folder */
+    PCAB_STREAM OpenStream(void* Context, USHORT CompressionType);
+    /* Ends a sequence of data blocks */
+    void CloseStream(PCAB_STREAM Stream);
+    /* Returns an empty data block */
+    PCAB_BLOCK AllocateBlock();
+    /* Queues a data block for compression */
+    void QueueBlock(PCAB_STREAM Stream, PCAB_BLOCK Block);
+    /* Returns the oldest queued data block once it is compressed */
+    PCAB_BLOCK GetCompressedBlock(bool Wait);
+    /* Releases a data block returned by GetCompressedBlock */
+    void FreeBlock(PCAB_BLOCK Block);
+    /* Returns whether the queue holds as many data blocks as it should */
+    bool IsFull();
+    /* Returns the number of processors in the system */
+    static ULONG GetProcessorCount();
+private:
+    void Lock();
+    void Unlock();
+    void WaitForChange();
+    void SignalChange();
+    PCAB_BLOCK FindWork();
+    void Worker();
+#if defined(_WIN32)
+    static DWORD WINAPI WorkerThread(LPVOID Parameter);
+#else
+    static void* WorkerThread(void* Parameter);
+#endif
+    LONG CodecId;
+    CAB_THREAD Threads[CAB_MAX_THREADS];
+    ULONG ThreadCount;
+    CAB_LOCK QueueLock;
+    CAB_CONDITION QueueChanged;
+    PCAB_BLOCK BlockListHead;   // Queued blocks, in the order they were queued
+    PCAB_BLOCK BlockListTail;
+    PCAB_BLOCK FreeListHead;
+    ULONG PendingCount;         // Number of blocks in the queue
+    ULONG MaxPending;
+    bool Terminate;
+};
+
+/* EOF */
@@ -770,6 +770,25 @@ ULONG CDFParser::DoMaxDiskSize(bool NumberValid, ULONG Number)
 }
 
 
+ULONG CDFParser::DoFolderSizeThreshold()
+/*
+ * FUNCTION: Sets the uncompressed size after which a new folder is started
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    if (!IsNextToken(TokenInteger, true))
+        return CAB_STATUS_FAILURE;
+
+    DPRINT(MID_TRACE, ("Setting folder size threshold to (%u)\n", (UINT)CurrentInteger));
+
+    FolderSizeThreshold = CurrentInteger;
+    SetMaxFolderSize(FolderSizeThreshold);
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
 void CDFParser::DoInfFileName(char* FileName)
 /*
  * FUNCTION: Sets filename of the generated .inf file
@@ -831,6 +850,8 @@ ULONG CDFParser::PerformSetCommand()
         SetType = stMaxDiskSize;
     else if (strcasecmp(CurrentString, "InfFileName") == 0)
         SetType = stInfFileName;
+    else if (strcasecmp(CurrentString, "FolderSizeThreshold") == 0)
+        SetType = stFolderSizeThreshold;
     else
         return CAB_STATUS_FAILURE;
 
@@ -862,7 +883,7 @@ ULONG CDFParser::PerformSetCommand()
     else if (!IsNextToken(TokenEqual, true))
             return CAB_STATUS_FAILURE;
 
-    if (SetType != stMaxDiskSize)
+    if ((SetType != stMaxDiskSize) && (SetType != stFolderSizeThreshold))
     {
         if (!IsNextToken(TokenString, true))
             return CAB_STATUS_FAILURE;
@@ -895,6 +916,9 @@ ULONG CDFParser::PerformSetCommand()
             DoInfFileName(CurrentString);
             return CAB_STATUS_SUCCESS;
 
+        case stFolderSizeThreshold:
+            return DoFolderSizeThreshold();
+
         default:
             return CAB_STATUS_FAILURE;
     }
@@ -0,0 +1,1485 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     CAB codec for LZX compressed data
+ * NOTES:       Every data block is written as one verbatim block, or as an
+ *              uncompressed block if it doesn't compress. Matches never cross
+ *              the end of a data block. The decoder handles everything the
+ *              format allows, including aligned offset blocks.
+ */
+
+#include "lzx.h"
+
+
+/* Number of position slots for window sizes of 2^15 to 2^21 bytes */
+static const UCHAR PositionSlots[] = { 30, 32, 34, 36, 38, 42, 50 };
+
+static const UCHAR ExtraBits[LZX_MAX_POSITION_SLOTS] =
+{
+     0,  0,  0,  0,  1,  1,  2,  2,  3,  3,  4,  4,  5,  5,  6,  6,
+     7,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14,
+    15, 15, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17,
+    17, 17
+};
+
+static const ULONG PositionBase[LZX_MAX_POSITION_SLOTS] =
+{
+          0,       1,       2,       3,       4,       6,       8,      12,
+         16,      24,      32,      48,      64,      96,     128,     192,
+        256,     384,     512,     768,    1024,    1536,    2048,    3072,
+       4096,    6144,    8192,   12288,   16384,   24576,   32768,   49152,
+      65536,   98304,  131072,  196608,  262144,  393216,  524288,  655360,
+     786432,  917504, 1048576, 1179648, 1310720, 1441792, 1572864, 1703936,
+    1835008, 1966080
+};
+
+
+/* Bit streams. LZX stores bits most significant first in 16-bit little endian words */
+
+static void PutBits(PLZX_BITSTREAM Stream, ULONG Value, ULONG Count)
+/*
+ * FUNCTION: Appends up to 17 bits to a bit stream
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ *     Value  = Bits to append
+ *     Count  = Number of bits to append
+ * NOTES:
+ *     Writing past the end of the buffer is not done, but is
+ *     accounted for so that the caller can detect the overflow
+ */
+{
+    ULONG Word;
+
+    Stream->Buffer = (Stream->Buffer << Count) | Value;
+    Stream->Bits  += Count;
+
+    while (Stream->Bits >= 16)
+    {
+        Stream->Bits -= 16;
+        Word = Stream->Buffer >> Stream->Bits;
+        if (Stream->Current + 2 <= Stream->End)
+        {
+            Stream->Current[0] = (UCHAR)Word;
+            Stream->Current[1] = (UCHAR)(Word >> 8);
+        }
+        Stream->Current += 2;
+    }
+}
+
+
+static void PutByte(PLZX_BITSTREAM Stream, UCHAR Value)
+/*
+ * FUNCTION: Appends a byte to a word aligned bit stream
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ *     Value  = Byte to append
+ */
+{
+    if (Stream->Current < Stream->End)
+        *Stream->Current = Value;
+    Stream->Current++;
+}
+
+
+static void EnsureBits(PLZX_BITSTREAM Stream, ULONG Count)
+/*
+ * FUNCTION: Makes sure up to 17 bits can be taken from a bit stream
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ *     Count  = Number of bits needed
+ * NOTES:
+ *     Reading past the end of the input gives zero bits. The caller
+ *     checks for that once it is done with the data block
+ */
+{
+    ULONG Word;
+
+    while (Stream->Bits < Count)
+    {
+        Word = 0;
+        if (Stream->Current < Stream->End)
+            Word = Stream->Current[0];
+        if (Stream->Current + 1 < Stream->End)
+            Word |= Stream->Current[1] << 8;
+        Stream->Current += 2;
+
+        Stream->Buffer |= Word << (16 - Stream->Bits);
+        Stream->Bits   += 16;
+    }
+}
+
+
+static ULONG GetBits(PLZX_BITSTREAM Stream, ULONG Count)
+/*
+ * FUNCTION: Takes up to 17 bits from a bit stream
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ *     Count  = Number of bits to take
+ * RETURNS:
+ *     The bits
+ */
+{
+    ULONG Value;
+
+    if (Count == 0)
+        return 0;
+
+    EnsureBits(Stream, Count);
+    Value = Stream->Buffer >> (32 - Count);
+    Stream->Buffer <<= Count;
+    Stream->Bits    -= Count;
+    return Value;
+}
+
+
+static void AlignBitStream(PLZX_BITSTREAM Stream)
+/*
+ * FUNCTION: Skips the 1 to 16 bits of padding in front of uncompressed data
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ * NOTES:
+ *     The stream can be read byte by byte afterwards
+ */
+{
+    ULONG Position;
+
+    /* Bit position of the next unread bit */
+    Position = (ULONG)(Stream->Current - Stream->Start) * 8 - Stream->Bits;
+    Position = (Position + 16) & ~15;
+
+    Stream->Current = Stream->Start + Position / 8;
+    Stream->Buffer  = 0;
+    Stream->Bits    = 0;
+}
+
+
+static ULONG ReadLong(PLZX_BITSTREAM Stream)
+/*
+ * FUNCTION: Reads a little endian 32-bit value from a byte aligned bit stream
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ * RETURNS:
+ *     The value, zero if the stream is exhausted
+ */
+{
+    ULONG Value = 0;
+
+    if (Stream->Current + 4 <= Stream->End)
+    {
+        Value = Stream->Current[0] |
+                (Stream->Current[1] << 8) |
+                (Stream->Current[2] << 16) |
+                ((ULONG)Stream->Current[3] << 24);
+    }
+    Stream->Current += 4;
+    return Value;
+}
+
+
+/* Huffman codes */
+
+typedef struct _LZX_LEAF
+{
+    ULONG Freq;
+    ULONG Symbol;
+} LZX_LEAF, *PLZX_LEAF;
+
+
+static int CompareLeaves(const void* A, const void* B)
+{
+    const LZX_LEAF* LeafA = (const LZX_LEAF*)A;
+    const LZX_LEAF* LeafB = (const LZX_LEAF*)B;
+
+    if (LeafA->Freq != LeafB->Freq)
+        return (LeafA->Freq < LeafB->Freq) ? -1 : 1;
+    return (LeafA->Symbol < LeafB->Symbol) ? -1 : 1;
+}
+
+
+static void MakeLengths(const ULONG* Freq, ULONG Count, ULONG MaxLength, PUCHAR Lengths)
+/*
+ * FUNCTION: Computes the code lengths of a length limited Huffman code
+ * ARGUMENTS:
+ *     Freq      = Pointer to symbol frequencies
+ *     Count     = Number of symbols
+ *     MaxLength = Longest code allowed
+ *     Lengths   = Pointer to buffer to place code lengths
+ * NOTES:
+ *     The code is always complete: a single used symbol gets a sibling,
+ *     as decoders reject incomplete codes. Frequencies are flattened
+ *     until the code fits MaxLength
+ */
+{
+    LZX_LEAF Leaves[LZX_MAX_MAIN_SYMBOLS];
+    ULONG Weight[2 * LZX_MAX_MAIN_SYMBOLS];
+    ULONG Parent[2 * LZX_MAX_MAIN_SYMBOLS];
+    UCHAR Depth[2 * LZX_MAX_MAIN_SYMBOLS];
+    ULONG Leaf, Node, Next, Child[2];
+    ULONG Used, Shift, Longest, i, j;
+
+    memset(Lengths, 0, Count);
+
+    for (Shift = 0; ; Shift++)
+    {
+        Used = 0;
+        for (i = 0; i < Count; i++)
+        {
+            if (Freq[i] != 0)
+            {
+                Leaves[Used].Freq   = (Freq[i] >> Shift) | 1;
+                Leaves[Used].Symbol = i;
+                Used++;
+            }
+        }
+
+        if (Used == 0)
+            return;
+
+        if (Used == 1)
+        {
+            Lengths[Leaves[0].Symbol] = 1;
+            Lengths[(Leaves[0].Symbol == 0) ? 1 : 0] = 1;
+            return;
+        }
+
+        qsort(Leaves, Used, sizeof(LZX_LEAF), CompareLeaves);
+
+        /* Leaves and internal nodes both come out in increasing weight, so
+           merging the two queues builds the tree in linear time */
+        for (i = 0; i < Used; i++)
+            Weight[i] = Leaves[i].Freq;
+
+        Leaf = 0;
+        Node = Used;
+        for (Next = Used; Next < 2 * Used - 1; Next++)
+        {
+            for (j = 0; j < 2; j++)
+            {
+                if ((Leaf < Used) && ((Node >= Next) || (Weight[Leaf] <= Weight[Node])))
+                    Child[j] = Leaf++;
+                else
+                    Child[j] = Node++;
+            }
+
+            Weight[Next] = Weight[Child[0]] + Weight[Child[1]];
+            Parent[Child[0]] = Next;
+            Parent[Child[1]] = Next;
+        }
+
+        Depth[2 * Used - 2] = 0;
+        Longest = 0;
+        for (i = 2 * Used - 2; i-- > 0; )
+        {
+            Depth[i] = Depth[Parent[i]] + 1;
+            if ((i < Used) && (Depth[i] > Longest))
+                Longest = Depth[i];
+        }
+
+        if (Longest <= MaxLength)
+            break;
+    }
+
+    for (i = 0; i < Used; i++)
+        Lengths[Leaves[i].Symbol] = Depth[i];
+}
+
+
+static void MakeCodes(PUCHAR Lengths, ULONG Count, PUSHORT Codes)
+/*
+ * FUNCTION: Assigns canonical Huffman codes
+ * ARGUMENTS:
+ *     Lengths = Pointer to code lengths
+ *     Count   = Number of symbols
+ *     Codes   = Pointer to buffer to place codes
+ */
+{
+    USHORT LengthCount[LZX_MAX_CODE_LENGTH + 1];
+    USHORT NextCode[LZX_MAX_CODE_LENGTH + 1];
+    ULONG Code, i;
+
+    memset(LengthCount, 0, sizeof(LengthCount));
+    for (i = 0; i < Count; i++)
+        LengthCount[Lengths[i]]++;
+    LengthCount[0] = 0;
+
+    Code = 0;
+    for (i = 1; i <= LZX_MAX_CODE_LENGTH; i++)
+    {
+        Code = (Code + LengthCount[i - 1]) << 1;
+        NextCode[i] = (USHORT)Code;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Lengths[i] != 0)
+            Codes[i] = NextCode[Lengths[i]]++;
+    }
+}
+
+
+static bool BuildDecodeTable(PLZX_DECODE_TABLE Table, PUCHAR Lengths, ULONG Count)
+/*
+ * FUNCTION: Prepares canonical Huffman decoding
+ * ARGUMENTS:
+ *     Table   = Pointer to decoding table
+ *     Lengths = Pointer to code lengths
+ *     Count   = Number of symbols
+ * RETURNS:
+ *     true if the code is complete or empty, false if it is not
+ */
+{
+    USHORT Offset[LZX_MAX_CODE_LENGTH + 1];
+    LONG Left;
+    ULONG i;
+
+    memset(Table->Count, 0, sizeof(Table->Count));
+    for (i = 0; i < Count; i++)
+        Table->Count[Lengths[i]]++;
+    Table->Count[0] = 0;
+
+    Left = 1;
+    for (i = 1; i <= LZX_MAX_CODE_LENGTH; i++)
+    {
+        Left <<= 1;
+        Left -= Table->Count[i];
+        if (Left < 0)
+            return false;
+    }
+
+    /* An empty code is fine as long as nothing is decoded with it */
+    if ((Left != 0) && (Left != (1 << LZX_MAX_CODE_LENGTH)))
+        return false;
+
+    Offset[1] = 0;
+    for (i = 1; i < LZX_MAX_CODE_LENGTH; i++)
+        Offset[i + 1] = Offset[i] + Table->Count[i];
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Lengths[i] != 0)
+            Table->Symbol[Offset[Lengths[i]]++] = (USHORT)i;
+    }
+
+    return true;
+}
+
+
+static LONG DecodeSymbol(PLZX_BITSTREAM Stream, PLZX_DECODE_TABLE Table)
+/*
+ * FUNCTION: Decodes a Huffman coded symbol
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ *     Table  = Pointer to decoding table
+ * RETURNS:
+ *     The symbol, -1 if the bits don't form a code
+ */
+{
+    ULONG Bits, Code, First, Index, Length;
+
+    EnsureBits(Stream, LZX_MAX_CODE_LENGTH);
+    Bits = Stream->Buffer >> (32 - LZX_MAX_CODE_LENGTH);
+
+    Code = First = Index = 0;
+    for (Length = 1; Length <= LZX_MAX_CODE_LENGTH; Length++)
+    {
+        Code |= (Bits >> (LZX_MAX_CODE_LENGTH - Length)) & 1;
+        if (Code < First + Table->Count[Length])
+        {
+            Stream->Buffer <<= Length;
+            Stream->Bits    -= Length;
+            return Table->Symbol[Index + Code - First];
+        }
+        Index += Table->Count[Length];
+        First  = (First + Table->Count[Length]) << 1;
+        Code <<= 1;
+    }
+
+    return -1;
+}
+
+
+/* E8 call translation */
+
+static void EncodeE8(PUCHAR Data, ULONG Length, ULONG Position)
+/*
+ * FUNCTION: Turns the relative targets of x86 CALL instructions into absolute ones
+ * ARGUMENTS:
+ *     Data     = Pointer to data block
+ *     Length   = Length of data block
+ *     Position = Uncompressed offset of data block in the folder
+ * NOTES:
+ *     Calls to the same function then look alike, so they compress better
+ */
+{
+    const LONG FileSize = LZX_E8_FILE_SIZE;
+    LONG Current, Relative, Absolute;
+    ULONG i;
+
+    if (Length <= 10)
+        return;
+
+    for (i = 0; i < Length - 10; )
+    {
+        if (Data[i] != 0xE8)
+        {
+            i++;
+            continue;
+        }
+
+        Current  = (LONG)(Position + i);
+        Relative = (LONG)(Data[i + 1] | (Data[i + 2] << 8) |
+                          (Data[i + 3] << 16) | ((ULONG)Data[i + 4] << 24));
+
+        if ((Relative >= -Current) && (Relative < FileSize))
+        {
+            if (Relative < FileSize - Current)
+                Absolute = Relative + Current;
+            else
+                Absolute = Relative - FileSize;
+
+            Data[i + 1] = (UCHAR)Absolute;
+            Data[i + 2] = (UCHAR)(Absolute >> 8);
+            Data[i + 3] = (UCHAR)(Absolute >> 16);
+            Data[i + 4] = (UCHAR)(Absolute >> 24);
+        }
+        i += 5;
+    }
+}
+
+
+static void DecodeE8(PUCHAR Data, ULONG Length, ULONG Position, LONG FileSize)
+/*
+ * FUNCTION: Undoes EncodeE8
+ * ARGUMENTS:
+ *     Data     = Pointer to data block
+ *     Length   = Length of data block
+ *     Position = Uncompressed offset of data block in the folder
+ *     FileSize = Translation size from the stream header
+ */
+{
+    LONG Current, Relative, Absolute;
+    ULONG i;
+
+    if (Length <= 10)
+        return;
+
+    for (i = 0; i < Length - 10; )
+    {
+        if (Data[i] != 0xE8)
+        {
+            i++;
+            continue;
+        }
+
+        Current  = (LONG)(Position + i);
+        Absolute = (LONG)(Data[i + 1] | (Data[i + 2] << 8) |
+                          (Data[i + 3] << 16) | ((ULONG)Data[i + 4] << 24));
+
+        if ((Absolute >= -Current) && (Absolute < FileSize))
+        {
+            if (Absolute >= 0)
+                Relative = Absolute - Current;
+            else
+                Relative = Absolute + FileSize;
+
+            Data[i + 1] = (UCHAR)Relative;
+            Data[i + 2] = (UCHAR)(Relative >> 8);
+            Data[i + 3] = (UCHAR)(Relative >> 16);
+            Data[i + 4] = (UCHAR)(Relative >> 24);
+        }
+        i += 5;
+    }
+}
+
+
+static ULONG GetPositionSlot(ULONG FormattedOffset)
+/*
+ * FUNCTION: Returns the position slot of a match offset
+ * ARGUMENTS:
+ *     FormattedOffset = Match offset plus two
+ */
+{
+    ULONG Bit;
+
+    if (FormattedOffset < 4)
+        return FormattedOffset;
+
+    /* From slot 36 on, all slots are 2^17 wide */
+    if (FormattedOffset >= PositionBase[36])
+        return 36 + ((FormattedOffset - PositionBase[36]) >> 17);
+
+    /* Otherwise two slots per power of two */
+    for (Bit = 2; (FormattedOffset >> (Bit + 1)) != 0; Bit++);
+    return 2 * Bit + ((FormattedOffset >> (Bit - 1)) & 1);
+}
+
+
+/* CLZXCodec */
+
+CLZXCodec::CLZXCodec()
+/*
+ * FUNCTION: Default constructor
+ */
+{
+    WindowBits   = 0;
+    Window       = NULL;
+    HashHead     = NULL;
+    HashPrev     = NULL;
+    Tokens       = NULL;
+    DecodeWindow = NULL;
+
+    Reset(LZX_COMPRESSION_TYPE(LZX_WINDOW_BITS));
+}
+
+
+CLZXCodec::~CLZXCodec()
+/*
+ * FUNCTION: Default destructor
+ */
+{
+    free(Window);
+    free(HashHead);
+    free(HashPrev);
+    free(Tokens);
+    free(DecodeWindow);
+}
+
+
+void CLZXCodec::Reset(USHORT CompressionType)
+/*
+ * FUNCTION: Restarts the codec at the beginning of a folder
+ * ARGUMENTS:
+ *     CompressionType = Compression type of the folder
+ */
+{
+    ULONG Bits;
+
+    Bits = (CompressionType >> 8) & 0x1F;
+    if ((Bits < LZX_MIN_WINDOW_BITS) || (Bits > LZX_MAX_WINDOW_BITS))
+    {
+        DPRINT(MIN_TRACE, ("Bad LZX window size (%u).\n", (UINT)Bits));
+        Bits = 0;
+    }
+
+    if (Bits != WindowBits)
+    {
+        /* The buffers depend on the window size */
+        free(Window);
+        free(HashPrev);
+        free(DecodeWindow);
+        Window       = NULL;
+        HashPrev     = NULL;
+        DecodeWindow = NULL;
+
+        WindowBits = Bits;
+        WindowSize = (Bits != 0) ? (1 << Bits) : 0;
+        MainSymbols = (Bits != 0) ? LZX_NUM_CHARS + PositionSlots[Bits - LZX_MIN_WINDOW_BITS] * 8 : 0;
+    }
+
+    R0 = R1 = R2 = 1;
+    FrameCount    = 0;
+    FramePosition = 0;
+    HeaderDone    = false;
+    memset(MainLengths, 0, sizeof(MainLengths));
+    memset(LengthLengths, 0, sizeof(LengthLengths));
+
+    WindowPosition = 0;
+    if (HashHead)
+        memset(HashHead, 0xFF, LZX_HASH_SIZE * sizeof(ULONG));
+
+    DecodePosition = 0;
+    E8FileSize     = 0;
+    BlockType      = 0;
+    BlockLength    = 0;
+    BlockRemaining = 0;
+    if (DecodeWindow)
+        memset(DecodeWindow, 0, WindowSize);
+}
+
+
+bool CLZXCodec::AllocateEncoder()
+/*
+ * FUNCTION: Allocates the compression buffers
+ * RETURNS:
+ *     true if the buffers are available, false if not
+ */
+{
+    if (WindowBits == 0)
+        return false;
+
+    if (!Window)
+        Window = (PUCHAR)malloc(2 * WindowSize);
+    if (!HashPrev)
+        HashPrev = (PULONG)malloc(WindowSize * sizeof(ULONG));
+    if (!HashHead)
+    {
+        HashHead = (PULONG)malloc(LZX_HASH_SIZE * sizeof(ULONG));
+        if (HashHead)
+            memset(HashHead, 0xFF, LZX_HASH_SIZE * sizeof(ULONG));
+    }
+    if (!Tokens)
+        Tokens = (PLZX_TOKEN)malloc(CAB_BLOCKSIZE * sizeof(LZX_TOKEN));
+
+    return (Window && HashPrev && HashHead && Tokens);
+}
+
+
+bool CLZXCodec::AllocateDecoder()
+/*
+ * FUNCTION: Allocates the decompression buffers
+ * RETURNS:
+ *     true if the buffers are available, false if not
+ */
+{
+    if (WindowBits == 0)
+        return false;
+
+    if (!DecodeWindow)
+        DecodeWindow = (PUCHAR)calloc(WindowSize, 1);
+
+    return (DecodeWindow != NULL);
+}
+
+
+void CLZXCodec::SlideWindow()
+/*
+ * FUNCTION: Drops the older half of the compression window
+ */
+{
+    ULONG i;
+
+    memmove(Window, Window + WindowSize, WindowPosition - WindowSize);
+    WindowPosition -= WindowSize;
+
+    for (i = 0; i < LZX_HASH_SIZE; i++)
+        HashHead[i] = (HashHead[i] == LZX_NIL || HashHead[i] < WindowSize) ? LZX_NIL : HashHead[i] - WindowSize;
+
+    for (i = 0; i < WindowSize; i++)
+        HashPrev[i] = (HashPrev[i] == LZX_NIL || HashPrev[i] < WindowSize) ? LZX_NIL : HashPrev[i] - WindowSize;
+}
+
+
+ULONG CLZXCodec::InsertHash(ULONG Position)
+/*
+ * FUNCTION: Adds a position to the hash chains
+ * ARGUMENTS:
+ *     Position = Position in the window
+ * RETURNS:
+ *     Previous position with the same hash, LZX_NIL if none
+ */
+{
+    ULONG Hash, Previous;
+
+    if (Position + 3 > WindowPosition)
+        return LZX_NIL;
+
+    Hash = ((Window[Position] << 16) | (Window[Position + 1] << 8) | Window[Position + 2]) * 2654435761U;
+    Hash >>= 32 - LZX_HASH_BITS;
+
+    Previous = HashHead[Hash];
+    HashHead[Hash] = Position;
+    HashPrev[Position & (WindowSize - 1)] = Previous;
+    return Previous;
+}
+
+
+static ULONG MatchLength(PUCHAR A, PUCHAR B, ULONG MaxLength)
+{
+    ULONG Length = 0;
+
+    while ((Length < MaxLength) && (A[Length] == B[Length]))
+        Length++;
+    return Length;
+}
+
+
+ULONG CLZXCodec::FindMatch(ULONG Position, ULONG End, PULONG Distance)
+/*
+ * FUNCTION: Finds the best match for the data at a position, and adds
+ *           the position to the hash chains
+ * ARGUMENTS:
+ *     Position = Position in the window
+ *     End      = End of the current data block in the window
+ *     Distance = Address of buffer to place distance of match
+ * RETURNS:
+ *     Length of match, 0 if there is none worth coding
+ */
+{
+    ULONG MaxLength, MaxDistance, Length, Best, BestDistance;
+    ULONG RepLength, RepDistance, Candidate, Next, Chain;
+    ULONG Repeated[3];
+    ULONG i;
+
+    MaxLength = End - Position;
+    if (MaxLength > LZX_MAX_MATCH)
+        MaxLength = LZX_MAX_MATCH;
+
+    if (MaxLength < LZX_MIN_MATCH)
+    {
+        InsertHash(Position);
+        return 0;
+    }
+
+    /* Repeated offsets cost next to nothing, so try them first */
+    Repeated[0] = R0;
+    Repeated[1] = R1;
+    Repeated[2] = R2;
+    RepLength   = 0;
+    RepDistance = 0;
+    for (i = 0; i < 3; i++)
+    {
+        if (Repeated[i] > Position)
+            continue;
+
+        Length = MatchLength(Window + Position, Window + Position - Repeated[i], MaxLength);
+        if (Length > RepLength)
+        {
+            RepLength   = Length;
+            RepDistance = Repeated[i];
+        }
+    }
+
+    Candidate = InsertHash(Position);
+    if (RepLength >= LZX_NICE_MATCH)
+    {
+        *Distance = RepDistance;
+        return RepLength;
+    }
+
+    /* A new offset has to beat a repeated one by more than a byte */
+    MaxDistance  = WindowSize - 3;
+    Best         = (RepLength + 1 > LZX_MIN_MATCH) ? RepLength + 1 : LZX_MIN_MATCH;
+    BestDistance = 0;
+
+    for (Chain = LZX_MAX_CHAIN;
+         (Chain > 0) && (Candidate != LZX_NIL) && (Position - Candidate <= MaxDistance);
+         Chain--)
+    {
+        if ((Window[Candidate + Best] == Window[Position + Best]) &&
+            (Window[Candidate] == Window[Position]))
+        {
+            Length = MatchLength(Window + Position, Window + Candidate, MaxLength);
+            if (Length > Best)
+            {
+                Best         = Length;
+                BestDistance = Position - Candidate;
+                if ((Length >= LZX_NICE_MATCH) || (Length == MaxLength))
+                    break;
+            }
+        }
+
+        Next = HashPrev[Candidate & (WindowSize - 1)];
+        if (Next >= Candidate)
+            break;
+        Candidate = Next;
+    }
+
+    if ((BestDistance != 0) && ((Best > 3) || (BestDistance <= LZX_TOO_FAR)))
+    {
+        *Distance = BestDistance;
+        return Best;
+    }
+
+    if (RepLength >= LZX_MIN_MATCH)
+    {
+        *Distance = RepDistance;
+        return RepLength;
+    }
+
+    return 0;
+}
+
+
+void CLZXCodec::EmitLiteral(UCHAR Literal)
+{
+    Tokens[TokenCount].MainSymbol   = Literal;
+    Tokens[TokenCount].LengthSymbol = LZX_NO_LENGTH;
+    Tokens[TokenCount].VerbatimBits = 0;
+    TokenCount++;
+
+    MainFreq[Literal]++;
+}
+
+
+void CLZXCodec::EmitMatch(ULONG Length, ULONG Distance)
+/*
+ * FUNCTION: Adds a match to the current block
+ * ARGUMENTS:
+ *     Length   = Length of match
+ *     Distance = Distance of match
+ */
+{
+    ULONG Slot, Header, Verbatim = 0;
+
+    if (Distance == R0)
+    {
+        Slot = 0;
+    }
+    else if (Distance == R1)
+    {
+        Slot = 1;
+        R1 = R0;
+        R0 = Distance;
+    }
+    else if (Distance == R2)
+    {
+        Slot = 2;
+        R2 = R0;
+        R0 = Distance;
+    }
+    else
+    {
+        Slot = GetPositionSlot(Distance + 2);
+        Verbatim = Distance + 2 - PositionBase[Slot];
+        R2 = R1;
+        R1 = R0;
+        R0 = Distance;
+    }
+
+    Header = Length - LZX_MIN_MATCH;
+    if (Header >= LZX_NUM_PRIMARY_LENGTHS)
+    {
+        Tokens[TokenCount].LengthSymbol = (USHORT)(Header - LZX_NUM_PRIMARY_LENGTHS);
+        LengthFreq[Header - LZX_NUM_PRIMARY_LENGTHS]++;
+        Header = LZX_NUM_PRIMARY_LENGTHS;
+    }
+    else
+    {
+        Tokens[TokenCount].LengthSymbol = LZX_NO_LENGTH;
+    }
+
+    Tokens[TokenCount].MainSymbol   = (USHORT)(LZX_NUM_CHARS + (Slot << 3) + Header);
+    Tokens[TokenCount].VerbatimBits = Verbatim;
+    TokenCount++;
+
+    MainFreq[LZX_NUM_CHARS + (Slot << 3) + Header]++;
+}
+
+
+void CLZXCodec::WriteLengths(PLZX_BITSTREAM Stream, PUCHAR Lengths, PUCHAR PrevLengths, ULONG Count)
+/*
+ * FUNCTION: Writes a range of tree lengths as changes to the previous block's
+ * ARGUMENTS:
+ *     Stream      = Pointer to bit stream
+ *     Lengths     = Pointer to new lengths
+ *     PrevLengths = Pointer to lengths of the previous block
+ *     Count       = Number of lengths
+ */
+{
+    UCHAR Symbols[LZX_MAX_MAIN_SYMBOLS];
+    UCHAR Extra[LZX_MAX_MAIN_SYMBOLS];
+    ULONG PreFreq[LZX_NUM_PRETREE];
+    UCHAR PreLengths[LZX_NUM_PRETREE];
+    USHORT PreCodes[LZX_NUM_PRETREE];
+    ULONG SymbolCount, Run, Part, i;
+
+    memset(PreFreq, 0, sizeof(PreFreq));
+
+    SymbolCount = 0;
+    for (i = 0; i < Count; )
+    {
+        if (Lengths[i] == 0)
+        {
+            for (Run = 1; (i + Run < Count) && (Lengths[i + Run] == 0); Run++);
+
+            if (Run >= 4)
+            {
+                /* Runs of 20 to 51 zeros, then one of 4 to 19 */
+                while (Run >= 20)
+                {
+                    Part = (Run > 51) ? 51 : Run;
+                    Symbols[SymbolCount] = 18;
+                    Extra[SymbolCount++] = (UCHAR)(Part - 20);
+                    i   += Part;
+                    Run -= Part;
+                }
+
+                if (Run >= 4)
+                {
+                    Symbols[SymbolCount] = 17;
+                    Extra[SymbolCount++] = (UCHAR)(Run - 4);
+                    i += Run;
+                }
+                continue;
+            }
+        }
+
+        Symbols[SymbolCount] = (UCHAR)((PrevLengths[i] + 17 - Lengths[i]) % 17);
+        Extra[SymbolCount++] = 0;
+        i++;
+    }
+
+    for (i = 0; i < SymbolCount; i++)
+        PreFreq[Symbols[i]]++;
+
+    /* Pretree lengths are stored in 4 bits */
+    MakeLengths(PreFreq, LZX_NUM_PRETREE, 15, PreLengths);
+    MakeCodes(PreLengths, LZX_NUM_PRETREE, PreCodes);
+
+    for (i = 0; i < LZX_NUM_PRETREE; i++)
+        PutBits(Stream, PreLengths[i], 4);
+
+    for (i = 0; i < SymbolCount; i++)
+    {
+        PutBits(Stream, PreCodes[Symbols[i]], PreLengths[Symbols[i]]);
+        if (Symbols[i] == 17)
+            PutBits(Stream, Extra[i], 4);
+        else if (Symbols[i] == 18)
+            PutBits(Stream, Extra[i], 5);
+    }
+}
+
+
+void CLZXCodec::WriteVerbatimBlock(PLZX_BITSTREAM Stream, ULONG Length,
+                                   PUCHAR NewMainLengths, PUCHAR NewLengthLengths)
+/*
+ * FUNCTION: Writes the tokens of the current data block as a verbatim block
+ * ARGUMENTS:
+ *     Stream           = Pointer to bit stream
+ *     Length           = Uncompressed length of the block
+ *     NewMainLengths   = Pointer to buffer to place main tree lengths
+ *     NewLengthLengths = Pointer to buffer to place length tree lengths
+ * NOTES:
+ *     The new tree lengths replace MainLengths and LengthLengths only
+ *     once the caller has decided to keep the block
+ */
+{
+    USHORT MainCodes[LZX_MAX_MAIN_SYMBOLS];
+    USHORT LengthCodes[LZX_NUM_LENGTHS];
+    PLZX_TOKEN Token;
+    ULONG Slot, i;
+
+    /* Some decoders don't like an empty length tree */
+    for (i = 0; (i < LZX_NUM_LENGTHS) && (LengthFreq[i] == 0); i++);
+    if (i == LZX_NUM_LENGTHS)
+        LengthFreq[0] = LengthFreq[1] = 1;
+
+    MakeLengths(MainFreq, MainSymbols, LZX_MAX_CODE_LENGTH, NewMainLengths);
+    MakeLengths(LengthFreq, LZX_NUM_LENGTHS, LZX_MAX_CODE_LENGTH, NewLengthLengths);
+    MakeCodes(NewMainLengths, MainSymbols, MainCodes);
+    MakeCodes(NewLengthLengths, LZX_NUM_LENGTHS, LengthCodes);
+
+    PutBits(Stream, LZX_BLOCKTYPE_VERBATIM, 3);
+    PutBits(Stream, Length >> 8, 16);
+    PutBits(Stream, Length & 0xFF, 8);
+
+    WriteLengths(Stream, NewMainLengths, MainLengths, LZX_NUM_CHARS);
+    WriteLengths(Stream, NewMainLengths + LZX_NUM_CHARS, MainLengths + LZX_NUM_CHARS,
+                 MainSymbols - LZX_NUM_CHARS);
+    WriteLengths(Stream, NewLengthLengths, LengthLengths, LZX_NUM_LENGTHS);
+
+    for (i = 0; i < TokenCount; i++)
+    {
+        Token = &Tokens[i];
+        PutBits(Stream, MainCodes[Token->MainSymbol], NewMainLengths[Token->MainSymbol]);
+        if (Token->MainSymbol < LZX_NUM_CHARS)
+            continue;
+
+        if (Token->LengthSymbol != LZX_NO_LENGTH)
+            PutBits(Stream, LengthCodes[Token->LengthSymbol], NewLengthLengths[Token->LengthSymbol]);
+
+        Slot = (Token->MainSymbol - LZX_NUM_CHARS) >> 3;
+        if (Slot >= 4)
+            PutBits(Stream, Token->VerbatimBits, ExtraBits[Slot]);
+    }
+}
+
+
+void CLZXCodec::WriteUncompressedBlock(PLZX_BITSTREAM Stream, PUCHAR Data, ULONG Length)
+/*
+ * FUNCTION: Writes a data block as an uncompressed block
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ *     Data   = Pointer to data, after E8 translation
+ *     Length = Length of data
+ * NOTES:
+ *     R0, R1 and R2 must be the values at the start of the block
+ */
+{
+    ULONG Repeated[3];
+    ULONG i;
+
+    PutBits(Stream, LZX_BLOCKTYPE_UNCOMPRESSED, 3);
+    PutBits(Stream, Length >> 8, 16);
+    PutBits(Stream, Length & 0xFF, 8);
+
+    /* Pad to the next word, a full one if already there */
+    PutBits(Stream, 0, 16 - Stream->Bits);
+
+    Repeated[0] = R0;
+    Repeated[1] = R1;
+    Repeated[2] = R2;
+    for (i = 0; i < 3; i++)
+    {
+        PutByte(Stream, (UCHAR)Repeated[i]);
+        PutByte(Stream, (UCHAR)(Repeated[i] >> 8));
+        PutByte(Stream, (UCHAR)(Repeated[i] >> 16));
+        PutByte(Stream, (UCHAR)(Repeated[i] >> 24));
+    }
+
+    for (i = 0; i < Length; i++)
+        PutByte(Stream, Data[i]);
+    if (Length & 1)
+        PutByte(Stream, 0);
+}
+
+
+ULONG CLZXCodec::Compress(void* OutputBuffer,
+                          void* InputBuffer,
+                          ULONG InputLength,
+                          PULONG OutputLength)
+/*
+ * FUNCTION: Compresses data in a buffer
+ * ARGUMENTS:
+ *     OutputBuffer = Pointer to buffer to place compressed data
+ *     InputBuffer  = Pointer to buffer with data to be compressed
+ *     InputLength  = Length of input buffer
+ *     OutputLength = Address of buffer to place size of compressed data
+ * NOTES:
+ *     Data blocks must be passed in folder order, and the output
+ *     buffer must hold CAB_COMPBLOCKSIZE bytes
+ */
+{
+    UCHAR NewMainLengths[LZX_MAX_MAIN_SYMBOLS];
+    UCHAR NewLengthLengths[LZX_NUM_LENGTHS];
+    LZX_BITSTREAM Stream;
+    ULONG Start, End, Position, Skip;
+    ULONG Length, Distance, NextLength, NextDistance;
+    ULONG SavedR0, SavedR1, SavedR2;
+
+    if (WindowBits == 0)
+        return CS_BADSTREAM;
+
+    if (!AllocateEncoder())
+        return CS_NOMEMORY;
+
+    if ((InputLength == 0) || (InputLength > CAB_BLOCKSIZE))
+        return CS_BADSTREAM;
+
+    if (WindowPosition + InputLength > 2 * WindowSize)
+        SlideWindow();
+
+    Start = WindowPosition;
+    End   = Start + InputLength;
+    memcpy(Window + Start, InputBuffer, InputLength);
+    WindowPosition = End;
+
+    if (FrameCount < LZX_E8_MAX_FRAMES)
+        EncodeE8(Window + Start, InputLength, FramePosition);
+
+    SavedR0 = R0;
+    SavedR1 = R1;
+    SavedR2 = R2;
+
+    TokenCount = 0;
+    memset(MainFreq, 0, sizeof(MainFreq));
+    memset(LengthFreq, 0, sizeof(LengthFreq));
+
+    /* Greedy parsing with one step of lazy evaluation */
+    Position = Start;
+    Length = FindMatch(Position, End, &Distance);
+    while (Position < End)
+    {
+        if (Length == 0)
+        {
+            EmitLiteral(Window[Position++]);
+            if (Position < End)
+                Length = FindMatch(Position, End, &Distance);
+            continue;
+        }
+
+        Skip = Position + 1;
+        if ((Length < LZX_LAZY_MATCH) && (Position + 1 < End))
+        {
+            NextLength = FindMatch(Position + 1, End, &NextDistance);
+            if (NextLength > Length)
+            {
+                EmitLiteral(Window[Position++]);
+                Length   = NextLength;
+                Distance = NextDistance;
+                continue;
+            }
+            Skip = Position + 2;
+        }
+
+        EmitMatch(Length, Distance);
+        for (; Skip < Position + Length; Skip++)
+            InsertHash(Skip);
+        Position += Length;
+
+        if (Position < End)
+            Length = FindMatch(Position, End, &Distance);
+    }
+
+    Stream.Start   = (PUCHAR)OutputBuffer;
+    Stream.Current = Stream.Start;
+    Stream.End     = Stream.Start + CAB_COMPBLOCKSIZE;
+    Stream.Buffer  = 0;
+    Stream.Bits    = 0;
+
+    /* Stream header, no translation size given means the default one */
+    if (!HeaderDone)
+    {
+        PutBits(&Stream, 1, 1);
+        PutBits(&Stream, LZX_E8_FILE_SIZE >> 16, 16);
+        PutBits(&Stream, LZX_E8_FILE_SIZE & 0xFFFF, 16);
+    }
+
+    WriteVerbatimBlock(&Stream, InputLength, NewMainLengths, NewLengthLengths);
+    if (Stream.Bits != 0)
+        PutBits(&Stream, 0, 16 - Stream.Bits);
+
+    if (Stream.Current - Stream.Start < (LONG)InputLength + 16)
+    {
+        memcpy(MainLengths, NewMainLengths, MainSymbols);
+        memcpy(LengthLengths, NewLengthLengths, LZX_NUM_LENGTHS);
+    }
+    else
+    {
+        /* Doesn't compress, so store it. The trees stay as they were */
+        R0 = SavedR0;
+        R1 = SavedR1;
+        R2 = SavedR2;
+
+        Stream.Current = Stream.Start;
+        Stream.Buffer  = 0;
+        Stream.Bits    = 0;
+
+        if (!HeaderDone)
+        {
+            PutBits(&Stream, 1, 1);
+            PutBits(&Stream, LZX_E8_FILE_SIZE >> 16, 16);
+            PutBits(&Stream, LZX_E8_FILE_SIZE & 0xFFFF, 16);
+        }
+
+        WriteUncompressedBlock(&Stream, Window + Start, InputLength);
+        if (Stream.Current > Stream.End)
+            return CS_BADSTREAM;
+    }
+
+    HeaderDone = true;
+    FramePosition += InputLength;
+    FrameCount++;
+
+    *OutputLength = (ULONG)(Stream.Current - Stream.Start);
+    return CS_SUCCESS;
+}
+
+
+bool CLZXCodec::ReadLengths(PLZX_BITSTREAM Stream, PUCHAR Lengths, ULONG First, ULONG Last)
+/*
+ * FUNCTION: Reads a range of tree lengths
+ * ARGUMENTS:
+ *     Stream  = Pointer to bit stream
+ *     Lengths = Pointer to lengths of the previous block, updated in place
+ *     First   = First length to read
+ *     Last    = One past the last length to read
+ * RETURNS:
+ *     true if the lengths were read, false if the stream is bad
+ */
+{
+    UCHAR PreLengths[LZX_NUM_PRETREE];
+    LZX_DECODE_TABLE PreTable;
+    LONG Symbol;
+    ULONG Run, i;
+    UCHAR Value;
+
+    for (i = 0; i < LZX_NUM_PRETREE; i++)
+        PreLengths[i] = (UCHAR)GetBits(Stream, 4);
+
+    if (!BuildDecodeTable(&PreTable, PreLengths, LZX_NUM_PRETREE))
+        return false;
+
+    for (i = First; i < Last; )
+    {
+        Symbol = DecodeSymbol(Stream, &PreTable);
+        if (Symbol < 0)
+            return false;
+
+        if (Symbol < 17)
+        {
+            Lengths[i] = (UCHAR)((Lengths[i] + 17 - Symbol) % 17);
+            i++;
+            continue;
+        }
+
+        Value = 0;
+        if (Symbol == 17)
+        {
+            Run = GetBits(Stream, 4) + 4;
+        }
+        else if (Symbol == 18)
+        {
+            Run = GetBits(Stream, 5) + 20;
+        }
+        else
+        {
+            Run = GetBits(Stream, 1) + 4;
+            Symbol = DecodeSymbol(Stream, &PreTable);
+            if ((Symbol < 0) || (Symbol >= 17))
+                return false;
+            Value = (UCHAR)((Lengths[i] + 17 - Symbol) % 17);
+        }
+
+        /* Some encoders overrun the range, the extra lengths are dropped */
+        for (; (Run > 0) && (i < Last); Run--)
+            Lengths[i++] = Value;
+    }
+
+    return true;
+}
+
+
+bool CLZXCodec::ReadBlockHeader(PLZX_BITSTREAM Stream)
+/*
+ * FUNCTION: Reads the header of the next block
+ * ARGUMENTS:
+ *     Stream = Pointer to bit stream
+ * RETURNS:
+ *     true if the header was read, false if the stream is bad
+ */
+{
+    ULONG i;
+
+    /* Uncompressed blocks of odd length are padded to a word */
+    if ((BlockType == LZX_BLOCKTYPE_UNCOMPRESSED) && (BlockLength & 1))
+        Stream->Current++;
+
+    BlockType      = GetBits(Stream, 3);
+    BlockLength    = GetBits(Stream, 16) << 8;
+    BlockLength   |= GetBits(Stream, 8);
+    BlockRemaining = BlockLength;
+
+    if (BlockLength == 0)
+        return false;
+
+    switch (BlockType)
+    {
+        case LZX_BLOCKTYPE_ALIGNED:
+            for (i = 0; i < LZX_NUM_ALIGNED; i++)
+                AlignedLengths[i] = (UCHAR)GetBits(Stream, 3);
+            if (!BuildDecodeTable(&AlignedTable, AlignedLengths, LZX_NUM_ALIGNED))
+                return false;
+            /* Fall through */
+
+        case LZX_BLOCKTYPE_VERBATIM:
+            if (!ReadLengths(Stream, MainLengths, 0, LZX_NUM_CHARS) ||
+                !ReadLengths(Stream, MainLengths, LZX_NUM_CHARS, MainSymbols) ||
+                !BuildDecodeTable(&MainTable, MainLengths, MainSymbols))
+            {
+                return false;
+            }
+
+            if (!ReadLengths(Stream, LengthLengths, 0, LZX_NUM_LENGTHS) ||
+                !BuildDecodeTable(&LengthTable, LengthLengths, LZX_NUM_LENGTHS))
+            {
+                return false;
+            }
+            return true;
+
+        case LZX_BLOCKTYPE_UNCOMPRESSED:
+            AlignBitStream(Stream);
+            R0 = ReadLong(Stream);
+            R1 = ReadLong(Stream);
+            R2 = ReadLong(Stream);
+            return (Stream->Current <= Stream->End);
+
+        default:
+            DPRINT(MIN_TRACE, ("Bad LZX block type (%u).\n", (UINT)BlockType));
+            return false;
+    }
+}
+
+
+bool CLZXCodec::DecodeRun(PLZX_BITSTREAM Stream, ULONG Run, PULONG Produced)
+/*
+ * FUNCTION: Decodes data of the current block into the window
+ * ARGUMENTS:
+ *     Stream   = Pointer to bit stream
+ *     Run      = Number of bytes wanted
+ *     Produced = Address of buffer to place number of bytes decoded
+ * RETURNS:
+ *     true if the data was decoded, false if the stream is bad
+ * NOTES:
+ *     The last match may go beyond Run, the excess then belongs
+ *     to the next data block
+ */
+{
+    ULONG Mask = WindowSize - 1;
+    ULONG Done, Length, Offset, Slot, Extra, i;
+    LONG Symbol;
+
+    if (BlockType == LZX_BLOCKTYPE_UNCOMPRESSED)
+    {
+        if (Stream->Current + Run > Stream->End)
+            return false;
+
+        for (i = 0; i < Run; i++)
+            DecodeWindow[DecodePosition++ & Mask] = *Stream->Current++;
+
+        *Produced = Run;
+        return true;
+    }
+
+    for (Done = 0; Done < Run; Done += Length)
+    {
+        Symbol = DecodeSymbol(Stream, &MainTable);
+        if (Symbol < 0)
+            return false;
+
+        if (Symbol < LZX_NUM_CHARS)
+        {
+            DecodeWindow[DecodePosition++ & Mask] = (UCHAR)Symbol;
+            Length = 1;
+            continue;
+        }
+
+        Symbol -= LZX_NUM_CHARS;
+        Slot    = Symbol >> 3;
+        Length  = Symbol & 7;
+        if (Length == LZX_NUM_PRIMARY_LENGTHS)
+        {
+            Symbol = DecodeSymbol(Stream, &LengthTable);
+            if (Symbol < 0)
+                return false;
+            Length += Symbol;
+        }
+        Length += LZX_MIN_MATCH;
+
+        if (Slot == 0)
+        {
+            Offset = R0;
+        }
+        else if (Slot == 1)
+        {
+            Offset = R1;
+            R1 = R0;
+            R0 = Offset;
+        }
+        else if (Slot == 2)
+        {
+            Offset = R2;
+            R2 = R0;
+            R0 = Offset;
+        }
+        else
+        {
+            Extra  = ExtraBits[Slot];
+            Offset = PositionBase[Slot] - 2;
+            if ((BlockType == LZX_BLOCKTYPE_ALIGNED) && (Extra >= 3))
+            {
+                /* The low three bits come from the aligned offset tree */
+                Offset += GetBits(Stream, Extra - 3) << 3;
+                Symbol = DecodeSymbol(Stream, &AlignedTable);
+                if (Symbol < 0)
+                    return false;
+                Offset += Symbol;
+            }
+            else
+            {
+                Offset += GetBits(Stream, Extra);
+            }
+
+            R2 = R1;
+            R1 = R0;
+            R0 = Offset;
+        }
+
+        for (i = 0; i < Length; i++, DecodePosition++)
+            DecodeWindow[DecodePosition & Mask] = DecodeWindow[(DecodePosition - Offset) & Mask];
+    }
+
+    *Produced = Done;
+    return true;
+}
+
+
+ULONG CLZXCodec::Uncompress(void* OutputBuffer,
+                            void* InputBuffer,
+                            ULONG InputLength,
+                            PULONG OutputLength)
+/*
+ * FUNCTION: Uncompresses data in a buffer
+ * ARGUMENTS:
+ *     OutputBuffer = Pointer to buffer to place uncompressed data
+ *     InputBuffer  = Pointer to buffer with data to be uncompressed
+ *     InputLength  = Length of input buffer
+ *     OutputLength = Address of buffer with the uncompressed size of the
+ *                    data block, as given by its CFDATA header
+ * NOTES:
+ *     Data blocks must be passed in folder order
+ */
+{
+    LZX_BITSTREAM Stream;
+    ULONG FrameSize, Produced, Done, Run, Start;
+
+    FrameSize = *OutputLength;
+    if ((FrameSize == 0) || (FrameSize > CAB_BLOCKSIZE) || (WindowBits == 0))
+        return CS_BADSTREAM;
+
+    if (!AllocateDecoder())
+        return CS_NOMEMORY;
+
+    Stream.Start   = (PUCHAR)InputBuffer;
+    Stream.Current = Stream.Start;
+    Stream.End     = Stream.Start + InputLength;
+    Stream.Buffer  = 0;
+    Stream.Bits    = 0;
+
+    if (!HeaderDone)
+    {
+        if (GetBits(&Stream, 1))
+        {
+            E8FileSize  = GetBits(&Stream, 16) << 16;
+            E8FileSize |= GetBits(&Stream, 16);
+        }
+        HeaderDone = true;
+    }
+
+    /* A match of the previous data block may already have produced some of this one */
+    Produced = DecodePosition - FramePosition;
+    while (Produced < FrameSize)
+    {
+        if (BlockRemaining == 0)
+        {
+            if (!ReadBlockHeader(&Stream))
+                return CS_BADSTREAM;
+        }
+
+        Run = FrameSize - Produced;
+        if (Run > BlockRemaining)
+            Run = BlockRemaining;
+
+        if (!DecodeRun(&Stream, Run, &Done) || (Done > BlockRemaining))
+            return CS_BADSTREAM;
+
+        BlockRemaining -= Done;
+        Produced       += Done;
+    }
+
+    /* Bits taken beyond the input mean it was cut short */
+    if ((ULONG)(Stream.Current - Stream.Start) * 8 - Stream.Bits > InputLength * 8)
+        return CS_BADSTREAM;
+
+    Start = FramePosition & (WindowSize - 1);
+    if (Start + FrameSize <= WindowSize)
+    {
+        memcpy(OutputBuffer, DecodeWindow + Start, FrameSize);
+    }
+    else
+    {
+        memcpy(OutputBuffer, DecodeWindow + Start, WindowSize - Start);
+        memcpy((PUCHAR)OutputBuffer + WindowSize - Start, DecodeWindow, FrameSize - (WindowSize - Start));
+    }
+
+    if ((FrameCount < LZX_E8_MAX_FRAMES) && (E8FileSize != 0))
+        DecodeE8((PUCHAR)OutputBuffer, FrameSize, FramePosition, (LONG)E8FileSize);
+
+    FramePosition += FrameSize;
+    FrameCount++;
+
+    *OutputLength = FrameSize;
+    return CS_SUCCESS;
+}
+
+/* EOF */
@@ -0,0 +1,146 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     CAB codec for LZX compressed data
+ */
+
+#pragma once
+
+#include "cabinet.h"
+
+/* Window sizes allowed by the format, and the one used for new folders */
+#define LZX_MIN_WINDOW_BITS     15
+#define LZX_MAX_WINDOW_BITS     21
+#define LZX_WINDOW_BITS         21
+
+/* Uncompressed size of the folders cabman starts for LZX */
+#define LZX_FOLDER_SIZE         (4 * 1024 * 1024)
+
+/* Folder compression type for a window of 2^Bits bytes */
+#define LZX_COMPRESSION_TYPE(Bits) (CAB_COMP_LZX | ((Bits) << 8))
+
+#define LZX_NUM_CHARS           256
+#define LZX_MAX_POSITION_SLOTS  50
+#define LZX_MAX_MAIN_SYMBOLS    (LZX_NUM_CHARS + LZX_MAX_POSITION_SLOTS * 8)
+#define LZX_NUM_LENGTHS         249
+#define LZX_NUM_PRETREE         20
+#define LZX_NUM_ALIGNED         8
+#define LZX_NUM_PRIMARY_LENGTHS 7
+#define LZX_MIN_MATCH           2
+#define LZX_MAX_MATCH           257
+#define LZX_MAX_CODE_LENGTH     16
+
+#define LZX_BLOCKTYPE_VERBATIM      1
+#define LZX_BLOCKTYPE_ALIGNED       2
+#define LZX_BLOCKTYPE_UNCOMPRESSED  3
+
+/* E8 call translation stops after this many frames */
+#define LZX_E8_MAX_FRAMES       32768
+/* Translation size makecab puts in the stream header */
+#define LZX_E8_FILE_SIZE        12000000
+
+/* Match finder */
+#define LZX_HASH_BITS           16
+#define LZX_HASH_SIZE           (1 << LZX_HASH_BITS)
+#define LZX_NIL                 0xFFFFFFFF
+#define LZX_MAX_CHAIN           96      /* Candidates looked at per position */
+#define LZX_NICE_MATCH          128     /* Stop searching at this length */
+#define LZX_LAZY_MATCH          32      /* No lazy evaluation above this length */
+#define LZX_TOO_FAR             4096    /* Three byte matches further away don't pay */
+
+typedef struct _LZX_TOKEN
+{
+    USHORT MainSymbol;
+    USHORT LengthSymbol;        // LZX_NO_LENGTH if the match length fits the main symbol
+    ULONG VerbatimBits;         // Low bits of the match offset
+} LZX_TOKEN, *PLZX_TOKEN;
+
+#define LZX_NO_LENGTH           0xFFFF
+
+typedef struct _LZX_BITSTREAM
+{
+    PUCHAR Start;
+    PUCHAR Current;
+    PUCHAR End;
+    ULONG Buffer;               // Pending bits, most significant first
+    ULONG Bits;                 // Number of pending bits
+} LZX_BITSTREAM, *PLZX_BITSTREAM;
+
+typedef struct _LZX_DECODE_TABLE
+{
+    USHORT Count[LZX_MAX_CODE_LENGTH + 1];      // Number of codes of each length
+    USHORT Symbol[LZX_MAX_MAIN_SYMBOLS];        // Symbols ordered by code
+} LZX_DECODE_TABLE, *PLZX_DECODE_TABLE;
+
+
+/* Classes */
+
+class CLZXCodec : public CCABCodec
+{
+public:
+    /* Default constructor */
+    CLZXCodec();
+    /* Default destructor */
+    virtual ~CLZXCodec();
+    /* Compresses a data block */
+    virtual ULONG Compress(void* OutputBuffer,
+                           void* InputBuffer,
+                           ULONG InputLength,
+                           PULONG OutputLength);
+    /* Uncompresses a data block */
+    virtual ULONG Uncompress(void* OutputBuffer,
+                             void* InputBuffer,
+                             ULONG InputLength,
+                             PULONG OutputLength);
+    /* Restarts the codec at the beginning of a folder */
+    virtual void Reset(USHORT CompressionType);
+    /* LZX data blocks depend on the ones before them */
+    virtual bool IsSolid() { return true; };
+private:
+    bool AllocateEncoder();
+    bool AllocateDecoder();
+    void SlideWindow();
+    ULONG InsertHash(ULONG Position);
+    ULONG FindMatch(ULONG Position, ULONG End, PULONG Distance);
+    void EmitLiteral(UCHAR Literal);
+    void EmitMatch(ULONG Length, ULONG Distance);
+    void WriteLengths(PLZX_BITSTREAM Stream, PUCHAR Lengths, PUCHAR PrevLengths, ULONG Count);
+    void WriteVerbatimBlock(PLZX_BITSTREAM Stream, ULONG Length,
+                            PUCHAR NewMainLengths, PUCHAR NewLengthLengths);
+    void WriteUncompressedBlock(PLZX_BITSTREAM Stream, PUCHAR Data, ULONG Length);
+    bool ReadLengths(PLZX_BITSTREAM Stream, PUCHAR Lengths, ULONG First, ULONG Last);
+    bool ReadBlockHeader(PLZX_BITSTREAM Stream);
+    bool DecodeRun(PLZX_BITSTREAM Stream, ULONG Run, PULONG Produced);
+    /* Format */
+    ULONG WindowBits;
+    ULONG WindowSize;
+    ULONG MainSymbols;          // 256 literals + 8 per position slot
+    ULONG R0, R1, R2;           // Repeated offsets
+    ULONG FrameCount;           // Data blocks since the start of the folder
+    ULONG FramePosition;        // Uncompressed offset of the current data block
+    bool HeaderDone;            // Stream header written or read
+    UCHAR MainLengths[LZX_MAX_MAIN_SYMBOLS];    // Tree lengths of the previous block
+    UCHAR LengthLengths[LZX_NUM_LENGTHS];
+    /* Encoder */
+    PUCHAR Window;              // Twice the window size, slid when full
+    ULONG WindowPosition;       // End of data in Window
+    PULONG HashHead;
+    PULONG HashPrev;            // Indexed by position modulo the window size
+    PLZX_TOKEN Tokens;
+    ULONG TokenCount;
+    ULONG MainFreq[LZX_MAX_MAIN_SYMBOLS];
+    ULONG LengthFreq[LZX_NUM_LENGTHS];
+    /* Decoder */
+    PUCHAR DecodeWindow;        // Ring buffer of the window size
+    ULONG DecodePosition;
+    ULONG E8FileSize;
+    ULONG BlockType;
+    ULONG BlockLength;
+    ULONG BlockRemaining;
+    UCHAR AlignedLengths[LZX_NUM_ALIGNED];
+    LZX_DECODE_TABLE MainTable;
+    LZX_DECODE_TABLE LengthTable;
+    LZX_DECODE_TABLE AlignedTable;
+};
+
+/* EOF */
@@ -14,6 +14,9 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
+#if !defined(_WIN32)
+#include <sys/time.h>
+#endif
 #include "cabman.h"
 
 
@@ -26,6 +29,22 @@ ULONG DebugTraceLevel = MIN_TRACE;
 #endif /* DBG */
 
 
+double GetSeconds()
+/*
+ * FUNCTION: Returns wall clock time in seconds from some fixed point
+ */
+{
+#if defined(_WIN32)
+    return GetTickCount() / 1000.0;
+#else
+    struct timeval Time;
+
+    gettimeofday(&Time, NULL);
+    return Time.tv_sec + Time.tv_usec / 1000000.0;
+#endif
+}
+
+
 char* Pad(char* Str, char PadChar, ULONG Length)
 /*
  * FUNCTION: Pads a string with a character to make a given length
@@ -192,8 +211,8 @@ void CCABManager::Usage()
 {
     printf("ReactOS Cabinet Manager\n\n");
     printf("CABMAN [-D | -E] [-A] [-L dir] cabinet [filename ...]\n");
-    printf("CABMAN [-M mode] -C dirfile [-I] [-RC file] [-P dir]\n");
-    printf("CABMAN [-M mode] -S cabinet filename [...]\n");
+    printf("CABMAN [-M mode] [-T threads] -C dirfile [-I] [-RC file] [-P dir]\n");
+    printf("CABMAN [-M mode] [-T threads] -S cabinet filename [...]\n");
     printf("  cabinet   Cabinet file.\n");
     printf("  filename  Name of the file to add to or extract from the cabinet.\n");
     printf("            Wild cards and multiple filenames\n");
@@ -212,11 +231,14 @@ void CCABManager::Usage()
     printf("  -M mode   Specify the compression method to use:\n");
     printf("               raw    - No compression\n");
     printf("               mszip  - MsZip compression (default)\n");
+    printf("               lzx    - LZX compression (not supported by setup)\n");
     printf("  -N        Don't create the .inf file, only the cabinet.\n");
     printf("  -RC       Specify file to put in cabinet reserved area\n");
     printf("            (size must be less than 64KB).\n");
     printf("  -S        Create simple cabinet.\n");
     printf("  -P dir    Files in the .dff are relative to this directory.\n");
+    printf("  -T count  Number of threads compressing data (default is one\n");
+    printf("            per processor).\n");
     printf("  -V        Verbose mode (prints more messages).\n");
 }
 
@@ -347,6 +369,18 @@ bool CCABManager::ParseCmdline(int argc, char* argv[])
 
                     break;
 
+                case 't':
+                case 'T':
+                    if (argv[i][2] == 0)
+                    {
+                        i++;
+                        SetThreadCount(strtoul(&argv[i][0], NULL, 10));
+                    }
+                    else
+                        SetThreadCount(strtoul(&argv[i][2], NULL, 10));
+
+                    break;
+
                 case 'V':
                     Verbose = true;
                     break;
@@ -555,20 +589,48 @@ bool CCABManager::ExtractFromCabinet()
 }
 
 
+void CCABManager::ShowStatistics(double StartTime)
+/*
+ * FUNCTION: Displays size of the created cabinet and time taken
+ * ARGUMENTS:
+ *     StartTime = Time in seconds when creation started
+ */
+{
+    FILE* File;
+    LONG Size = -1;
+
+    File = fopen(GetCabinetName(), "rb");
+    if (File != NULL)
+    {
+        Size = GetSizeOfFile(File);
+        fclose(File);
+    }
+
+    printf("\nCreated %s: %ld bytes in %.2f seconds\n",
+           GetCabinetName(), (long)Size, GetSeconds() - StartTime);
+}
+
+
 bool CCABManager::Run()
 /*
  * FUNCTION: Process cabinet
  */
 {
+    double StartTime;
+    bool Result;
+
     if (Verbose)
     {
         printf("ReactOS Cabinet Manager\n\n");
     }
 
+    StartTime = GetSeconds();
+
     switch (Mode)
     {
         case CM_MODE_CREATE:
-            return CreateCabinet();
+            Result = CreateCabinet();
+            break;
 
         case CM_MODE_DISPLAY:
             return DisplayCabinet();
@@ -577,12 +639,17 @@ bool CCABManager::Run()
             return ExtractFromCabinet();
 
         case CM_MODE_CREATE_SIMPLE:
-            return CreateSimpleCabinet();
+            Result = CreateSimpleCabinet();
+            break;
 
         default:
-            break;
+            return false;
     }
-    return false;
+
+    if (Result && Verbose)
+        ShowStatistics(StartTime);
+
+    return Result;
 }
 
 
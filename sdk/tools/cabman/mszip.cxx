@@ -75,7 +75,7 @@ ULONG CMSZipCodec::Compress(void* OutputBuffer,
     ZStream.next_in   = (unsigned char*)InputBuffer;
     ZStream.avail_in  = InputLength;
     ZStream.next_out  = ((unsigned char *)OutputBuffer + 2);
-    ZStream.avail_out = CAB_BLOCKSIZE + 12;
+    ZStream.avail_out = CAB_COMPBLOCKSIZE - 2;
 
     /* WindowBits is passed < 0 to tell that there is no zlib header */
     Status = deflateInit2(&ZStream,
@@ -91,7 +91,7 @@ ULONG CMSZipCodec::Compress(void* OutputBuffer,
     }
 
     Status = deflate(&ZStream, Z_FINISH);
-    if ((Status != Z_OK) && (Status != Z_STREAM_END))
+    if (Status != Z_STREAM_END)
     {
         DPRINT(MIN_TRACE, ("deflate() returned (%d) (%s).\n", Status, ZStream.msg));
         if (Status == Z_MEM_ERROR)
@@ -0,0 +1,24 @@
+/*
+ * PROJECT:     ReactOS host tools
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Shared definitions for the host tests of kernel and driver code
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typedefs.h>
+
+/* Test harness: checks count their failures, and the test exits with HostTestFinish */
+static ULONG Failures;
+
+#define ok(cond, ...) \
+    do { if (!(cond)) { printf("%s:%d: Test failed: ", __FILE__, __LINE__); printf(__VA_ARGS__); Failures++; } } while (0)
+
+static inline int HostTestFinish(const char *Name)
+{
+    printf("%s: %lu failures\n", Name, (unsigned long)Failures);
+    return Failures ? 1 : 0;
+}
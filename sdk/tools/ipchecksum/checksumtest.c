@@ -0,0 +1,123 @@
+/*
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Host test of the IP checksum routines against the scalar loop
+ */
+
+#include "precomp.h"
+
+#define BUFFER_SIZE     4096
+
+static UCHAR Source[BUFFER_SIZE + 16];
+static UCHAR Target[BUFFER_SIZE + 16];
+
+/* The UDP checksum as the stack computed it before, in network byte order */
+static ULONG UDPv4ChecksumScalar(
+  PIPv4_HEADER IPHeader,
+  PUCHAR PacketBuffer,
+  ULONG DataLength)
+{
+  ULONG Sum = 0;
+  ULONG i;
+
+  for (i = 0; i + 1 < DataLength; i += 2)
+    Sum += (PacketBuffer[i] << 8) + PacketBuffer[i + 1];
+  if (DataLength & 1)
+    Sum += PacketBuffer[DataLength - 1] << 8;
+
+  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
+    {
+      Sum += (((PUCHAR)&IPHeader->SrcAddr)[i] << 8) + ((PUCHAR)&IPHeader->SrcAddr)[i + 1];
+      Sum += (((PUCHAR)&IPHeader->DstAddr)[i] << 8) + ((PUCHAR)&IPHeader->DstAddr)[i + 1];
+    }
+
+  Sum += IPPROTO_UDP + DataLength;
+
+  return ~ChecksumFold(Sum);
+}
+
+static void TestCompute(void)
+{
+  ULONG Offset, Count, Seed, Expected, Result;
+
+  for (Offset = 0; Offset < 8; Offset++)
+    {
+      for (Count = 0; Count <= 300; Count++)
+        {
+          Seed = Count * 0x10001;
+          Expected = ChecksumFold(ChecksumComputeScalar(Source + Offset, Count, Seed));
+          Result = ChecksumFold(ChecksumCompute(Source + Offset, Count, Seed));
+          ok(Result == Expected, "Offset %u Count %u: 0x%x, expected 0x%x\n",
+             Offset, Count, Result, Expected);
+        }
+
+      Expected = ChecksumFold(ChecksumComputeScalar(Source + Offset, BUFFER_SIZE, 0));
+      Result = ChecksumFold(ChecksumCompute(Source + Offset, BUFFER_SIZE, 0));
+      ok(Result == Expected, "Offset %u: 0x%x, expected 0x%x\n", Offset, Result, Expected);
+    }
+
+  /* A sum of all ones must not lose its carries */
+  memset(Target, 0xFF, BUFFER_SIZE);
+  Result = ChecksumFold(ChecksumCompute(Target, BUFFER_SIZE, 0xFFFFFFFF));
+  Expected = ChecksumFold(ChecksumFold(ChecksumComputeScalar(Target, BUFFER_SIZE, 0)) + 0xFFFF);
+  ok(Result == Expected, "All ones: 0x%x, expected 0x%x\n", Result, Expected);
+}
+
+static void TestCopy(void)
+{
+  ULONG Offset, Count, Expected, Result;
+
+  for (Offset = 0; Offset < 4; Offset++)
+    {
+      for (Count = 0; Count <= 300; Count += (Count < 40) ? 1 : 7)
+        {
+          memset(Target, 0xCC, sizeof(Target));
+          Expected = ChecksumFold(ChecksumComputeScalar(Source + Offset, Count, 5));
+          Result = ChecksumFold(ChecksumCopy(Target + 3 - Offset, Source + Offset, Count, 5));
+          ok(Result == Expected, "Offset %u Count %u: 0x%x, expected 0x%x\n",
+             Offset, Count, Result, Expected);
+          ok(!memcmp(Target + 3 - Offset, Source + Offset, Count),
+             "Offset %u Count %u: data not copied\n", Offset, Count);
+          ok(Target[3 - Offset + Count] == 0xCC,
+             "Offset %u Count %u: copied too much\n", Offset, Count);
+        }
+    }
+}
+
+static void TestUDP(void)
+{
+  IPv4_HEADER Header;
+  ULONG Count, Expected, Result, Sum;
+
+  memset(&Header, 0, sizeof(Header));
+  Header.SrcAddr = 0x0101A8C0;
+  Header.DstAddr = 0x6401A8C0;
+
+  for (Count = 8; Count <= 1500; Count += (Count < 64) ? 1 : 61)
+    {
+      Expected = UDPv4ChecksumScalar(&Header, Source, Count);
+      Result = UDPv4ChecksumCalculate(&Header, Source, Count);
+      ok(Result == Expected, "Count %u: 0x%x, expected 0x%x\n", Count, Result, Expected);
+
+      /* The send path checksums the data while copying it */
+      Sum = ChecksumCopy(Target + 8, Source + 8, Count - 8, 0);
+      Sum = ChecksumCompute(Source, 8, Sum);
+      Result = UDPv4ChecksumFinish(&Header, Count, Sum);
+      ok(Result == Expected, "Count %u: 0x%x, expected 0x%x\n", Count, Result, Expected);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+  ULONG i;
+
+  srand(1071);
+  for (i = 0; i < sizeof(Source); i++)
+    Source[i] = (UCHAR)rand();
+
+  TestCompute();
+  TestCopy();
+  TestUDP();
+
+  return HostTestFinish("checksumtest");
+}
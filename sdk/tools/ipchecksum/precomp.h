@@ -0,0 +1,92 @@
+/*
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Host definitions to build the IP checksum routines
+ */
+
+#pragma once
+
+#include "../hosttest.h"
+
+#ifndef UNALIGNED
+#define UNALIGNED
+#endif
+
+#define IPPROTO_UDP 17
+
+/* Hosts we build on are little endian, like the targets */
+#define DH2N(dw) \
+    ((((dw) & 0xFF000000L) >> 24) | \
+     (((dw) & 0x00FF0000L) >> 8) | \
+     (((dw) & 0x0000FF00L) << 8) | \
+     (((dw) & 0x000000FFL) << 24))
+#define WN2H(w) \
+    ((((w) & 0xFF00) >> 8) | \
+     (((w) & 0x00FF) << 8))
+#define WH2N(w) \
+    ((((w) & 0xFF00) >> 8) | \
+     (((w) & 0x00FF) << 8))
+
+typedef ULONG IPv4_RAW_ADDRESS;
+
+typedef struct IPv4_HEADER {
+    UCHAR VerIHL;
+    UCHAR Tos;
+    USHORT TotalLength;
+    USHORT Id;
+    USHORT FlagsFragOfs;
+    UCHAR Ttl;
+    UCHAR Protocol;
+    USHORT Checksum;
+    IPv4_RAW_ADDRESS SrcAddr;
+    IPv4_RAW_ADDRESS DstAddr;
+} IPv4_HEADER, *PIPv4_HEADER;
+
+ULONG ChecksumFold(
+  ULONG Sum);
+
+ULONG ChecksumCompute(
+    PVOID Data,
+    UINT Count,
+    ULONG Seed);
+
+ULONG ChecksumCopy(
+    PVOID Destination,
+    PVOID Source,
+    UINT Count,
+    ULONG Seed);
+
+ULONG
+UDPv4ChecksumFinish(
+  PIPv4_HEADER IPHeader,
+  ULONG DataLength,
+  ULONG Sum);
+
+ULONG
+UDPv4ChecksumCalculate(
+  PIPv4_HEADER IPHeader,
+  PUCHAR PacketBuffer,
+  ULONG DataLength);
+
+/* The RFC 1071 loop the stack used before, one word at a time */
+static inline ULONG ChecksumComputeScalar(
+  PVOID Data,
+  UINT Count,
+  ULONG Seed)
+{
+  ULONG Sum = Seed;
+
+  while (Count > 1)
+    {
+      Sum += *(PUSHORT)Data;
+      Count -= 2;
+      Data = (PVOID)((ULONG_PTR) Data + 2);
+    }
+
+  if (Count > 0)
+    {
+      Sum += *(PUCHAR)Data;
+    }
+
+  return Sum;
+}
@@ -0,0 +1,94 @@
+/*
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Host definitions to build the IP routing subsystem
+ */
+
+#pragma once
+
+#include "../hosttest.h"
+
+/* Kernel definitions. The harness is single threaded, so nothing here needs to be atomic */
+typedef LONGLONG *PLONGLONG;
+typedef UCHAR KIRQL, *PKIRQL;
+typedef ULONG_PTR KSPIN_LOCK, *PKSPIN_LOCK;
+typedef struct _FAST_MUTEX { LONG Count; } FAST_MUTEX, *PFAST_MUTEX;
+typedef PVOID PNDIS_PACKET;
+typedef INT NDIS_STATUS;
+typedef struct IPARP_ENTRY *PIPARP_ENTRY;
+
+#define STATUS_SUCCESS          ((NTSTATUS)0x00000000)
+#define STATUS_UNSUCCESSFUL     ((NTSTATUS)0xC0000001)
+
+#define PASSIVE_LEVEL   0
+#define DISPATCH_LEVEL  2
+
+#define NonPagedPool    0
+
+#undef ASSERT
+#define ASSERT(x) \
+    do { if (!(x)) { printf("%s:%d: Assertion failed: %s\n", __FILE__, __LINE__, #x); abort(); } } while (0)
+
+#define ExAllocatePoolWithTag(Type, Size, Tag)  malloc(Size)
+#define ExFreePoolWithTag(Object, Tag)          free(Object)
+
+#define YieldProcessor()
+
+static inline LONG InterlockedIncrement(volatile LONG *Addend) { return ++*Addend; }
+static inline LONG InterlockedDecrement(volatile LONG *Addend) { return --*Addend; }
+
+static inline LONG InterlockedExchange(volatile LONG *Target, LONG Value)
+{
+    LONG Old = *Target;
+    *Target = Value;
+    return Old;
+}
+
+static inline PVOID InterlockedExchangePointer(PVOID volatile *Target, PVOID Value)
+{
+    PVOID Old = *Target;
+    *Target = Value;
+    return Old;
+}
+
+static inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG *Destination,
+                                                    LONGLONG Exchange,
+                                                    LONGLONG Comparand)
+{
+    LONGLONG Old = *Destination;
+    if (Old == Comparand)
+        *Destination = Exchange;
+    return Old;
+}
+
+/* Driver definitions */
+#define TI_DbgPrint(Level, Args) do { } while (0)
+
+typedef VOID (*OBJECT_FREE_ROUTINE)(PVOID Object);
+
+typedef ULONG IPv4_RAW_ADDRESS;
+typedef UCHAR IPv6_RAW_ADDRESS[16];
+
+typedef struct IP_ADDRESS {
+    UCHAR Type;
+    union {
+        IPv4_RAW_ADDRESS IPv4Address;
+        IPv6_RAW_ADDRESS IPv6Address;
+    } Address;
+} IP_ADDRESS, *PIP_ADDRESS;
+
+#define IP_ADDRESS_V4   0x04
+#define IP_ADDRESS_V6   0x06
+
+typedef struct _IP_INTERFACE {
+    UINT MTU;
+} IP_INTERFACE, *PIP_INTERFACE;
+
+#include <lock.h>
+#include <tags.h>
+#include <router.h>
+
+ULONG IPv4NToHl(ULONG Address);
+UINT AddrCountPrefixBits(PIP_ADDRESS Netmask);
+BOOLEAN AddrIsEqual(PIP_ADDRESS Address1, PIP_ADDRESS Address2);
+PIP_INTERFACE FindOnLinkInterface(PIP_ADDRESS Address);
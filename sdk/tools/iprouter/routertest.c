@@ -0,0 +1,237 @@
+/*
+ * PROJECT:     ReactOS TCP/IP protocol driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Host test of the IPv4 FIB table against the expected routes
+ */
+
+#include "precomp.h"
+
+/* The FIB table routines are static, so build the routing subsystem here */
+#include "../../lib/drivers/ip/network/router.c"
+
+static NEIGHBOR_CACHE_ENTRY Routers[4];
+static IP_INTERFACE Interface;
+
+/* Hosts we build on are little endian, like the targets */
+ULONG IPv4NToHl(ULONG Address)
+{
+    return ((Address & 0xFF000000) >> 24) | ((Address & 0x00FF0000) >> 8) |
+           ((Address & 0x0000FF00) << 8) | ((Address & 0x000000FF) << 24);
+}
+
+UINT AddrCountPrefixBits(PIP_ADDRESS Netmask)
+{
+    ULONG Mask = IPv4NToHl(Netmask->Address.IPv4Address);
+    UINT Prefix = 0;
+
+    while (Prefix < 32 && (Mask & (0x80000000 >> Prefix)))
+        Prefix++;
+
+    return Prefix;
+}
+
+BOOLEAN AddrIsEqual(PIP_ADDRESS Address1, PIP_ADDRESS Address2)
+{
+    return Address1->Type == Address2->Type &&
+           !memcmp(&Address1->Address, &Address2->Address,
+                   Address1->Type == IP_ADDRESS_V4 ? sizeof(IPv4_RAW_ADDRESS) : sizeof(IPv6_RAW_ADDRESS));
+}
+
+PIP_INTERFACE FindOnLinkInterface(PIP_ADDRESS Address)
+{
+    return NULL;
+}
+
+PNEIGHBOR_CACHE_ENTRY NBFindOrCreateNeighbor(PIP_INTERFACE Interface, PIP_ADDRESS Address, BOOLEAN NoTimeout)
+{
+    return NULL;
+}
+
+static IPv4_RAW_ADDRESS Ipv4(UCHAR A, UCHAR B, UCHAR C, UCHAR D)
+{
+    return A | (B << 8) | (C << 16) | ((ULONG)D << 24);
+}
+
+static IP_ADDRESS Address(IPv4_RAW_ADDRESS Raw)
+{
+    IP_ADDRESS Result;
+
+    memset(&Result, 0, sizeof(Result));
+    Result.Type = IP_ADDRESS_V4;
+    Result.Address.IPv4Address = Raw;
+    return Result;
+}
+
+static VOID AddRoute(IPv4_RAW_ADDRESS Network, UINT PrefixLength, ULONG Router, UINT Metric)
+{
+    IP_ADDRESS NetworkAddress = Address(Network);
+    IP_ADDRESS Netmask = Address(IPv4NToHl(PrefixLength ? 0xFFFFFFFF << (32 - PrefixLength) : 0));
+
+    ok(RouterAddRoute(&NetworkAddress, &Netmask, &Routers[Router], Metric) != NULL,
+       "Route to %x/%u not added\n", Network, PrefixLength);
+}
+
+static PNEIGHBOR_CACHE_ENTRY GetRoute(IPv4_RAW_ADDRESS Destination)
+{
+    IP_ADDRESS DestinationAddress = Address(Destination);
+
+    return RouterGetRoute(&DestinationAddress);
+}
+
+static VOID ResetRoutes(VOID)
+{
+    ULONG i;
+
+    RouterShutdown();
+    RouterStartup();
+
+    for (i = 0; i < sizeof(Routers) / sizeof(Routers[0]); i++) {
+        memset(&Routers[i], 0, sizeof(Routers[i]));
+        Routers[i].Interface = &Interface;
+        Routers[i].Address = Address(Ipv4(192, 168, 0, (UCHAR)(i + 1)));
+    }
+}
+
+/* Both the table and the FIB list walk must pick Expected */
+static VOID CheckRoute(IPv4_RAW_ADDRESS Destination, PNEIGHBOR_CACHE_ENTRY Expected)
+{
+    PFIB_TABLE Table;
+    PNEIGHBOR_CACHE_ENTRY NCE;
+
+    Table = RouterBuildFIBTable();
+    ok(Table != NULL, "No FIB table\n");
+    if (!Table)
+        return;
+
+    NCE = RouterLookupFIBTable(Table, Destination);
+    ok(NCE == Expected, "%08x: table gave router %d, expected %d\n", IPv4NToHl(Destination),
+       NCE ? (int)(NCE - Routers) : -1, Expected ? (int)(Expected - Routers) : -1);
+    ExFreePoolWithTag(Table, FIB_TABLE_TAG);
+
+    NCE = GetRoute(Destination);
+    ok(NCE == Expected, "%08x: RouterGetRoute gave router %d, expected %d\n", IPv4NToHl(Destination),
+       NCE ? (int)(NCE - Routers) : -1, Expected ? (int)(Expected - Routers) : -1);
+
+    /* Without a table the transmit path walks the list, with the same rules */
+    Table = FIBTable;
+    FIBTable = NULL;
+    NCE = GetRoute(Destination);
+    FIBTable = Table;
+    ok(NCE == Expected, "%08x: FIB list gave router %d, expected %d\n", IPv4NToHl(Destination),
+       NCE ? (int)(NCE - Routers) : -1, Expected ? (int)(Expected - Routers) : -1);
+}
+
+static VOID TestLongestPrefix(VOID)
+{
+    ResetRoutes();
+
+    CheckRoute(Ipv4(10, 1, 2, 3), NULL);
+
+    AddRoute(Ipv4(10, 0, 0, 0), 8, 0, 1);
+    AddRoute(Ipv4(10, 1, 2, 0), 24, 2, 1);
+    AddRoute(Ipv4(10, 1, 0, 0), 16, 1, 1);
+    AddRoute(Ipv4(10, 1, 2, 128), 32, 3, 1);
+
+    CheckRoute(Ipv4(10, 1, 2, 128), &Routers[3]);
+    CheckRoute(Ipv4(10, 1, 2, 129), &Routers[2]);
+    CheckRoute(Ipv4(10, 1, 2, 3), &Routers[2]);
+    CheckRoute(Ipv4(10, 1, 3, 3), &Routers[1]);
+    CheckRoute(Ipv4(10, 200, 3, 3), &Routers[0]);
+    CheckRoute(Ipv4(11, 1, 2, 3), NULL);
+}
+
+static VOID TestMetric(VOID)
+{
+    ResetRoutes();
+
+    AddRoute(Ipv4(172, 16, 0, 0), 12, 0, 20);
+    AddRoute(Ipv4(172, 16, 0, 0), 12, 1, 10);
+    AddRoute(Ipv4(172, 16, 0, 0), 12, 2, 10);
+    AddRoute(Ipv4(172, 16, 0, 0), 12, 3, 30);
+
+    /* The cheapest route wins, and the first one added among equals */
+    CheckRoute(Ipv4(172, 20, 1, 1), &Routers[1]);
+
+    /* A router that can't be used hands over to the next cheapest */
+    Routers[1].State = NUD_STALE;
+    CheckRoute(Ipv4(172, 20, 1, 1), &Routers[2]);
+    Routers[2].State = NUD_INCOMPLETE;
+    CheckRoute(Ipv4(172, 20, 1, 1), &Routers[0]);
+}
+
+static VOID TestDefaultRoute(VOID)
+{
+    ResetRoutes();
+
+    AddRoute(Ipv4(0, 0, 0, 0), 0, 0, 1);
+    AddRoute(Ipv4(192, 168, 1, 0), 24, 1, 1);
+    AddRoute(Ipv4(192, 168, 1, 0), 24, 2, 2);
+
+    CheckRoute(Ipv4(192, 168, 1, 7), &Routers[1]);
+    CheckRoute(Ipv4(8, 8, 8, 8), &Routers[0]);
+    CheckRoute(Ipv4(192, 168, 2, 7), &Routers[0]);
+
+    /* A prefix with no usable router falls back to the default route */
+    Routers[1].State = NUD_STALE;
+    Routers[2].State = NUD_STALE;
+    CheckRoute(Ipv4(192, 168, 1, 7), &Routers[0]);
+
+    /* With no usable router anywhere, the longest prefix still gets the packet */
+    Routers[0].State = NUD_STALE;
+    CheckRoute(Ipv4(192, 168, 1, 7), &Routers[1]);
+    CheckRoute(Ipv4(8, 8, 8, 8), &Routers[0]);
+}
+
+static VOID TestCache(VOID)
+{
+    IPv4_RAW_ADDRESS Destination = Ipv4(10, 1, 2, 3);
+    PFIB_TABLE Table;
+    PLONGLONG Slot;
+    ULONG Child[2];
+
+    ResetRoutes();
+
+    AddRoute(Ipv4(10, 0, 0, 0), 8, 0, 1);
+    AddRoute(Ipv4(10, 1, 0, 0), 16, 1, 1);
+
+    Table = RouterBuildFIBTable();
+    ok(Table != NULL, "No FIB table\n");
+    if (!Table)
+        return;
+    RouterReplaceFIBTable(Table);
+    ok(FIBTable == Table, "Table not published\n");
+
+    /* A new table starts with an empty cache */
+    Slot = &Table->Cache[FIB_CACHE_HASH(Destination)];
+    ok(*Slot == 0, "Cache slot is %llx\n", (unsigned long long)*Slot);
+
+    ok(GetRoute(Destination) == &Routers[1], "Wrong router\n");
+    ok((ULONG)*Slot == Destination, "Cache slot is %llx\n", (unsigned long long)*Slot);
+    ok((ULONG)((ULONGLONG)*Slot >> 32) != 0, "Cache slot is %llx\n", (unsigned long long)*Slot);
+
+    /* Cut the trie off the root: only the cache can find the route now */
+    memcpy(Child, Table->Nodes[0].Child, sizeof(Child));
+    memset(Table->Nodes[0].Child, 0, sizeof(Child));
+    ok(GetRoute(Destination) == &Routers[1], "Cache miss\n");
+    ok(GetRoute(Ipv4(10, 1, 2, 4)) == NULL, "Trie still reachable\n");
+    memcpy(Table->Nodes[0].Child, Child, sizeof(Child));
+
+    /* The cache doesn't outlive a FIB change */
+    AddRoute(Ipv4(10, 1, 2, 0), 24, 2, 1);
+    ok(FIBTable != Table, "Table not replaced\n");
+    ok(GetRoute(Destination) == &Routers[2], "Stale cache entry used\n");
+}
+
+int main(int argc, char *argv[])
+{
+    RouterStartup();
+
+    TestLongestPrefix();
+    TestMetric();
+    TestDefaultRoute();
+    TestCache();
+
+    RouterShutdown();
+
+    return HostTestFinish("routertest");
+}
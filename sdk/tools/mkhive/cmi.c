@@ -288,6 +288,31 @@ CmiCreateSubKey(
     return STATUS_SUCCESS;
 }
 
+static VOID
+CmiFreeSubKey(
+    IN PCMHIVE RegistryHive,
+    IN HCELL_INDEX NKBOffset)
+{
+    PCM_KEY_NODE KeyCell;
+
+    /* Drop the security reference inherited from the parent */
+    KeyCell = (PCM_KEY_NODE)HvGetCell(&RegistryHive->Hive, NKBOffset);
+    if (KeyCell)
+    {
+        if (KeyCell->Security != HCELL_NIL)
+        {
+            PCM_KEY_SECURITY Security;
+            Security = (PCM_KEY_SECURITY)HvGetCell(&RegistryHive->Hive, KeyCell->Security);
+            --Security->ReferenceCount;
+            HvReleaseCell(&RegistryHive->Hive, KeyCell->Security);
+        }
+        HvReleaseCell(&RegistryHive->Hive, NKBOffset);
+    }
+
+    /* The name is stored in the key node itself, and new keys have no class */
+    HvFreeCell(&RegistryHive->Hive, NKBOffset);
+}
+
 NTSTATUS
 CmiAddSubKey(
     IN PCMHIVE RegistryHive,
@@ -339,6 +364,66 @@ CmiAddSubKey(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+CmiAddSubKeys(
+    IN PCMHIVE RegistryHive,
+    IN HCELL_INDEX ParentKeyCellOffset,
+    IN ULONG Count,
+    IN PCUNICODE_STRING SubKeyNames,
+    IN BOOLEAN VolatileKey,
+    OUT HCELL_INDEX *pBlockOffsets)
+{
+    PCM_KEY_NODE ParentKeyCell;
+    USHORT MaxNameLen = 0;
+    NTSTATUS Status;
+    ULONG i;
+
+    /* Create all the new keys first */
+    for (i = 0; i < Count; i++)
+    {
+        Status = CmiCreateSubKey(RegistryHive, ParentKeyCellOffset, &SubKeyNames[i],
+                                 VolatileKey, &pBlockOffsets[i]);
+        if (!NT_SUCCESS(Status))
+        {
+            /* Delete the keys created so far */
+            while (i--) CmiFreeSubKey(RegistryHive, pBlockOffsets[i]);
+            return Status;
+        }
+
+        if (MaxNameLen < SubKeyNames[i].Length)
+            MaxNameLen = SubKeyNames[i].Length;
+    }
+
+    /* Mark the parent cell as dirty */
+    HvMarkCellDirty(&RegistryHive->Hive, ParentKeyCellOffset, FALSE);
+
+    /* And link them into the parent index in one go */
+    if (!CmpAddSubKeys(&RegistryHive->Hive, ParentKeyCellOffset, pBlockOffsets, Count))
+    {
+        /* None of them got linked, delete them all */
+        for (i = 0; i < Count; i++) CmiFreeSubKey(RegistryHive, pBlockOffsets[i]);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    /* Get the parent node */
+    ParentKeyCell = (PCM_KEY_NODE)HvGetCell(&RegistryHive->Hive, ParentKeyCellOffset);
+    if (!ParentKeyCell)
+        return STATUS_UNSUCCESSFUL;
+    VERIFY_KEY_CELL(ParentKeyCell);
+
+    /* Update the timestamp */
+    KeQuerySystemTime(&ParentKeyCell->LastWriteTime);
+
+    /* Check if we need to update name maximum, update it if so */
+    if (ParentKeyCell->MaxNameLen < MaxNameLen)
+        ParentKeyCell->MaxNameLen = MaxNameLen;
+
+    /* Release the cell */
+    HvReleaseCell(&RegistryHive->Hive, ParentKeyCellOffset);
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 CmiAddValueKey(
     IN PCMHIVE RegistryHive,
@@ -46,6 +46,15 @@ CmiAddSubKey(
     IN BOOLEAN VolatileKey,
     OUT HCELL_INDEX *pBlockOffset);
 
+NTSTATUS
+CmiAddSubKeys(
+    IN PCMHIVE RegistryHive,
+    IN HCELL_INDEX ParentKeyCellOffset,
+    IN ULONG Count,
+    IN PCUNICODE_STRING SubKeyNames,
+    IN BOOLEAN VolatileKey,
+    OUT HCELL_INDEX *pBlockOffsets);
+
 NTSTATUS
 CmiAddValueKey(
     IN PCMHIVE RegistryHive,
@@ -0,0 +1,311 @@
+/*
+ * PROJECT:     ReactOS hive maker
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Host benchmark for the cmlib cell allocator: builds a large,
+ *              fragmented hive, then times loading it and allocating cells
+ */
+
+#include <string.h>
+#include <time.h>
+
+/* gcc defaults to cdecl */
+#if defined(__GNUC__)
+#undef __cdecl
+#define __cdecl
+#endif
+
+#include "mkhive.h"
+
+#define DEFAULT_CELL_COUNT  200000
+#define LOAD_ROUNDS         5
+#define ALLOC_ROUNDS        5
+#define ALLOC_COUNT         100000
+
+typedef struct _BENCH_HIVE
+{
+    HHIVE Hive;
+    FILE *File;
+} BENCH_HIVE, *PBENCH_HIVE;
+
+static const char *FileName;
+static HCELL_INDEX *Cells;
+static ULONG Seed = 1;
+
+PVOID
+NTAPI
+CmpAllocate(
+    IN SIZE_T Size,
+    IN BOOLEAN Paged,
+    IN ULONG Tag)
+{
+    return (PVOID)malloc((size_t)Size);
+}
+
+VOID
+NTAPI
+CmpFree(
+    IN PVOID Ptr,
+    IN ULONG Quota)
+{
+    free(Ptr);
+}
+
+static BOOLEAN
+NTAPI
+BenchFileRead(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    IN PULONG FileOffset,
+    OUT PVOID Buffer,
+    IN SIZE_T BufferLength)
+{
+    FILE *File = ((PBENCH_HIVE)RegistryHive)->File;
+    if (fseek(File, *FileOffset, SEEK_SET) != 0)
+        return FALSE;
+
+    return (fread(Buffer, 1, BufferLength, File) == BufferLength);
+}
+
+static BOOLEAN
+NTAPI
+BenchFileWrite(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    IN PULONG FileOffset,
+    IN PVOID Buffer,
+    IN SIZE_T BufferLength)
+{
+    FILE *File = ((PBENCH_HIVE)RegistryHive)->File;
+    if (fseek(File, *FileOffset, SEEK_SET) != 0)
+        return FALSE;
+
+    return (fwrite(Buffer, 1, BufferLength, File) == BufferLength);
+}
+
+static BOOLEAN
+NTAPI
+BenchFileSetSize(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    IN ULONG FileSize,
+    IN ULONG OldFileSize)
+{
+    return TRUE;
+}
+
+static BOOLEAN
+NTAPI
+BenchFileFlush(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    PLARGE_INTEGER FileOffset,
+    ULONG Length)
+{
+    FILE *File = ((PBENCH_HIVE)RegistryHive)->File;
+    return (fflush(File) == 0);
+}
+
+static ULONG
+Random(VOID)
+{
+    Seed = Seed * 1103515245 + 12345;
+    return (Seed >> 16) & 0x7FFF;
+}
+
+/* Mostly key-sized cells, with now and then a big value */
+static ULONG
+RandomCellSize(VOID)
+{
+    if (Random() % 16 == 0)
+        return 1024 + Random() % 3072;
+
+    return 8 + Random() % 256;
+}
+
+static double
+Milliseconds(
+    IN clock_t Start)
+{
+    return (double)(clock() - Start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static NTSTATUS
+OpenHive(
+    OUT PBENCH_HIVE BenchHive,
+    IN ULONG Operation)
+{
+    NTSTATUS Status;
+
+    RtlZeroMemory(BenchHive, sizeof(*BenchHive));
+    BenchHive->File = fopen(FileName, (Operation == HINIT_CREATE) ? "w+b" : "r+b");
+    if (!BenchHive->File)
+    {
+        printf("Cannot open %s\n", FileName);
+        exit(2);
+    }
+
+    Status = HvInitialize(&BenchHive->Hive,
+                          Operation,
+                          0,
+                          HFILE_TYPE_PRIMARY,
+                          NULL,
+                          CmpAllocate,
+                          CmpFree,
+                          BenchFileSetSize,
+                          BenchFileWrite,
+                          BenchFileRead,
+                          BenchFileFlush,
+                          1,
+                          NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Cannot %s the hive: 0x%lx\n",
+               (Operation == HINIT_CREATE) ? "create" : "load", (unsigned long)Status);
+        exit(2);
+    }
+
+    return Status;
+}
+
+static VOID
+CloseHive(
+    IN PBENCH_HIVE BenchHive)
+{
+    HvFree(&BenchHive->Hive);
+    fclose(BenchHive->File);
+}
+
+/* Builds a hive of CellCount cells and frees a third of them to fragment it */
+static VOID
+CreateBenchHive(
+    IN ULONG CellCount)
+{
+    BENCH_HIVE BenchHive;
+    ULONG Index;
+
+    OpenHive(&BenchHive, HINIT_CREATE);
+
+    /* Loading the hive needs a root key */
+    if (!CmCreateRootNode(&BenchHive.Hive, L"HiveBench"))
+    {
+        printf("Cannot create the root key\n");
+        exit(2);
+    }
+
+    for (Index = 0; Index < CellCount; Index++)
+    {
+        Cells[Index] = HvAllocateCell(&BenchHive.Hive, RandomCellSize(), Stable, HCELL_NIL);
+        if (Cells[Index] == HCELL_NIL)
+        {
+            printf("Cannot allocate cell %lu\n", (unsigned long)Index);
+            exit(2);
+        }
+    }
+
+    for (Index = 0; Index < CellCount; Index += 3)
+        HvFreeCell(&BenchHive.Hive, Cells[Index]);
+
+    if (!HvSyncHive(&BenchHive.Hive))
+    {
+        printf("Cannot write the hive\n");
+        exit(2);
+    }
+
+    printf("Hive: %lu cells, %lu KB\n",
+           (unsigned long)CellCount,
+           (unsigned long)(BenchHive.Hive.Storage[Stable].Length * (HBLOCK_SIZE / 1024)));
+    CloseHive(&BenchHive);
+}
+
+static VOID
+BenchLoad(VOID)
+{
+    BENCH_HIVE BenchHive;
+    clock_t Start;
+    double Total = 0.0;
+    ULONG Round;
+
+    for (Round = 0; Round < LOAD_ROUNDS; Round++)
+    {
+        Start = clock();
+        OpenHive(&BenchHive, HINIT_FILE);
+        Total += Milliseconds(Start);
+        CloseHive(&BenchHive);
+    }
+
+    printf("Load: %.2f ms\n", Total / LOAD_ROUNDS);
+}
+
+static VOID
+BenchAllocate(VOID)
+{
+    BENCH_HIVE BenchHive;
+    clock_t Start;
+    double Total = 0.0;
+    ULONG Round, Index, Length;
+
+    OpenHive(&BenchHive, HINIT_FILE);
+    Length = BenchHive.Hive.Storage[Stable].Length;
+
+    for (Round = 0; Round < ALLOC_ROUNDS; Round++)
+    {
+        Start = clock();
+
+        for (Index = 0; Index < ALLOC_COUNT; Index++)
+        {
+            Cells[Index] = HvAllocateCell(&BenchHive.Hive, RandomCellSize(), Stable, HCELL_NIL);
+            if (Cells[Index] == HCELL_NIL)
+            {
+                printf("Cannot allocate cell %lu\n", (unsigned long)Index);
+                exit(2);
+            }
+        }
+
+        /* Free them out of order, so that they merge in all directions */
+        for (Index = 0; Index < ALLOC_COUNT; Index += 2)
+            HvFreeCell(&BenchHive.Hive, Cells[Index]);
+        for (Index = 1; Index < ALLOC_COUNT; Index += 2)
+            HvFreeCell(&BenchHive.Hive, Cells[Index]);
+
+        Total += Milliseconds(Start);
+    }
+
+    printf("Allocate/free: %.0f cells/s, hive grew by %lu KB\n",
+           (Total > 0.0) ? (double)ALLOC_ROUNDS * ALLOC_COUNT * 1000.0 / Total : 0.0,
+           (unsigned long)((BenchHive.Hive.Storage[Stable].Length - Length) * (HBLOCK_SIZE / 1024)));
+    CloseHive(&BenchHive);
+}
+
+int main(int argc, char *argv[])
+{
+    ULONG CellCount = DEFAULT_CELL_COUNT;
+
+    if (argc < 2 || argc > 3)
+    {
+        printf("Usage: hivebench <scratch hive file> [cell count]\n");
+        return 2;
+    }
+
+    FileName = argv[1];
+    if (argc == 3)
+        CellCount = strtoul(argv[2], NULL, 0);
+    if (CellCount < ALLOC_COUNT)
+        CellCount = ALLOC_COUNT;
+
+    Cells = malloc(CellCount * sizeof(HCELL_INDEX));
+    if (!Cells)
+    {
+        printf("Out of memory\n");
+        return 2;
+    }
+
+    CreateBenchHive(CellCount);
+    BenchLoad();
+    BenchAllocate();
+
+    remove(FileName);
+    free(Cells);
+    return 0;
+}
+
+/* EOF */
@@ -0,0 +1,370 @@
+/*
+ * PROJECT:     ReactOS hive maker
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Host test for the hive log: crashes in the middle of flushes
+ *              and checks that loading the hive replays the log
+ */
+
+#include <string.h>
+
+/* gcc defaults to cdecl */
+#if defined(__GNUC__)
+#undef __cdecl
+#define __cdecl
+#endif
+
+#include "mkhive.h"
+#include "../hosttest.h"
+
+#define CELL_COUNT      48
+#define CELL_SIZE       6000
+
+typedef struct _TEST_HIVE
+{
+    HHIVE Hive;
+    FILE *Files[HFILE_TYPE_MAX];
+} TEST_HIVE, *PTEST_HIVE;
+
+static const char *FileNames[HFILE_TYPE_MAX];
+static HCELL_INDEX Cells[CELL_COUNT];
+static UCHAR Expected[CELL_COUNT];
+
+/* Number of writes that still reach each file, the rest is lost in the crash */
+static ULONG WritesLeft[HFILE_TYPE_MAX];
+static ULONG WriteCount[HFILE_TYPE_MAX];
+
+PVOID
+NTAPI
+CmpAllocate(
+    IN SIZE_T Size,
+    IN BOOLEAN Paged,
+    IN ULONG Tag)
+{
+    return (PVOID)malloc((size_t)Size);
+}
+
+VOID
+NTAPI
+CmpFree(
+    IN PVOID Ptr,
+    IN ULONG Quota)
+{
+    free(Ptr);
+}
+
+static BOOLEAN
+NTAPI
+TestFileRead(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    IN PULONG FileOffset,
+    OUT PVOID Buffer,
+    IN SIZE_T BufferLength)
+{
+    FILE *File = ((PTEST_HIVE)RegistryHive)->Files[FileType];
+    if (fseek(File, *FileOffset, SEEK_SET) != 0)
+        return FALSE;
+
+    return (fread(Buffer, 1, BufferLength, File) == BufferLength);
+}
+
+static BOOLEAN
+NTAPI
+TestFileWrite(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    IN PULONG FileOffset,
+    IN PVOID Buffer,
+    IN SIZE_T BufferLength)
+{
+    FILE *File = ((PTEST_HIVE)RegistryHive)->Files[FileType];
+
+    /* Simulate the crash */
+    if (WritesLeft[FileType] == 0)
+        return FALSE;
+    WritesLeft[FileType]--;
+    WriteCount[FileType]++;
+
+    if (fseek(File, *FileOffset, SEEK_SET) != 0)
+        return FALSE;
+
+    return (fwrite(Buffer, 1, BufferLength, File) == BufferLength);
+}
+
+static BOOLEAN
+NTAPI
+TestFileSetSize(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    IN ULONG FileSize,
+    IN ULONG OldFileSize)
+{
+    return TRUE;
+}
+
+static BOOLEAN
+NTAPI
+TestFileFlush(
+    IN PHHIVE RegistryHive,
+    IN ULONG FileType,
+    PLARGE_INTEGER FileOffset,
+    ULONG Length)
+{
+    FILE *File = ((PTEST_HIVE)RegistryHive)->Files[FileType];
+    return (fflush(File) == 0);
+}
+
+static VOID
+AllowWrites(
+    IN ULONG LogWrites,
+    IN ULONG PrimaryWrites)
+{
+    WritesLeft[HFILE_TYPE_PRIMARY] = PrimaryWrites;
+    WritesLeft[HFILE_TYPE_LOG] = LogWrites;
+    RtlZeroMemory(WriteCount, sizeof(WriteCount));
+}
+
+static NTSTATUS
+OpenHive(
+    OUT PTEST_HIVE TestHive,
+    IN ULONG Operation)
+{
+    NTSTATUS Status;
+    ULONG FileType;
+
+    RtlZeroMemory(TestHive, sizeof(*TestHive));
+    for (FileType = HFILE_TYPE_PRIMARY; FileType <= HFILE_TYPE_LOG; FileType++)
+    {
+        TestHive->Files[FileType] = fopen(FileNames[FileType],
+                                          (Operation == HINIT_CREATE) ? "w+b" : "r+b");
+        if (!TestHive->Files[FileType])
+        {
+            printf("Cannot open %s\n", FileNames[FileType]);
+            exit(2);
+        }
+    }
+
+    Status = HvInitialize(&TestHive->Hive,
+                          Operation,
+                          0,
+                          HFILE_TYPE_LOG,
+                          NULL,
+                          CmpAllocate,
+                          CmpFree,
+                          TestFileSetSize,
+                          TestFileWrite,
+                          TestFileRead,
+                          TestFileFlush,
+                          1,
+                          NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        fclose(TestHive->Files[HFILE_TYPE_PRIMARY]);
+        fclose(TestHive->Files[HFILE_TYPE_LOG]);
+    }
+
+    return Status;
+}
+
+static VOID
+CloseHive(
+    IN PTEST_HIVE TestHive)
+{
+    HvFree(&TestHive->Hive);
+    fclose(TestHive->Files[HFILE_TYPE_PRIMARY]);
+    fclose(TestHive->Files[HFILE_TYPE_LOG]);
+}
+
+static VOID
+FillCell(
+    IN PHHIVE Hive,
+    IN ULONG Index,
+    IN UCHAR Pattern)
+{
+    memset(HvGetCell(Hive, Cells[Index]), Pattern, CELL_SIZE);
+    HvMarkCellDirty(Hive, Cells[Index], FALSE);
+}
+
+static ULONG
+CheckCells(
+    IN PHHIVE Hive,
+    IN const UCHAR *Patterns)
+{
+    PUCHAR Data;
+    ULONG Index, i, Bad = 0;
+
+    for (Index = 0; Index < CELL_COUNT; Index++)
+    {
+        Data = HvGetCell(Hive, Cells[Index]);
+        for (i = 0; i < CELL_SIZE; i++)
+        {
+            if (Data[i] != Patterns[Index])
+            {
+                Bad++;
+                break;
+            }
+        }
+    }
+
+    return Bad;
+}
+
+/* Opens the hive the way it was left on disk and checks what survived */
+static VOID
+Reload(
+    IN NTSTATUS ExpectedStatus,
+    IN const UCHAR *Patterns,
+    IN const char *Test)
+{
+    TEST_HIVE TestHive;
+    NTSTATUS Status;
+
+    AllowWrites(MAXULONG, MAXULONG);
+    Status = OpenHive(&TestHive, HINIT_FILE);
+    ok(Status == ExpectedStatus, "%s: loading returned 0x%lx, expected 0x%lx\n",
+       Test, (unsigned long)Status, (unsigned long)ExpectedStatus);
+    if (!NT_SUCCESS(Status)) return;
+
+    ok(CheckCells(&TestHive.Hive, Patterns) == 0, "%s: cells don't have the expected contents\n", Test);
+    CloseHive(&TestHive);
+}
+
+static VOID
+CreateTestHive(VOID)
+{
+    TEST_HIVE TestHive;
+    NTSTATUS Status;
+    ULONG Index;
+
+    Status = OpenHive(&TestHive, HINIT_CREATE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Cannot create the hive: 0x%lx\n", (unsigned long)Status);
+        exit(2);
+    }
+
+    /* Loading the hive needs a root key */
+    if (!CmCreateRootNode(&TestHive.Hive, L"HiveLogTest"))
+    {
+        printf("Cannot create the root key\n");
+        exit(2);
+    }
+
+    for (Index = 0; Index < CELL_COUNT; Index++)
+    {
+        Cells[Index] = HvAllocateCell(&TestHive.Hive, CELL_SIZE, Stable, HCELL_NIL);
+        if (Cells[Index] == HCELL_NIL)
+        {
+            printf("Cannot allocate cell %lu\n", (unsigned long)Index);
+            exit(2);
+        }
+
+        Expected[Index] = 0x10;
+        FillCell(&TestHive.Hive, Index, Expected[Index]);
+    }
+
+    ok(HvSyncHive(&TestHive.Hive), "Initial flush failed\n");
+    CloseHive(&TestHive);
+}
+
+/* Changes a few cells, flushes them with a limited number of writes and "crashes" */
+static VOID
+CrashDuringFlush(
+    IN BOOLEAN Lazy,
+    IN ULONG LogWrites,
+    IN ULONG PrimaryWrites,
+    IN ULONG FirstCell,
+    IN ULONG CellCount,
+    IN UCHAR Pattern)
+{
+    TEST_HIVE TestHive;
+    NTSTATUS Status;
+    ULONG Index;
+
+    AllowWrites(MAXULONG, MAXULONG);
+    Status = OpenHive(&TestHive, HINIT_FILE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Cannot load the hive: 0x%lx\n", (unsigned long)Status);
+        exit(2);
+    }
+
+    for (Index = FirstCell; Index < FirstCell + CellCount; Index++)
+        FillCell(&TestHive.Hive, Index, Pattern);
+
+    AllowWrites(LogWrites, PrimaryWrites);
+    if (Lazy)
+        HvLazySyncHive(&TestHive.Hive);
+    else
+        HvSyncHive(&TestHive.Hive);
+
+    /* Whatever didn't make it to the disk is gone */
+    CloseHive(&TestHive);
+}
+
+int main(int argc, char *argv[])
+{
+    static char LogName[260];
+    UCHAR Old[CELL_COUNT], Index;
+
+    if (argc != 2 || strlen(argv[1]) > sizeof(LogName) - 5)
+    {
+        printf("Usage: hivelogtest <scratch hive file>\n");
+        return 2;
+    }
+
+    FileNames[HFILE_TYPE_PRIMARY] = argv[1];
+    strcpy(LogName, argv[1]);
+    strcat(LogName, ".LOG");
+    FileNames[HFILE_TYPE_LOG] = LogName;
+
+    AllowWrites(MAXULONG, MAXULONG);
+    CreateTestHive();
+    Reload(STATUS_SUCCESS, Expected, "Clean hive");
+
+    /* Crash while the log is written: the primary file is intact and older */
+    memcpy(Old, Expected, sizeof(Old));
+    CrashDuringFlush(FALSE, 2, MAXULONG, 0, 4, 0x21);
+    Reload(STATUS_SUCCESS, Old, "Torn log");
+
+    /* Crash while the primary file is written: the log brings it up to date */
+    for (Index = 0; Index < 4; Index++) Expected[Index] = 0x22;
+    CrashDuringFlush(FALSE, MAXULONG, 2, 0, 4, 0x22);
+    ok(WriteCount[HFILE_TYPE_PRIMARY] != 0, "Crash didn't hit the primary file\n");
+    Reload(STATUS_REGISTRY_RECOVERED, Expected, "Torn primary");
+
+    /* A complete flush leaves nothing to replay */
+    for (Index = 10; Index < 14; Index++) Expected[Index] = 0x23;
+    CrashDuringFlush(FALSE, MAXULONG, MAXULONG, 10, 4, 0x23);
+    Reload(STATUS_SUCCESS, Expected, "Complete flush");
+
+    /* A cell changes a single run, which costs one write besides the two headers */
+    Expected[30] = 0x26;
+    CrashDuringFlush(FALSE, MAXULONG, MAXULONG, 30, 1, 0x26);
+    ok(WriteCount[HFILE_TYPE_LOG] == 3, "Log took %lu writes\n",
+       (unsigned long)WriteCount[HFILE_TYPE_LOG]);
+    ok(WriteCount[HFILE_TYPE_PRIMARY] == 3, "Primary file took %lu writes\n",
+       (unsigned long)WriteCount[HFILE_TYPE_PRIMARY]);
+    Reload(STATUS_SUCCESS, Expected, "Single cell");
+
+    /* A small lazy flush only writes the log, which has to be replayed */
+    for (Index = 20; Index < 22; Index++) Expected[Index] = 0x24;
+    CrashDuringFlush(TRUE, MAXULONG, MAXULONG, 20, 2, 0x24);
+    ok(WriteCount[HFILE_TYPE_PRIMARY] == 0, "Lazy flush wrote %lu primary blocks\n",
+       (unsigned long)WriteCount[HFILE_TYPE_PRIMARY]);
+    ok(WriteCount[HFILE_TYPE_LOG] != 0, "Lazy flush didn't write the log\n");
+    Reload(STATUS_REGISTRY_RECOVERED, Expected, "Lazy flush");
+
+    /* Lazy flushes of many blocks go through to the primary file */
+    for (Index = 0; Index < CELL_COUNT; Index++) Expected[Index] = 0x25;
+    CrashDuringFlush(TRUE, MAXULONG, MAXULONG, 0, CELL_COUNT, 0x25);
+    ok(WriteCount[HFILE_TYPE_PRIMARY] != 0, "Big lazy flush didn't write the primary file\n");
+    Reload(STATUS_SUCCESS, Expected, "Big lazy flush");
+
+    remove(FileNames[HFILE_TYPE_PRIMARY]);
+    remove(FileNames[HFILE_TYPE_LOG]);
+
+    return HostTestFinish("hivelogtest");
+}
+
+/* EOF */
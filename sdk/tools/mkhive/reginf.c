@@ -383,6 +383,207 @@ do_reg_operation(
     return TRUE;
 }
 
+typedef struct _KEY_PATH
+{
+    PCWSTR Path;        /* Not NUL-terminated at Length */
+    USHORT Length;      /* In characters */
+    USHORT NameOffset;  /* Start of the last path component, in characters */
+    USHORT Depth;
+} KEY_PATH, *PKEY_PATH;
+
+static int
+compare_key_paths(const void *p1, const void *p2)
+{
+    const KEY_PATH *Path1 = p1, *Path2 = p2;
+    int Result;
+
+    /* Parents go first, then siblings end up next to each other */
+    if (Path1->Depth != Path2->Depth)
+        return (Path1->Depth < Path2->Depth) ? -1 : 1;
+
+    Result = memicmpW(Path1->Path, Path2->Path, min(Path1->Length, Path2->Length));
+    if (Result)
+        return Result;
+
+    return (int)Path1->Length - (int)Path2->Length;
+}
+
+static BOOL
+add_key_path(PKEY_PATH *Paths, ULONG *Count, ULONG *Size, PCWSTR KeyName)
+{
+    PKEY_PATH NewPaths;
+    PWSTR Path;
+    size_t Length;
+    ULONG i, Start, Depth;
+
+    /* Skip leading and trailing separators */
+    while (*KeyName == OBJ_NAME_PATH_SEPARATOR)
+        KeyName++;
+    Length = strlenW(KeyName);
+    while (Length && KeyName[Length - 1] == OBJ_NAME_PATH_SEPARATOR)
+        Length--;
+    if (!Length || Length > MAXUSHORT)
+        return TRUE;
+
+    /* Leave paths with empty components to RegCreateKeyW */
+    for (i = 1, Depth = 1; i < Length; i++)
+    {
+        if (KeyName[i] != OBJ_NAME_PATH_SEPARATOR)
+            continue;
+        if (KeyName[i - 1] == OBJ_NAME_PATH_SEPARATOR)
+            return TRUE;
+        Depth++;
+    }
+
+    /* Make room for the path and all its parents */
+    if (*Count + Depth > *Size)
+    {
+        NewPaths = realloc(*Paths, (*Count + Depth + 256) * sizeof(KEY_PATH));
+        if (!NewPaths)
+            return FALSE;
+        *Paths = NewPaths;
+        *Size = *Count + Depth + 256;
+    }
+
+    Path = malloc(Length * sizeof(WCHAR));
+    if (!Path)
+        return FALSE;
+    memcpy(Path, KeyName, Length * sizeof(WCHAR));
+
+    /* Record them, they all share the same buffer */
+    for (i = 0, Start = 0, Depth = 1; i <= Length; i++)
+    {
+        if (i < Length && Path[i] != OBJ_NAME_PATH_SEPARATOR)
+            continue;
+
+        (*Paths)[*Count].Path = Path;
+        (*Paths)[*Count].Length = (USHORT)i;
+        (*Paths)[*Count].NameOffset = (USHORT)Start;
+        (*Paths)[*Count].Depth = (USHORT)Depth;
+        (*Count)++;
+
+        Start = i + 1;
+        Depth++;
+    }
+
+    return TRUE;
+}
+
+/***********************************************************************
+ *            create_registry_keys
+ *
+ * Creates up front all the keys an AddReg section refers to, so that
+ * the subkeys of each parent get linked into its index as one batch
+ * instead of one insertion per INF line.
+ */
+static VOID
+create_registry_keys(HINF hInf, PWCHAR Section)
+{
+    WCHAR Buffer[MAX_INF_STRING_LENGTH];
+    PKEY_PATH Paths = NULL;
+    PUNICODE_STRING Names = NULL;
+    ULONG Count = 0, Size = 0, NameCount;
+    ULONG Flags, i, j;
+    size_t Length;
+    PINFCONTEXT Context = NULL;
+    HKEY KeyHandle;
+    BOOL Ok;
+
+    Ok = InfHostFindFirstLine(hInf, Section, NULL, &Context) == 0;
+    if (!Ok)
+        return;
+
+    for (;Ok; Ok = (InfHostFindNextLine(Context, Context) == 0))
+    {
+        /* Keys that registry_callback() wouldn't create are none of our business */
+        if (InfHostGetIntField(Context, 4, (INT *)&Flags) != 0)
+            Flags = 0;
+        if (Flags & FLG_ADDREG_OVERWRITEONLY)
+            continue;
+
+        /* get root */
+        if (InfHostGetStringField(Context, 1, Buffer, sizeof(Buffer)/sizeof(WCHAR), NULL) != 0)
+            continue;
+        if (!get_root_key(Buffer))
+            continue;
+
+        /* get key */
+        Length = strlenW(Buffer);
+        if (InfHostGetStringField(Context, 2, Buffer + Length, sizeof(Buffer)/sizeof(WCHAR) - (ULONG)Length, NULL) != 0)
+            continue;
+
+        if (!add_key_path(&Paths, &Count, &Size, Buffer))
+        {
+            DPRINT1("Out of memory while collecting keys of section %S\n", Section);
+            break;
+        }
+    }
+
+    InfHostFreeContext(Context);
+
+    if (Count)
+        Names = malloc(Count * sizeof(UNICODE_STRING));
+    if (!Names)
+        goto Quit;
+
+    qsort(Paths, Count, sizeof(KEY_PATH), compare_key_paths);
+
+    /* Create the missing subkeys of every parent in one go */
+    for (i = 0; i < Count; i = j)
+    {
+        NameCount = 0;
+        for (j = i; j < Count; j++)
+        {
+            /* Stop at the first key with another parent */
+            if (Paths[j].Depth != Paths[i].Depth ||
+                Paths[j].NameOffset != Paths[i].NameOffset ||
+                memicmpW(Paths[j].Path, Paths[i].Path, Paths[i].NameOffset))
+            {
+                break;
+            }
+
+            /* Skip duplicates */
+            if (j != i &&
+                Paths[j].Length == Paths[j - 1].Length &&
+                !memicmpW(Paths[j].Path, Paths[j - 1].Path, Paths[j].Length))
+            {
+                continue;
+            }
+
+            Names[NameCount].Buffer = (PWSTR)&Paths[j].Path[Paths[j].NameOffset];
+            Names[NameCount].Length = (Paths[j].Length - Paths[j].NameOffset) * sizeof(WCHAR);
+            Names[NameCount].MaximumLength = Names[NameCount].Length;
+            NameCount++;
+        }
+
+        /* Open the parent, it has been created by a previous round */
+        Length = Paths[i].NameOffset ? Paths[i].NameOffset - 1 : 0;
+        memcpy(Buffer, Paths[i].Path, Length * sizeof(WCHAR));
+        Buffer[Length] = 0;
+
+        if (RegCreateKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
+        {
+            DPRINT("RegCreateKey(%S) failed\n", Buffer);
+            continue;
+        }
+
+        if (RegCreateSubKeys(KeyHandle, NameCount, Names) != ERROR_SUCCESS)
+            DPRINT1("Creating %lu subkeys of '%S' failed\n", (unsigned long)NameCount, Buffer);
+
+        free(KeyHandle);
+    }
+
+Quit:
+    /* Each buffer is shared by all the parents of a path, free it once */
+    for (i = 0; i < Count; i++)
+    {
+        if (Paths[i].Depth == 1)
+            free((PVOID)Paths[i].Path);
+    }
+    free(Names);
+    free(Paths);
+}
+
 /***********************************************************************
  *            registry_callback
  *
@@ -493,6 +694,8 @@ ImportRegistryFile(PCHAR FileName)
         return FALSE;
     }
 
+    create_registry_keys(hInf, (PWCHAR)AddReg);
+
     if (!registry_callback(hInf, (PWCHAR)AddReg, FALSE))
     {
         DPRINT1("registry_callback() for AddReg failed\n");
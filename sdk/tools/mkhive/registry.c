@@ -473,6 +473,77 @@ RegCreateKeyW(
     return RegpOpenOrCreateKey(hKey, lpSubKey, TRUE, FALSE, phkResult);
 }
 
+/*
+ * Creates the direct subkeys of hKey listed in SubKeyNames that don't exist
+ * yet, and links them all into hKey's index in a single pass. The names must
+ * be distinct, single path components.
+ */
+LONG
+RegCreateSubKeys(
+    IN HKEY hKey,
+    IN ULONG Count,
+    IN PCUNICODE_STRING SubKeyNames)
+{
+    PMEMKEY ParentKey = HKEY_TO_MEMKEY(hKey);
+    PCM_KEY_NODE ParentKeyCell;
+    PUNICODE_STRING NewNames;
+    PHCELL_INDEX BlockOffsets;
+    ULONG i, NewCount = 0;
+    NTSTATUS Status;
+
+    NewNames = (PUNICODE_STRING)malloc(Count * sizeof(UNICODE_STRING));
+    BlockOffsets = (PHCELL_INDEX)malloc(Count * sizeof(HCELL_INDEX));
+    if (!NewNames || !BlockOffsets)
+    {
+        free(NewNames);
+        free(BlockOffsets);
+        return ERROR_OUTOFMEMORY;
+    }
+
+    /* Keep only the subkeys that are missing */
+    ParentKeyCell = (PCM_KEY_NODE)HvGetCell(&ParentKey->RegistryHive->Hive,
+                                            ParentKey->KeyCellOffset);
+    if (!ParentKeyCell)
+    {
+        free(NewNames);
+        free(BlockOffsets);
+        return ERROR_UNSUCCESSFUL;
+    }
+
+    VERIFY_KEY_CELL(ParentKeyCell);
+
+    for (i = 0; i < Count; i++)
+    {
+        if (CmpFindSubKeyByName(&ParentKey->RegistryHive->Hive,
+                                ParentKeyCell,
+                                &SubKeyNames[i]) == HCELL_NIL)
+        {
+            NewNames[NewCount++] = SubKeyNames[i];
+        }
+    }
+
+    HvReleaseCell(&ParentKey->RegistryHive->Hive, ParentKey->KeyCellOffset);
+
+    Status = STATUS_SUCCESS;
+    if (NewCount)
+    {
+        Status = CmiAddSubKeys(ParentKey->RegistryHive,
+                               ParentKey->KeyCellOffset,
+                               NewCount,
+                               NewNames,
+                               FALSE,
+                               BlockOffsets);
+    }
+
+    free(NewNames);
+    free(BlockOffsets);
+
+    if (!NT_SUCCESS(Status))
+        return ERROR_UNSUCCESSFUL;
+
+    return ERROR_SUCCESS;
+}
+
 LONG WINAPI
 RegDeleteKeyW(
     IN HKEY hKey,
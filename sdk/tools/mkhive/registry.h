@@ -62,4 +62,10 @@ RegInitializeRegistry(VOID);
 VOID
 RegShutdownRegistry(VOID);
 
+LONG
+RegCreateSubKeys(
+    IN HKEY hKey,
+    IN ULONG Count,
+    IN PCUNICODE_STRING SubKeyNames);
+
 /* EOF */
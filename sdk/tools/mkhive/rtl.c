@@ -54,7 +54,7 @@ RtlCompareUnicodeString(
     USHORT i;
     WCHAR c1, c2;
 
-    for (i = 0; i <= String1->Length / sizeof(WCHAR) && i <= String2->Length / sizeof(WCHAR); i++)
+    for (i = 0; i < String1->Length / sizeof(WCHAR) && i < String2->Length / sizeof(WCHAR); i++)
     {
         if (CaseInSensitive)
         {
@@ -73,6 +73,12 @@ RtlCompareUnicodeString(
             return 1;
     }
 
+    /* The common part matches, the shorter string comes first */
+    if (String1->Length < String2->Length)
+        return -1;
+    else if (String1->Length > String2->Length)
+        return 1;
+
     return 0;
 }
 